@@ -0,0 +1,318 @@
+#include "audit.h"
+#include "strength.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef _WIN32
+    #include <unistd.h>
+    #include <pthread.h>
+#endif
+
+#define MAX_AUDIT_THREADS 32
+#define SECONDS_PER_DAY 86400
+
+// Below this many entries per thread, starting threads costs more than it saves
+#define MIN_ENTRIES_PER_THREAD 2048
+
+typedef struct {
+    const PasswordEntry *entries;
+    AuditResult *results;
+    uint64_t *hashes;
+    size_t begin;
+    size_t end;
+    int64_t now;
+    const BreachCorpus *breach;
+} AuditSlice;
+
+// FNV-1a, 64-bit: wide enough that unequal passwords rarely share a hash
+static uint64_t password_hash(const char *password) {
+    uint64_t hash = 14695981039346656037ull;
+    for (const unsigned char *p = (const unsigned char*)password; *p; p++) {
+        hash ^= *p;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// Score, hash and date the entries of one slice
+static void* audit_slice(void *arg) {
+    AuditSlice *slice = arg;
+
+    for (size_t i = slice->begin; i < slice->end; i++) {
+        const PasswordEntry *entry = &slice->entries[i];
+        AuditResult *result = &slice->results[i];
+
+        result->guess_bits = strength_estimate_bits(entry->password);
+        result->strength = strength_from_bits(result->guess_bits);
+        result->flags = result->strength == STRENGTH_WEAK ? AUDIT_WEAK : 0;
+        if (slice->breach && breach_contains(slice->breach, entry->password)) {
+            result->flags |= AUDIT_BREACHED;
+        }
+        result->reuse_group = 0;
+        result->reuse_count = 1;
+
+        int64_t changed = entry->password_modified ? entry->password_modified
+                                                   : entry->created;
+        if (changed <= 0) {
+            result->age_days = -1;
+        } else {
+            int64_t age = slice->now - changed;
+            result->age_days = age > 0 ? age / SECONDS_PER_DAY : 0;
+        }
+
+        slice->hashes[i] = password_hash(entry->password);
+    }
+    return NULL;
+}
+
+static size_t worker_count(size_t count, int requested) {
+    long threads = requested;
+    if (threads <= 0) {
+#ifdef _WIN32
+        threads = 1;
+#else
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    }
+    if (threads < 1) threads = 1;
+    if (threads > MAX_AUDIT_THREADS) threads = MAX_AUDIT_THREADS;
+
+    size_t useful = count / MIN_ENTRIES_PER_THREAD + 1;
+    return (size_t)threads < useful ? (size_t)threads : useful;
+}
+
+static void run_slices(AuditSlice *slices, size_t thread_count) {
+#ifdef _WIN32
+    for (size_t t = 0; t < thread_count; t++) {
+        audit_slice(&slices[t]);
+    }
+#else
+    pthread_t threads[MAX_AUDIT_THREADS];
+    int started[MAX_AUDIT_THREADS] = {0};
+
+    // The calling thread takes the first slice itself
+    for (size_t t = 1; t < thread_count; t++) {
+        if (pthread_create(&threads[t], NULL, audit_slice, &slices[t]) == 0) {
+            started[t] = 1;
+        } else {
+            audit_slice(&slices[t]);
+        }
+    }
+    audit_slice(&slices[0]);
+    for (size_t t = 1; t < thread_count; t++) {
+        if (started[t]) pthread_join(threads[t], NULL);
+    }
+#endif
+}
+
+// Group entries by password: one pass over an open-addressing table keyed
+// by the hashes, confirming equal hashes with a full compare.
+// first[i] receives the index of the first entry with entry i's password.
+static int group_passwords(const PasswordEntry *entries, const uint64_t *hashes,
+                           size_t count, uint32_t *first) {
+    size_t size = 16;
+    while (size < count * 2) size <<= 1;
+    size_t mask = size - 1;
+
+    uint32_t *slots = calloc(size, sizeof(uint32_t));   // Index + 1; 0 = empty
+    if (!slots) return 0;
+
+    for (size_t i = 0; i < count; i++) {
+        size_t slot = (size_t)hashes[i] & mask;
+        first[i] = (uint32_t)i;
+
+        while (slots[slot] != 0) {
+            uint32_t other = slots[slot] - 1;
+            if (hashes[other] == hashes[i] &&
+                strcmp(entries[other].password, entries[i].password) == 0) {
+                first[i] = other;
+                break;
+            }
+            slot = (slot + 1) & mask;
+        }
+        if (first[i] == i) slots[slot] = (uint32_t)(i + 1);
+    }
+
+    free(slots);
+    return 1;
+}
+
+AuditResult* audit_entries(const PasswordEntry *entries, size_t count,
+                           const AuditOptions *options, AuditSummary *summary) {
+    if ((!entries && count > 0) || !options || count > UINT32_MAX) return NULL;
+
+    AuditResult *results = calloc(count ? count : 1, sizeof(AuditResult));
+    uint64_t *hashes = malloc(sizeof(uint64_t) * (count ? count : 1));
+    uint32_t *first = malloc(sizeof(uint32_t) * (count ? count : 1));
+    uint32_t *counts = calloc(count ? count : 1, sizeof(uint32_t));
+    if (!results || !hashes || !first || !counts) {
+        free(results);
+        free(hashes);
+        free(first);
+        free(counts);
+        return NULL;
+    }
+
+    int64_t now = options->now ? options->now : (int64_t)time(NULL);
+
+    // Strength scoring dominates; split it evenly across the workers, with
+    // the shared dictionary automaton built before they start
+    strength_init();
+    AuditSlice slices[MAX_AUDIT_THREADS];
+    size_t thread_count = worker_count(count, options->threads);
+    for (size_t t = 0; t < thread_count; t++) {
+        slices[t].entries = entries;
+        slices[t].results = results;
+        slices[t].hashes = hashes;
+        slices[t].begin = count * t / thread_count;
+        slices[t].end = count * (t + 1) / thread_count;
+        slices[t].now = now;
+        slices[t].breach = options->breach;
+    }
+    run_slices(slices, thread_count);
+
+    int ok = group_passwords(entries, hashes, count, first);
+
+    AuditSummary totals = {0};
+    totals.entries = count;
+
+    if (ok) {
+        for (size_t i = 0; i < count; i++) {
+            counts[first[i]]++;
+        }
+
+        // Number groups in entry order so reports are stable
+        uint32_t next_group = 0;
+        for (size_t i = 0; i < count; i++) {
+            AuditResult *result = &results[i];
+            uint32_t uses = counts[first[i]];
+
+            if (uses > 1) {
+                if (first[i] == i) {
+                    result->reuse_group = ++next_group;
+                } else {
+                    result->reuse_group = results[first[i]].reuse_group;
+                }
+                result->reuse_count = uses;
+                result->flags |= AUDIT_REUSED;
+                totals.reused++;
+            }
+
+            if (result->age_days < 0) {
+                totals.unknown_age++;
+            } else if (options->max_age_days > 0 &&
+                       result->age_days > options->max_age_days) {
+                result->flags |= AUDIT_STALE;
+                totals.stale++;
+            }
+
+            if (result->flags & AUDIT_WEAK) totals.weak++;
+            if (result->flags & AUDIT_BREACHED) totals.breached++;
+        }
+        totals.reuse_groups = next_group;
+    }
+
+    memset(hashes, 0, sizeof(uint64_t) * (count ? count : 1));
+    free(hashes);
+    free(first);
+    free(counts);
+
+    if (!ok) {
+        free(results);
+        return NULL;
+    }
+
+    if (summary) *summary = totals;
+    return results;
+}
+
+static const char* strength_name(PasswordStrength strength) {
+    switch (strength) {
+        case STRENGTH_WEAK: return "weak";
+        case STRENGTH_MEDIUM: return "medium";
+        case STRENGTH_STRONG: return "strong";
+        case STRENGTH_VERY_STRONG: return "very_strong";
+        default: return "unknown";
+    }
+}
+
+static void write_json_string(FILE *out, const char *value) {
+    fputc('"', out);
+    for (const unsigned char *p = (const unsigned char*)value; *p; p++) {
+        switch (*p) {
+            case '"': fputs("\\\"", out); break;
+            case '\\': fputs("\\\\", out); break;
+            case '\n': fputs("\\n", out); break;
+            case '\r': fputs("\\r", out); break;
+            case '\t': fputs("\\t", out); break;
+            default:
+                if (*p < 0x20) {
+                    fprintf(out, "\\u%04x", *p);
+                } else {
+                    fputc(*p, out);
+                }
+        }
+    }
+    fputc('"', out);
+}
+
+int audit_write_report(FILE *out, const PasswordEntry *entries,
+                       const AuditResult *results, size_t count,
+                       const AuditOptions *options, const AuditSummary *summary) {
+    if (!out || (!entries && count > 0) || (!results && count > 0) ||
+        !options || !summary) {
+        return 0;
+    }
+
+    int64_t now = options->now ? options->now : (int64_t)time(NULL);
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"generated\": %lld,\n", (long long)now);
+    fprintf(out, "  \"max_age_days\": %d,\n", options->max_age_days);
+    fprintf(out, "  \"summary\": {\"entries\": %zu, \"weak\": %zu, \"reused\": %zu, "
+                 "\"reuse_groups\": %zu, \"stale\": %zu, \"breached\": %zu, "
+                 "\"unknown_age\": %zu},\n",
+            summary->entries, summary->weak, summary->reused,
+            summary->reuse_groups, summary->stale, summary->breached,
+            summary->unknown_age);
+    fprintf(out, "  \"findings\": [");
+
+    int first_finding = 1;
+    for (size_t i = 0; i < count; i++) {
+        const AuditResult *result = &results[i];
+        if (result->flags == 0) continue;
+
+        fprintf(out, "%s\n    {\"service\": ", first_finding ? "" : ",");
+        write_json_string(out, entries[i].service);
+        fprintf(out, ", \"username\": ");
+        write_json_string(out, entries[i].username);
+        fprintf(out, ", \"strength\": \"%s\", \"guess_bits\": %.1f, \"issues\": [",
+                strength_name(result->strength), result->guess_bits);
+
+        const char *separator = "";
+        if (result->flags & AUDIT_WEAK) {
+            fprintf(out, "%s\"weak\"", separator);
+            separator = ", ";
+        }
+        if (result->flags & AUDIT_REUSED) {
+            fprintf(out, "%s\"reused\"", separator);
+            separator = ", ";
+        }
+        if (result->flags & AUDIT_STALE) {
+            fprintf(out, "%s\"stale\"", separator);
+            separator = ", ";
+        }
+        if (result->flags & AUDIT_BREACHED) {
+            fprintf(out, "%s\"breached\"", separator);
+        }
+
+        fprintf(out, "], \"reuse_group\": %u, \"reuse_count\": %u, \"age_days\": %lld}",
+                result->reuse_group, result->reuse_count, (long long)result->age_days);
+        first_finding = 0;
+    }
+
+    fprintf(out, "%s]\n}\n", first_finding ? "" : "\n  ");
+    return !ferror(out);
+}
@@ -0,0 +1,68 @@
+#ifndef AUDIT_H
+#define AUDIT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "breach.h"
+#include "generator.h"
+#include "password.h"
+
+/**
+ * Vault-wide password audit
+ *
+ * Every entry is scored with strength_estimate_bits() by a pool of worker
+ * threads pulling batches of entries, each of which also hashes the
+ * password. Reuse is then found in one pass over a hash table keyed by
+ * those hashes (equal hashes are confirmed by comparing the passwords),
+ * so the whole audit is linear in the number of entries. Passwords not
+ * changed within max_age_days are flagged as stale, and with a breach
+ * corpus the workers also look every password up in it.
+ */
+
+// Issues found with an entry (AuditResult.flags)
+#define AUDIT_WEAK   0x01   // Scored STRENGTH_WEAK
+#define AUDIT_REUSED 0x02   // Same password as at least one other entry
+#define AUDIT_STALE  0x04   // Password older than max_age_days
+#define AUDIT_BREACHED 0x08 // Found in the breach corpus
+
+#define AUDIT_DEFAULT_MAX_AGE_DAYS 365
+
+typedef struct {
+    int max_age_days;   // <= 0 disables the stale check
+    int threads;        // 0 = one per online CPU
+    int64_t now;        // Reference time; 0 = time(NULL)
+    const BreachCorpus *breach; // NULL skips the breach check
+} AuditOptions;
+
+typedef struct {
+    PasswordStrength strength;
+    double guess_bits;      // log2 of the estimated guesses
+    unsigned flags;
+    uint32_t reuse_group;   // Entries sharing a password share it; 0 = unique
+    uint32_t reuse_count;   // Entries using this password
+    int64_t age_days;       // Since the password last changed; -1 = unknown
+} AuditResult;
+
+typedef struct {
+    size_t entries;
+    size_t weak;
+    size_t reused;          // Entries whose password is used elsewhere too
+    size_t reuse_groups;    // Distinct reused passwords
+    size_t stale;
+    size_t breached;
+    size_t unknown_age;     // Entries from before modification stamps
+} AuditSummary;
+
+// Audit count entries
+// Returns: one result per entry (free() it), or NULL on failure
+AuditResult* audit_entries(const PasswordEntry *entries, size_t count,
+                           const AuditOptions *options, AuditSummary *summary);
+
+// Write a JSON report of the summary and every entry with an issue
+// (passwords are never included)
+int audit_write_report(FILE *out, const PasswordEntry *entries,
+                       const AuditResult *results, size_t count,
+                       const AuditOptions *options, const AuditSummary *summary);
+
+#endif // AUDIT_H
@@ -0,0 +1,792 @@
+#ifndef _WIN32
+    #define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "backup.h"
+#include "btree.h"
+#include "compress.h"
+#include "crypto.h"
+#include "file_io.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#ifdef _WIN32
+    #include <direct.h>
+#else
+    #include <unistd.h>
+#endif
+
+#define PATH_SIZE 600
+
+#define CATALOG_MAGIC "CIPHERBK"
+#define MANIFEST_MAGIC "CIPHERSN"
+#define BACKUP_VERSION 1
+#define MANIFEST_VERSION 2
+
+// A chunk ends after a record whose service hash has these top bits
+// clear (about one record in 64), or after CHUNK_MAX_RECORDS records
+#define CHUNK_BOUNDARY_SHIFT 26
+#define CHUNK_MAX_RECORDS 256
+
+#define CODEC_NONE 0
+#define CODEC_LZ 1
+
+// backups/catalog: the store's key salt and the list of snapshots
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t snapshot_count;
+    uint64_t next_id;
+    unsigned char salt[SALT_SIZE];
+    unsigned char check[KEY_SIZE];      // Proves the master password
+} CatalogHeader;
+
+// backups/snapshots/<id>.snap: header, chunk ids, HMAC of both. The
+// chunk list ends with tombstone_chunks chunks of tombstones.
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    BackupSnapshot info;
+    uint64_t log_floor;
+    uint64_t tombstone_count;
+    uint32_t tombstone_chunks;
+    uint32_t reserved;
+} ManifestHeader;
+
+// backups/chunks/<xx>/<id>: header, then the sealed (compressed) records
+typedef struct {
+    uint32_t plain_len;
+    uint32_t stored_len;
+    uint32_t codec;
+    uint32_t record_count;
+    unsigned char nonce[AEAD_NONCE_SIZE];
+    unsigned char tag[AEAD_TAG_SIZE];
+} ChunkHeader;
+
+// Chunk ids and header fields before the nonce are authenticated
+#define CHUNK_AAD_SIZE (HASH_SIZE + offsetof(ChunkHeader, nonce))
+
+typedef struct {
+    unsigned char id_key[KEY_SIZE];
+    unsigned char chunk_key[KEY_SIZE];
+    unsigned char manifest_key[KEY_SIZE];
+    unsigned char check[KEY_SIZE];
+} BackupKeys;
+
+typedef unsigned char ChunkId[HASH_SIZE];
+
+// Records being gathered into chunks while a snapshot is taken
+typedef struct {
+    const BackupKeys *keys;
+    PasswordEntry records[CHUNK_MAX_RECORDS];
+    size_t record_count;
+    ChunkId *ids;
+    size_t id_count;
+    size_t id_capacity;
+    uint64_t entry_count;
+    BackupStats *stats;
+    int ok;
+} ChunkBuilder;
+
+static void backup_path(char *buffer, size_t size, const char *name) {
+    snprintf(buffer, size, "%s/%s/%s", get_data_dir(), BACKUP_DIR_NAME, name);
+}
+
+static void manifest_path(uint64_t id, char *buffer, size_t size) {
+    char name[64];
+    snprintf(name, sizeof(name), "snapshots/%016llx.snap", (unsigned long long)id);
+    backup_path(buffer, size, name);
+}
+
+// Chunks are spread over 256 directories by their first id byte
+static void chunk_path(const unsigned char *id, char *buffer, size_t size,
+                       int directory_only) {
+    char name[32 + 2 * HASH_SIZE];
+    int len = snprintf(name, sizeof(name), "chunks/%02x", id[0]);
+
+    if (!directory_only) {
+        name[len++] = '/';
+        for (size_t i = 0; i < HASH_SIZE; i++) {
+            len += snprintf(name + len, sizeof(name) - (size_t)len, "%02x", id[i]);
+        }
+    }
+    backup_path(buffer, size, name);
+}
+
+static int make_dir(const char *path) {
+#ifdef _WIN32
+    return _mkdir(path) == 0 || errno == EEXIST;
+#else
+    return mkdir(path, 0700) == 0 || errno == EEXIST;
+#endif
+}
+
+static int make_store_dirs(void) {
+    char path[PATH_SIZE];
+
+    snprintf(path, sizeof(path), "%s/%s", get_data_dir(), BACKUP_DIR_NAME);
+    if (!make_dir(path)) return 0;
+    backup_path(path, sizeof(path), "snapshots");
+    if (!make_dir(path)) return 0;
+    backup_path(path, sizeof(path), "chunks");
+    return make_dir(path);
+}
+
+static int file_present(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file) return 0;
+    fclose(file);
+    return 1;
+}
+
+static int derive_backup_keys(const char *master_password,
+                              const unsigned char *salt, BackupKeys *keys) {
+    unsigned char key[KEY_SIZE];
+    int ok = derive_key(master_password, salt, key, KEY_SIZE) &&
+             derive_subkey(key, "cipher-backup-id", keys->id_key) &&
+             derive_subkey(key, "cipher-backup-chunk", keys->chunk_key) &&
+             derive_subkey(key, "cipher-backup-manifest", keys->manifest_key) &&
+             derive_subkey(key, "cipher-backup-check", keys->check);
+    memset(key, 0, sizeof(key));
+    return ok;
+}
+
+// Returns: 1 on success, 0 if the catalog is missing or unreadable
+static int load_catalog(CatalogHeader *header, BackupSnapshot **snapshots) {
+    char path[PATH_SIZE];
+    backup_path(path, sizeof(path), "catalog");
+
+    *snapshots = NULL;
+    FILE *file = fopen(path, "rb");
+    if (!file) return 0;
+
+    int ok = fread(header, sizeof(CatalogHeader), 1, file) == 1 &&
+             memcmp(header->magic, CATALOG_MAGIC, sizeof(header->magic)) == 0 &&
+             header->version == BACKUP_VERSION;
+
+    if (ok && header->snapshot_count > 0) {
+        *snapshots = malloc(sizeof(BackupSnapshot) * header->snapshot_count);
+        ok = *snapshots &&
+             fread(*snapshots, sizeof(BackupSnapshot), header->snapshot_count, file) ==
+                 header->snapshot_count;
+    }
+    fclose(file);
+
+    if (!ok) {
+        free(*snapshots);
+        *snapshots = NULL;
+    }
+    return ok;
+}
+
+static int save_catalog(const CatalogHeader *header, const BackupSnapshot *snapshots) {
+    char path[PATH_SIZE];
+    char tmp_path[PATH_SIZE + 4];
+    backup_path(path, sizeof(path), "catalog");
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    FILE *file = fopen(tmp_path, "wb");
+    if (!file) return 0;
+
+    int ok = fwrite(header, sizeof(CatalogHeader), 1, file) == 1 &&
+             (header->snapshot_count == 0 ||
+              fwrite(snapshots, sizeof(BackupSnapshot), header->snapshot_count, file) ==
+                  header->snapshot_count) &&
+             fflush(file) == 0;
+#ifndef _WIN32
+    ok = ok && fsync(fileno(file)) == 0;
+#endif
+    ok = fclose(file) == 0 && ok;
+
+    if (!ok || rename(tmp_path, path) != 0) {
+        remove(tmp_path);
+        return 0;
+    }
+    return 1;
+}
+
+// Seal one chunk and store it unless an identical one is already there
+static int store_chunk(ChunkBuilder *builder) {
+    const BackupKeys *keys = builder->keys;
+    size_t plain_len = builder->record_count * sizeof(PasswordEntry);
+    const unsigned char *plain = (const unsigned char*)builder->records;
+
+    if (builder->id_count >= builder->id_capacity) {
+        size_t capacity = builder->id_capacity ? builder->id_capacity * 2 : 64;
+        ChunkId *ids = realloc(builder->ids, sizeof(ChunkId) * capacity);
+        if (!ids) return 0;
+        builder->ids = ids;
+        builder->id_capacity = capacity;
+    }
+
+    unsigned char *id = builder->ids[builder->id_count];
+    if (!hmac_sha256(keys->id_key, plain, plain_len, id)) return 0;
+    builder->id_count++;
+    builder->stats->chunks++;
+
+    char path[PATH_SIZE];
+    chunk_path(id, path, sizeof(path), 0);
+    if (file_present(path)) return 1;
+
+    size_t capacity = compress_bound(plain_len);
+    unsigned char *packed = malloc(capacity);
+    unsigned char *sealed = malloc(capacity);
+    if (!packed || !sealed) {
+        free(packed);
+        free(sealed);
+        return 0;
+    }
+
+    ChunkHeader header;
+    memset(&header, 0, sizeof(header));
+    header.plain_len = (uint32_t)plain_len;
+    header.record_count = (uint32_t)builder->record_count;
+    header.codec = CODEC_LZ;
+
+    size_t stored_len = compress_block(plain, plain_len, packed, capacity);
+    if (stored_len == 0 || stored_len >= plain_len) {
+        header.codec = CODEC_NONE;
+        stored_len = plain_len;
+        memcpy(packed, plain, plain_len);
+    }
+    header.stored_len = (uint32_t)stored_len;
+
+    unsigned char aad[CHUNK_AAD_SIZE];
+    memcpy(aad, id, HASH_SIZE);
+    memcpy(aad + HASH_SIZE, &header, CHUNK_AAD_SIZE - HASH_SIZE);
+
+    char dir[PATH_SIZE];
+    char tmp_path[PATH_SIZE + 4];
+    chunk_path(id, dir, sizeof(dir), 1);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    int ok = make_dir(dir) &&
+             generate_random_bytes(header.nonce, AEAD_NONCE_SIZE) &&
+             aead_encrypt(keys->chunk_key, header.nonce, aad, sizeof(aad),
+                          packed, stored_len, sealed, header.tag);
+    memset(packed, 0, capacity);
+    free(packed);
+
+    FILE *file = ok ? fopen(tmp_path, "wb") : NULL;
+    if (file) {
+        ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+             fwrite(sealed, 1, stored_len, file) == stored_len;
+        ok = fclose(file) == 0 && ok;
+        if (!ok || rename(tmp_path, path) != 0) {
+            remove(tmp_path);
+            ok = 0;
+        }
+    } else {
+        ok = 0;
+    }
+    free(sealed);
+
+    if (ok) {
+        builder->stats->new_chunks++;
+        builder->stats->bytes_written += sizeof(header) + stored_len;
+    }
+    return ok;
+}
+
+// Store the records gathered so far as a chunk and start the next one
+static int end_chunk(ChunkBuilder *builder) {
+    if (builder->record_count > 0) {
+        builder->ok = builder->ok && store_chunk(builder);
+        memset(builder->records, 0, sizeof(builder->records));
+        builder->record_count = 0;
+    }
+    return builder->ok;
+}
+
+static int add_record(const PasswordEntry *entry, void *ctx) {
+    ChunkBuilder *builder = ctx;
+
+    builder->records[builder->record_count++] = *entry;
+    builder->entry_count++;
+
+    int boundary = (pm_service_hash(entry->service) >> CHUNK_BOUNDARY_SHIFT) == 0;
+    if (boundary || builder->record_count == CHUNK_MAX_RECORDS) end_chunk(builder);
+    return builder->ok;
+}
+
+// Create the catalog on first use, or check the password against it
+// Returns: 1 on success, 0 on failure, -1 on a wrong password
+static int open_store(const char *master_password, CatalogHeader *header,
+                      BackupSnapshot **snapshots, BackupKeys *keys) {
+    if (load_catalog(header, snapshots)) {
+        if (!derive_backup_keys(master_password, header->salt, keys)) return 0;
+        return crypto_equal(keys->check, header->check, KEY_SIZE) ? 1 : -1;
+    }
+
+    char path[PATH_SIZE];
+    backup_path(path, sizeof(path), "catalog");
+    if (file_present(path)) return 0;
+
+    memset(header, 0, sizeof(CatalogHeader));
+    memcpy(header->magic, CATALOG_MAGIC, sizeof(header->magic));
+    header->version = BACKUP_VERSION;
+    header->next_id = 1;
+
+    if (!make_store_dirs() ||
+        !generate_random_bytes(header->salt, SALT_SIZE) ||
+        !derive_backup_keys(master_password, header->salt, keys)) {
+        return 0;
+    }
+    memcpy(header->check, keys->check, KEY_SIZE);
+    return 1;
+}
+
+static int write_manifest(const ManifestHeader *header, const ChunkId *ids,
+                          const BackupKeys *keys) {
+    size_t len = sizeof(ManifestHeader) + sizeof(ChunkId) * header->info.chunk_count;
+    unsigned char *buffer = malloc(len + HASH_SIZE);
+    if (!buffer) return 0;
+
+    memcpy(buffer, header, sizeof(ManifestHeader));
+    if (header->info.chunk_count > 0) {
+        memcpy(buffer + sizeof(ManifestHeader), ids,
+               sizeof(ChunkId) * header->info.chunk_count);
+    }
+
+    char path[PATH_SIZE];
+    char tmp_path[PATH_SIZE + 4];
+    manifest_path(header->info.id, path, sizeof(path));
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    // On disk before it is renamed into place: a crash leaves either no
+    // manifest or a whole one, never a truncated one prune would reject
+    int ok = hmac_sha256(keys->manifest_key, buffer, len, buffer + len);
+    FILE *file = ok ? fopen(tmp_path, "wb") : NULL;
+    if (file) {
+        ok = fwrite(buffer, 1, len + HASH_SIZE, file) == len + HASH_SIZE &&
+             fflush(file) == 0;
+#ifndef _WIN32
+        ok = ok && fsync(fileno(file)) == 0;
+#endif
+        ok = fclose(file) == 0 && ok;
+        if (!ok || rename(tmp_path, path) != 0) {
+            remove(tmp_path);
+            ok = 0;
+        }
+    } else {
+        ok = 0;
+    }
+
+    free(buffer);
+    return ok;
+}
+
+// Read a manifest's chunk ids and check its HMAC
+static ChunkId* read_manifest(uint64_t id, ManifestHeader *header,
+                              const BackupKeys *keys) {
+    char path[PATH_SIZE];
+    manifest_path(id, path, sizeof(path));
+
+    FILE *file = fopen(path, "rb");
+    if (!file) return NULL;
+
+    int ok = fread(header, sizeof(ManifestHeader), 1, file) == 1 &&
+             memcmp(header->magic, MANIFEST_MAGIC, sizeof(header->magic)) == 0 &&
+             header->version == MANIFEST_VERSION &&
+             header->info.id == id &&
+             header->tombstone_chunks <= header->info.chunk_count;
+
+    size_t count = ok ? header->info.chunk_count : 0;
+    ChunkId *ids = ok ? malloc(sizeof(ChunkId) * (count + 1)) : NULL;
+    unsigned char mac[HASH_SIZE];
+    ok = ids &&
+         fread(ids, sizeof(ChunkId), count, file) == count &&
+         fread(mac, 1, HASH_SIZE, file) == HASH_SIZE;
+    fclose(file);
+
+    if (ok) {
+        size_t len = sizeof(ManifestHeader) + sizeof(ChunkId) * count;
+        unsigned char *buffer = malloc(len);
+        unsigned char expected[HASH_SIZE];
+
+        ok = buffer != NULL;
+        if (ok) {
+            memcpy(buffer, header, sizeof(ManifestHeader));
+            memcpy(buffer + sizeof(ManifestHeader), ids, sizeof(ChunkId) * count);
+            ok = hmac_sha256(keys->manifest_key, buffer, len, expected) &&
+                 crypto_equal(expected, mac, HASH_SIZE);
+        }
+        free(buffer);
+    }
+
+    if (!ok) {
+        free(ids);
+        return NULL;
+    }
+    return ids;
+}
+
+int backup_create(const PasswordManager *pm, const char *master_password,
+                  BackupSnapshot *snapshot, BackupStats *stats) {
+    if (!pm || !master_password || !stats) return 0;
+
+    CatalogHeader catalog;
+    BackupSnapshot *snapshots = NULL;
+    BackupKeys keys;
+
+    int opened = open_store(master_password, &catalog, &snapshots, &keys);
+    if (opened != 1) {
+        memset(&keys, 0, sizeof(keys));
+        free(snapshots);
+        return opened;
+    }
+
+    memset(stats, 0, sizeof(BackupStats));
+    ChunkBuilder *builder = calloc(1, sizeof(ChunkBuilder));
+    int ok = builder != NULL;
+    uint64_t entry_count = 0;
+    size_t entry_chunks = 0;
+
+    if (ok) {
+        builder->keys = &keys;
+        builder->stats = stats;
+        builder->ok = 1;
+
+        if (pm->store) {
+            ok = btree_foreach(pm->store, add_record, builder);
+        } else {
+            for (size_t i = 0; ok && i < pm->count; i++) {
+                ok = add_record(&pm->entries[i], builder);
+            }
+        }
+        ok = ok && end_chunk(builder);
+        entry_count = builder->entry_count;
+        entry_chunks = builder->id_count;
+
+        // Tombstones go in chunks of their own after the entries
+        if (pm->store) {
+            ok = ok && btree_foreach_tombstone(pm->store, add_record, builder);
+        } else {
+            for (size_t i = 0; ok && i < pm->tombstone_count; i++) {
+                ok = add_record(&pm->tombstones[i], builder);
+            }
+        }
+        ok = ok && end_chunk(builder);
+    }
+
+    ManifestHeader manifest;
+    memset(&manifest, 0, sizeof(manifest));
+    memcpy(manifest.magic, MANIFEST_MAGIC, sizeof(manifest.magic));
+    manifest.version = MANIFEST_VERSION;
+    manifest.record_size = sizeof(PasswordEntry);
+
+    BackupSnapshot *grown = NULL;
+    if (ok) {
+        manifest.info.id = catalog.next_id;
+        manifest.info.created = (int64_t)time(NULL);
+        manifest.info.generation = pm->generation;
+        manifest.info.entry_count = entry_count;
+        manifest.info.chunk_count = (uint32_t)builder->id_count;
+        manifest.log_floor = pm->log_floor;
+        manifest.tombstone_count = builder->entry_count - entry_count;
+        manifest.tombstone_chunks = (uint32_t)(builder->id_count - entry_chunks);
+
+        grown = realloc(snapshots, sizeof(BackupSnapshot) * (catalog.snapshot_count + 1));
+        ok = grown && write_manifest(&manifest, builder->ids, &keys);
+        if (grown) snapshots = grown;
+    }
+
+    if (ok) {
+        snapshots[catalog.snapshot_count++] = manifest.info;
+        catalog.next_id++;
+        ok = save_catalog(&catalog, snapshots);
+        if (ok && snapshot) *snapshot = manifest.info;
+    }
+
+    if (builder) {
+        free(builder->ids);
+        memset(builder, 0, sizeof(ChunkBuilder));
+        free(builder);
+    }
+    memset(&keys, 0, sizeof(keys));
+    free(snapshots);
+    return ok;
+}
+
+BackupSnapshot* backup_list(size_t *count) {
+    CatalogHeader catalog;
+    BackupSnapshot *snapshots;
+
+    *count = 0;
+    if (!load_catalog(&catalog, &snapshots)) return NULL;
+
+    *count = catalog.snapshot_count;
+    return snapshots;
+}
+
+// Read, open and unpack one chunk into the manager's entries, or into its
+// tombstones
+static int restore_chunk(const unsigned char *id, const BackupKeys *keys,
+                         uint32_t record_size, int tombstones, PasswordManager *pm) {
+    char path[PATH_SIZE];
+    chunk_path(id, path, sizeof(path), 0);
+
+    FILE *file = fopen(path, "rb");
+    if (!file) return 0;
+
+    ChunkHeader header;
+    int ok = fread(&header, sizeof(header), 1, file) == 1 &&
+             header.record_count > 0 &&
+             header.record_count <= CHUNK_MAX_RECORDS &&
+             header.plain_len == header.record_count * record_size &&
+             header.stored_len <= compress_bound(header.plain_len) &&
+             (header.codec == CODEC_LZ ||
+              (header.codec == CODEC_NONE && header.stored_len == header.plain_len));
+
+    unsigned char *sealed = ok ? malloc(header.stored_len + 1) : NULL;
+    unsigned char *packed = ok ? malloc(header.stored_len + 1) : NULL;
+    unsigned char *plain = ok ? malloc(header.plain_len) : NULL;
+    ok = sealed && packed && plain &&
+         fread(sealed, 1, header.stored_len, file) == header.stored_len;
+    fclose(file);
+
+    if (ok) {
+        unsigned char aad[CHUNK_AAD_SIZE];
+        memcpy(aad, id, HASH_SIZE);
+        memcpy(aad + HASH_SIZE, &header, CHUNK_AAD_SIZE - HASH_SIZE);
+        ok = aead_decrypt(keys->chunk_key, header.nonce, aad, sizeof(aad),
+                          sealed, header.stored_len, header.tag, packed);
+    }
+
+    if (ok && header.codec == CODEC_LZ) {
+        ok = decompress_block(packed, header.stored_len, plain, header.plain_len);
+    } else if (ok) {
+        memcpy(plain, packed, header.plain_len);
+    }
+
+    // The id is a hash of the contents: a chunk swapped for another fails here
+    unsigned char expected[HASH_SIZE];
+    ok = ok && hmac_sha256(keys->id_key, plain, header.plain_len, expected) &&
+         crypto_equal(expected, id, HASH_SIZE) &&
+         (tombstones || pm_reserve(pm, pm->count + header.record_count));
+
+    size_t copy = record_size < sizeof(PasswordEntry) ? record_size : sizeof(PasswordEntry);
+    for (uint32_t i = 0; ok && i < header.record_count; i++) {
+        if (tombstones) {
+            PasswordEntry tombstone;
+            memset(&tombstone, 0, sizeof(tombstone));
+            memcpy(&tombstone, plain + (size_t)i * record_size, copy);
+            tombstone.service[MAX_SERVICE_NAME - 1] = '\0';
+            ok = pm_add_tombstone(pm, tombstone.service, tombstone.generation);
+            continue;
+        }
+
+        PasswordEntry *entry = &pm->entries[pm->count++];
+        memset(entry, 0, sizeof(PasswordEntry));
+        memcpy(entry, plain + (size_t)i * record_size, copy);
+        entry->service[MAX_SERVICE_NAME - 1] = '\0';
+        entry->username[MAX_USERNAME - 1] = '\0';
+        entry->password[MAX_PASSWORD - 1] = '\0';
+    }
+
+    if (packed) memset(packed, 0, header.stored_len);
+    if (plain) memset(plain, 0, header.plain_len);
+    free(sealed);
+    free(packed);
+    free(plain);
+    return ok;
+}
+
+PasswordManager* backup_restore(uint64_t id, const char *master_password,
+                                int *status) {
+    *status = 0;
+
+    CatalogHeader catalog;
+    BackupSnapshot *snapshots;
+    if (!load_catalog(&catalog, &snapshots)) return NULL;
+    free(snapshots);
+
+    BackupKeys keys;
+    if (!derive_backup_keys(master_password, catalog.salt, &keys)) return NULL;
+    if (!crypto_equal(keys.check, catalog.check, KEY_SIZE)) {
+        memset(&keys, 0, sizeof(keys));
+        *status = -1;
+        return NULL;
+    }
+
+    ManifestHeader manifest;
+    ChunkId *ids = read_manifest(id, &manifest, &keys);
+    PasswordManager *pm = ids ? pm_init() : NULL;
+
+    int ok = pm && manifest.record_size > 0 &&
+             manifest.record_size <= 4 * sizeof(PasswordEntry);
+    uint32_t entry_chunks = manifest.info.chunk_count - manifest.tombstone_chunks;
+    for (uint32_t i = 0; ok && i < manifest.info.chunk_count; i++) {
+        ok = restore_chunk(ids[i], &keys, manifest.record_size, i >= entry_chunks, pm);
+    }
+    ok = ok && pm->count == manifest.info.entry_count;
+
+    memset(&keys, 0, sizeof(keys));
+    free(ids);
+
+    if (!ok) {
+        pm_free(pm);
+        return NULL;
+    }
+
+    pm->generation = manifest.info.generation;
+    if (pm->log_floor < manifest.log_floor) pm->log_floor = manifest.log_floor;
+    *status = 1;
+    return pm;
+}
+
+static int compare_ids(const void *a, const void *b) {
+    return memcmp(a, b, sizeof(ChunkId));
+}
+
+static int64_t week_of(int64_t created) {
+    // The epoch was a Thursday; shift so weeks start on Monday
+    return (created / 86400 + 3) / 7;
+}
+
+// Mark the newest snapshot of each of the last limit periods
+static void keep_periods(const BackupSnapshot *snapshots, size_t count,
+                         int64_t period, int weekly, int limit,
+                         unsigned char *keep) {
+    int kept = 0;
+    int64_t last = 0;
+
+    for (size_t i = count; i-- > 0 && kept < limit;) {
+        int64_t bucket = weekly ? week_of(snapshots[i].created)
+                                : snapshots[i].created / period;
+        if (kept > 0 && bucket == last) continue;
+        keep[i] = 1;
+        last = bucket;
+        kept++;
+    }
+}
+
+// A snapshot as its authenticated manifest describes it
+typedef struct {
+    BackupSnapshot info;
+    ChunkId *ids;
+} PruneSnapshot;
+
+static int compare_snapshots(const void *a, const void *b) {
+    uint64_t x = ((const PruneSnapshot*)a)->info.id;
+    uint64_t y = ((const PruneSnapshot*)b)->info.id;
+    return (x > y) - (x < y);
+}
+
+long backup_prune(const BackupPolicy *policy, const char *master_password,
+                  size_t *chunks_removed) {
+    if (!policy || !master_password) return -1;
+    if (chunks_removed) *chunks_removed = 0;
+
+    CatalogHeader catalog;
+    BackupSnapshot *listed;
+    if (!load_catalog(&catalog, &listed)) return -1;
+
+    size_t count = catalog.snapshot_count;
+    if (count == 0) return 0;
+
+    BackupKeys keys;
+    if (!derive_backup_keys(master_password, catalog.salt, &keys)) {
+        free(listed);
+        return -1;
+    }
+    if (!crypto_equal(keys.check, catalog.check, KEY_SIZE)) {
+        memset(&keys, 0, sizeof(keys));
+        free(listed);
+        return -2;
+    }
+
+    // Every manifest must check out before anything is deleted, and the
+    // policy runs on their authenticated times rather than the catalog's
+    PruneSnapshot *snapshots = calloc(count, sizeof(PruneSnapshot));
+    BackupSnapshot *infos = malloc(sizeof(BackupSnapshot) * count);
+    unsigned char *keep = calloc(count, 1);
+    int ok = snapshots && infos && keep;
+
+    for (size_t i = 0; ok && i < count; i++) {
+        ManifestHeader manifest;
+        snapshots[i].ids = read_manifest(listed[i].id, &manifest, &keys);
+        snapshots[i].info = manifest.info;
+        ok = snapshots[i].ids != NULL;
+    }
+    memset(&keys, 0, sizeof(keys));
+    free(listed);
+
+    if (ok) {
+        qsort(snapshots, count, sizeof(PruneSnapshot), compare_snapshots);
+        for (size_t i = 0; i < count; i++) {
+            infos[i] = snapshots[i].info;
+            if (i > 0 && infos[i].id == infos[i - 1].id) ok = 0;
+        }
+    }
+
+    if (ok) {
+        keep[count - 1] = 1;
+        keep_periods(infos, count, 3600, 0, policy->hourly, keep);
+        keep_periods(infos, count, 86400, 0, policy->daily, keep);
+        keep_periods(infos, count, 0, 1, policy->weekly, keep);
+    }
+
+    // Chunk ids still used, sorted for lookup
+    ChunkId *live = NULL;
+    size_t live_count = 0;
+
+    for (size_t i = 0; ok && i < count; i++) {
+        if (!keep[i]) continue;
+
+        uint32_t chunk_count = snapshots[i].info.chunk_count;
+        ChunkId *grown = realloc(live, sizeof(ChunkId) * (live_count + chunk_count + 1));
+        if (grown) {
+            live = grown;
+            memcpy(live + live_count, snapshots[i].ids, sizeof(ChunkId) * chunk_count);
+            live_count += chunk_count;
+        }
+        ok = grown != NULL;
+    }
+    if (ok && live_count > 1) qsort(live, live_count, sizeof(ChunkId), compare_ids);
+
+    // Drop the manifests from the catalog first, so a failure part way
+    // through leaves unused chunks behind rather than broken snapshots
+    size_t kept_count = 0;
+    for (size_t i = 0; ok && i < count; i++) {
+        if (keep[i]) infos[kept_count++] = snapshots[i].info;
+    }
+
+    CatalogHeader updated = catalog;
+    updated.snapshot_count = (uint32_t)kept_count;
+    if (ok && kept_count < count) ok = save_catalog(&updated, infos);
+
+    long removed = 0;
+    for (size_t i = 0; ok && i < count; i++) {
+        if (keep[i]) continue;
+
+        const ChunkId *ids = snapshots[i].ids;
+        for (uint32_t c = 0; c < snapshots[i].info.chunk_count; c++) {
+            if (live_count > 0 &&
+                bsearch(ids[c], live, live_count, sizeof(ChunkId), compare_ids)) {
+                continue;
+            }
+
+            char path[PATH_SIZE];
+            chunk_path(ids[c], path, sizeof(path), 0);
+            if (remove(path) == 0 && chunks_removed) (*chunks_removed)++;
+        }
+
+        char path[PATH_SIZE];
+        manifest_path(snapshots[i].info.id, path, sizeof(path));
+        remove(path);
+        removed++;
+    }
+
+    for (size_t i = 0; snapshots && i < count; i++) free(snapshots[i].ids);
+    free(snapshots);
+    free(infos);
+    free(live);
+    free(keep);
+    return ok ? removed : -1;
+}
@@ -0,0 +1,83 @@
+#ifndef BACKUP_H
+#define BACKUP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "password.h"
+
+/**
+ * Deduplicating snapshot store for vault backups
+ *
+ * Snapshots live under get_data_dir()/backups. The entries of a vault are
+ * cut into chunks at record boundaries chosen by the service name, so an
+ * edit only changes the chunk holding that record and an insert or delete
+ * only moves the boundaries next to it. Each chunk is compressed, then
+ * sealed with AES-256-GCM, and stored once under a keyed hash of its
+ * plaintext: snapshots that share chunks share the files, and a new
+ * snapshot writes only chunks no earlier snapshot has.
+ *
+ * A snapshot is a manifest listing its chunk ids. Retention keeps the
+ * newest snapshot of each of the last N hours, days and weeks; pruning
+ * drops the other manifests and then every chunk no kept manifest uses.
+ * Listing needs no password, since chunk ids reveal nothing. Pruning
+ * deletes, so it needs the password and checks every manifest first.
+ * Snapshots also keep the vault's tombstones and log floor, so a restore
+ * still tells replicas what was deleted.
+ */
+
+#define BACKUP_DIR_NAME "backups"
+
+typedef struct {
+    uint64_t id;
+    int64_t created;        // Seconds since the epoch
+    uint64_t generation;    // Vault generation the snapshot was taken at
+    uint64_t entry_count;
+    uint32_t chunk_count;
+    uint32_t reserved;
+} BackupSnapshot;
+
+// Snapshots to keep: newest in each of the last hourly hours, daily days
+// and weekly weeks (UTC); the newest snapshot is always kept
+typedef struct {
+    int hourly;
+    int daily;
+    int weekly;
+} BackupPolicy;
+
+// Roughly 90 days of history
+#define BACKUP_DEFAULT_HOURLY 24
+#define BACKUP_DEFAULT_DAILY 30
+#define BACKUP_DEFAULT_WEEKLY 13
+
+typedef struct {
+    size_t chunks;          // Chunks in the snapshot
+    size_t new_chunks;      // Chunks that had to be written
+    uint64_t bytes_written; // Size of the new chunk files
+} BackupStats;
+
+// Take a snapshot of pm (in-memory vault or paged store)
+// Returns: 1 on success, 0 on failure,
+//          -1 if the store was created under another master password
+int backup_create(const PasswordManager *pm, const char *master_password,
+                  BackupSnapshot *snapshot, BackupStats *stats);
+
+// Snapshots in the store, oldest first; *count receives how many
+// Returns: array to free(), or NULL if there are none or on failure
+BackupSnapshot* backup_list(size_t *count);
+
+// Read snapshot id back into a new in-memory password manager, with its
+// tombstones and log floor
+// *status receives 1 on success, 0 if the snapshot is missing or damaged,
+// -1 on a wrong master password
+PasswordManager* backup_restore(uint64_t id, const char *master_password,
+                                int *status);
+
+// Apply a retention policy; nothing is deleted unless every manifest
+// passes its HMAC under master_password
+// Returns: number of snapshots removed (chunks no longer used are deleted
+//          and counted in *chunks_removed), -1 on failure or a damaged
+//          manifest, -2 on a wrong master password
+long backup_prune(const BackupPolicy *policy, const char *master_password,
+                  size_t *chunks_removed);
+
+#endif // BACKUP_H
@@ -0,0 +1,288 @@
+#include "blind_index.h"
+#include "crypto.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    unsigned char vault_iv[IV_SIZE];
+    uint64_t count;
+    uint64_t vault_generation;
+} IndexHeader;
+
+typedef struct {
+    unsigned char token[HASH_SIZE];
+    uint64_t record;
+    uint64_t frame_offset;      // 0 in an uncompressed payload
+    uint32_t frame_slot;
+    uint32_t reserved;
+    unsigned char mac[HASH_SIZE];
+} IndexSlot;
+
+// What a slot's MAC covers: the slot, where it sits, the token that
+// follows it (zeros after the last) and the vault payload the index
+// belongs to. Two neighbouring tokens that verify prove nothing is
+// indexed between them, so a miss is as trustworthy as a hit.
+typedef struct {
+    uint64_t position;
+    uint64_t count;
+    uint64_t vault_generation;
+    unsigned char vault_iv[IV_SIZE];
+    unsigned char token[HASH_SIZE];
+    uint64_t record;
+    uint64_t frame_offset;
+    uint64_t frame_slot;
+    unsigned char next_token[HASH_SIZE];
+} SlotMacInput;
+
+static int derive_index_key(const unsigned char *vault_key, unsigned char *key) {
+    return derive_subkey(vault_key, "cipher-blind-index", key);
+}
+
+static int derive_mac_key(const unsigned char *vault_key, unsigned char *key) {
+    return derive_subkey(vault_key, "cipher-blind-index-mac", key);
+}
+
+static int slot_mac(const unsigned char *mac_key, const IndexHeader *header,
+                    uint64_t position, const IndexSlot *slot,
+                    const unsigned char *next_token, unsigned char *mac) {
+    SlotMacInput input;
+
+    memset(&input, 0, sizeof(input));
+    input.position = position;
+    input.count = header->count;
+    input.vault_generation = header->vault_generation;
+    memcpy(input.vault_iv, header->vault_iv, IV_SIZE);
+    memcpy(input.token, slot->token, HASH_SIZE);
+    input.record = slot->record;
+    input.frame_offset = slot->frame_offset;
+    input.frame_slot = slot->frame_slot;
+    if (next_token) memcpy(input.next_token, next_token, HASH_SIZE);
+    return hmac_sha256(mac_key, &input, sizeof(input), mac);
+}
+
+static int service_token(const unsigned char *index_key, const char *service,
+                         unsigned char *token) {
+    char folded[MAX_SERVICE_NAME];
+    size_t len = 0;
+    
+    for (; service[len] && len < MAX_SERVICE_NAME - 1; len++) {
+        folded[len] = (char)tolower((unsigned char)service[len]);
+    }
+    
+    int ok = hmac_sha256(index_key, folded, len, token);
+    memset(folded, 0, sizeof(folded));
+    return ok;
+}
+
+static int compare_slots(const void *a, const void *b) {
+    return memcmp(((const IndexSlot*)a)->token, ((const IndexSlot*)b)->token,
+                  HASH_SIZE);
+}
+
+int blind_index_write(const char *path, const PasswordManager *pm,
+                      size_t shard, size_t shard_count,
+                      const unsigned char *vault_key,
+                      const unsigned char *vault_iv, uint64_t vault_generation,
+                      const uint64_t *frame_offsets, size_t frame_records) {
+    if (!path || !pm || !vault_key || !vault_iv ||
+        (frame_offsets && frame_records == 0)) {
+        return 0;
+    }
+    
+    unsigned char index_key[KEY_SIZE];
+    if (!derive_index_key(vault_key, index_key)) return 0;
+    
+    // Write next to the final path and swap it in, so a reader never sees
+    // a half-written index
+    char tmp_path[600];
+    int len = snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    if (len < 0 || (size_t)len >= sizeof(tmp_path)) {
+        memset(index_key, 0, sizeof(index_key));
+        return 0;
+    }
+    
+    IndexSlot *slots = NULL;
+    if (pm->count > 0) {
+        slots = malloc(sizeof(IndexSlot) * pm->count);
+        if (!slots) {
+            memset(index_key, 0, sizeof(index_key));
+            return 0;
+        }
+    }
+    
+    size_t count = 0;
+    for (size_t i = 0; i < pm->count; i++) {
+        const char *service = pm->entries[i].service;
+        if (shard_count > 0 && pm_shard_of(service, shard_count) != shard) {
+            continue;
+        }
+        
+        memset(&slots[count], 0, sizeof(IndexSlot));
+        slots[count].record = count;
+        if (frame_offsets) {
+            slots[count].frame_offset = frame_offsets[count / frame_records];
+            slots[count].frame_slot = (uint32_t)(count % frame_records);
+        }
+        if (!service_token(index_key, service, slots[count].token)) {
+            free(slots);
+            memset(index_key, 0, sizeof(index_key));
+            return 0;
+        }
+        count++;
+    }
+    memset(index_key, 0, sizeof(index_key));
+    
+    if (count > 1) {
+        qsort(slots, count, sizeof(IndexSlot), compare_slots);
+    }
+    
+    IndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+    header.version = INDEX_VERSION;
+    header.record_size = sizeof(PasswordEntry);
+    memcpy(header.vault_iv, vault_iv, IV_SIZE);
+    header.count = count;
+    header.vault_generation = vault_generation;
+    
+    unsigned char mac_key[KEY_SIZE];
+    int ok = derive_mac_key(vault_key, mac_key);
+    for (size_t i = 0; ok && i < count; i++) {
+        ok = slot_mac(mac_key, &header, i, &slots[i],
+                      i + 1 < count ? slots[i + 1].token : NULL, slots[i].mac);
+    }
+    memset(mac_key, 0, sizeof(mac_key));
+    if (!ok) {
+        free(slots);
+        return 0;
+    }
+    
+    FILE *file = fopen(tmp_path, "wb");
+    if (!file) {
+        free(slots);
+        return 0;
+    }
+    
+    ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+             (count == 0 ||
+              fwrite(slots, sizeof(IndexSlot), count, file) == count);
+    if (fclose(file) != 0) ok = 0;
+    free(slots);
+    
+    if (!ok || rename(tmp_path, path) != 0) {
+        remove(tmp_path);
+        return 0;
+    }
+    return 1;
+}
+
+static int read_slot(FILE *file, uint64_t position, IndexSlot *slot) {
+    return fseek(file, (long)(sizeof(IndexHeader) + position * sizeof(IndexSlot)),
+                 SEEK_SET) == 0 &&
+           fread(slot, sizeof(IndexSlot), 1, file) == 1;
+}
+
+// Read slot position and check its MAC, which needs the next token
+static int read_verified_slot(FILE *file, const IndexHeader *header,
+                              const unsigned char *mac_key, uint64_t position,
+                              IndexSlot *slot, IndexSlot *next) {
+    unsigned char mac[HASH_SIZE];
+    int has_next = position + 1 < header->count;
+
+    return read_slot(file, position, slot) &&
+           (!has_next || read_slot(file, position + 1, next)) &&
+           slot_mac(mac_key, header, position, slot,
+                    has_next ? next->token : NULL, mac) &&
+           crypto_equal(mac, slot->mac, HASH_SIZE);
+}
+
+int64_t blind_index_find(const char *path, const unsigned char *vault_key,
+                         const unsigned char *vault_iv, uint64_t vault_generation,
+                         uint64_t entry_count, const char *service,
+                         IndexFrame *frame) {
+    if (!path || !vault_key || !vault_iv || !service) return -2;
+    
+    FILE *file = fopen(path, "rb");
+    if (!file) return -2;
+    
+    IndexHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, INDEX_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != INDEX_VERSION ||
+        header.record_size != sizeof(PasswordEntry) ||
+        memcmp(header.vault_iv, vault_iv, IV_SIZE) != 0 ||
+        header.vault_generation != vault_generation ||
+        header.count != entry_count || header.count == 0) {
+        fclose(file);
+        return -2;
+    }
+    
+    unsigned char index_key[KEY_SIZE];
+    unsigned char mac_key[KEY_SIZE];
+    unsigned char token[HASH_SIZE];
+    int ok = derive_index_key(vault_key, index_key) &&
+             derive_mac_key(vault_key, mac_key) &&
+             service_token(index_key, service, token);
+    memset(index_key, 0, sizeof(index_key));
+    if (!ok) {
+        memset(mac_key, 0, sizeof(mac_key));
+        fclose(file);
+        return -2;
+    }
+    
+    // Binary search straight on the file: O(log n) slot reads. The slots
+    // read on the way are untrusted; only the one the search ends on (or
+    // the one before the gap it ends in) is verified
+    uint64_t lo = 0, hi = header.count;
+    int found = 0;
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        IndexSlot slot;
+        
+        if (!read_slot(file, mid, &slot)) {
+            lo = hi = 0;
+            ok = 0;
+            break;
+        }
+        
+        int cmp = memcmp(slot.token, token, HASH_SIZE);
+        if (cmp == 0) {
+            lo = mid;
+            found = 1;
+            break;
+        }
+        if (cmp < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    
+    IndexSlot slot, next;
+    uint64_t position = found || lo == 0 ? lo : lo - 1;
+    int64_t result = -2;
+    
+    if (ok && read_verified_slot(file, &header, mac_key, position, &slot, &next)) {
+        int cmp = memcmp(slot.token, token, HASH_SIZE);
+        int next_above = position + 1 >= header.count ||
+                         memcmp(next.token, token, HASH_SIZE) > 0;
+        
+        if (found && cmp == 0) {
+            result = slot.record < header.count ? (int64_t)slot.record : -2;
+            if (frame) {
+                frame->offset = slot.frame_offset;
+                frame->slot = slot.frame_slot;
+            }
+        } else if (!found && lo == 0 && cmp > 0) {
+            result = -1;
+        } else if (!found && lo > 0 && cmp < 0 && next_above) {
+            result = -1;
+        }
+    }
+    
+    memset(mac_key, 0, sizeof(mac_key));
+    fclose(file);
+    return result;
+}
@@ -0,0 +1,54 @@
+#ifndef BLIND_INDEX_H
+#define BLIND_INDEX_H
+
+#include <stdint.h>
+#include "password.h"
+
+/**
+ * Blind index sidecar for the flat vault
+ *
+ * Maps HMAC-SHA256 tokens of case-folded service names to record numbers
+ * in the encrypted payload. The HMAC key is derived from the vault key,
+ * so the file reveals nothing without the master password, and a single
+ * service can be located with one HMAC and a binary search instead of
+ * decrypting the whole vault. Each slot carries a MAC binding it to its
+ * position, the next slot's token and the vault payload, so both hits and
+ * misses on a current index can be trusted.
+ */
+
+// The index of a vault file lives next to it as <vault file>.idx
+#define INDEX_FILE_SUFFIX ".idx"
+#define INDEX_MAGIC "CIPHERIX"
+#define INDEX_VERSION 4
+
+// Where a record sits in a compressed payload: the plaintext offset of
+// the frame holding it and its place within that frame
+typedef struct {
+    uint64_t offset;
+    uint32_t slot;
+} IndexFrame;
+
+// Write the index for the entries of pm stored in one shard (record
+// numbers count entries of that shard only; shard_count 0 = all entries).
+// vault_iv and vault_generation tie the index to one saved payload; an
+// index whose IV, generation or entry count no longer matches the vault
+// is treated as stale. For a compressed payload, frame_offsets holds the
+// offset of each frame of frame_records records (NULL = uncompressed).
+int blind_index_write(const char *path, const PasswordManager *pm,
+                      size_t shard, size_t shard_count,
+                      const unsigned char *vault_key,
+                      const unsigned char *vault_iv, uint64_t vault_generation,
+                      const uint64_t *frame_offsets, size_t frame_records);
+
+// Look up the record number of a service in a vault file holding
+// entry_count entries. Only the slots the answer rests on are verified,
+// so a lookup stays O(log n). frame (may be NULL) receives where the
+// record sits in a compressed payload.
+// Returns: record number, -1 if the service is not in the vault,
+//          -2 if the index is missing, stale, unreadable or fails to verify
+int64_t blind_index_find(const char *path, const unsigned char *vault_key,
+                         const unsigned char *vault_iv, uint64_t vault_generation,
+                         uint64_t entry_count, const char *service,
+                         IndexFrame *frame);
+
+#endif // BLIND_INDEX_H
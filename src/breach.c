@@ -0,0 +1,397 @@
+#ifndef _WIN32
+    #define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "breach.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#ifdef _WIN32
+    #include <windows.h>
+    #define fseeko _fseeki64
+    #define ftello _ftelli64
+    typedef long long off_t;
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+#define BUCKET_COUNT 256
+#define PATH_SIZE 600
+#define LINE_SIZE 256
+
+// Interpolation probes before falling back to bisection, so a skewed
+// corpus cannot make a lookup walk it step by step
+#define MAX_INTERPOLATION_PROBES 8
+
+struct BreachCorpus {
+    const unsigned char *map;
+    uint64_t map_size;
+    const unsigned char *bloom;
+    uint64_t bloom_blocks;
+    const unsigned char *hashes;
+    uint64_t hash_count;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#endif
+};
+
+static uint64_t read_be64(const unsigned char *p) {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++) {
+        value = value << 8 | p[i];
+    }
+    return value;
+}
+
+// Block and bit positions come from disjoint bytes of the hash
+static const unsigned char* bloom_block(const unsigned char *bloom, uint64_t blocks,
+                                        const unsigned char *hash) {
+    return bloom + (read_be64(hash + 4) % blocks) * BREACH_BLOOM_BLOCK;
+}
+
+static void bloom_add(unsigned char *bloom, uint64_t blocks, const unsigned char *hash) {
+    unsigned char *block = (unsigned char*)bloom_block(bloom, blocks, hash);
+    uint64_t bits = read_be64(hash + 12);
+
+    for (int i = 0; i < BREACH_BLOOM_PROBES; i++) {
+        unsigned bit = (unsigned)(bits & 511);
+        block[bit >> 3] |= (unsigned char)(1u << (bit & 7));
+        bits >>= 9;
+    }
+}
+
+static int bloom_may_contain(const unsigned char *bloom, uint64_t blocks,
+                             const unsigned char *hash) {
+    const unsigned char *block = bloom_block(bloom, blocks, hash);
+    uint64_t bits = read_be64(hash + 12);
+
+    for (int i = 0; i < BREACH_BLOOM_PROBES; i++) {
+        unsigned bit = (unsigned)(bits & 511);
+        if (!(block[bit >> 3] & (1u << (bit & 7)))) return 0;
+        bits >>= 9;
+    }
+    return 1;
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// "<40 hex>" optionally followed by ":count" or whitespace
+static int parse_line(const char *line, unsigned char *hash) {
+    for (int i = 0; i < SHA1_SIZE; i++) {
+        int high = hex_value(line[2 * i]);
+        int low = high < 0 ? -1 : hex_value(line[2 * i + 1]);
+        if (low < 0) return 0;
+        hash[i] = (unsigned char)(high << 4 | low);
+    }
+
+    char next = line[2 * SHA1_SIZE];
+    return next == '\0' || next == ':' || next == '\n' || next == '\r' ||
+           next == ' ' || next == '\t';
+}
+
+static int compare_hashes(const void *a, const void *b) {
+    return memcmp(a, b, SHA1_SIZE);
+}
+
+static void bucket_path(char *out, const char *output, int bucket) {
+    snprintf(out, PATH_SIZE, "%s.%02x.tmp", output, bucket);
+}
+
+static void close_buckets(FILE **buckets, const char *output) {
+    char path[PATH_SIZE];
+    for (int b = 0; b < BUCKET_COUNT; b++) {
+        if (buckets[b]) fclose(buckets[b]);
+        buckets[b] = NULL;
+        bucket_path(path, output, b);
+        remove(path);
+    }
+}
+
+// Split the hashes of the text list into one file per leading byte
+static long long split_input(FILE *in, FILE **buckets, size_t *skipped) {
+    char line[LINE_SIZE];
+    unsigned char hash[SHA1_SIZE];
+    long long total = 0;
+
+    while (fgets(line, sizeof(line), in)) {
+        size_t len = strlen(line);
+        int whole = len > 0 && line[len - 1] == '\n';
+
+        // Drop the rest of an overlong line
+        if (!whole && !feof(in)) {
+            int c;
+            while ((c = fgetc(in)) != EOF && c != '\n') {}
+        }
+
+        if (len < 2 * SHA1_SIZE || !parse_line(line, hash)) {
+            if (len > 0 && line[0] != '\n' && line[0] != '\r') (*skipped)++;
+            continue;
+        }
+
+        if (fwrite(hash, SHA1_SIZE, 1, buckets[hash[0]]) != 1) return -1;
+        total++;
+    }
+    return ferror(in) ? -1 : total;
+}
+
+// Sort and deduplicate one bucket onto the end of out, filling the filter
+static long long merge_bucket(FILE *bucket, FILE *out, unsigned char *bloom,
+                              uint64_t blocks) {
+    if (fflush(bucket) != 0 || fseeko(bucket, 0, SEEK_END) != 0) return -1;
+    off_t size = ftello(bucket);
+    if (size < 0) return -1;
+
+    size_t count = (size_t)size / SHA1_SIZE;
+    if (count == 0) return 0;
+
+    unsigned char *hashes = malloc(count * SHA1_SIZE);
+    if (!hashes) return -1;
+
+    rewind(bucket);
+    if (fread(hashes, SHA1_SIZE, count, bucket) != count) {
+        free(hashes);
+        return -1;
+    }
+    qsort(hashes, count, SHA1_SIZE, compare_hashes);
+
+    size_t unique = 0;
+    for (size_t i = 0; i < count; i++) {
+        unsigned char *hash = hashes + i * SHA1_SIZE;
+        if (unique > 0 && memcmp(hash, hashes + (unique - 1) * SHA1_SIZE, SHA1_SIZE) == 0) {
+            continue;
+        }
+        if (unique != i) memcpy(hashes + unique * SHA1_SIZE, hash, SHA1_SIZE);
+        bloom_add(bloom, blocks, hash);
+        unique++;
+    }
+
+    size_t written = fwrite(hashes, SHA1_SIZE, unique, out);
+    free(hashes);
+    return written == unique ? (long long)unique : -1;
+}
+
+long long breach_convert(const char *input, const char *output, size_t *skipped) {
+    if (!input || !output || !skipped) return -1;
+    *skipped = 0;
+
+    FILE *in = fopen(input, "r");
+    if (!in) return -1;
+
+    FILE *buckets[BUCKET_COUNT] = {0};
+    char path[PATH_SIZE];
+    int ok = 1;
+    for (int b = 0; ok && b < BUCKET_COUNT; b++) {
+        bucket_path(path, output, b);
+        buckets[b] = fopen(path, "w+b");
+        ok = buckets[b] != NULL;
+    }
+
+    long long total = ok ? split_input(in, buckets, skipped) : -1;
+    fclose(in);
+    if (total < 0) {
+        close_buckets(buckets, output);
+        return -1;
+    }
+
+    BreachHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BREACH_MAGIC, 8);
+    header.version = BREACH_VERSION;
+    header.hash_size = SHA1_SIZE;
+    header.bloom_blocks = (uint64_t)total * BREACH_BLOOM_BITS_PER_HASH /
+                          (BREACH_BLOOM_BLOCK * 8) + 1;
+    header.bloom_offset = BREACH_BLOOM_BLOCK;
+    header.hash_offset = header.bloom_offset + header.bloom_blocks * BREACH_BLOOM_BLOCK;
+
+    unsigned char *bloom = calloc(header.bloom_blocks, BREACH_BLOOM_BLOCK);
+    FILE *out = bloom ? fopen(output, "wb") : NULL;
+    ok = out != NULL && fseeko(out, (off_t)header.hash_offset, SEEK_SET) == 0;
+
+    // Buckets hold ascending leading bytes, so appending them in turn
+    // leaves the whole corpus sorted
+    for (int b = 0; ok && b < BUCKET_COUNT; b++) {
+        long long unique = merge_bucket(buckets[b], out, bloom, header.bloom_blocks);
+        if (unique < 0) ok = 0;
+        else header.hash_count += (uint64_t)unique;
+
+        fclose(buckets[b]);
+        buckets[b] = NULL;
+        bucket_path(path, output, b);
+        remove(path);
+    }
+    close_buckets(buckets, output);
+
+    if (ok) {
+        ok = fseeko(out, 0, SEEK_SET) == 0 &&
+             fwrite(&header, sizeof(header), 1, out) == 1 &&
+             fseeko(out, (off_t)header.bloom_offset, SEEK_SET) == 0 &&
+             fwrite(bloom, BREACH_BLOOM_BLOCK, header.bloom_blocks, out) == header.bloom_blocks;
+    }
+    if (out && fclose(out) != 0) ok = 0;
+    free(bloom);
+
+    if (!ok) {
+        remove(output);
+        return -1;
+    }
+    return (long long)header.hash_count;
+}
+
+// Check the header against the mapping and locate the filter and hashes
+static int locate_sections(BreachCorpus *corpus) {
+    if (corpus->map_size < sizeof(BreachHeader)) return 0;
+
+    BreachHeader header;
+    memcpy(&header, corpus->map, sizeof(header));
+    if (memcmp(header.magic, BREACH_MAGIC, 8) != 0 ||
+        header.version != BREACH_VERSION || header.hash_size != SHA1_SIZE ||
+        header.bloom_blocks == 0) {
+        return 0;
+    }
+
+    uint64_t size = corpus->map_size;
+    if (header.bloom_offset < sizeof(header) || header.bloom_offset > size ||
+        header.bloom_blocks > (size - header.bloom_offset) / BREACH_BLOOM_BLOCK ||
+        header.hash_offset < header.bloom_offset + header.bloom_blocks * BREACH_BLOOM_BLOCK ||
+        header.hash_offset > size ||
+        header.hash_count > (size - header.hash_offset) / SHA1_SIZE) {
+        return 0;
+    }
+
+    corpus->bloom = corpus->map + header.bloom_offset;
+    corpus->bloom_blocks = header.bloom_blocks;
+    corpus->hashes = corpus->map + header.hash_offset;
+    corpus->hash_count = header.hash_count;
+    return 1;
+}
+
+BreachCorpus* breach_open(const char *path) {
+    if (!path) return NULL;
+
+    BreachCorpus *corpus = calloc(1, sizeof(BreachCorpus));
+    if (!corpus) return NULL;
+
+#ifdef _WIN32
+    corpus->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                               OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+    LARGE_INTEGER size;
+    if (corpus->file == INVALID_HANDLE_VALUE || !GetFileSizeEx(corpus->file, &size) ||
+        size.QuadPart == 0) {
+        if (corpus->file != INVALID_HANDLE_VALUE) CloseHandle(corpus->file);
+        free(corpus);
+        return NULL;
+    }
+    corpus->mapping = CreateFileMappingA(corpus->file, NULL, PAGE_READONLY, 0, 0, NULL);
+    corpus->map = corpus->mapping ? MapViewOfFile(corpus->mapping, FILE_MAP_READ, 0, 0, 0)
+                                  : NULL;
+    corpus->map_size = (uint64_t)size.QuadPart;
+    if (!corpus->map) {
+        if (corpus->mapping) CloseHandle(corpus->mapping);
+        CloseHandle(corpus->file);
+        free(corpus);
+        return NULL;
+    }
+#else
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size <= 0) {
+        if (fd >= 0) close(fd);
+        free(corpus);
+        return NULL;
+    }
+
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        free(corpus);
+        return NULL;
+    }
+
+    // Lookups hop across the file; read-ahead would only bloat the cache
+    posix_madvise(map, (size_t)st.st_size, POSIX_MADV_RANDOM);
+    corpus->map = map;
+    corpus->map_size = (uint64_t)st.st_size;
+#endif
+
+    if (!locate_sections(corpus)) {
+        breach_close(corpus);
+        return NULL;
+    }
+    return corpus;
+}
+
+void breach_close(BreachCorpus *corpus) {
+    if (!corpus) return;
+
+#ifdef _WIN32
+    if (corpus->map) UnmapViewOfFile(corpus->map);
+    if (corpus->mapping) CloseHandle(corpus->mapping);
+    if (corpus->file != INVALID_HANDLE_VALUE) CloseHandle(corpus->file);
+#else
+    if (corpus->map) munmap((void*)corpus->map, (size_t)corpus->map_size);
+#endif
+    free(corpus);
+}
+
+uint64_t breach_hash_count(const BreachCorpus *corpus) {
+    return corpus ? corpus->hash_count : 0;
+}
+
+int breach_contains_hash(const BreachCorpus *corpus,
+                         const unsigned char hash[SHA1_SIZE]) {
+    if (!corpus || !hash || corpus->hash_count == 0) return 0;
+    if (!bloom_may_contain(corpus->bloom, corpus->bloom_blocks, hash)) return 0;
+
+    const unsigned char *hashes = corpus->hashes;
+    uint64_t key = read_be64(hash);
+    uint64_t lo = 0;
+    uint64_t hi = corpus->hash_count - 1;
+    int probes = 0;
+
+    while (lo <= hi) {
+        uint64_t lo_key = read_be64(hashes + lo * SHA1_SIZE);
+        uint64_t hi_key = read_be64(hashes + hi * SHA1_SIZE);
+        if (key < lo_key || key > hi_key) return 0;
+
+        uint64_t pos;
+        if (probes++ < MAX_INTERPOLATION_PROBES && hi_key > lo_key) {
+            long double fraction = (long double)(key - lo_key) / (long double)(hi_key - lo_key);
+            pos = lo + (uint64_t)(fraction * (long double)(hi - lo));
+            if (pos > hi) pos = hi;
+        } else {
+            pos = lo + (hi - lo) / 2;
+        }
+
+        int cmp = memcmp(hashes + pos * SHA1_SIZE, hash, SHA1_SIZE);
+        if (cmp == 0) return 1;
+        if (cmp < 0) {
+            lo = pos + 1;
+        } else {
+            if (pos == 0) return 0;
+            hi = pos - 1;
+        }
+    }
+    return 0;
+}
+
+int breach_contains(const BreachCorpus *corpus, const char *password) {
+    if (!corpus || !password) return 0;
+
+    unsigned char hash[SHA1_SIZE];
+    if (!sha1(password, strlen(password), hash)) return 0;
+
+    int found = breach_contains_hash(corpus, hash);
+    memset(hash, 0, sizeof(hash));
+    return found;
+}
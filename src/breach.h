@@ -0,0 +1,63 @@
+#ifndef BREACH_H
+#define BREACH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "crypto.h"
+
+/**
+ * Offline breached-password corpus
+ *
+ * A HIBP-style text list ("<40 hex SHA-1>[:count]" per line) is converted
+ * once into a binary corpus: a header, a blocked Bloom filter, then the
+ * SHA-1 hashes sorted and deduplicated as fixed 20-byte records. Lookups
+ * map the file and ask the filter first; only a possible hit searches the
+ * hashes, by interpolation on their leading 8 bytes (SHA-1 is uniform, so
+ * a hash sits close to where its value predicts), touching a handful of
+ * pages however large the corpus. Nothing but the touched pages is read.
+ *
+ * Each filter block is one 64-byte cache line; a hash picks a block and
+ * sets BREACH_BLOOM_PROBES bits inside it, so a lookup costs one line.
+ */
+
+#define BREACH_MAGIC "CIPHERHB"
+#define BREACH_VERSION 1
+#define BREACH_BLOOM_BLOCK 64           // Bytes per filter block
+#define BREACH_BLOOM_BITS_PER_HASH 8    // About 2% false positives
+#define BREACH_BLOOM_PROBES 6
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t hash_size;         // SHA1_SIZE
+    uint64_t hash_count;
+    uint64_t bloom_blocks;
+    uint64_t bloom_offset;      // From the start of the file
+    uint64_t hash_offset;
+} BreachHeader;
+
+typedef struct BreachCorpus BreachCorpus;
+
+// Convert a text list to a binary corpus at output; lines that are not a
+// SHA-1 are skipped and counted in *skipped. Needs free space next to
+// output for a copy of the hashes while they are sorted.
+// Returns: number of distinct hashes written, or -1 on failure
+long long breach_convert(const char *input, const char *output, size_t *skipped);
+
+// Map a converted corpus
+// Returns: corpus handle, or NULL if the file is missing or not a corpus
+BreachCorpus* breach_open(const char *path);
+
+void breach_close(BreachCorpus *corpus);
+
+uint64_t breach_hash_count(const BreachCorpus *corpus);
+
+// Returns: 1 if the SHA-1 of password is in the corpus, 0 if not
+// (safe to call from several threads at once)
+int breach_contains(const BreachCorpus *corpus, const char *password);
+
+// As above, for a SHA-1 already computed
+int breach_contains_hash(const BreachCorpus *corpus,
+                         const unsigned char hash[SHA1_SIZE]);
+
+#endif // BREACH_H
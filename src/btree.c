@@ -0,0 +1,900 @@
+#include "btree.h"
+#include "crypto.h"
+#include "pager.h"
+#include <ctype.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#define NODE_LEAF 1
+#define NODE_INTERNAL 2
+
+// Deepest tree we ever expect (39-way fan-out covers billions of entries)
+#define MAX_TREE_HEIGHT 16
+
+typedef struct {
+    uint8_t type;
+    uint8_t reserved;
+    uint16_t count;
+    uint32_t next;          // Right sibling (leaves only, 0 = none)
+} NodeHeader;
+
+#define LEAF_CAPACITY \
+    ((PAGE_PAYLOAD - sizeof(NodeHeader)) / sizeof(PasswordEntry))
+#define INTERNAL_CAPACITY \
+    ((PAGE_PAYLOAD - sizeof(NodeHeader) - sizeof(uint32_t)) / \
+     (MAX_SERVICE_NAME + sizeof(uint32_t)))
+
+typedef struct {
+    NodeHeader header;
+    PasswordEntry entries[LEAF_CAPACITY];
+} LeafNode;
+
+// key[i] separates child[i] (smaller keys) from child[i + 1]
+typedef struct {
+    NodeHeader header;
+    uint32_t child[INTERNAL_CAPACITY + 1];
+    char key[INTERNAL_CAPACITY][MAX_SERVICE_NAME];
+} InternalNode;
+
+_Static_assert(sizeof(LeafNode) <= PAGE_PAYLOAD, "leaf node exceeds page");
+_Static_assert(sizeof(InternalNode) <= PAGE_PAYLOAD, "internal node exceeds page");
+
+// Plaintext part of the header page
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t page_size;
+    uint32_t record_size;
+    uint32_t reserved;
+    unsigned char salt[SALT_SIZE];
+    unsigned char verifier[HASH_SIZE];
+} StoreHeader;
+
+// Encrypted part of the header page
+typedef struct {
+    uint32_t root;
+    uint32_t height;
+    uint64_t entry_count;
+    uint64_t generation;        // Last flush that carried changes
+    uint64_t log_floor;         // Oldest generation change logs can start from
+    uint32_t tomb_root;         // 0 until the first delete
+    uint32_t tomb_height;
+    uint64_t tomb_count;
+    PagerCommit pages;          // Page version table (see pager.h)
+} StoreMeta;
+
+struct BTree {
+    Pager *pager;
+    StoreHeader header;
+    StoreMeta meta;
+    unsigned char meta_key[KEY_SIZE];
+    int meta_dirty;
+    int changed;                // Records edited since the last flush
+};
+
+// The page file holds two trees of records with the same layout: the
+// entries, and tombstones (service and generation) of deleted services,
+// kept like a flat vault's so sync and change logs can carry deletions
+typedef struct {
+    uint32_t *root;
+    uint32_t *height;
+    uint64_t *count;
+} Records;
+
+static Records entries_of(BTree *tree) {
+    Records records = {&tree->meta.root, &tree->meta.height, &tree->meta.entry_count};
+    return records;
+}
+
+static Records tombstones_of(BTree *tree) {
+    Records records = {&tree->meta.tomb_root, &tree->meta.tomb_height, &tree->meta.tomb_count};
+    return records;
+}
+
+// Pages a leaf split needs, reserved before the tree is touched: the path
+// nodes it rewrites stay pinned and every new page is already allocated,
+// so a split cannot fail half way and leave a node without a parent
+typedef struct {
+    uint32_t pinned[MAX_TREE_HEIGHT];
+    int pinned_count;
+    uint32_t spare[MAX_TREE_HEIGHT + 1];
+    unsigned char *spare_page[MAX_TREE_HEIGHT + 1];
+    int spare_count;
+    int used;
+} SplitPlan;
+
+// Derive the page, meta and verification keys for a master password
+static int derive_store_keys(const char *master_password,
+                             const unsigned char *salt,
+                             unsigned char *page_key,
+                             unsigned char *meta_key,
+                             unsigned char *verifier) {
+    unsigned char key[KEY_SIZE];
+
+    int ok = derive_key(master_password, salt, key, KEY_SIZE) &&
+             derive_subkey(key, "cipher-store-page", page_key) &&
+             derive_subkey(key, "cipher-store-meta", meta_key) &&
+             derive_subkey(key, "cipher-store-verify", verifier);
+
+    memset(key, 0, sizeof(key));
+    return ok;
+}
+
+// Lay out the header page: the plaintext header, then the meta sealed
+// under meta_key with the header as associated data
+static int seal_header_page(const StoreHeader *header, const StoreMeta *meta,
+                            const unsigned char *meta_key, unsigned char *page) {
+    unsigned char *nonce = page + sizeof(StoreHeader);
+    unsigned char *tag = nonce + AEAD_NONCE_SIZE;
+    unsigned char *sealed = tag + AEAD_TAG_SIZE;
+
+    memset(page, 0, PAGE_SIZE);
+    memcpy(page, header, sizeof(StoreHeader));
+    return generate_random_bytes(nonce, AEAD_NONCE_SIZE) &&
+           aead_encrypt(meta_key, nonce, page, sizeof(StoreHeader),
+                        (const unsigned char*)meta, sizeof(StoreMeta),
+                        sealed, tag);
+}
+
+static int write_header_page(BTree *tree) {
+    unsigned char page[PAGE_SIZE];
+
+    if (!seal_header_page(&tree->header, &tree->meta, tree->meta_key, page) ||
+        !pager_write_header(tree->pager, page)) {
+        return 0;
+    }
+    tree->meta_dirty = 0;
+    return 1;
+}
+
+static void fold_key(const char *service, char *key) {
+    size_t i = 0;
+    for (; service[i] && i < MAX_SERVICE_NAME - 1; i++) {
+        key[i] = (char)tolower((unsigned char)service[i]);
+    }
+    memset(key + i, 0, MAX_SERVICE_NAME - i);
+}
+
+// Index of the child to descend into for key
+static int internal_slot(const InternalNode *node, const char *key) {
+    int lo = 0, hi = node->header.count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (strcasecmp(key, node->key[mid]) < 0) hi = mid;
+        else lo = mid + 1;
+    }
+    return lo;
+}
+
+// Position of key in a leaf; *found is set if it is already there
+static int leaf_slot(const LeafNode *node, const char *key, int *found) {
+    int lo = 0, hi = node->header.count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        int cmp = strcasecmp(node->entries[mid].service, key);
+        if (cmp == 0) {
+            *found = 1;
+            return mid;
+        }
+        if (cmp < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    *found = 0;
+    return lo;
+}
+
+// Walk from the root to the leaf that owns key, recording the path.
+// Returns the leaf page number, or 0 on I/O failure.
+static uint32_t find_leaf(BTree *tree, const Records *records, const char *key,
+                          uint32_t *path, int *depth) {
+    uint32_t pgno = *records->root;
+    int level = 0;
+
+    for (;;) {
+        const unsigned char *page = pager_get(tree->pager, pgno);
+        if (!page) return 0;
+
+        const NodeHeader *node = (const NodeHeader*)page;
+        if (node->type == NODE_LEAF) {
+            pager_unpin(tree->pager, pgno, 0);
+            break;
+        }
+        if (node->type != NODE_INTERNAL || level >= MAX_TREE_HEIGHT - 1) {
+            pager_unpin(tree->pager, pgno, 0);
+            return 0;
+        }
+
+        if (path) path[level] = pgno;
+        level++;
+        uint32_t next = ((const InternalNode*)page)->child[
+            internal_slot((const InternalNode*)page, key)];
+        pager_unpin(tree->pager, pgno, 0);
+        pgno = next;
+    }
+
+    if (depth) *depth = level;
+    return pgno;
+}
+
+static void release_plan(BTree *tree, SplitPlan *plan) {
+    for (int i = 0; i < plan->pinned_count; i++) {
+        pager_unpin(tree->pager, plan->pinned[i], 0);
+    }
+    // Reserved but unused pages stay behind as unreachable zero pages,
+    // like leaves emptied by deletes
+    for (int i = plan->used; i < plan->spare_count; i++) {
+        pager_unpin(tree->pager, plan->spare[i], 1);
+    }
+}
+
+// Pin the path nodes a split of the leaf below path[depth - 1] rewrites
+// (every full one, and the first that is not) and allocate its new pages:
+// the leaf's sibling, one per full node, and a new root if all are full
+static int plan_split(BTree *tree, const uint32_t *path, int depth, SplitPlan *plan) {
+    memset(plan, 0, sizeof(*plan));
+    int pages = 1;
+    int level = depth - 1;
+
+    for (; level >= 0; level--) {
+        const InternalNode *node = (const InternalNode*)pager_get(tree->pager, path[level]);
+        if (!node) {
+            release_plan(tree, plan);
+            return 0;
+        }
+        plan->pinned[plan->pinned_count++] = path[level];
+        if ((size_t)node->header.count < INTERNAL_CAPACITY) break;
+        pages++;
+    }
+    if (level < 0) pages++;
+
+    for (int i = 0; i < pages; i++) {
+        plan->spare_page[i] = pager_allocate(tree->pager, &plan->spare[i]);
+        if (!plan->spare_page[i]) {
+            release_plan(tree, plan);
+            return 0;
+        }
+        plan->spare_count++;
+    }
+    return 1;
+}
+
+// Next reserved page; it stays pinned until the caller unpins it
+static unsigned char* take_spare(SplitPlan *plan, uint32_t *pgno) {
+    *pgno = plan->spare[plan->used];
+    return plan->spare_page[plan->used++];
+}
+
+// Insert separator key and right child into the internal node at
+// path[level], splitting upwards as needed, with pages from plan
+static int insert_separator(BTree *tree, const Records *records, SplitPlan *plan,
+                            uint32_t *path, int level, const char *key, uint32_t right) {
+    char promote[MAX_SERVICE_NAME];
+    memcpy(promote, key, MAX_SERVICE_NAME);
+
+    while (level >= 0) {
+        uint32_t pgno = path[level];
+        InternalNode *node = (InternalNode*)pager_get(tree->pager, pgno);
+        if (!node) return 0;
+
+        int slot = internal_slot(node, promote);
+        int count = node->header.count;
+
+        if ((size_t)count < INTERNAL_CAPACITY) {
+            memmove(node->key[slot + 1], node->key[slot],
+                    (size_t)(count - slot) * MAX_SERVICE_NAME);
+            memmove(&node->child[slot + 2], &node->child[slot + 1],
+                    (size_t)(count - slot) * sizeof(uint32_t));
+            memcpy(node->key[slot], promote, MAX_SERVICE_NAME);
+            node->child[slot + 1] = right;
+            node->header.count++;
+            pager_unpin(tree->pager, pgno, 1);
+            return 1;
+        }
+
+        // Full: merge into scratch arrays, then split around the middle
+        char keys[INTERNAL_CAPACITY + 1][MAX_SERVICE_NAME];
+        uint32_t children[INTERNAL_CAPACITY + 2];
+
+        memcpy(keys, node->key, (size_t)slot * MAX_SERVICE_NAME);
+        memcpy(keys[slot], promote, MAX_SERVICE_NAME);
+        memcpy(keys[slot + 1], node->key[slot],
+               (size_t)(count - slot) * MAX_SERVICE_NAME);
+        memcpy(children, node->child, (size_t)(slot + 1) * sizeof(uint32_t));
+        children[slot + 1] = right;
+        memcpy(&children[slot + 2], &node->child[slot + 1],
+               (size_t)(count - slot) * sizeof(uint32_t));
+
+        int total = count + 1;
+        int mid = total / 2;
+
+        uint32_t sibling_pgno;
+        InternalNode *sibling = (InternalNode*)take_spare(plan, &sibling_pgno);
+
+        memset(node, 0, PAGE_PAYLOAD);
+        node->header.type = NODE_INTERNAL;
+        node->header.count = (uint16_t)mid;
+        memcpy(node->key, keys, (size_t)mid * MAX_SERVICE_NAME);
+        memcpy(node->child, children, (size_t)(mid + 1) * sizeof(uint32_t));
+
+        sibling->header.type = NODE_INTERNAL;
+        sibling->header.count = (uint16_t)(total - mid - 1);
+        memcpy(sibling->key, keys[mid + 1],
+               (size_t)(total - mid - 1) * MAX_SERVICE_NAME);
+        memcpy(sibling->child, &children[mid + 1],
+               (size_t)(total - mid) * sizeof(uint32_t));
+
+        memcpy(promote, keys[mid], MAX_SERVICE_NAME);
+        right = sibling_pgno;
+
+        pager_unpin(tree->pager, sibling_pgno, 1);
+        pager_unpin(tree->pager, pgno, 1);
+        level--;
+    }
+
+    // The root split: grow the tree by one level
+    uint32_t root_pgno;
+    InternalNode *root = (InternalNode*)take_spare(plan, &root_pgno);
+
+    root->header.type = NODE_INTERNAL;
+    root->header.count = 1;
+    root->child[0] = *records->root;
+    root->child[1] = right;
+    memcpy(root->key[0], promote, MAX_SERVICE_NAME);
+    pager_unpin(tree->pager, root_pgno, 1);
+
+    *records->root = root_pgno;
+    (*records->height)++;
+    tree->meta_dirty = 1;
+    return 1;
+}
+
+// Give an empty set of records its first (leaf) page
+static int create_root(BTree *tree, const Records *records) {
+    uint32_t pgno;
+    LeafNode *root = (LeafNode*)pager_allocate(tree->pager, &pgno);
+    if (!root) return 0;
+
+    root->header.type = NODE_LEAF;
+    pager_unpin(tree->pager, pgno, 1);
+
+    *records->root = pgno;
+    *records->height = 1;
+    *records->count = 0;
+    tree->meta_dirty = 1;
+    return 1;
+}
+
+static int get_record(BTree *tree, const Records *records, const char *service,
+                      PasswordEntry *out) {
+    if (*records->root == 0) return 0;
+
+    uint32_t pgno = find_leaf(tree, records, service, NULL, NULL);
+    if (!pgno) return 0;
+
+    LeafNode *leaf = (LeafNode*)pager_get(tree->pager, pgno);
+    if (!leaf) return 0;
+
+    int found;
+    int slot = leaf_slot(leaf, service, &found);
+    if (found && out) *out = leaf->entries[slot];
+
+    pager_unpin(tree->pager, pgno, 0);
+    return found;
+}
+
+// Add a record; one for the same service is overwritten if replace is set
+// Returns: 1 on success, 0 if the service exists (and !replace) or on I/O failure
+static int insert_record(BTree *tree, const Records *records,
+                         const PasswordEntry *entry, int replace) {
+    if (*records->root == 0 && !create_root(tree, records)) return 0;
+
+    uint32_t path[MAX_TREE_HEIGHT];
+    int depth;
+    uint32_t pgno = find_leaf(tree, records, entry->service, path, &depth);
+    if (!pgno) return 0;
+
+    LeafNode *leaf = (LeafNode*)pager_get(tree->pager, pgno);
+    if (!leaf) return 0;
+
+    int found;
+    int slot = leaf_slot(leaf, entry->service, &found);
+    if (found) {
+        if (replace) leaf->entries[slot] = *entry;
+        pager_unpin(tree->pager, pgno, replace);
+        return replace;
+    }
+
+    int count = leaf->header.count;
+    if ((size_t)count < LEAF_CAPACITY) {
+        memmove(&leaf->entries[slot + 1], &leaf->entries[slot],
+                (size_t)(count - slot) * sizeof(PasswordEntry));
+        leaf->entries[slot] = *entry;
+        leaf->header.count++;
+        pager_unpin(tree->pager, pgno, 1);
+
+        (*records->count)++;
+        tree->meta_dirty = 1;
+        return 1;
+    }
+
+    SplitPlan plan;
+    if (!plan_split(tree, path, depth, &plan)) {
+        pager_unpin(tree->pager, pgno, 0);
+        return 0;
+    }
+
+    // Split: lower half stays, upper half moves to a new right sibling
+    uint32_t sibling_pgno;
+    LeafNode *sibling = (LeafNode*)take_spare(&plan, &sibling_pgno);
+
+    int total = count + 1;
+    int mid = total / 2;
+    PasswordEntry all[LEAF_CAPACITY + 1];
+
+    memcpy(all, leaf->entries, (size_t)slot * sizeof(PasswordEntry));
+    all[slot] = *entry;
+    memcpy(&all[slot + 1], &leaf->entries[slot],
+           (size_t)(count - slot) * sizeof(PasswordEntry));
+
+    sibling->header.type = NODE_LEAF;
+    sibling->header.count = (uint16_t)(total - mid);
+    sibling->header.next = leaf->header.next;
+    memcpy(sibling->entries, &all[mid],
+           (size_t)(total - mid) * sizeof(PasswordEntry));
+
+    memset(leaf->entries, 0, sizeof(leaf->entries));
+    memcpy(leaf->entries, all, (size_t)mid * sizeof(PasswordEntry));
+    leaf->header.count = (uint16_t)mid;
+    leaf->header.next = sibling_pgno;
+
+    char separator[MAX_SERVICE_NAME];
+    fold_key(sibling->entries[0].service, separator);
+
+    memset(all, 0, sizeof(all));
+    pager_unpin(tree->pager, sibling_pgno, 1);
+    pager_unpin(tree->pager, pgno, 1);
+
+    int ok = insert_separator(tree, records, &plan, path, depth - 1, separator, sibling_pgno);
+    release_plan(tree, &plan);
+
+    (*records->count)++;
+    tree->meta_dirty = 1;
+    return ok;
+}
+
+// Leaves are not merged when they shrink; an emptied leaf simply stays
+// in the sibling chain until an insert lands in its key range again
+static int remove_record(BTree *tree, const Records *records, const char *service,
+                         PasswordEntry *removed) {
+    if (*records->root == 0) return 0;
+
+    uint32_t pgno = find_leaf(tree, records, service, NULL, NULL);
+    if (!pgno) return 0;
+
+    LeafNode *leaf = (LeafNode*)pager_get(tree->pager, pgno);
+    if (!leaf) return 0;
+
+    int found;
+    int slot = leaf_slot(leaf, service, &found);
+    if (!found) {
+        pager_unpin(tree->pager, pgno, 0);
+        return 0;
+    }
+
+    if (removed) *removed = leaf->entries[slot];
+    int count = leaf->header.count;
+    memmove(&leaf->entries[slot], &leaf->entries[slot + 1],
+            (size_t)(count - slot - 1) * sizeof(PasswordEntry));
+    memset(&leaf->entries[count - 1], 0, sizeof(PasswordEntry));
+    leaf->header.count--;
+    pager_unpin(tree->pager, pgno, 1);
+
+    (*records->count)--;
+    tree->meta_dirty = 1;
+    return 1;
+}
+
+static int walk_records(BTree *tree, const Records *records, BTreeVisitor visit, void *ctx) {
+    if (*records->root == 0) return 1;
+
+    // Leftmost leaf: the empty key sorts before every service
+    uint32_t pgno = find_leaf(tree, records, "", NULL, NULL);
+    if (!pgno) return 0;
+
+    while (pgno) {
+        LeafNode *leaf = (LeafNode*)pager_get(tree->pager, pgno);
+        if (!leaf || leaf->header.type != NODE_LEAF) return 0;
+
+        for (int i = 0; i < leaf->header.count; i++) {
+            if (!visit(&leaf->entries[i], ctx)) {
+                pager_unpin(tree->pager, pgno, 0);
+                return 0;
+            }
+        }
+
+        uint32_t next = leaf->header.next;
+        pager_unpin(tree->pager, pgno, 0);
+        pgno = next;
+    }
+
+    return 1;
+}
+
+static BTree* btree_alloc(void) {
+    BTree *tree = calloc(1, sizeof(BTree));
+    return tree;
+}
+
+static void btree_free(BTree *tree) {
+    if (!tree) return;
+    memset(tree->meta_key, 0, sizeof(tree->meta_key));
+    free(tree);
+}
+
+BTree* btree_create(const char *path, const char *master_password) {
+    if (!path || !master_password) return NULL;
+
+    BTree *tree = btree_alloc();
+    if (!tree) return NULL;
+
+    unsigned char page_key[KEY_SIZE];
+    memcpy(tree->header.magic, STORE_MAGIC, sizeof(tree->header.magic));
+    tree->header.version = STORE_VERSION;
+    tree->header.page_size = PAGE_SIZE;
+    tree->header.record_size = sizeof(PasswordEntry);
+
+    if (!generate_random_bytes(tree->header.salt, SALT_SIZE) ||
+        !derive_store_keys(master_password, tree->header.salt, page_key,
+                           tree->meta_key, tree->header.verifier)) {
+        btree_free(tree);
+        return NULL;
+    }
+
+    tree->pager = pager_open(path, page_key, PAGER_DEFAULT_CACHE, 1);
+    memset(page_key, 0, sizeof(page_key));
+    if (!tree->pager) {
+        btree_free(tree);
+        return NULL;
+    }
+
+    Records entries = entries_of(tree);
+    if (!create_root(tree, &entries) || !btree_flush(tree)) {
+        pager_close(tree->pager);
+        btree_free(tree);
+        return NULL;
+    }
+
+    return tree;
+}
+
+// Read the records of one tree of an old store, laid out with its record
+// size, and hand each to add
+static int copy_old_records(BTree *old, uint32_t root, uint32_t height, BTree *tree,
+                            int (*add)(BTree*, const PasswordEntry*)) {
+    size_t record_size = old->header.record_size;
+    size_t capacity = (PAGE_PAYLOAD - sizeof(NodeHeader)) / record_size;
+    uint32_t pgno = root;
+    PasswordEntry entry;
+    int ok = 1;
+
+    // Internal pages don't depend on the record size; walk to the
+    // leftmost leaf and follow the sibling chain from there
+    for (uint32_t level = 1; ok && level < height; level++) {
+        InternalNode *node = (InternalNode*)pager_get(old->pager, pgno);
+        if (!node) {
+            ok = 0;
+            break;
+        }
+        uint32_t child = node->child[0];
+        pager_unpin(old->pager, pgno, 0);
+        pgno = child;
+    }
+
+    while (ok && pgno != 0) {
+        unsigned char *page = pager_get(old->pager, pgno);
+        if (!page) {
+            ok = 0;
+            break;
+        }
+
+        NodeHeader header;
+        memcpy(&header, page, sizeof(header));
+        ok = header.type == NODE_LEAF && header.count <= capacity;
+
+        for (uint16_t i = 0; ok && i < header.count; i++) {
+            memset(&entry, 0, sizeof(entry));
+            memcpy(&entry, page + sizeof(NodeHeader) + i * record_size, record_size);
+            entry.service[MAX_SERVICE_NAME - 1] = '\0';
+            entry.username[MAX_USERNAME - 1] = '\0';
+            entry.password[MAX_PASSWORD - 1] = '\0';
+            ok = add(tree, &entry);
+        }
+
+        pager_unpin(old->pager, pgno, 0);
+        pgno = header.next;
+    }
+
+    memset(&entry, 0, sizeof(entry));
+    return ok;
+}
+
+// Stores written with a shorter PasswordEntry are rebuilt once in the
+// current layout: leaf capacity depends on the record size, so the old
+// leaves are read record by record and inserted into a fresh tree
+static BTree* upgrade_store(BTree *old, const char *path,
+                            const char *master_password) {
+    char tmp_path[600];
+    int len = snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    if (len < 0 || (size_t)len >= sizeof(tmp_path)) {
+        btree_close(old);
+        return NULL;
+    }
+
+    BTree *tree = btree_create(tmp_path, master_password);
+    if (!tree) {
+        btree_close(old);
+        return NULL;
+    }
+
+    uint32_t tomb_root = old->meta.tomb_root;
+    int ok = copy_old_records(old, old->meta.root, old->meta.height, tree, btree_insert) &&
+             (tomb_root == 0 ||
+              copy_old_records(old, tomb_root, old->meta.tomb_height, tree, btree_add_tombstone));
+    btree_set_generation(tree, old->meta.generation, old->meta.log_floor);
+
+    btree_close(old);
+
+    if (!btree_close(tree) || !ok || rename(tmp_path, path) != 0) {
+        remove(tmp_path);
+        return NULL;
+    }
+    return btree_open(path, master_password);
+}
+
+BTree* btree_open(const char *path, const char *master_password) {
+    if (!path || !master_password) return NULL;
+
+    unsigned char page[PAGE_SIZE];
+    if (!pager_read_header(path, page)) return NULL;
+
+    BTree *tree = btree_alloc();
+    if (!tree) return NULL;
+    memcpy(&tree->header, page, sizeof(StoreHeader));
+
+    if (memcmp(tree->header.magic, STORE_MAGIC, sizeof(tree->header.magic)) != 0 ||
+        tree->header.version != STORE_VERSION ||
+        tree->header.page_size != PAGE_SIZE ||
+        tree->header.record_size == 0 ||
+        tree->header.record_size > sizeof(PasswordEntry)) {
+        btree_free(tree);
+        return NULL;
+    }
+
+    unsigned char page_key[KEY_SIZE];
+    unsigned char verifier[HASH_SIZE];
+    if (!derive_store_keys(master_password, tree->header.salt, page_key,
+                           tree->meta_key, verifier) ||
+        !crypto_equal(verifier, tree->header.verifier, HASH_SIZE)) {
+        memset(page_key, 0, sizeof(page_key));
+        btree_free(tree);
+        return NULL;
+    }
+
+    const unsigned char *nonce = page + sizeof(StoreHeader);
+    const unsigned char *tag = nonce + AEAD_NONCE_SIZE;
+    const unsigned char *sealed = tag + AEAD_TAG_SIZE;
+    if (!aead_decrypt(tree->meta_key, nonce, page, sizeof(StoreHeader),
+                      sealed, sizeof(StoreMeta), tag,
+                      (unsigned char*)&tree->meta)) {
+        memset(page_key, 0, sizeof(page_key));
+        btree_free(tree);
+        return NULL;
+    }
+
+    tree->pager = pager_open(path, page_key, PAGER_DEFAULT_CACHE, 0);
+    memset(page_key, 0, sizeof(page_key));
+    if (!tree->pager || !pager_load(tree->pager, &tree->meta.pages) ||
+        tree->meta.root == 0 ||
+        tree->meta.root >= pager_page_count(tree->pager) ||
+        tree->meta.tomb_root >= pager_page_count(tree->pager)) {
+        if (tree->pager) pager_close(tree->pager);
+        btree_free(tree);
+        return NULL;
+    }
+
+    if (tree->header.record_size < sizeof(PasswordEntry)) {
+        return upgrade_store(tree, path, master_password);
+    }
+    return tree;
+}
+
+int btree_close(BTree *tree) {
+    if (!tree) return 0;
+
+    int ok = btree_flush(tree);
+    if (!pager_close(tree->pager)) ok = 0;
+    btree_free(tree);
+    return ok;
+}
+
+int btree_flush(BTree *tree) {
+    if (!tree) return 0;
+
+    // Each flush that carries edits is one generation, as a flat save is
+    if (tree->changed) {
+        tree->meta.generation++;
+        tree->changed = 0;
+        tree->meta_dirty = 1;
+    }
+
+    // Pages and their version table first, so the header never points at
+    // unwritten nodes
+    uint64_t epoch = tree->meta.pages.epoch;
+    if (!pager_commit(tree->pager, &tree->meta.pages)) return 0;
+    if (tree->meta.pages.epoch != epoch) tree->meta_dirty = 1;
+    if (tree->meta_dirty && !write_header_page(tree)) return 0;
+    return pager_flush(tree->pager);
+}
+
+int btree_get(BTree *tree, const char *service, PasswordEntry *out) {
+    if (!tree || !service) return 0;
+
+    Records entries = entries_of(tree);
+    return get_record(tree, &entries, service, out);
+}
+
+int btree_insert(BTree *tree, const PasswordEntry *entry) {
+    if (!tree || !entry) return 0;
+
+    Records entries = entries_of(tree);
+    Records tombstones = tombstones_of(tree);
+    if (!insert_record(tree, &entries, entry, 0)) return 0;
+
+    // A service that comes back is no longer deleted
+    remove_record(tree, &tombstones, entry->service, NULL);
+    tree->changed = 1;
+    return 1;
+}
+
+int btree_update(BTree *tree, const char *service,
+                 const char *new_username, const char *new_password) {
+    if (!tree || !service) return 0;
+
+    Records entries = entries_of(tree);
+    uint32_t pgno = find_leaf(tree, &entries, service, NULL, NULL);
+    if (!pgno) return 0;
+
+    LeafNode *leaf = (LeafNode*)pager_get(tree->pager, pgno);
+    if (!leaf) return 0;
+
+    int found;
+    int slot = leaf_slot(leaf, service, &found);
+    if (!found) {
+        pager_unpin(tree->pager, pgno, 0);
+        return 0;
+    }
+
+    PasswordEntry *entry = &leaf->entries[slot];
+    if (new_username) {
+        strncpy(entry->username, new_username, MAX_USERNAME - 1);
+        entry->username[MAX_USERNAME - 1] = '\0';
+    }
+    if (new_password) {
+        strncpy(entry->password, new_password, MAX_PASSWORD - 1);
+        entry->password[MAX_PASSWORD - 1] = '\0';
+    }
+    pm_touch_entry(entry, new_username != NULL, new_password != NULL);
+    entry->generation = tree->meta.generation + 1;
+
+    pager_unpin(tree->pager, pgno, 1);
+    tree->changed = 1;
+    return 1;
+}
+
+// The deleted service is remembered as a tombstone stamped with the
+// generation of the next flush; unlike a flat vault the store has room
+// for every tombstone, so none are dropped. The tombstone goes in before
+// the entry comes out, so a failure never loses the entry unrecorded
+int btree_delete(BTree *tree, const char *service) {
+    if (!tree || !service) return 0;
+
+    Records entries = entries_of(tree);
+    Records tombstones = tombstones_of(tree);
+    PasswordEntry tombstone;
+    if (!get_record(tree, &entries, service, &tombstone)) return 0;
+
+    char name[MAX_SERVICE_NAME];
+    memcpy(name, tombstone.service, MAX_SERVICE_NAME);
+    memset(&tombstone, 0, sizeof(tombstone));
+    memcpy(tombstone.service, name, MAX_SERVICE_NAME);
+    tombstone.generation = tree->meta.generation + 1;
+    if (!insert_record(tree, &tombstones, &tombstone, 1)) return 0;
+    tree->changed = 1;
+
+    if (!remove_record(tree, &entries, name, NULL)) {
+        remove_record(tree, &tombstones, name, NULL);
+        return 0;
+    }
+    return 1;
+}
+
+int btree_foreach(BTree *tree, BTreeVisitor visit, void *ctx) {
+    if (!tree || !visit) return 0;
+
+    Records entries = entries_of(tree);
+    return walk_records(tree, &entries, visit, ctx);
+}
+
+int btree_add_tombstone(BTree *tree, const PasswordEntry *tombstone) {
+    if (!tree || !tombstone) return 0;
+
+    Records tombstones = tombstones_of(tree);
+    PasswordEntry record;
+    memset(&record, 0, sizeof(record));
+    memcpy(record.service, tombstone->service, MAX_SERVICE_NAME);
+    record.service[MAX_SERVICE_NAME - 1] = '\0';
+    record.generation = tombstone->generation;
+    return insert_record(tree, &tombstones, &record, 1);
+}
+
+int btree_foreach_tombstone(BTree *tree, BTreeVisitor visit, void *ctx) {
+    if (!tree || !visit) return 0;
+
+    Records tombstones = tombstones_of(tree);
+    return walk_records(tree, &tombstones, visit, ctx);
+}
+
+size_t btree_tombstone_count(const BTree *tree) {
+    return tree ? (size_t)tree->meta.tomb_count : 0;
+}
+
+uint64_t btree_generation(const BTree *tree) {
+    return tree ? tree->meta.generation : 0;
+}
+
+uint64_t btree_log_floor(const BTree *tree) {
+    return tree ? tree->meta.log_floor : 0;
+}
+
+void btree_set_generation(BTree *tree, uint64_t generation, uint64_t log_floor) {
+    if (!tree) return;
+
+    tree->meta.generation = generation;
+    tree->meta.log_floor = log_floor;
+    tree->changed = 0;
+    tree->meta_dirty = 1;
+}
+
+size_t btree_count(const BTree *tree) {
+    return tree ? (size_t)tree->meta.entry_count : 0;
+}
+
+int btree_rekey(BTree *tree, const char *new_password) {
+    if (!tree || !new_password) return 0;
+
+    StoreHeader header = tree->header;
+    unsigned char page_key[KEY_SIZE];
+    unsigned char meta_key[KEY_SIZE];
+    unsigned char page[PAGE_SIZE];
+
+    // The pager writes the re-encrypted file beside the store and renames
+    // it into place, so the header page sealed under the new key goes
+    // with it and a crash leaves either store whole
+    int ok = btree_flush(tree) &&
+             generate_random_bytes(header.salt, SALT_SIZE) &&
+             derive_store_keys(new_password, header.salt, page_key, meta_key,
+                               header.verifier) &&
+             seal_header_page(&header, &tree->meta, meta_key, page) &&
+             pager_rekey(tree->pager, page_key, page);
+
+    if (ok) {
+        tree->header = header;
+        memcpy(tree->meta_key, meta_key, KEY_SIZE);
+    }
+    memset(page_key, 0, sizeof(page_key));
+    memset(meta_key, 0, sizeof(meta_key));
+    return ok;
+}
@@ -0,0 +1,92 @@
+#ifndef BTREE_H
+#define BTREE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "password.h"
+
+/**
+ * Paged vault storage: a B+tree of PasswordEntry records
+ *
+ * Entries are kept in leaf pages ordered by case-folded service name and
+ * reached through internal pages of separator keys, all stored in an
+ * encrypted page file (see pager.h). Lookups and edits touch one page
+ * per tree level, so only a small working set is ever decrypted no
+ * matter how large the vault grows.
+ *
+ * Deleted services are kept as tombstones in a second tree of the same
+ * file, and every flush that carries edits advances the store's
+ * generation, so sync and change logs see a store the way they see a
+ * flat vault.
+ */
+
+#define STORE_MAGIC "CIPHERDB"
+#define STORE_VERSION 3
+
+typedef struct BTree BTree;
+
+// Callback for btree_foreach; return 0 to stop the walk
+typedef int (*BTreeVisitor)(const PasswordEntry *entry, void *ctx);
+
+// Create a new, empty store at path (overwrites existing file)
+BTree* btree_create(const char *path, const char *master_password);
+
+// Open an existing store
+// Returns: NULL if the password is wrong or the file is damaged
+BTree* btree_open(const char *path, const char *master_password);
+
+// Flush everything and close
+// Returns: 1 if all pages were written, 0 otherwise
+int btree_close(BTree *tree);
+
+// Write all modified pages and the header to disk
+int btree_flush(BTree *tree);
+
+// Look up an entry (case-insensitive); copies it into out
+// Returns: 1 if found, 0 if not
+int btree_get(BTree *tree, const char *service, PasswordEntry *out);
+
+// Insert a new entry
+// Returns: 1 on success, 0 if the service exists or on I/O failure
+int btree_insert(BTree *tree, const PasswordEntry *entry);
+
+// Update username and/or password of an existing entry (NULL = keep);
+// the entry is stamped with the generation of the next flush
+int btree_update(BTree *tree, const char *service,
+                 const char *new_username, const char *new_password);
+
+// Remove an entry, leaving a tombstone for its service
+int btree_delete(BTree *tree, const char *service);
+
+// Visit every entry in service order
+// Returns: 1 if the walk completed, 0 on I/O failure or early stop
+int btree_foreach(BTree *tree, BTreeVisitor visit, void *ctx);
+
+// Number of entries in the store
+size_t btree_count(const BTree *tree);
+
+// Re-encrypt the store under a new master password
+// The new file replaces the old one only once it is complete
+int btree_rekey(BTree *tree, const char *new_password);
+
+// Record a deleted service (service and generation are used), replacing
+// any tombstone it already has
+int btree_add_tombstone(BTree *tree, const PasswordEntry *tombstone);
+
+// Visit every tombstone in service order
+int btree_foreach_tombstone(BTree *tree, BTreeVisitor visit, void *ctx);
+
+// Number of tombstones in the store
+size_t btree_tombstone_count(const BTree *tree);
+
+// Generation of the last flush that carried edits
+uint64_t btree_generation(const BTree *tree);
+
+// Oldest generation a change log against this store may start from
+uint64_t btree_log_floor(const BTree *tree);
+
+// Set the generation and log floor, e.g. when a flat vault is converted;
+// edits made so far no longer count as a new generation
+void btree_set_generation(BTree *tree, uint64_t generation, uint64_t log_floor);
+
+#endif // BTREE_H
@@ -0,0 +1,478 @@
+#include "changelog.h"
+#include "btree.h"
+#include "crypto.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#define OP_PUT 1
+#define OP_DELETE 2
+
+// Longest encoding of one change: op, three length-prefixed strings,
+// three stamps and the generation
+#define MAX_CHANGE_SIZE (1 + 3 + MAX_SERVICE_NAME + MAX_USERNAME + MAX_PASSWORD + 4 * 8)
+
+// Largest body a log may announce; the header is only authenticated once
+// the body has been read, so its length is bounded before anything is
+// allocated from it
+#define MAX_LOG_BODY ((uint64_t)512 << 20)
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t change_count;
+    uint64_t from_generation;   // Log holds changes after this generation...
+    uint64_t to_generation;     // ...up to and including this one
+    uint64_t body_len;
+    unsigned char salt[SALT_SIZE];
+    unsigned char nonce[AEAD_NONCE_SIZE];
+    unsigned char tag[AEAD_TAG_SIZE];
+} LogHeader;
+
+// Everything before the tag is authenticated with the body
+#define LOG_AAD_SIZE offsetof(LogHeader, tag)
+
+typedef struct {
+    unsigned char *data;
+    size_t len;
+    size_t capacity;
+} LogBuffer;
+
+typedef struct {
+    const unsigned char *data;
+    size_t len;
+    size_t pos;
+} LogReader;
+
+static int derive_log_key(const char *master_password, const unsigned char *salt,
+                          unsigned char *key) {
+    unsigned char vault_key[KEY_SIZE];
+    int ok = derive_key(master_password, salt, vault_key, KEY_SIZE) &&
+             derive_subkey(vault_key, "cipher-log", key);
+    memset(vault_key, 0, sizeof(vault_key));
+    return ok;
+}
+
+static int buffer_reserve(LogBuffer *buffer, size_t extra) {
+    if (buffer->len + extra <= buffer->capacity) return 1;
+
+    size_t capacity = buffer->capacity ? buffer->capacity : 4096;
+    while (capacity < buffer->len + extra) capacity *= 2;
+
+    // Grow by hand so the old copy can be wiped
+    unsigned char *data = malloc(capacity);
+    if (!data) return 0;
+    if (buffer->data) {
+        memcpy(data, buffer->data, buffer->len);
+        memset(buffer->data, 0, buffer->capacity);
+        free(buffer->data);
+    }
+
+    buffer->data = data;
+    buffer->capacity = capacity;
+    return 1;
+}
+
+static void put_u64(LogBuffer *buffer, uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+        buffer->data[buffer->len++] = (unsigned char)(value >> (8 * i));
+    }
+}
+
+static void put_string(LogBuffer *buffer, const char *value, size_t size) {
+    size_t len = 0;
+    while (len < size - 1 && value[len]) len++;
+    buffer->data[buffer->len++] = (unsigned char)len;
+    memcpy(buffer->data + buffer->len, value, len);
+    buffer->len += len;
+}
+
+static int encode_put(LogBuffer *buffer, const PasswordEntry *entry) {
+    if (!buffer_reserve(buffer, MAX_CHANGE_SIZE)) return 0;
+
+    buffer->data[buffer->len++] = OP_PUT;
+    put_string(buffer, entry->service, MAX_SERVICE_NAME);
+    put_string(buffer, entry->username, MAX_USERNAME);
+    put_string(buffer, entry->password, MAX_PASSWORD);
+    put_u64(buffer, (uint64_t)entry->created);
+    put_u64(buffer, (uint64_t)entry->username_modified);
+    put_u64(buffer, (uint64_t)entry->password_modified);
+    put_u64(buffer, entry->generation);
+    return 1;
+}
+
+static int encode_delete(LogBuffer *buffer, const PasswordEntry *tombstone) {
+    if (!buffer_reserve(buffer, MAX_CHANGE_SIZE)) return 0;
+
+    buffer->data[buffer->len++] = OP_DELETE;
+    put_string(buffer, tombstone->service, MAX_SERVICE_NAME);
+    put_u64(buffer, tombstone->generation);
+    return 1;
+}
+
+static int get_u64(LogReader *reader, uint64_t *value) {
+    if (reader->len - reader->pos < 8) return 0;
+
+    *value = 0;
+    for (int i = 0; i < 8; i++) {
+        *value |= (uint64_t)reader->data[reader->pos++] << (8 * i);
+    }
+    return 1;
+}
+
+static int get_string(LogReader *reader, char *out, size_t size) {
+    if (reader->pos >= reader->len) return 0;
+
+    size_t len = reader->data[reader->pos++];
+    if (len >= size || reader->len - reader->pos < len) return 0;
+
+    memcpy(out, reader->data + reader->pos, len);
+    out[len] = '\0';
+    reader->pos += len;
+    return 1;
+}
+
+// Read one change into entry; *op receives OP_PUT or OP_DELETE
+static int decode_change(LogReader *reader, int *op, PasswordEntry *entry) {
+    if (reader->pos >= reader->len) return 0;
+
+    memset(entry, 0, sizeof(PasswordEntry));
+    *op = reader->data[reader->pos++];
+
+    if (*op == OP_DELETE) {
+        return get_string(reader, entry->service, MAX_SERVICE_NAME) &&
+               get_u64(reader, &entry->generation);
+    }
+    if (*op != OP_PUT) return 0;
+
+    uint64_t created, username_modified, password_modified;
+    if (!get_string(reader, entry->service, MAX_SERVICE_NAME) ||
+        !get_string(reader, entry->username, MAX_USERNAME) ||
+        !get_string(reader, entry->password, MAX_PASSWORD) ||
+        !get_u64(reader, &created) ||
+        !get_u64(reader, &username_modified) ||
+        !get_u64(reader, &password_modified) ||
+        !get_u64(reader, &entry->generation)) {
+        return 0;
+    }
+
+    entry->created = (int64_t)created;
+    entry->username_modified = (int64_t)username_modified;
+    entry->password_modified = (int64_t)password_modified;
+    return entry->service[0] != '\0';
+}
+
+// Collects the records of a paged store changed after since
+typedef struct {
+    LogBuffer *body;
+    uint64_t since;
+    size_t count;
+    int (*encode)(LogBuffer*, const PasswordEntry*);
+} StoreExport;
+
+static int export_record(const PasswordEntry *record, void *ctx) {
+    StoreExport *export = ctx;
+    if (record->generation <= export->since) return 1;
+
+    export->count++;
+    return export->encode(export->body, record);
+}
+
+static void buffer_free(LogBuffer *buffer) {
+    if (buffer->data) {
+        memset(buffer->data, 0, buffer->capacity);
+        free(buffer->data);
+    }
+}
+
+long changelog_export(const PasswordManager *pm, uint64_t since,
+                      const char *master_password, const char *path) {
+    if (!pm || !master_password || !path) return -1;
+    if (since < pm->log_floor) return -2;
+
+    LogBuffer body = {0};
+    size_t count = 0;
+    int ok = 1;
+
+    if (pm->store) {
+        StoreExport export = {&body, since, 0, encode_put};
+        ok = btree_foreach(pm->store, export_record, &export);
+        export.encode = encode_delete;
+        ok = ok && btree_foreach_tombstone(pm->store, export_record, &export);
+        count = export.count;
+    }
+
+    for (size_t i = 0; ok && i < pm->count; i++) {
+        if (pm->entries[i].generation <= since) continue;
+        ok = encode_put(&body, &pm->entries[i]);
+        count++;
+    }
+    for (size_t i = 0; ok && i < pm->tombstone_count; i++) {
+        if (pm->tombstones[i].generation <= since) continue;
+        ok = encode_delete(&body, &pm->tombstones[i]);
+        count++;
+    }
+    if (!ok || count > UINT32_MAX) {
+        buffer_free(&body);
+        return -1;
+    }
+
+    LogHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CHANGELOG_MAGIC, sizeof(header.magic));
+    header.version = CHANGELOG_VERSION;
+    header.change_count = (uint32_t)count;
+    header.from_generation = since;
+    header.to_generation = pm->generation > since ? pm->generation : since;
+    header.body_len = body.len;
+
+    unsigned char key[KEY_SIZE];
+    unsigned char *sealed = malloc(body.len + 1);
+    ok = sealed &&
+         generate_random_bytes(header.salt, SALT_SIZE) &&
+         generate_random_bytes(header.nonce, AEAD_NONCE_SIZE) &&
+         derive_log_key(master_password, header.salt, key) &&
+         aead_encrypt(key, header.nonce, (const unsigned char*)&header, LOG_AAD_SIZE,
+                      body.data, body.len, sealed, header.tag);
+    memset(key, 0, sizeof(key));
+    buffer_free(&body);
+
+    FILE *file = ok ? fopen(path, "wb") : NULL;
+    if (file) {
+        ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+             fwrite(sealed, 1, (size_t)header.body_len, file) == header.body_len;
+        ok = fclose(file) == 0 && ok;
+        if (!ok) remove(path);
+    } else {
+        ok = 0;
+    }
+
+    free(sealed);
+    return ok ? (long)count : -1;
+}
+
+static const PasswordEntry* find_tombstone(const PasswordManager *pm,
+                                           const char *service) {
+    for (size_t i = 0; i < pm->tombstone_count; i++) {
+        if (strcasecmp(pm->tombstones[i].service, service) == 0) return &pm->tombstones[i];
+    }
+    return NULL;
+}
+
+static int same_record(const PasswordEntry *a, const PasswordEntry *b) {
+    return strcmp(a->username, b->username) == 0 &&
+           strcmp(a->password, b->password) == 0 &&
+           a->username_modified == b->username_modified &&
+           a->password_modified == b->password_modified;
+}
+
+// Settle one field both sides changed: the newer stamp wins, a tie keeps
+// the replica's. Returns: 1 if the log's value was taken, 0 if not;
+// *lost is set when the log's differing value loses.
+static int merge_field(char *out, int64_t *out_stamp, size_t size,
+                       const char *value, int64_t stamp, int *lost) {
+    if (strcmp(out, value) == 0) {
+        if (stamp > *out_stamp) *out_stamp = stamp;
+        return 0;
+    }
+    if (stamp <= *out_stamp) {
+        *lost = 1;
+        return 0;
+    }
+    memcpy(out, value, size);
+    *out_stamp = stamp;
+    return 1;
+}
+
+// Apply one change. A service the replica has not touched since base
+// takes the log's record as it is. One changed on both sides is settled
+// as sync settles it: the newer modification stamp wins each field, and
+// an edit wins over a deletion; a change that loses counts as a conflict.
+// What the replica takes is stamped with generation, or keeps the log's
+// generation when that is 0.
+// Returns: 1 if the replica changed, 0 if it kept its own, -1 on failure
+static int apply_change(PasswordManager *pm, int op, const PasswordEntry *record,
+                        uint64_t base, uint64_t generation, size_t *conflicts) {
+    PasswordEntry *local = pm_find_entry(pm, record->service);
+    const PasswordEntry *tombstone = local ? NULL : find_tombstone(pm, record->service);
+    int changed_here = (local && local->generation > base) ||
+                       (tombstone && tombstone->generation > base);
+    uint64_t stamp = generation ? generation : record->generation;
+
+    if (op == OP_DELETE) {
+        if (!local && tombstone) return 0;
+        if (changed_here) {
+            (*conflicts)++;
+            return 0;
+        }
+        pm_delete_entry(pm, record->service);
+        return pm_add_tombstone(pm, record->service, stamp) ? 1 : -1;
+    }
+
+    if (local && same_record(local, record)) return 0;
+
+    PasswordEntry merged = *record;
+    if (changed_here && !local) (*conflicts)++;
+    if (changed_here && local) {
+        int lost = 0;
+        merged = *local;
+        int taken = merge_field(merged.username, &merged.username_modified, MAX_USERNAME,
+                                record->username, record->username_modified, &lost);
+        taken |= merge_field(merged.password, &merged.password_modified, MAX_PASSWORD,
+                             record->password, record->password_modified, &lost);
+        if (record->created != 0 && (local->created == 0 || record->created < local->created)) {
+            merged.created = record->created;
+        }
+        if (lost) (*conflicts)++;
+        if (!taken) {
+            memset(&merged, 0, sizeof(merged));
+            return 0;
+        }
+    }
+
+    merged.generation = stamp;
+    int ok = pm_put_entry(pm, &merged);
+    memset(&merged, 0, sizeof(merged));
+    return ok ? 1 : -1;
+}
+
+// Copy of pm's entries, tombstones and generations for a log to be
+// applied to, so a log that fails halfway leaves pm as it was
+static PasswordManager* stage_copy(const PasswordManager *pm) {
+    PasswordManager *stage = pm_init();
+    if (!stage) return NULL;
+
+    if ((pm->count > 0 && !pm_reserve(stage, pm->count)) ||
+        (pm->tombstone_count > 0 && !pm_reserve_tombstones(stage, pm->tombstone_count))) {
+        pm_free(stage);
+        return NULL;
+    }
+    if (pm->count > 0) {
+        memcpy(stage->entries, pm->entries, pm->count * sizeof(PasswordEntry));
+    }
+    if (pm->tombstone_count > 0) {
+        memcpy(stage->tombstones, pm->tombstones,
+               pm->tombstone_count * sizeof(PasswordEntry));
+    }
+    stage->count = pm->count;
+    stage->tombstone_count = pm->tombstone_count;
+    stage->shard_count = pm->shard_count;
+    stage->dirty_shards = pm->dirty_shards;
+    stage->generation = pm->generation;
+    stage->log_floor = pm->log_floor;
+    stage->codec = pm->codec;
+    return stage;
+}
+
+// Make the staged state pm's own and free what pm held before
+static void commit_stage(PasswordManager *pm, PasswordManager *stage) {
+    PasswordManager previous = *pm;
+    *pm = *stage;
+    *stage = previous;
+    pm_free(stage);
+}
+
+// Bytes left in file after the current position, or -1
+static long remaining_bytes(FILE *file) {
+    long start = ftell(file);
+    if (start < 0 || fseek(file, 0, SEEK_END) != 0) return -1;
+
+    long end = ftell(file);
+    if (end < start || fseek(file, start, SEEK_SET) != 0) return -1;
+    return end - start;
+}
+
+long changelog_apply(PasswordManager *pm, const char *master_password,
+                     const char *path, size_t *conflicts) {
+    if (!pm || !master_password || !path || !conflicts || pm->store) return -1;
+    *conflicts = 0;
+
+    FILE *file = fopen(path, "rb");
+    if (!file) return -1;
+
+    LogHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, CHANGELOG_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != CHANGELOG_VERSION ||
+        header.from_generation > header.to_generation ||
+        header.body_len > (uint64_t)header.change_count * MAX_CHANGE_SIZE ||
+        header.body_len > MAX_LOG_BODY) {
+        fclose(file);
+        return -1;
+    }
+
+    // A body longer than the file is damaged; don't allocate for it
+    long available = remaining_bytes(file);
+    if (available < 0 || header.body_len > (uint64_t)available) {
+        fclose(file);
+        return -1;
+    }
+
+    size_t len = (size_t)header.body_len;
+    unsigned char *sealed = malloc(len + 1);
+    unsigned char *body = malloc(len + 1);
+    unsigned char key[KEY_SIZE];
+    int ok = sealed && body &&
+             fread(sealed, 1, len, file) == len &&
+             derive_log_key(master_password, header.salt, key) &&
+             aead_decrypt(key, header.nonce, (const unsigned char*)&header, LOG_AAD_SIZE,
+                          sealed, len, header.tag, body);
+    memset(key, 0, sizeof(key));
+    fclose(file);
+    free(sealed);
+
+    long result = -1;
+    PasswordManager *stage = NULL;
+    if (ok && header.from_generation > pm->generation) {
+        result = -2;
+    } else if (ok && (stage = stage_copy(pm)) != NULL) {
+        // A replica still at the log's base lands on the log's last
+        // generation and keeps the log's stamps. One that has moved on
+        // (its own saves, or an earlier log) merges, and what it takes is
+        // its own next change so logs exported from it carry it on.
+        uint64_t base = header.from_generation;
+        uint64_t last = header.to_generation > base ? header.to_generation - 1 : base;
+        uint64_t generation = 0;
+        if (last < pm->generation) last = pm->generation;
+        if (pm->generation > base) generation = last + 1;
+        stage->generation = last;
+
+        LogReader reader = {body, len, 0};
+        PasswordEntry entry;
+        int op;
+        size_t lost = 0;
+        result = 0;
+
+        for (uint32_t i = 0; i < header.change_count; i++) {
+            if (!decode_change(&reader, &op, &entry)) {
+                result = -1;
+                break;
+            }
+
+            int applied = apply_change(stage, op, &entry, base, generation, &lost);
+            if (applied < 0) {
+                result = -1;
+                break;
+            }
+            result += applied;
+        }
+        if (result >= 0 && reader.pos != reader.len) result = -1;
+        memset(&entry, 0, sizeof(entry));
+
+        // Entries and generation change together, and only for a whole log
+        if (result >= 0) {
+            commit_stage(pm, stage);
+            *conflicts = lost;
+        } else {
+            pm_free(stage);
+        }
+    }
+
+    if (body) {
+        memset(body, 0, len);
+        free(body);
+    }
+    return result;
+}
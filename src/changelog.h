@@ -0,0 +1,48 @@
+#ifndef CHANGELOG_H
+#define CHANGELOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "password.h"
+
+/**
+ * Incremental change logs between vault replicas
+ *
+ * Every save of a vault gets the next generation number, and every entry
+ * (and every deletion, kept as a tombstone) records the generation that
+ * last changed it. A change log holds what changed after one generation:
+ * the full records of entries changed since then and the services deleted
+ * since then, so a replica that is at that generation catches up without
+ * the whole vault being copied.
+ *
+ * A log is one AES-256-GCM sealed body behind a small header. The key is
+ * derived from the master password and a fresh salt, so logs can travel
+ * over untrusted channels; the header (generation range, counts) is
+ * authenticated along with the body.
+ */
+
+#define CHANGELOG_MAGIC "CIPHERLG"
+#define CHANGELOG_VERSION 1
+
+// Write every change made after generation since, up to pm's generation,
+// to path
+// Returns: number of changes written, -1 on failure,
+//          -2 if since is older than the vault still remembers (log_floor)
+long changelog_export(const PasswordManager *pm, uint64_t since,
+                      const char *master_password, const char *path);
+
+// Apply a change log to a replica. On success pm is left one save short
+// of the log's last generation (or of its own next one, if it is already
+// past that): saving it lands the replica there. On failure pm is left
+// as it was; a log is applied whole or not at all.
+// A service the replica also changed after the log's first generation is
+// merged as sync_merge would merge it: the newer modification stamp wins
+// each field and an edit wins over a deletion. Changes that lose, on
+// either side, are counted in *conflicts.
+// Returns: number of changes applied, 0 if the replica already has them,
+//          -1 on a wrong password or damaged log,
+//          -2 if the log starts after the replica's generation (a gap)
+long changelog_apply(PasswordManager *pm, const char *master_password,
+                     const char *path, size_t *conflicts);
+
+#endif // CHANGELOG_H
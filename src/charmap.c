@@ -0,0 +1,255 @@
+#include "charmap.h"
+#include <stdint.h>
+#include <string.h>
+
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <pthread.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #define CHARMAP_X86
+    #include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+    #define CHARMAP_NEON
+    #include <arm_neon.h>
+#endif
+
+typedef size_t (*MapKernel)(const CharMap*, const unsigned char*, size_t, char*);
+
+// For each 8-bit acceptance mask: the positions of its set bits, in order,
+// as shuffle indices that move the accepted bytes of a group of 8 to the
+// front, and how many there are
+static unsigned char compress[256][8];
+static unsigned char accepted_count[256];
+
+static MapKernel kernel;
+static const char *kernel_name;
+
+#ifdef _WIN32
+static INIT_ONCE init_once = INIT_ONCE_STATIC_INIT;
+#else
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+#endif
+
+int charmap_init(CharMap *map, const char *chars, size_t len) {
+    if (!map || !chars || len == 0 || len > CHARMAP_MAX) return 0;
+
+    map->len = (unsigned)len;
+    map->limit = 256 - 256 % (unsigned)len;
+    // Exact for every byte when len >= 2: the rounding error stays below 1/len
+    map->reciprocal = 65536 / (unsigned)len + 1;
+    memset(map->chars, 0, sizeof(map->chars));
+    memcpy(map->chars, chars, len);
+    memset(map->table, 0, sizeof(map->table));
+    for (unsigned byte = 0; byte < map->limit; byte++) {
+        map->table[byte] = (unsigned char)chars[byte % len];
+    }
+    return 1;
+}
+
+size_t charmap_map_scalar(const CharMap *map, const unsigned char *in, size_t len, char *out) {
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char byte = in[i];
+        out[n] = (char)map->table[byte];
+        n += byte < map->limit;
+    }
+    return n;
+}
+
+#ifdef CHARMAP_X86
+// The x86 kernels widen each byte to 16 bits to take byte % len with a
+// multiply, then look chars[] up 16 entries per row: r ^ (h << 4) is below
+// 16 only in row h, and adding 0x70 with saturation sets the top bit
+// everywhere else, which makes pshufb return 0 for those lanes. OR-ing the
+// rows gives chars[r] in every lane.
+
+// Write the accepted bytes of 16 mapped characters to out + n. Each store
+// is 8 bytes wide but only the accepted ones are kept: n advances past
+// them, and never beyond the input consumed so far.
+__attribute__((target("sse4.1")))
+static inline size_t compact16(__m128i chars, unsigned mask, char *out, size_t n) {
+    unsigned low = mask & 0xff;
+    unsigned high = (mask >> 8) & 0xff;
+
+    __m128i moved = _mm_shuffle_epi8(chars, _mm_loadl_epi64((const __m128i*)compress[low]));
+    _mm_storel_epi64((__m128i*)(out + n), moved);
+    n += accepted_count[low];
+
+    moved = _mm_shuffle_epi8(_mm_srli_si128(chars, 8),
+                             _mm_loadl_epi64((const __m128i*)compress[high]));
+    _mm_storel_epi64((__m128i*)(out + n), moved);
+    return n + accepted_count[high];
+}
+
+__attribute__((target("sse4.1")))
+static size_t map_sse41(const CharMap *map, const unsigned char *in, size_t len, char *out) {
+    unsigned rows = (map->len + 15) / 16;
+    __m128i table[16];
+    for (unsigned h = 0; h < rows; h++) {
+        table[h] = _mm_loadu_si128((const __m128i*)(map->chars + 16 * h));
+    }
+    const __m128i last = _mm_set1_epi8((char)(map->limit - 1));
+    const __m128i outside = _mm_set1_epi8(0x70);
+    const __m128i reciprocal = _mm_set1_epi16((short)map->reciprocal);
+    const __m128i divisor = _mm_set1_epi16((short)map->len);
+    const __m128i zero = _mm_setzero_si128();
+
+    size_t n = 0;
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i*)(in + i));
+        __m128i accepted = _mm_cmpeq_epi8(_mm_min_epu8(bytes, last), bytes);
+
+        __m128i low = _mm_unpacklo_epi8(bytes, zero);
+        __m128i high = _mm_unpackhi_epi8(bytes, zero);
+        low = _mm_sub_epi16(low, _mm_mullo_epi16(_mm_mulhi_epu16(low, reciprocal), divisor));
+        high = _mm_sub_epi16(high, _mm_mullo_epi16(_mm_mulhi_epu16(high, reciprocal), divisor));
+        __m128i residue = _mm_packus_epi16(low, high);
+
+        __m128i chars = _mm_setzero_si128();
+        for (unsigned h = 0; h < rows; h++) {
+            __m128i index = _mm_xor_si128(residue, _mm_set1_epi8((char)(h << 4)));
+            index = _mm_adds_epu8(index, outside);
+            chars = _mm_or_si128(chars, _mm_shuffle_epi8(table[h], index));
+        }
+
+        n = compact16(chars, (unsigned)_mm_movemask_epi8(accepted), out, n);
+    }
+    return n + charmap_map_scalar(map, in + i, len - i, out + n);
+}
+
+__attribute__((target("avx2")))
+static size_t map_avx2(const CharMap *map, const unsigned char *in, size_t len, char *out) {
+    unsigned rows = (map->len + 15) / 16;
+    __m256i table[16];
+    for (unsigned h = 0; h < rows; h++) {
+        __m128i row = _mm_loadu_si128((const __m128i*)(map->chars + 16 * h));
+        table[h] = _mm256_broadcastsi128_si256(row);
+    }
+    const __m256i last = _mm256_set1_epi8((char)(map->limit - 1));
+    const __m256i outside = _mm256_set1_epi8(0x70);
+    const __m256i reciprocal = _mm256_set1_epi16((short)map->reciprocal);
+    const __m256i divisor = _mm256_set1_epi16((short)map->len);
+    const __m256i zero = _mm256_setzero_si256();
+
+    size_t n = 0;
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i bytes = _mm256_loadu_si256((const __m256i*)(in + i));
+        __m256i accepted = _mm256_cmpeq_epi8(_mm256_min_epu8(bytes, last), bytes);
+
+        // Unpack and pack both work within 128-bit lanes, so byte order holds
+        __m256i low = _mm256_unpacklo_epi8(bytes, zero);
+        __m256i high = _mm256_unpackhi_epi8(bytes, zero);
+        low = _mm256_sub_epi16(low, _mm256_mullo_epi16(_mm256_mulhi_epu16(low, reciprocal), divisor));
+        high = _mm256_sub_epi16(high, _mm256_mullo_epi16(_mm256_mulhi_epu16(high, reciprocal), divisor));
+        __m256i residue = _mm256_packus_epi16(low, high);
+
+        __m256i chars = _mm256_setzero_si256();
+        for (unsigned h = 0; h < rows; h++) {
+            __m256i index = _mm256_xor_si256(residue, _mm256_set1_epi8((char)(h << 4)));
+            index = _mm256_adds_epu8(index, outside);
+            chars = _mm256_or_si256(chars, _mm256_shuffle_epi8(table[h], index));
+        }
+
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(accepted);
+        n = compact16(_mm256_castsi256_si128(chars), mask & 0xffff, out, n);
+        n = compact16(_mm256_extracti128_si256(chars, 1), mask >> 16, out, n);
+    }
+    return n + charmap_map_scalar(map, in + i, len - i, out + n);
+}
+#endif
+
+#ifdef CHARMAP_NEON
+// tbl over four registers covers 64 table entries and returns 0 for any
+// index past them, so four lookups at byte - 64 * q, OR-ed, give table[byte]
+static size_t map_neon(const CharMap *map, const unsigned char *in, size_t len, char *out) {
+    uint8x16x4_t table[4];
+    for (int q = 0; q < 4; q++) {
+        for (int r = 0; r < 4; r++) {
+            table[q].val[r] = vld1q_u8(map->table + 64 * q + 16 * r);
+        }
+    }
+    const uint8x16_t last = vdupq_n_u8((uint8_t)(map->limit - 1));
+    const uint8x8_t bits = {1, 2, 4, 8, 16, 32, 64, 128};
+
+    size_t n = 0;
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        uint8x16_t bytes = vld1q_u8(in + i);
+        uint8x16_t accepted = vcleq_u8(bytes, last);
+
+        uint8x16_t chars = vqtbl4q_u8(table[0], bytes);
+        chars = vorrq_u8(chars, vqtbl4q_u8(table[1], vsubq_u8(bytes, vdupq_n_u8(64))));
+        chars = vorrq_u8(chars, vqtbl4q_u8(table[2], vsubq_u8(bytes, vdupq_n_u8(128))));
+        chars = vorrq_u8(chars, vqtbl4q_u8(table[3], vsubq_u8(bytes, vdupq_n_u8(192))));
+
+        unsigned low = vaddv_u8(vand_u8(vget_low_u8(accepted), bits));
+        unsigned high = vaddv_u8(vand_u8(vget_high_u8(accepted), bits));
+
+        vst1_u8((uint8_t*)out + n, vtbl1_u8(vget_low_u8(chars), vld1_u8(compress[low])));
+        n += accepted_count[low];
+        vst1_u8((uint8_t*)out + n, vtbl1_u8(vget_high_u8(chars), vld1_u8(compress[high])));
+        n += accepted_count[high];
+    }
+    return n + charmap_map_scalar(map, in + i, len - i, out + n);
+}
+#endif
+
+static void select_kernel(void) {
+    for (unsigned mask = 0; mask < 256; mask++) {
+        unsigned count = 0;
+        for (unsigned bit = 0; bit < 8; bit++) {
+            if (mask & (1u << bit)) compress[mask][count++] = (unsigned char)bit;
+        }
+        accepted_count[mask] = (unsigned char)count;
+    }
+
+    kernel = charmap_map_scalar;
+    kernel_name = "scalar";
+#if defined(CHARMAP_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        kernel = map_avx2;
+        kernel_name = "avx2";
+    } else if (__builtin_cpu_supports("sse4.1")) {
+        kernel = map_sse41;
+        kernel_name = "sse4.1";
+    }
+#elif defined(CHARMAP_NEON)
+    kernel = map_neon;
+    kernel_name = "neon";
+#endif
+}
+
+#ifdef _WIN32
+static BOOL CALLBACK select_kernel_once(PINIT_ONCE once, PVOID param, PVOID *context) {
+    (void)once;
+    (void)param;
+    (void)context;
+    select_kernel();
+    return TRUE;
+}
+#endif
+
+static void ensure_kernel(void) {
+#ifdef _WIN32
+    InitOnceExecuteOnce(&init_once, select_kernel_once, NULL, NULL);
+#else
+    pthread_once(&init_once, select_kernel);
+#endif
+}
+
+size_t charmap_map(const CharMap *map, const unsigned char *in, size_t len, char *out) {
+    ensure_kernel();
+    if (map->len < 2) return charmap_map_scalar(map, in, len, out);
+    return kernel(map, in, len, out);
+}
+
+const char* charmap_kernel_name(void) {
+    ensure_kernel();
+    return kernel_name;
+}
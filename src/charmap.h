@@ -0,0 +1,43 @@
+#ifndef CHARMAP_H
+#define CHARMAP_H
+
+#include <stddef.h>
+
+/**
+ * Random bytes to charset characters, without modulo bias
+ *
+ * A byte below the largest multiple of the charset length that fits in a
+ * byte maps to chars[byte % len]; any other byte is dropped, so every
+ * character is equally likely. The vector kernels (AVX2, SSE4.1 or NEON,
+ * chosen at run time) take the remainder with a multiply, look the
+ * character up with byte shuffles 16 or 32 bytes at a time, and squeeze
+ * rejected bytes out in-register. Every kernel produces exactly the output
+ * of charmap_map_scalar() for the same input.
+ */
+
+#define CHARMAP_MAX 256
+
+typedef struct {
+    unsigned char table[256];   // table[byte] for accepted bytes, 0 otherwise
+    unsigned char chars[CHARMAP_MAX];
+    unsigned len;
+    unsigned limit;             // Bytes below this are accepted
+    unsigned reciprocal;        // byte / len == (byte * reciprocal) >> 16
+} CharMap;
+
+// Build the map for len characters (1 to CHARMAP_MAX)
+// Returns: 1 on success, 0 on an empty or oversized charset
+int charmap_init(CharMap *map, const char *chars, size_t len);
+
+// Map len random bytes, writing one character per accepted byte to out,
+// which needs room for len characters. in and out may be the same buffer.
+// Returns: number of characters written
+size_t charmap_map(const CharMap *map, const unsigned char *in, size_t len, char *out);
+
+// Reference one-byte-at-a-time implementation of charmap_map()
+size_t charmap_map_scalar(const CharMap *map, const unsigned char *in, size_t len, char *out);
+
+// Name of the kernel charmap_map() uses on this CPU
+const char* charmap_kernel_name(void);
+
+#endif // CHARMAP_H
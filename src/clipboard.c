@@ -1,4 +1,15 @@
+#if defined(__linux__)
+    #define _GNU_SOURCE             // struct ucred, for SO_PEERCRED
+#elif defined(__APPLE__)
+    #define _DARWIN_C_SOURCE        // getpeereid
+#elif !defined(_WIN32)
+    #define _POSIX_C_SOURCE 200809L
+#endif
+
 #include "clipboard.h"
+#include "crypto.h"
+#include "file_io.h"
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,45 +18,78 @@
     #include <windows.h>
 #else
     #include <unistd.h>
+    #include <sys/socket.h>
+    #include <sys/stat.h>
+    #include <sys/time.h>
+    #include <sys/un.h>
     #include <sys/wait.h>
     #include <errno.h>
+    #include <fcntl.h>
+    #include <poll.h>
+    #include <pthread.h>
+    #include <signal.h>
+    #include <spawn.h>
+    #include <time.h>
+    #ifdef __APPLE__
+        #include <mach-o/dyld.h>
+    #endif
+
+    extern char **environ;
 #endif
 
 static char backend_name[32] = "unknown";
 static int backend_detected = 0;
 
+// What a pending clear remembers of the secret: a keyed hash, enough to
+// tell whether the clipboard still holds it without keeping the secret
+typedef struct {
+    unsigned char key[KEY_SIZE];
+    unsigned char digest[HASH_SIZE];
+} SecretPrint;
+
+static int secret_print(const char *text, SecretPrint *print) {
+    return generate_random_bytes(print->key, KEY_SIZE) &&
+           hmac_sha256(print->key, text, strlen(text), print->digest);
+}
+
+static int secret_matches(const SecretPrint *print, const char *text, size_t len) {
+    unsigned char digest[HASH_SIZE];
+    if (!hmac_sha256(print->key, text, len, digest)) return 0;
+    return crypto_equal(digest, print->digest, HASH_SIZE);
+}
+
 #ifdef _WIN32
 // Windows implementation using native API (unchanged - already safe)
 int clipboard_copy(const char *text) {
     if (!text || strlen(text) == 0) return 0;
-    
+
     if (!OpenClipboard(NULL)) return 0;
-    
+
     EmptyClipboard();
-    
+
     size_t len = strlen(text) + 1;
     HGLOBAL hg = GlobalAlloc(GMEM_MOVEABLE, len);
     if (!hg) {
         CloseClipboard();
         return 0;
     }
-    
+
     char *locked = (char*)GlobalLock(hg);
     if (!locked) {
         GlobalFree(hg);
         CloseClipboard();
         return 0;
     }
-    
+
     memcpy(locked, text, len);
     GlobalUnlock(hg);
-    
+
     if (!SetClipboardData(CF_TEXT, hg)) {
         GlobalFree(hg);
         CloseClipboard();
         return 0;
     }
-    
+
     CloseClipboard();
     strncpy(backend_name, "native", sizeof(backend_name) - 1);
     backend_detected = 1;
@@ -53,35 +97,63 @@ int clipboard_copy(const char *text) {
 }
 
 int clipboard_clear(void) {
-    return clipboard_copy("");
+    if (!OpenClipboard(NULL)) return 0;
+    int ok = EmptyClipboard() != 0;
+    CloseClipboard();
+    return ok;
 }
 
+typedef struct {
+    int seconds;
+    SecretPrint print;
+} ClearJob;
+
+// Clears only if the clipboard still holds the copied secret
 DWORD WINAPI clear_clipboard_thread(LPVOID lpParam) {
-    int seconds = *(int*)lpParam;
-    Sleep(seconds * 1000);
-    clipboard_clear();
-    free(lpParam);
+    ClearJob *job = (ClearJob*)lpParam;
+    Sleep(job->seconds * 1000);
+
+    if (OpenClipboard(NULL)) {
+        HANDLE data = GetClipboardData(CF_TEXT);
+        const char *text = data ? (const char*)GlobalLock(data) : NULL;
+        int held = text && secret_matches(&job->print, text, strlen(text));
+        if (text) GlobalUnlock(data);
+        if (held) EmptyClipboard();
+        CloseClipboard();
+    }
+
+    memset(job, 0, sizeof(*job));
+    free(job);
     return 0;
 }
 
 int clipboard_copy_with_timeout(const char *text, int seconds) {
     if (!clipboard_copy(text)) return 0;
-    
-    int *timeout_ptr = malloc(sizeof(int));
-    if (!timeout_ptr) return 0;
-    *timeout_ptr = seconds;
-    
-    HANDLE thread = CreateThread(NULL, 0, clear_clipboard_thread, 
-                                 timeout_ptr, 0, NULL);
+
+    ClearJob *job = malloc(sizeof(ClearJob));
+    if (!job) return 0;
+    job->seconds = seconds;
+    if (!secret_print(text, &job->print)) {
+        free(job);
+        return 0;
+    }
+
+    HANDLE thread = CreateThread(NULL, 0, clear_clipboard_thread,
+                                 job, 0, NULL);
     if (thread) {
         CloseHandle(thread);
         return 1;
     }
-    
-    free(timeout_ptr);
+
+    memset(job, 0, sizeof(*job));
+    free(job);
     return 0;
 }
 
+int clipboard_scheduler_run(void) {
+    return 1; // Clears run in a thread of the copying process
+}
+
 int clipboard_is_available(void) {
     if (!backend_detected) {
         strncpy(backend_name, "native", sizeof(backend_name) - 1);
@@ -91,205 +163,724 @@ int clipboard_is_available(void) {
 }
 
 #else
-// Unix/Linux/macOS implementation using SAFE pipe/fork/exec pattern
-
-// Check if command exists in PATH
-static int check_command(const char *command) {
-    char path_env[4096];
-    const char *path = getenv("PATH");
-    if (!path) return 0;
-    
-    strncpy(path_env, path, sizeof(path_env) - 1);
-    path_env[sizeof(path_env) - 1] = '\0';
-    
-    char *dir = strtok(path_env, ":");
-    while (dir) {
-        char full_path[512];
-        snprintf(full_path, sizeof(full_path), "%s/%s", dir, command);
-        
-        if (access(full_path, X_OK) == 0) {
-            return 1;
+// Unix/Linux/macOS implementation using SAFE pipe/spawn pattern
+
+#define BACKEND_PATH_SIZE 512
+#define TTY_PATH_SIZE 64
+#define DISPLAY_NAME_SIZE 128
+#define CHECK_BUFFER 4096           // Clipboard contents read back for a check
+#define TOOL_TIMEOUT_MS 5000        // A clipboard command running longer is killed
+
+#define SCHEDULER_SOCKET "clipd.sock"
+#define SCHEDULER_MAGIC 0x32524c43u // "CLR2"
+#define SCHEDULER_MAX_PENDING 64
+#define SCHEDULER_MAX_SECONDS 86400
+#define SCHEDULER_IDLE_MS 60000     // Exit after this long with nothing pending
+#define SCHEDULER_SLACK_MS 250      // Clears this close to due run together
+#define SCHEDULER_START_TRIES 50    // Connection attempts, 10 ms apart
+#define SCHEDULER_REPLY_SECONDS 2   // How long a client waits for the reply
+
+#ifndef MSG_NOSIGNAL
+    #define MSG_NOSIGNAL 0
+#endif
+
+// Clipboard commands in order of preference: how each one copies (new
+// contents on stdin), pastes (contents on stdout) and clears
+typedef struct {
+    const char *name;
+    const char *copy[4];
+    const char *paste[5];
+    const char *clear[4];
+} Backend;
+
+static const Backend backends[] = {
+    {"wl-copy", {"wl-copy", NULL}, {"wl-paste", "--no-newline", NULL},
+     {"wl-copy", "--clear", NULL}},
+    {"pbcopy", {"pbcopy", NULL}, {"pbpaste", NULL}, {"pbcopy", NULL}},
+    {"xclip", {"xclip", "-selection", "clipboard", NULL},
+     {"xclip", "-selection", "clipboard", "-o", NULL}, {"xclip", "-selection", "clipboard", NULL}},
+    {"xsel", {"xsel", "--clipboard", "--input", NULL}, {"xsel", "--clipboard", "--output", NULL},
+     {"xsel", "--clipboard", "--clear", NULL}},
+};
+
+#define BACKEND_COUNT (sizeof(backends) / sizeof(backends[0]))
+
+// Not a command: the terminal sets its own clipboard when sent an OSC 52
+// escape sequence, which also reaches it over SSH
+#define OSC52_BACKEND BACKEND_COUNT
+#define OSC52_NAME "osc52"
+
+// CIPHER_CLIPBOARD=<name> uses only that backend; unset or "auto" detects
+#define BACKEND_ENV "CIPHER_CLIPBOARD"
+
+#define REQUEST_TMUX 1u             // ClearRequest flag: wrap for tmux
+
+// Absolute paths of each backend's copy and paste commands ("" if not
+// installed), looked up once; runs use that file directly instead of
+// searching PATH again
+static char copy_paths[BACKEND_COUNT][BACKEND_PATH_SIZE];
+static char paste_paths[BACKEND_COUNT][BACKEND_PATH_SIZE];
+static pthread_once_t resolve_once = PTHREAD_ONCE_INIT;
+
+// Backend the last successful copy used (OSC52_BACKEND included), tried
+// first next time
+static int preferred_backend = -1;
+
+// The scheduler this process started, reaped once it exits
+static pid_t scheduler_pid = 0;
+
+// A secret on the clipboard and when to clear it
+typedef struct {
+    uint32_t magic;
+    uint32_t seconds;
+    uint32_t backend;
+    uint32_t flags;
+    SecretPrint print;
+    char tty[TTY_PATH_SIZE];    // Terminal to clear, for OSC52_BACKEND
+    char display[DISPLAY_NAME_SIZE];            // The client's DISPLAY
+    char wayland_display[DISPLAY_NAME_SIZE];    // and WAYLAND_DISPLAY
+} ClearRequest;
+
+typedef struct {
+    int64_t deadline;           // Monotonic milliseconds
+    size_t backend;
+    uint32_t flags;
+    SecretPrint print;
+    char tty[TTY_PATH_SIZE];
+    char display[DISPLAY_NAME_SIZE];
+    char wayland_display[DISPLAY_NAME_SIZE];
+} PendingClear;
+
+// Find command in PATH. Empty and relative entries are skipped: they name
+// the current directory, and a clipboard tool that sees every secret must
+// not be picked up from wherever the program happens to be started.
+static int find_command(const char *command, char *full_path, size_t size) {
+    const char *dir = getenv("PATH");
+    if (!dir) return 0;
+
+    while (1) {
+        size_t len = strcspn(dir, ":");
+        if (len > 0 && dir[0] == '/') {
+            int written = snprintf(full_path, size, "%.*s/%s", (int)len, dir, command);
+            if (written > 0 && (size_t)written < size && access(full_path, X_OK) == 0) {
+                return 1;
+            }
         }
-        
-        dir = strtok(NULL, ":");
+
+        if (dir[len] == '\0') break;
+        dir += len + 1;
     }
-    
+
+    full_path[0] = '\0';
     return 0;
 }
 
-// SECURE clipboard copy using pipe/fork/exec (NO SHELL)
-static int safe_clipboard_copy(const char *text, const char *command, 
-                               const char *backend) {
-    if (!text || strlen(text) == 0) return 0;
-    
-    int pipefd[2];
-    if (pipe(pipefd) == -1) {
+static void resolve_backends(void) {
+    for (size_t i = 0; i < BACKEND_COUNT; i++) {
+        find_command(backends[i].copy[0], copy_paths[i], sizeof(copy_paths[i]));
+        find_command(backends[i].paste[0], paste_paths[i], sizeof(paste_paths[i]));
+    }
+}
+
+static int64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// SECURE run of a clipboard command using pipe/posix_spawn (NO SHELL):
+// input goes to its stdin and, if output is given, its stdout is
+// collected (*output_len counts every byte, even those that did not fit).
+// The child shares the parent's memory until it execs instead of copying
+// it, so a decrypted vault is never duplicated into another address space.
+// A command still running after TOOL_TIMEOUT_MS (a tool waiting on a
+// display that has gone away, say) is killed and counts as failed.
+// Returns: 1 if the command exited successfully
+static int run_tool(const char *path, const char *const *args, const char *input,
+                    size_t input_len, char *output, size_t output_size, size_t *output_len) {
+    int in[2];
+    int out[2] = {-1, -1};
+    if (pipe(in) == -1) {
+        perror("pipe");
+        return 0;
+    }
+    if (output && pipe(out) == -1) {
         perror("pipe");
+        close(in[0]);
+        close(in[1]);
         return 0;
     }
-    
-    pid_t pid = fork();
-    
-    if (pid == -1) {
-        // Fork failed
-        perror("fork");
-        close(pipefd[0]);
-        close(pipefd[1]);
+
+    // Child: stdin (and stdout) are the pipes, and no pipe end stays open
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, in[0], STDIN_FILENO);
+    posix_spawn_file_actions_addclose(&actions, in[0]);
+    posix_spawn_file_actions_addclose(&actions, in[1]);
+    if (output) {
+        posix_spawn_file_actions_adddup2(&actions, out[1], STDOUT_FILENO);
+        posix_spawn_file_actions_addclose(&actions, out[0]);
+        posix_spawn_file_actions_addclose(&actions, out[1]);
+    }
+
+    pid_t pid;
+    int error = posix_spawn(&pid, path, &actions, NULL, (char * const *)args, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(in[0]);
+    if (output) close(out[1]);
+
+    if (error != 0) {
+        fprintf(stderr, "posix_spawn: %s\n", strerror(error));
+        close(in[1]);
+        if (output) close(out[0]);
         return 0;
     }
-    
-    if (pid == 0) {
-        // Child process
-        close(pipefd[1]); // Close write end
-        
-        // Redirect stdin to read from pipe
-        if (dup2(pipefd[0], STDIN_FILENO) == -1) {
-            perror("dup2");
-            close(pipefd[0]);
-            exit(EXIT_FAILURE);
-        }
-        
-        close(pipefd[0]);
-        
-        // Execute command WITHOUT shell - prevents injection
-        if (strcmp(command, "wl-copy") == 0) {
-            execlp("wl-copy", "wl-copy", NULL);
-        } else if (strcmp(command, "pbcopy") == 0) {
-            execlp("pbcopy", "pbcopy", NULL);
-        } else if (strcmp(command, "xclip") == 0) {
-            execlp("xclip", "xclip", "-selection", "clipboard", NULL);
-        } else if (strcmp(command, "xsel") == 0) {
-            execlp("xsel", "xsel", "--clipboard", "--input", NULL);
+
+    int64_t deadline = now_ms() + TOOL_TIMEOUT_MS;
+
+    // Write the input via pipe
+    ssize_t written = input_len > 0 ? write(in[1], input, input_len) : 0;
+    close(in[1]);
+    int ok = written == (ssize_t)input_len;
+    if (!ok) perror("write");
+
+    if (output) {
+        char drain[256];
+        size_t total = 0;
+        while (1) {
+            struct pollfd poll_fd = {out[0], POLLIN, 0};
+            int64_t left = deadline - now_ms();
+            int ready = left > 0 ? poll(&poll_fd, 1, (int)left) : 0;
+            if (ready < 0 && errno == EINTR) continue;
+            if (ready <= 0) {
+                ok = 0;
+                break;
+            }
+
+            char *to = total < output_size ? output + total : drain;
+            size_t room = total < output_size ? output_size - total : sizeof(drain);
+            ssize_t got = read(out[0], to, room);
+            if (got > 0) total += (size_t)got;
+            else if (got == 0 || errno != EINTR) break;
         }
-        
-        // If exec fails
-        perror("execlp");
-        exit(EXIT_FAILURE);
-    }
-    
-    // Parent process
-    close(pipefd[0]); // Close read end
-    
-    // Write text to clipboard command via pipe
-    size_t text_len = strlen(text);
-    ssize_t written = write(pipefd[1], text, text_len);
-    
-    close(pipefd[1]);
-    
-    if (written != (ssize_t)text_len) {
-        perror("write");
-        waitpid(pid, NULL, 0); // Reap child
-        return 0;
+        close(out[0]);
+        *output_len = total;
+        memset(drain, 0, sizeof(drain));
     }
-    
-    // Wait for child to complete
+
+    // Wait for child to complete, killing it once its time is up
     int status;
-    if (waitpid(pid, &status, 0) == -1) {
-        perror("waitpid");
-        return 0;
+    pid_t done;
+    struct timespec pause = {0, 5 * 1000000};
+    while ((done = waitpid(pid, &status, WNOHANG)) != pid) {
+        if (done < 0 && errno != EINTR) {
+            perror("waitpid");
+            return 0;
+        }
+        if (now_ms() >= deadline) {
+            kill(pid, SIGKILL);
+            waitpid(pid, &status, 0);
+            return 0;
+        }
+        nanosleep(&pause, NULL);
     }
-    
+
     // Check if command succeeded
-    if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
-        strncpy(backend_name, backend, sizeof(backend_name) - 1);
-        backend_name[sizeof(backend_name) - 1] = '\0';
-        backend_detected = 1;
-        return 1;
+    return ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static const char* backend_label(size_t backend) {
+    return backend == OSC52_BACKEND ? OSC52_NAME : backends[backend].name;
+}
+
+static int configured_backend(void) {
+    const char *name = getenv(BACKEND_ENV);
+    if (!name || name[0] == '\0' || strcmp(name, "auto") == 0) return -1;
+    if (strcmp(name, OSC52_NAME) == 0) return (int)OSC52_BACKEND;
+
+    for (size_t i = 0; i < BACKEND_COUNT; i++) {
+        if (strcmp(name, backends[i].name) == 0) return (int)i;
     }
-    
-    return 0;
+    return -1;
 }
 
-int clipboard_copy(const char *text) {
-    if (!text || strlen(text) == 0) return 0;
-    
-    // Try Wayland first (wl-copy)
-    if (check_command("wl-copy")) {
-        if (safe_clipboard_copy(text, "wl-copy", "wl-copy")) {
-            return 1;
-        }
+static int env_set(const char *name) {
+    const char *value = getenv(name);
+    return value && value[0] != '\0';
+}
+
+// Logged in over SSH without a forwarded display: the clipboard commands
+// here would reach this machine's clipboard, or none, not the user's
+static int remote_session(void) {
+    return (env_set("SSH_TTY") || env_set("SSH_CONNECTION")) &&
+           !env_set("DISPLAY") && !env_set("WAYLAND_DISPLAY");
+}
+
+// A controlling terminal that may understand OSC 52 (the Linux console
+// and "dumb" terminals do not)
+static int terminal_usable(void) {
+    const char *term = getenv("TERM");
+    if (!term || term[0] == '\0' || strcmp(term, "dumb") == 0 || strcmp(term, "linux") == 0) {
+        return 0;
     }
-    
-    // Try macOS (pbcopy)
-    if (check_command("pbcopy")) {
-        if (safe_clipboard_copy(text, "pbcopy", "pbcopy")) {
+
+    int fd = open("/dev/tty", O_WRONLY | O_NOCTTY | O_CLOEXEC);
+    if (fd < 0) return 0;
+    close(fd);
+    return 1;
+}
+
+static int backend_present(size_t backend) {
+    return backend == OSC52_BACKEND ? terminal_usable() : copy_paths[backend][0] != '\0';
+}
+
+// Path of the terminal a process without one (the scheduler) can open
+static int terminal_path(char *path, size_t size) {
+    const int fds[] = {STDERR_FILENO, STDOUT_FILENO, STDIN_FILENO};
+    for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); i++) {
+        const char *name = isatty(fds[i]) ? ttyname(fds[i]) : NULL;
+        if (name && strlen(name) < size) {
+            strcpy(path, name);
             return 1;
         }
     }
-    
-    // Try X11 - xclip
-    if (check_command("xclip")) {
-        if (safe_clipboard_copy(text, "xclip", "xclip")) {
-            return 1;
-        }
+    return 0;
+}
+
+// ESC ] 52 ; c ; <base64 text> BEL, in one write. Inside tmux it goes
+// through a DCS passthrough (ESC doubled) to the outer terminal, which
+// needs tmux's allow-passthrough option. Empty text clears the clipboard.
+static int terminal_send(const char *tty, int tmux, const char *text, size_t len) {
+    static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    const char *prefix = tmux ? "\033Ptmux;\033\033]52;c;" : "\033]52;c;";
+    const char *suffix = tmux ? "\a\033\\" : "\a";
+
+    size_t size = strlen(prefix) + (len + 2) / 3 * 4 + strlen(suffix);
+    char *sequence = malloc(size);
+    if (!sequence) return 0;
+
+    size_t n = strlen(prefix);
+    memcpy(sequence, prefix, n);
+    for (size_t i = 0; i < len; i += 3) {
+        uint32_t bits = (uint32_t)(unsigned char)text[i] << 16;
+        if (i + 1 < len) bits |= (uint32_t)(unsigned char)text[i + 1] << 8;
+        if (i + 2 < len) bits |= (unsigned char)text[i + 2];
+        sequence[n++] = digits[bits >> 18];
+        sequence[n++] = digits[(bits >> 12) & 63];
+        sequence[n++] = i + 1 < len ? digits[(bits >> 6) & 63] : '=';
+        sequence[n++] = i + 2 < len ? digits[bits & 63] : '=';
+    }
+    memcpy(sequence + n, suffix, strlen(suffix));
+
+    // Never wait on a terminal nobody is reading
+    int fd = open(tty, O_WRONLY | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    int ok = fd >= 0 && write(fd, sequence, size) == (ssize_t)size;
+    if (fd >= 0) close(fd);
+
+    memset(sequence, 0, size);
+    free(sequence);
+    return ok;
+}
+
+static int inside_tmux(void) {
+    return env_set("TMUX");
+}
+
+static int copy_with(const char *text, size_t backend) {
+    int ok = backend == OSC52_BACKEND
+        ? terminal_send("/dev/tty", inside_tmux(), text, strlen(text))
+        : run_tool(copy_paths[backend], backends[backend].copy, text, strlen(text), NULL, 0, NULL);
+    if (!ok) return 0;
+
+    strncpy(backend_name, backend_label(backend), sizeof(backend_name) - 1);
+    backend_name[sizeof(backend_name) - 1] = '\0';
+    backend_detected = 1;
+    preferred_backend = (int)backend;
+    return 1;
+}
+
+static int clear_with(size_t backend) {
+    if (backend == OSC52_BACKEND) return terminal_send("/dev/tty", inside_tmux(), "", 0);
+    return run_tool(copy_paths[backend], backends[backend].clear, NULL, 0, NULL, 0, NULL);
+}
+
+// Clear the clipboard if it still holds one of the secrets; when it cannot
+// be read back, clear it anyway rather than risk leaving a secret there
+static void clear_if_held(size_t backend, const SecretPrint *const *prints, size_t count) {
+    char contents[CHECK_BUFFER];
+    size_t len = 0;
+    int held = paste_paths[backend][0] == '\0' ||
+               !run_tool(paste_paths[backend], backends[backend].paste, NULL, 0,
+                         contents, sizeof(contents), &len);
+
+    for (size_t i = 0; !held && i < count; i++) {
+        held = len <= sizeof(contents) && secret_matches(prints[i], contents, len);
+    }
+    if (held) clear_with(backend);
+    memset(contents, 0, sizeof(contents));
+}
+
+// Backends to try, best first: a configured one alone, else the one that
+// worked last time, then the commands in order (a Wayland tool fails under
+// X11, for instance), with the terminal first in an SSH session and last
+// otherwise
+static size_t candidate_backends(size_t *order) {
+    int forced = configured_backend();
+    if (forced >= 0) {
+        order[0] = (size_t)forced;
+        return backend_present((size_t)forced);
+    }
+
+    size_t count = 0;
+    int remote = remote_session();
+    if (preferred_backend >= 0) order[count++] = (size_t)preferred_backend;
+    if (remote && preferred_backend != (int)OSC52_BACKEND && terminal_usable()) {
+        order[count++] = OSC52_BACKEND;
     }
-    
-    // Try X11 - xsel
-    if (check_command("xsel")) {
-        if (safe_clipboard_copy(text, "xsel", "xsel")) {
+    for (size_t i = 0; i < BACKEND_COUNT; i++) {
+        if ((int)i != preferred_backend && copy_paths[i][0] != '\0') order[count++] = i;
+    }
+    if (!remote && preferred_backend != (int)OSC52_BACKEND && terminal_usable()) {
+        order[count++] = OSC52_BACKEND;
+    }
+    return count;
+}
+
+int clipboard_copy(const char *text) {
+    if (!text || strlen(text) == 0) return 0;
+    pthread_once(&resolve_once, resolve_backends);
+
+    size_t order[BACKEND_COUNT + 1];
+    size_t count = candidate_backends(order);
+    for (size_t i = 0; i < count; i++) {
+        if (copy_with(text, order[i])) {
             return 1;
         }
     }
-    
+
     return 0;
 }
 
 int clipboard_clear(void) {
-    return clipboard_copy("");
+    pthread_once(&resolve_once, resolve_backends);
+
+    size_t order[BACKEND_COUNT + 1];
+    return candidate_backends(order) > 0 && clear_with(order[0]);
+}
+
+// One scheduler per user: in the per-user runtime directory if there is
+// one, else in the data directory
+static int scheduler_address(struct sockaddr_un *address) {
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+
+    const char *runtime = getenv("XDG_RUNTIME_DIR");
+    int len = runtime && runtime[0] == '/'
+        ? snprintf(address->sun_path, sizeof(address->sun_path), "%s/cipher-%s", runtime, SCHEDULER_SOCKET)
+        : snprintf(address->sun_path, sizeof(address->sun_path), "%s/%s", get_data_dir(), SCHEDULER_SOCKET);
+    return len > 0 && (size_t)len < sizeof(address->sun_path);
+}
+
+// Whether the process at the other end of a connected socket runs as
+// this user: fingerprints of secrets go only to our own scheduler, and it
+// takes requests only from us
+static int peer_is_self(int fd) {
+#ifdef __linux__
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 &&
+           len == sizeof(cred) && cred.uid == getuid();
+#else
+    uid_t uid;
+    gid_t gid;
+    return getpeereid(fd, &uid, &gid) == 0 && uid == getuid();
+#endif
+}
+
+static int connect_scheduler(void) {
+    struct sockaddr_un address;
+    if (!scheduler_address(&address)) return -1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+    if (!peer_is_self(fd)) {
+        close(fd);
+        errno = EACCES;
+        return -1;
+    }
+    return fd;
+}
+
+// Start "cipher __clipd" from this executable, detached from the terminal
+static int start_scheduler(void) {
+    if (scheduler_pid > 0 && waitpid(scheduler_pid, NULL, WNOHANG) == scheduler_pid) {
+        scheduler_pid = 0;
+    }
+
+    char self[BACKEND_PATH_SIZE] = "";
+#ifdef __APPLE__
+    uint32_t size = sizeof(self);
+    if (_NSGetExecutablePath(self, &size) != 0) return 0;
+#else
+    strncpy(self, "/proc/self/exe", sizeof(self) - 1);
+#endif
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+
+    char *const args[] = {"cipher", CLIPBOARD_SCHEDULER_COMMAND, NULL};
+    pid_t pid;
+    int error = posix_spawn(&pid, self, &actions, NULL, args, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (error != 0) return 0;
+
+    scheduler_pid = pid;
+    return 1;
+}
+
+// Copy environment variable name into buffer ("" if unset)
+// Returns: 0 if its value does not fit
+static int copy_env(const char *name, char *buffer, size_t size) {
+    const char *value = getenv(name);
+    int len = snprintf(buffer, size, "%s", value ? value : "");
+    return len >= 0 && (size_t)len < size;
+}
+
+// Hand the clear to the scheduler, starting it if it is not running
+static int schedule_clear(const char *text, size_t backend, int seconds) {
+    ClearRequest request = {SCHEDULER_MAGIC, (uint32_t)seconds, (uint32_t)backend, 0,
+                            {{0}, {0}}, "", "", ""};
+    if (backend == OSC52_BACKEND) {
+        if (!terminal_path(request.tty, sizeof(request.tty))) return 0;
+        if (inside_tmux()) request.flags |= REQUEST_TMUX;
+    }
+
+    // The scheduler may have been started from another session: the clear
+    // has to reach the display this copy went to
+    if (!copy_env("DISPLAY", request.display, sizeof(request.display)) ||
+        !copy_env("WAYLAND_DISPLAY", request.wayland_display, sizeof(request.wayland_display)) ||
+        !secret_print(text, &request.print)) {
+        return 0;
+    }
+
+    int fd = connect_scheduler();
+    if (fd < 0 && start_scheduler()) {
+        struct timespec pause = {0, 10 * 1000000};
+        for (int i = 0; fd < 0 && i < SCHEDULER_START_TRIES; i++) {
+            nanosleep(&pause, NULL);
+            fd = connect_scheduler();
+        }
+    }
+
+    int ok = 0;
+    if (fd >= 0) {
+        // A scheduler that accepts but never answers must not hang the copy
+        struct timeval timeout = {SCHEDULER_REPLY_SECONDS, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        unsigned char reply = 0;
+        ok = send(fd, &request, sizeof(request), MSG_NOSIGNAL) == (ssize_t)sizeof(request) &&
+             recv(fd, &reply, 1, 0) == 1 && reply == 1;
+        close(fd);
+    }
+    memset(&request, 0, sizeof(request));
+    return ok;
 }
 
 int clipboard_copy_with_timeout(const char *text, int seconds) {
     if (!clipboard_copy(text)) return 0;
-    
-    pid_t pid = fork();
-    
-    if (pid < 0) {
-        // Fork failed
-        return 0;
-    } else if (pid == 0) {
-        // Child process
-        sleep(seconds);
-        clipboard_clear();
-        exit(0);
-    }
-    
-    // Parent process continues
-    return 1;
+    if (schedule_clear(text, (size_t)preferred_backend, seconds)) return 1;
+
+    // No scheduler (no socket path, or it would not start): nothing would
+    // ever clear the secret, so take it back out rather than leave it
+    clear_with((size_t)preferred_backend);
+    return 0;
 }
 
-int clipboard_is_available(void) {
-    // Detect backend if not already detected
-    if (!backend_detected) {
-        if (check_command("wl-copy")) {
-            strncpy(backend_name, "wl-copy", sizeof(backend_name) - 1);
-            backend_detected = 1;
-            return 1;
+// Take one request from a client; a client that stalls is dropped
+static void accept_request(int listener, PendingClear *pending, size_t *count) {
+    int fd = accept(listener, NULL, NULL);
+    if (fd < 0) return;
+    if (!peer_is_self(fd)) {
+        close(fd);
+        return;
+    }
+
+    struct timeval timeout = {1, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    ClearRequest request;
+    unsigned char reply = 0;
+    if (recv(fd, &request, sizeof(request), MSG_WAITALL) == (ssize_t)sizeof(request) &&
+        request.magic == SCHEDULER_MAGIC && request.backend <= OSC52_BACKEND &&
+        request.seconds <= SCHEDULER_MAX_SECONDS && *count < SCHEDULER_MAX_PENDING &&
+        memchr(request.tty, '\0', sizeof(request.tty)) &&
+        memchr(request.display, '\0', sizeof(request.display)) &&
+        memchr(request.wayland_display, '\0', sizeof(request.wayland_display)) &&
+        (request.backend != OSC52_BACKEND || strncmp(request.tty, "/dev/", 5) == 0)) {
+        // A terminal's clipboard cannot be read back, but a newer copy to
+        // it means the older secrets are gone: only the latest is cleared
+        if (request.backend == OSC52_BACKEND) {
+            size_t kept = 0;
+            for (size_t i = 0; i < *count; i++) {
+                if (pending[i].backend != OSC52_BACKEND || strcmp(pending[i].tty, request.tty) != 0) {
+                    pending[kept++] = pending[i];
+                }
+            }
+            memset(pending + kept, 0, (*count - kept) * sizeof(PendingClear));
+            *count = kept;
         }
-        
-        if (check_command("pbcopy")) {
-            strncpy(backend_name, "pbcopy", sizeof(backend_name) - 1);
-            backend_detected = 1;
-            return 1;
+
+        PendingClear *entry = &pending[(*count)++];
+        entry->deadline = now_ms() + (int64_t)request.seconds * 1000;
+        entry->backend = request.backend;
+        entry->flags = request.flags;
+        entry->print = request.print;
+        memcpy(entry->tty, request.tty, sizeof(entry->tty));
+        memcpy(entry->display, request.display, sizeof(entry->display));
+        memcpy(entry->wayland_display, request.wayland_display, sizeof(entry->wayland_display));
+        reply = 1;
+    }
+    send(fd, &reply, 1, MSG_NOSIGNAL);
+    close(fd);
+    memset(&request, 0, sizeof(request));
+}
+
+static int same_clipboard(const PendingClear *a, const PendingClear *b) {
+    return a->backend == b->backend && strcmp(a->display, b->display) == 0 &&
+           strcmp(a->wayland_display, b->wayland_display) == 0;
+}
+
+// Point the clipboard commands at the display a copy was made on. The
+// scheduler is single-threaded and spawns with its own environment, so
+// setting it here is what the commands see.
+static void use_display(const PendingClear *entry) {
+    if (entry->display[0] != '\0') setenv("DISPLAY", entry->display, 1);
+    else unsetenv("DISPLAY");
+    if (entry->wayland_display[0] != '\0') setenv("WAYLAND_DISPLAY", entry->wayland_display, 1);
+    else unsetenv("WAYLAND_DISPLAY");
+}
+
+// Clear for every entry that is due, reading each clipboard back once
+// however many of its clears fall due together
+static void run_due(PendingClear *pending, size_t *count, int64_t now) {
+    unsigned char handled[SCHEDULER_MAX_PENDING] = {0};
+    for (size_t first = 0; first < *count; first++) {
+        const PendingClear *entry = &pending[first];
+        if (handled[first] || entry->backend == OSC52_BACKEND || entry->deadline > now) continue;
+
+        const SecretPrint *due[SCHEDULER_MAX_PENDING];
+        size_t due_count = 0;
+        for (size_t i = first; i < *count; i++) {
+            if (!handled[i] && pending[i].deadline <= now && same_clipboard(entry, &pending[i])) {
+                due[due_count++] = &pending[i].print;
+                handled[i] = 1;
+            }
         }
-        
-        if (check_command("xclip")) {
-            strncpy(backend_name, "xclip", sizeof(backend_name) - 1);
-            backend_detected = 1;
+        use_display(entry);
+        clear_if_held(entry->backend, due, due_count);
+    }
+
+    for (size_t i = 0; i < *count; i++) {
+        if (pending[i].backend == OSC52_BACKEND && pending[i].deadline <= now) {
+            terminal_send(pending[i].tty, (pending[i].flags & REQUEST_TMUX) != 0, "", 0);
+        }
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < *count; i++) {
+        if (pending[i].deadline > now) pending[kept++] = pending[i];
+    }
+    memset(pending + kept, 0, (*count - kept) * sizeof(PendingClear));
+    *count = kept;
+}
+
+int clipboard_scheduler_run(void) {
+    struct sockaddr_un address;
+    if (!scheduler_address(&address)) return 1;
+
+    setsid();
+    pthread_once(&resolve_once, resolve_backends);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) return 1;
+
+    // A socket nobody answers on is left over from a scheduler that died
+    umask(077);
+    if (bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        int other = errno == EADDRINUSE ? connect_scheduler() : -1;
+        if (other >= 0 || errno != ECONNREFUSED) {
+            if (other >= 0) close(other);
+            close(listener);
+            return other >= 0 ? 0 : 1;
+        }
+        unlink(address.sun_path);
+        if (bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0) {
+            close(listener);
             return 1;
         }
-        
-        if (check_command("xsel")) {
-            strncpy(backend_name, "xsel", sizeof(backend_name) - 1);
+    }
+    if (listen(listener, 16) != 0) {
+        close(listener);
+        unlink(address.sun_path);
+        return 1;
+    }
+
+    PendingClear pending[SCHEDULER_MAX_PENDING];
+    size_t count = 0;
+    int64_t last_activity = now_ms();
+
+    // Sleep until the next deadline or the next request
+    while (1) {
+        int64_t now = now_ms();
+        size_t before = count;
+        run_due(pending, &count, now + SCHEDULER_SLACK_MS);
+        if (count != before) last_activity = now;
+        if (count == 0 && now - last_activity >= SCHEDULER_IDLE_MS) break;
+
+        int64_t wake = last_activity + SCHEDULER_IDLE_MS;
+        for (size_t i = 0; i < count; i++) {
+            if (i == 0 || pending[i].deadline < wake) wake = pending[i].deadline;
+        }
+
+        struct pollfd poll_fd = {listener, POLLIN, 0};
+        if (poll(&poll_fd, 1, wake > now ? (int)(wake - now) : 0) > 0) {
+            accept_request(listener, pending, &count);
+            last_activity = now_ms();
+        }
+    }
+
+    close(listener);
+    unlink(address.sun_path);
+    return 0;
+}
+
+int clipboard_is_available(void) {
+    // Detect backend if not already detected
+    if (!backend_detected) {
+        pthread_once(&resolve_once, resolve_backends);
+
+        size_t order[BACKEND_COUNT + 1];
+        if (candidate_backends(order) > 0) {
+            strncpy(backend_name, backend_label(order[0]), sizeof(backend_name) - 1);
             backend_detected = 1;
             return 1;
         }
-        
+
         // No backend found
         strncpy(backend_name, "not available", sizeof(backend_name) - 1);
         backend_detected = 1;
         return 0;
     }
-    
+
     return strcmp(backend_name, "not available") != 0;
 }
 
@@ -3,7 +3,15 @@
 
 /**
  * Cross-platform clipboard management
- * Supports: Linux (X11/Wayland), macOS, Windows
+ * Supports: Linux (X11/Wayland), macOS, Windows, and on Unix any terminal
+ * that understands OSC 52 (xterm, kitty, iTerm2, WezTerm, ...), which is
+ * how a copy on a server reached over SSH lands on the user's machine.
+ *
+ * The backend is detected: over SSH without a forwarded display the
+ * terminal comes first, otherwise the clipboard commands (wl-copy, pbcopy,
+ * xclip, xsel) and then the terminal. CIPHER_CLIPBOARD=<name> ("osc52",
+ * "xclip", ...) uses that backend only. Under tmux, OSC 52 needs
+ * "set -g allow-passthrough on".
  */
 
 // Copy text to clipboard
@@ -15,12 +23,28 @@ int clipboard_copy(const char *text);
 int clipboard_clear(void);
 
 // Copy text to clipboard and automatically clear after timeout
+// On Unix the clear is handed to a per-user scheduler process (started on
+// first use, exits when idle) that keeps every pending clear in one
+// deadline queue; on Windows a thread waits instead. Either way the
+// clipboard is cleared only if it still holds this text, checked against
+// a keyed hash, so a newer copy is left alone. A terminal's clipboard
+// cannot be read back, so there only a newer timed copy is left alone.
+// If the clear cannot be scheduled, the clipboard is cleared at once and
+// the copy fails. The scheduler and its clients check that the other end
+// of the socket belongs to the same user.
 // Parameters:
 //   text: Text to copy
 //   seconds: Time in seconds before auto-clear (recommended: 30-45)
 // Returns: 1 on success, 0 on failure
 int clipboard_copy_with_timeout(const char *text, int seconds);
 
+// Hidden command that runs the clear scheduler ("cipher __clipd")
+#define CLIPBOARD_SCHEDULER_COMMAND "__clipd"
+
+// Run the clear scheduler until it has been idle for a while
+// Returns: exit status for the process
+int clipboard_scheduler_run(void);
+
 // Check if clipboard functionality is available
 // Returns: 1 if available, 0 if not
 int clipboard_is_available(void);
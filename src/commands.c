@@ -0,0 +1,1430 @@
+#ifndef _WIN32
+    #define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "commands.h"
+#include "audit.h"
+#include "backup.h"
+#include "breach.h"
+#include "btree.h"
+#include "changelog.h"
+#include "clipboard.h"
+#include "crypto.h"
+#include "file_io.h"
+#include "generator.h"
+#include "markov.h"
+#include "passphrase.h"
+#include "policy.h"
+#include "sync.h"
+#include "utils.h"
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+#define MASTER_PASSWORD_SIZE 256
+
+typedef struct {
+    const char *name;
+    const char *usage;
+    const char *description;
+    int (*run)(int argc, char **argv);
+} Command;
+
+// Prompt for the master password of an existing vault
+static int read_master_password(char *buffer, size_t size) {
+    if (!file_exists()) {
+        print_error("No password vault found. Run cipher without arguments to create one.");
+        return 0;
+    }
+    
+    get_password_input("Enter master password: ", buffer, size);
+    return strlen(buffer) > 0;
+}
+
+static int cmd_migrate(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    
+    if (file_is_paged()) {
+        print_info("Vault already uses the paged store.");
+        return 0;
+    }
+    
+    char password[MASTER_PASSWORD_SIZE];
+    if (!read_master_password(password, sizeof(password))) return 1;
+    
+    long moved = file_convert_to_store(password);
+    memset(password, 0, sizeof(password));
+    
+    if (moved < 0) {
+        print_error("Migration failed (wrong password or unreadable vault).");
+        return 1;
+    }
+    
+    print_success("Vault converted to the paged store.");
+    print_info("Moved %ld entries; the flat file was kept as %s", moved,
+               BACKUP_FILE_NAME);
+    return 0;
+}
+
+// Entries of a paged store, copied out for the audit
+typedef struct {
+    PasswordEntry *entries;
+    size_t count;
+    size_t capacity;
+} EntryList;
+
+static int collect_entry(const PasswordEntry *entry, void *ctx) {
+    EntryList *list = ctx;
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 256;
+        PasswordEntry *grown = realloc(list->entries, sizeof(PasswordEntry) * capacity);
+        if (!grown) return 0;
+        list->entries = grown;
+        list->capacity = capacity;
+    }
+    list->entries[list->count++] = *entry;
+    return 1;
+}
+
+static int audit_usage(void) {
+    fprintf(stderr, "Usage: cipher audit [--max-age <days>] [--threads <n>] [--report <file>]\n");
+    fprintf(stderr, "                    [--breach <corpus>]\n");
+    return 1;
+}
+
+static int cmd_audit(int argc, char **argv) {
+    AuditOptions options = {AUDIT_DEFAULT_MAX_AGE_DAYS, 0, 0, NULL};
+    const char *report = NULL;
+    const char *breach = NULL;
+    
+    for (int i = 1; i < argc; i++) {
+        int *field = NULL;
+        if (strcmp(argv[i], "--max-age") == 0) field = &options.max_age_days;
+        else if (strcmp(argv[i], "--threads") == 0) field = &options.threads;
+        else if (strcmp(argv[i], "--report") == 0 && i + 1 < argc) {
+            report = argv[++i];
+            continue;
+        } else if (strcmp(argv[i], "--breach") == 0 && i + 1 < argc) {
+            breach = argv[++i];
+            continue;
+        }
+        
+        char *end = NULL;
+        long value = (field && i + 1 < argc) ? strtol(argv[i + 1], &end, 10) : -1;
+        if (!field || !end || *end != '\0' || value < 0 || value > 100000) {
+            return audit_usage();
+        }
+        *field = (int)value;
+        i++;
+    }
+    
+    BreachCorpus *corpus = NULL;
+    if (breach) {
+        corpus = breach_open(breach);
+        if (!corpus) {
+            print_error("Cannot open the breach corpus (convert it with 'cipher breach convert').");
+            return 1;
+        }
+        options.breach = corpus;
+    }
+    
+    char password[MASTER_PASSWORD_SIZE];
+    if (!read_master_password(password, sizeof(password))) {
+        breach_close(corpus);
+        return 1;
+    }
+    
+    int success;
+    PasswordManager *pm = file_load(password, &success);
+    memset(password, 0, sizeof(password));
+    if (!success || !pm) {
+        breach_close(corpus);
+        print_error("Incorrect password or corrupted vault!");
+        return 1;
+    }
+    
+    EntryList list = {pm->entries, pm->count, pm->count};
+    if (pm->store) {
+        list.entries = NULL;
+        list.count = 0;
+        list.capacity = 0;
+        if (!btree_foreach(pm->store, collect_entry, &list)) {
+            print_error("Failed to read the paged store.");
+            free(list.entries);
+            breach_close(corpus);
+            pm_free(pm);
+            return 1;
+        }
+    }
+    
+    options.now = (int64_t)time(NULL);
+    AuditSummary summary;
+    AuditResult *results = audit_entries(list.entries, list.count, &options, &summary);
+    breach_close(corpus);
+    
+    int status = 1;
+    if (!results) {
+        print_error("Audit failed (out of memory).");
+    } else {
+        int written = 1;
+        if (report) {
+            FILE *out = fopen(report, "w");
+            written = out && audit_write_report(out, list.entries, results, list.count,
+                                                &options, &summary);
+            if (out && fclose(out) != 0) written = 0;
+        }
+        
+        if (!written) {
+            print_error("Failed to write the audit report.");
+        } else {
+            print_info("Audited %zu entries: %zu weak, %zu reused (%zu shared passwords), %zu stale",
+                       summary.entries, summary.weak, summary.reused,
+                       summary.reuse_groups, summary.stale);
+            if (corpus) {
+                print_info("%zu passwords appear in the breach corpus", summary.breached);
+            }
+            if (report) print_info("Report written to %s", report);
+            
+            // 2 = findings, so scripts can tell them from failures
+            status = (summary.weak || summary.reused || summary.stale ||
+                      summary.breached) ? 2 : 0;
+        }
+    }
+    
+    if (pm->store) {
+        memset(list.entries, 0, sizeof(PasswordEntry) * list.count);
+        free(list.entries);
+    }
+    free(results);
+    pm_free(pm);
+    return status;
+}
+
+static int cmd_breach(int argc, char **argv) {
+    if (argc != 4 || strcmp(argv[1], "convert") != 0) {
+        fprintf(stderr, "Usage: cipher breach convert <sha1 list> <corpus>\n");
+        return 1;
+    }
+    
+    print_info("Converting %s (this reads the whole list once)...", argv[2]);
+    size_t skipped = 0;
+    long long count = breach_convert(argv[2], argv[3], &skipped);
+    if (count < 0) {
+        print_error("Conversion failed (unreadable list, or no room for the corpus).");
+        return 1;
+    }
+    
+    print_success("Breach corpus written.");
+    print_info("%lld distinct hashes in %s", count, argv[3]);
+    if (skipped > 0) print_info("Skipped %zu lines that were not SHA-1 hashes", skipped);
+    return 0;
+}
+
+static int backup_usage(void) {
+    fprintf(stderr, "Usage: cipher backup [create]\n");
+    fprintf(stderr, "       cipher backup list\n");
+    fprintf(stderr, "       cipher backup restore <id>\n");
+    fprintf(stderr, "       cipher backup prune [--hourly N] [--daily N] [--weekly N]\n");
+    return 1;
+}
+
+static int backup_prune_with(const BackupPolicy *policy, const char *password) {
+    size_t chunks = 0;
+    long removed = backup_prune(policy, password, &chunks);
+    if (removed == -2) {
+        print_error("The backup store was created under a different master password.");
+        return 0;
+    }
+    if (removed < 0) {
+        print_error("Failed to prune old snapshots (a manifest is missing or damaged).");
+        return 0;
+    }
+    if (removed > 0) {
+        print_info("Pruned %ld old snapshots (%zu chunks freed)", removed, chunks);
+    }
+    return 1;
+}
+
+static int backup_create_snapshot(void) {
+    char password[MASTER_PASSWORD_SIZE];
+    if (!read_master_password(password, sizeof(password))) return 1;
+    
+    int success;
+    PasswordManager *pm = file_load(password, &success);
+    if (!success || !pm) {
+        memset(password, 0, sizeof(password));
+        print_error("Incorrect password or corrupted vault!");
+        return 1;
+    }
+    
+    BackupSnapshot snapshot;
+    BackupStats stats;
+    int result = backup_create(pm, password, &snapshot, &stats);
+    pm_free(pm);
+    
+    if (result == -1) {
+        memset(password, 0, sizeof(password));
+        print_error("The backup store was created under a different master password.");
+        return 1;
+    }
+    if (result != 1) {
+        memset(password, 0, sizeof(password));
+        print_error("Failed to write the snapshot.");
+        return 1;
+    }
+    
+    print_success("Snapshot taken.");
+    print_info("Snapshot %llu: %llu entries in %zu chunks, %zu new (%llu bytes written)",
+               (unsigned long long)snapshot.id,
+               (unsigned long long)snapshot.entry_count, stats.chunks,
+               stats.new_chunks, (unsigned long long)stats.bytes_written);
+    
+    BackupPolicy policy = {BACKUP_DEFAULT_HOURLY, BACKUP_DEFAULT_DAILY,
+                           BACKUP_DEFAULT_WEEKLY};
+    int pruned = backup_prune_with(&policy, password);
+    memset(password, 0, sizeof(password));
+    return pruned ? 0 : 1;
+}
+
+static int backup_list_snapshots(void) {
+    size_t count;
+    BackupSnapshot *snapshots = backup_list(&count);
+    if (!snapshots) {
+        print_info("No snapshots yet; run 'cipher backup' to take one.");
+        return 0;
+    }
+    
+    printf("  %-6s %-20s %10s %8s %8s\n", "ID", "Taken (UTC)", "Generation",
+           "Entries", "Chunks");
+    for (size_t i = 0; i < count; i++) {
+        char taken[32] = "?";
+        time_t created = (time_t)snapshots[i].created;
+        struct tm *tm = gmtime(&created);
+        if (tm) strftime(taken, sizeof(taken), "%Y-%m-%d %H:%M:%S", tm);
+        
+        printf("  %-6llu %-20s %10llu %8llu %8u\n",
+               (unsigned long long)snapshots[i].id, taken,
+               (unsigned long long)snapshots[i].generation,
+               (unsigned long long)snapshots[i].entry_count,
+               snapshots[i].chunk_count);
+    }
+    
+    free(snapshots);
+    return 0;
+}
+
+static int compare_entry_services(const void *a, const void *b) {
+    return strcasecmp((*(PasswordEntry* const*)a)->service,
+                      (*(PasswordEntry* const*)b)->service);
+}
+
+// Make a restored snapshot the vault's next change: its entries are new at
+// that generation, and whatever the current vault has that the snapshot
+// lacks is deleted then. Deletions the current vault already knows about
+// are kept alongside the snapshot's own, and change logs cannot reach back
+// across the jump.
+static int rebase_restored(PasswordManager *restored, const PasswordManager *current) {
+    uint64_t generation = current->generation + 1;
+    
+    // Restored services, sorted for lookup
+    PasswordEntry **sorted = malloc(sizeof(PasswordEntry*) * (restored->count + 1));
+    if (!sorted) return 0;
+    for (size_t i = 0; i < restored->count; i++) sorted[i] = &restored->entries[i];
+    qsort(sorted, restored->count, sizeof(PasswordEntry*), compare_entry_services);
+    
+    int ok = 1;
+    for (size_t i = 0; ok && i < current->tombstone_count + current->count; i++) {
+        int deleted = i < current->tombstone_count;
+        const PasswordEntry *entry = deleted ? &current->tombstones[i]
+                                             : &current->entries[i - current->tombstone_count];
+        const PasswordEntry *key = entry;
+        if (restored->count > 0 &&
+            bsearch(&key, sorted, restored->count, sizeof(PasswordEntry*),
+                    compare_entry_services)) {
+            continue;
+        }
+        ok = pm_add_tombstone(restored, entry->service,
+                              deleted ? entry->generation : generation);
+    }
+    free(sorted);
+    
+    for (size_t i = 0; i < restored->count; i++) {
+        restored->entries[i].generation = generation;
+    }
+    restored->generation = current->generation;
+    if (restored->log_floor < generation) restored->log_floor = generation;
+    return ok;
+}
+
+static int backup_restore_snapshot(const char *id_arg) {
+    char *end;
+    unsigned long long id = strtoull(id_arg, &end, 10);
+    if (*end != '\0' || id == 0) return backup_usage();
+    
+    if (file_is_paged()) {
+        print_error("Snapshots can only be restored into a flat vault.");
+        return 1;
+    }
+    
+    char password[MASTER_PASSWORD_SIZE];
+    if (!read_master_password(password, sizeof(password))) return 1;
+    
+    int success;
+    PasswordManager *current = file_load(password, &success);
+    if (!success || !current) {
+        memset(password, 0, sizeof(password));
+        print_error("Incorrect password or corrupted vault!");
+        return 1;
+    }
+    
+    int status;
+    PasswordManager *restored = backup_restore((uint64_t)id, password, &status);
+    int ok = restored != NULL;
+    
+    if (ok) {
+        restored->shard_count = current->shard_count;
+        restored->codec = current->codec;
+        restored->dirty_shards = ~0ULL;
+        
+        ok = rebase_restored(restored, current) &&
+             file_create_backup() && file_save(restored, password);
+    }
+    memset(password, 0, sizeof(password));
+    
+    if (status == -1) {
+        print_error("The backup store was created under a different master password.");
+    } else if (!restored) {
+        print_error("Snapshot is missing or damaged.");
+    } else if (!ok) {
+        print_error("Failed to write the restored vault.");
+    } else {
+        print_success("Snapshot restored.");
+        print_info("%zu entries; the previous vault was kept as %s", restored->count,
+                   BACKUP_FILE_NAME);
+    }
+    
+    pm_free(current);
+    pm_free(restored);
+    return ok ? 0 : 1;
+}
+
+static int cmd_backup(int argc, char **argv) {
+    if (argc < 2 || strcmp(argv[1], "create") == 0) {
+        return argc <= 2 ? backup_create_snapshot() : backup_usage();
+    }
+    if (strcmp(argv[1], "list") == 0 && argc == 2) return backup_list_snapshots();
+    if (strcmp(argv[1], "restore") == 0 && argc == 3) return backup_restore_snapshot(argv[2]);
+    if (strcmp(argv[1], "prune") != 0) return backup_usage();
+    
+    BackupPolicy policy = {BACKUP_DEFAULT_HOURLY, BACKUP_DEFAULT_DAILY,
+                           BACKUP_DEFAULT_WEEKLY};
+    for (int i = 2; i < argc; i++) {
+        int *field = NULL;
+        if (strcmp(argv[i], "--hourly") == 0) field = &policy.hourly;
+        else if (strcmp(argv[i], "--daily") == 0) field = &policy.daily;
+        else if (strcmp(argv[i], "--weekly") == 0) field = &policy.weekly;
+        
+        if (!field || i + 1 >= argc) return backup_usage();
+        
+        char *end;
+        errno = 0;
+        long value = strtol(argv[++i], &end, 10);
+        if (end == argv[i] || *end != '\0' || errno != 0 || value < 0 || value > INT_MAX) {
+            print_error("Retention counts must be whole numbers, 0 or more.");
+            return 1;
+        }
+        *field = (int)value;
+    }
+    
+    char password[MASTER_PASSWORD_SIZE];
+    if (!read_master_password(password, sizeof(password))) return 1;
+    
+    int pruned = backup_prune_with(&policy, password);
+    memset(password, 0, sizeof(password));
+    if (!pruned) return 1;
+    print_success("Retention policy applied.");
+    return 0;
+}
+
+static int gen_usage(void) {
+    fprintf(stderr, "Usage: cipher gen [--count N] [--length L] [--output <file>]\n");
+    fprintf(stderr, "                  [--no-upper] [--no-lower] [--no-digits] [--no-symbols]\n");
+    fprintf(stderr, "       cipher gen [--count N] [--output <file>] --policy <policy> | --service <name>\n");
+    fprintf(stderr, "       cipher gen [--count N] [--output <file>] --mask <mask>\n");
+    fprintf(stderr, "       cipher gen [--count N] [--length L] [--output <file>] --pronounceable [--order 2|3]\n");
+    return 1;
+}
+
+// Compile a policy, reporting what is wrong with it
+static PasswordPolicy* compile_policy(const char *text) {
+    char error[128];
+    PasswordPolicy *policy = policy_compile(text, error, sizeof(error));
+    if (!policy) fprintf(stderr, "Invalid policy: %s\n", error);
+    return policy;
+}
+
+// Open an output file for generated secrets, readable by the owner only
+// from the moment it exists
+static FILE* open_secret_output(const char *path) {
+#ifdef _WIN32
+    return fopen(path, "wb");
+#else
+    int fd = open(path, O_CREAT | O_TRUNC | O_WRONLY, 0600);
+    if (fd < 0) return NULL;
+
+    FILE *file = fdopen(fd, "wb");
+    if (!file) close(fd);
+    return file;
+#endif
+}
+
+static int cmd_gen(int argc, char **argv) {
+    PasswordOptions options = {16, 1, 1, 1, 1};
+    unsigned long long count = 1;
+    const char *output = NULL;
+    const char *policy_text = NULL;
+    const char *service = NULL;
+    const char *mask_text = NULL;
+    int pronounceable = 0;
+    int order = 0;
+    int length_given = 0;
+    int shaped = 0;
+    
+    for (int i = 1; i < argc; i++) {
+        int *flag = NULL;
+        if (strcmp(argv[i], "--no-upper") == 0) flag = &options.use_uppercase;
+        else if (strcmp(argv[i], "--no-lower") == 0) flag = &options.use_lowercase;
+        else if (strcmp(argv[i], "--no-digits") == 0) flag = &options.use_numbers;
+        else if (strcmp(argv[i], "--no-symbols") == 0) flag = &options.use_symbols;
+        
+        if (flag) {
+            *flag = 0;
+            shaped = 1;
+        } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) output = argv[++i];
+        else if (strcmp(argv[i], "--policy") == 0 && i + 1 < argc) policy_text = argv[++i];
+        else if (strcmp(argv[i], "--service") == 0 && i + 1 < argc) service = argv[++i];
+        else if (strcmp(argv[i], "--mask") == 0 && i + 1 < argc) mask_text = argv[++i];
+        else if (strcmp(argv[i], "--pronounceable") == 0) pronounceable = 1;
+        else if ((strcmp(argv[i], "--count") == 0 || strcmp(argv[i], "--length") == 0 ||
+                  strcmp(argv[i], "--order") == 0) &&
+                 i + 1 < argc && argv[i + 1][0] != '-') {
+            char *end = NULL;
+            unsigned long long value = strtoull(argv[i + 1], &end, 10);
+            if (*end != '\0' || value == 0) return gen_usage();
+            if (argv[i][2] == 'c') {
+                count = value;
+            } else if (argv[i][2] == 'o') {
+                order = value > 9 ? 10 : (int)value;
+            } else {
+                options.length = value > 128 ? 129 : (int)value;
+                length_given = 1;
+            }
+            i++;
+        } else {
+            return gen_usage();
+        }
+    }
+    
+    // A policy or mask says everything about the passwords itself; the
+    // pronounceable model only takes a length
+    int shapes = (policy_text != NULL) + (service != NULL) + (mask_text != NULL) + pronounceable;
+    if (shapes > 1 || (shapes == 1 && shaped)) return gen_usage();
+    if (length_given && shapes == 1 && !pronounceable) return gen_usage();
+    if (order && !pronounceable) return gen_usage();
+    
+    PasswordPolicy *policy = NULL;
+    MaskProgram *mask = NULL;
+    MarkovModel *model = NULL;
+    if (pronounceable) {
+        if (order == 0) order = MARKOV_DEFAULT_ORDER;
+        if (order < MARKOV_MIN_ORDER || order > MARKOV_MAX_ORDER) {
+            print_error("Order must be 2 or 3.");
+            return 1;
+        }
+        if (options.length < 4 || options.length > MARKOV_MAX_LENGTH) {
+            print_error("Length must be between 4 and 128.");
+            return 1;
+        }
+        model = markov_train(order);
+        if (!model) {
+            print_error("Cannot build the pronounceable model.");
+            return 1;
+        }
+    } else if (mask_text) {
+        char error[128];
+        mask = mask_compile(mask_text, error, sizeof(error));
+        if (!mask) {
+            fprintf(stderr, "Invalid mask: %s\n", error);
+            return 1;
+        }
+    } else if (policy_text || service) {
+        char text[POLICY_TEXT_MAX];
+        if (service) {
+            policy_lookup(service, text, sizeof(text));
+            policy_text = text;
+        }
+        policy = compile_policy(policy_text);
+        if (!policy) return 1;
+    } else if (options.length < 4 || options.length > 128) {
+        print_error("Length must be between 4 and 128.");
+        return 1;
+    }
+    
+    FILE *out = output ? open_secret_output(output) : stdout;
+    if (!out) {
+        policy_free(policy);
+        mask_free(mask);
+        markov_free(model);
+        print_error("Cannot open the output file.");
+        return 1;
+    }
+    
+    long long written;
+    if (model) {
+        written = markov_generate_batch(out, count, options.length, model);
+    } else if (mask) {
+        written = mask_generate_batch(out, count, mask);
+    } else if (policy) {
+        written = policy_generate_batch(out, count, policy);
+    } else {
+        written = generate_password_batch(out, count, options);
+    }
+    int status = written < 0 ? 1 : 0;
+    if (output && fclose(out) != 0) status = 1;
+    policy_free(policy);
+    
+    if (status != 0) {
+        print_error("Password generation failed (no character classes, or a write error).");
+    } else if (output) {
+        print_info("%lld passwords written to %s", written, output);
+    }
+    
+    // Stay off stdout when the passwords are going there
+    if (status == 0 && (mask || model)) {
+        const char *source = mask ? "Mask" : "Model";
+        double bits = mask ? mask_entropy_bits(mask) : markov_entropy_bits(model, options.length);
+        if (output) {
+            print_info("%s entropy: %.2f bits per password", source, bits);
+        } else {
+            fprintf(stderr, "%s entropy: %.2f bits per password\n", source, bits);
+        }
+    }
+    mask_free(mask);
+    markov_free(model);
+    return status;
+}
+
+static int passphrase_usage(void) {
+    fprintf(stderr, "Usage: cipher passphrase [--count N] [--output <file>] [--words N]\n");
+    fprintf(stderr, "                         [--wordlist <name|path>] [--separator <char>|none]\n");
+    fprintf(stderr, "                         [--capitalize] [--number] [--distinct]\n");
+    fprintf(stderr, "       cipher passphrase [--separator <char>|none] [--capitalize] --dice <roll>...\n");
+    fprintf(stderr, "Wordlists: '%s' (built in), a file path, or a name in the data directory's\n",
+            WORDLIST_BUILTIN);
+    fprintf(stderr, "'%s' folder (<name>.txt, one word per line).\n", WORDLIST_DIR_NAME);
+    fprintf(stderr, "A roll is %d dice read left to right, e.g. 31452; each gives one word of '%s'.\n",
+            PASSPHRASE_DICE_PER_WORD, WORDLIST_BUILTIN);
+    return 1;
+}
+
+// Passphrase from physically rolled dice: no randomness of ours is used
+static int dice_passphrase(char **rolls, int count, const PassphraseConfig *config) {
+    for (int i = 0; i < count; i++) {
+        if (!passphrase_dice_word(rolls[i], NULL)) {
+            fprintf(stderr, "Invalid roll '%s': expected %d dice, each 1 to 6.\n",
+                    rolls[i], PASSPHRASE_DICE_PER_WORD);
+            return 1;
+        }
+    }
+    
+    char *passphrase = malloc((size_t)count * (WORDLIST_MAX_WORD + 1) + 1);
+    if (!passphrase) return 1;
+    
+    size_t used = 0;
+    for (int i = 0; i < count; i++) {
+        size_t length;
+        const char *word = passphrase_dice_word(rolls[i], &length);
+        memcpy(passphrase + used, word, length);
+        if (config->capitalize) {
+            passphrase[used] = (char)toupper((unsigned char)passphrase[used]);
+        }
+        used += length;
+        if (i < count - 1 && config->separator != '\0') passphrase[used++] = config->separator;
+    }
+    passphrase[used] = '\0';
+    
+    printf("%s\n", passphrase);
+    memset(passphrase, 0, used);
+    free(passphrase);
+    
+    fprintf(stderr, "Entropy: %.1f bits, if the dice are fair\n",
+            count * log2((double)passphrase_word_count()));
+    return 0;
+}
+
+static int cmd_passphrase(int argc, char **argv) {
+    PassphraseConfig config = get_preset_config(PRESET_STANDARD);
+    const char *list_name = NULL;
+    const char *output = NULL;
+    unsigned long long count = 1;
+    int words_given = 0;
+    int dice_first = 0;
+    int dice_count = 0;
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--capitalize") == 0) config.capitalize = 1;
+        else if (strcmp(argv[i], "--number") == 0) config.add_number = 1;
+        else if (strcmp(argv[i], "--distinct") == 0) config.distinct_words = 1;
+        else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) output = argv[++i];
+        else if (strcmp(argv[i], "--count") == 0 && i + 1 < argc) {
+            char *end = NULL;
+            count = strtoull(argv[++i], &end, 10);
+            if (*end != '\0' || count == 0) return passphrase_usage();
+        } else if (strcmp(argv[i], "--dice") == 0) {
+            // Every roll up to the next option
+            dice_first = i + 1;
+            while (i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0) i++;
+            dice_count = i + 1 - dice_first;
+            if (dice_count == 0) return passphrase_usage();
+        } else if (strcmp(argv[i], "--wordlist") == 0 && i + 1 < argc) list_name = argv[++i];
+        else if (strcmp(argv[i], "--separator") == 0 && i + 1 < argc) {
+            const char *value = argv[++i];
+            if (strcmp(value, "none") == 0) config.separator = '\0';
+            else if (strlen(value) == 1) config.separator = value[0];
+            else return passphrase_usage();
+        } else if (strcmp(argv[i], "--words") == 0 && i + 1 < argc) {
+            char *end = NULL;
+            long value = strtol(argv[++i], &end, 10);
+            if (*end != '\0' || value < 1 || value > PASSPHRASE_MAX_WORDS) {
+                print_error("Words must be between 1 and 20.");
+                return 1;
+            }
+            config.num_words = (int)value;
+            words_given = 1;
+        } else {
+            return passphrase_usage();
+        }
+    }
+    
+    // The rolls are the whole passphrase; nothing else may be random
+    if (dice_count > 0) {
+        if (list_name || output || count != 1 || words_given || config.add_number ||
+            config.distinct_words) {
+            return passphrase_usage();
+        }
+        return dice_passphrase(argv + dice_first, dice_count, &config);
+    }
+    
+    char error[1024];
+    config.wordlist = wordlist_get(list_name, error, sizeof(error));
+    if (!config.wordlist) {
+        fprintf(stderr, "Cannot load wordlist: %s\n", error);
+        return 1;
+    }
+    
+    if (config.distinct_words && wordlist_size(config.wordlist) < (uint32_t)config.num_words) {
+        print_error("The wordlist has fewer words than the passphrase.");
+        return 1;
+    }
+    
+    FILE *out = output ? open_secret_output(output) : stdout;
+    if (!out) {
+        print_error("Cannot open the output file.");
+        return 1;
+    }
+    
+    long long written = passphrase_generate_batch(out, count, &config);
+    int status = written < 0 ? 1 : 0;
+    if (output && fclose(out) != 0) status = 1;
+    
+    if (status != 0) {
+        print_error("Passphrase generation failed.");
+        return status;
+    }
+    if (output) print_info("%lld passphrases written to %s", written, output);
+    
+    // Stay off stdout when the passphrases are going there
+    fprintf(output ? stdout : stderr, "Entropy: %.1f bits (%u words in '%s')\n",
+            passphrase_entropy(&config), wordlist_size(config.wordlist),
+            wordlist_name(config.wordlist));
+    return 0;
+}
+
+static int policy_usage(void) {
+    fprintf(stderr, "Usage: cipher policy set <service> <policy>\n");
+    fprintf(stderr, "       cipher policy show <service>\n");
+    fprintf(stderr, "       cipher policy remove <service>\n");
+    fprintf(stderr, "Use service '%s' for the default policy; see policy.h for the rules.\n",
+            POLICY_DEFAULT_SERVICE);
+    return 1;
+}
+
+static int cmd_policy(int argc, char **argv) {
+    if (argc < 3) return policy_usage();
+    const char *action = argv[1];
+    const char *service = argv[2];
+    
+    if (strcmp(action, "set") == 0 && argc >= 4) {
+        // The rules may come as one argument or several
+        char text[POLICY_TEXT_MAX] = "";
+        size_t used = 0;
+        for (int i = 3; i < argc; i++) {
+            int n = snprintf(text + used, sizeof(text) - used, "%s%s",
+                             used ? " " : "", argv[i]);
+            if (n < 0 || (size_t)n >= sizeof(text) - used) {
+                print_error("Policy is too long.");
+                return 1;
+            }
+            used += (size_t)n;
+        }
+        
+        PasswordPolicy *policy = compile_policy(text);
+        if (!policy) return 1;
+        double bits = policy_entropy_bits(policy);
+        policy_free(policy);
+        
+        if (!policy_attach(service, text)) {
+            print_error("Failed to write the policy file.");
+            return 1;
+        }
+        print_success("Policy saved.");
+        print_info("%s: %.1f bits per password", service, bits);
+        return 0;
+    }
+    
+    if (strcmp(action, "remove") == 0 && argc == 3) {
+        if (!policy_attach(service, NULL)) {
+            print_error("Failed to write the policy file.");
+            return 1;
+        }
+        print_success("Policy removed.");
+        return 0;
+    }
+    
+    if (strcmp(action, "show") == 0 && argc == 3) {
+        char text[POLICY_TEXT_MAX];
+        int own = policy_lookup(service, text, sizeof(text));
+        PasswordPolicy *policy = compile_policy(text);
+        if (!policy) return 1;
+        printf("%s%s\n", text, own ? "" : "  (default)");
+        printf("%.1f bits per password\n", policy_entropy_bits(policy));
+        policy_free(policy);
+        return 0;
+    }
+    
+    return policy_usage();
+}
+
+// Policies compiled so far during one rotation, by text
+typedef struct {
+    char text[POLICY_TEXT_MAX];
+    PasswordPolicy *policy;
+} CachedPolicy;
+
+#define MAX_CACHED_POLICIES 64
+
+typedef struct {
+    CachedPolicy entries[MAX_CACHED_POLICIES];
+    size_t count;
+} PolicyCache;
+
+static PasswordPolicy* cached_policy(PolicyCache *cache, const char *service) {
+    char text[POLICY_TEXT_MAX];
+    policy_lookup(service, text, sizeof(text));
+    
+    for (size_t i = 0; i < cache->count; i++) {
+        if (strcmp(cache->entries[i].text, text) == 0) return cache->entries[i].policy;
+    }
+    
+    PasswordPolicy *policy = compile_policy(text);
+    if (policy && cache->count < MAX_CACHED_POLICIES) {
+        CachedPolicy *entry = &cache->entries[cache->count++];
+        memcpy(entry->text, text, sizeof(text));
+        entry->policy = policy;
+    } else if (policy) {
+        // Cache full: keep the newest in the last slot
+        policy_free(cache->entries[cache->count - 1].policy);
+        memcpy(cache->entries[cache->count - 1].text, text, sizeof(text));
+        cache->entries[cache->count - 1].policy = policy;
+    }
+    return policy;
+}
+
+static int rotate_usage(void) {
+    fprintf(stderr, "Usage: cipher rotate <service>... | --all\n");
+    return 1;
+}
+
+static int cmd_rotate(int argc, char **argv) {
+    int all = argc == 2 && strcmp(argv[1], "--all") == 0;
+    if (argc < 2 || (!all && strncmp(argv[1], "--", 2) == 0)) return rotate_usage();
+    
+    char password[MASTER_PASSWORD_SIZE];
+    if (!read_master_password(password, sizeof(password))) return 1;
+    
+    int success;
+    PasswordManager *pm = file_load(password, &success);
+    if (!success || !pm) {
+        memset(password, 0, sizeof(password));
+        print_error("Incorrect password or corrupted vault!");
+        return 1;
+    }
+    
+    // Services to rotate; with --all, every entry in the vault
+    EntryList list = {NULL, 0, 0};
+    int ok = 1;
+    if (all && pm->store) {
+        ok = btree_foreach(pm->store, collect_entry, &list);
+    } else if (all) {
+        for (size_t i = 0; ok && i < pm->count; i++) ok = collect_entry(&pm->entries[i], &list);
+    } else {
+        for (int i = 1; ok && i < argc; i++) {
+            PasswordEntry *entry = pm_find_entry(pm, argv[i]);
+            if (!entry) {
+                fprintf(stderr, "Service not found: %s\n", argv[i]);
+                ok = 0;
+            } else {
+                ok = collect_entry(entry, &list);
+            }
+        }
+    }
+    
+    // The paged store changes in place, so take the backup first
+    if (ok && list.count > 0) ok = file_create_backup();
+    
+    PolicyCache cache = {0};
+    size_t rotated = 0;
+    char generated[MAX_PASSWORD];
+    for (size_t i = 0; ok && i < list.count; i++) {
+        const char *service = list.entries[i].service;
+        PasswordPolicy *policy = cached_policy(&cache, service);
+        ok = policy && policy_generate(policy, generated, sizeof(generated)) &&
+             pm_update_entry(pm, service, NULL, generated);
+        if (ok) rotated++;
+    }
+    memset(generated, 0, sizeof(generated));
+    
+    if (ok && rotated > 0) ok = file_save(pm, password);
+    memset(password, 0, sizeof(password));
+    
+    // A flat vault is only written by the save above, but the paged store
+    // changes in place and keeps whatever was rotated before the failure
+    if (!ok && pm->store && rotated > 0) {
+        print_error("Rotation failed; these entries may already have new passwords:");
+        for (size_t i = 0; i < rotated; i++) {
+            fprintf(stderr, "  %s\n", list.entries[i].service);
+        }
+        print_info("The backup taken before the rotation has their old passwords");
+    } else if (!ok) {
+        print_error("Rotation failed; the vault was not saved.");
+    }
+    
+    for (size_t i = 0; i < cache.count; i++) {
+        policy_free(cache.entries[i].policy);
+    }
+    memset(list.entries, 0, sizeof(PasswordEntry) * list.count);
+    free(list.entries);
+    pm_free(pm);
+    
+    if (!ok) return 1;
+    print_success("Passwords rotated.");
+    print_info("%zu entries have new passwords following their policies", rotated);
+    return 0;
+}
+
+static int cmd_get(int argc, char **argv) {
+    const char *service = NULL;
+    int copy = 0;
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--copy") == 0) {
+            copy = 1;
+        } else if (!service) {
+            service = argv[i];
+        } else {
+            fprintf(stderr, "Unexpected argument: %s\n", argv[i]);
+            return 1;
+        }
+    }
+    
+    if (!service) {
+        fprintf(stderr, "Usage: cipher get <service> [--copy]\n");
+        return 1;
+    }
+    
+    char password[MASTER_PASSWORD_SIZE];
+    if (!read_master_password(password, sizeof(password))) return 1;
+    
+    PasswordEntry entry;
+    int found = file_lookup_entry(password, service, &entry);
+    memset(password, 0, sizeof(password));
+    
+    if (found < 0) {
+        print_error("Incorrect password or corrupted vault!");
+        return 1;
+    }
+    if (found == 0) {
+        print_error("Service not found!");
+        return 1;
+    }
+    
+    printf("Service:  %s\n", entry.service);
+    printf("Username: %s\n", entry.username);
+    
+    int status = 0;
+    if (copy) {
+        if (clipboard_copy_with_timeout(entry.password, 30)) {
+            print_success("Password copied! Auto-clears in 30 seconds.");
+        } else {
+            print_error("Failed to copy to clipboard.");
+            status = 1;
+        }
+    } else {
+        printf("Password: %s\n", entry.password);
+    }
+    
+    memset(&entry, 0, sizeof(entry));
+    return status;
+}
+
+static int cmd_compress(int argc, char **argv) {
+    uint32_t codec;
+    if (argc == 2 && strcmp(argv[1], "on") == 0) {
+        codec = VAULT_CODEC_LZ;
+    } else if (argc == 2 && strcmp(argv[1], "off") == 0) {
+        codec = VAULT_CODEC_NONE;
+    } else {
+        fprintf(stderr, "Usage: cipher compress <on|off>\n");
+        return 1;
+    }
+    
+    if (file_is_paged()) {
+        print_error("The paged store is not compressed.");
+        return 1;
+    }
+    
+    char password[MASTER_PASSWORD_SIZE];
+    if (!read_master_password(password, sizeof(password))) return 1;
+    
+    int success;
+    PasswordManager *pm = file_load(password, &success);
+    if (!success || !pm) {
+        memset(password, 0, sizeof(password));
+        print_error("Incorrect password or corrupted vault!");
+        return 1;
+    }
+    
+    pm->codec = codec;
+    pm->dirty_shards = ~0ULL;
+    int ok = file_create_backup() && file_save(pm, password);
+    memset(password, 0, sizeof(password));
+    pm_free(pm);
+    
+    if (!ok) {
+        print_error("Failed to rewrite the vault.");
+        return 1;
+    }
+    
+    if (codec == VAULT_CODEC_LZ) {
+        print_success("Vault payload is now compressed before encryption.");
+    } else {
+        print_success("Vault payload is now stored uncompressed.");
+    }
+    return 0;
+}
+
+static int cmd_shard(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: cipher shard <count>\n");
+        return 1;
+    }
+    
+    char *end;
+    long count = strtol(argv[1], &end, 10);
+    if (*end != '\0' || count < 1 || count > MAX_SHARDS) {
+        fprintf(stderr, "Shard count must be between 1 and %d\n", MAX_SHARDS);
+        return 1;
+    }
+    
+    if (file_is_paged()) {
+        print_error("The paged store is not sharded.");
+        return 1;
+    }
+    
+    char password[MASTER_PASSWORD_SIZE];
+    if (!read_master_password(password, sizeof(password))) return 1;
+    
+    int success;
+    PasswordManager *pm = file_load(password, &success);
+    if (!success || !pm) {
+        memset(password, 0, sizeof(password));
+        print_error("Incorrect password or corrupted vault!");
+        return 1;
+    }
+    
+    int ok = file_create_backup() &&
+             file_set_shard_count(pm, password, (size_t)count);
+    memset(password, 0, sizeof(password));
+    pm_free(pm);
+    
+    if (!ok) {
+        print_error("Failed to rewrite the vault.");
+        return 1;
+    }
+    
+    if (count == 1) {
+        print_success("Vault stored as a single file.");
+    } else {
+        print_success("Vault split into shard files.");
+        print_info("%ld shards; later saves rewrite only the shards that changed", count);
+    }
+    return 0;
+}
+
+static void print_range(const char *path, uint64_t offset, uint64_t length,
+                        void *ctx) {
+    const char *label = ctx;
+    
+    if (length == 0) {
+        printf("  %s: %s\n", path, label);
+    } else {
+        printf("  %s: bytes %llu-%llu\n", path, (unsigned long long)offset,
+               (unsigned long long)(offset + length - 1));
+    }
+}
+
+static int cmd_verify(int argc, char **argv) {
+    const char *against = NULL;
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--against") == 0 && i + 1 < argc) {
+            against = argv[++i];
+        } else {
+            fprintf(stderr, "Usage: cipher verify [--against <vault file>]\n");
+            return 1;
+        }
+    }
+    
+    if (against) {
+        // Tree-only comparison: no key needed, payloads are not read
+        long count = file_compare_vaults(file_vault_path(), against,
+                                         print_range, "differs");
+        if (count == -2) {
+            print_error("Both vaults must be saved by this version first.");
+            return 1;
+        }
+        if (count < 0) {
+            print_error("Could not read both vaults.");
+            return 1;
+        }
+        if (count == 0) {
+            print_success("Vaults are identical.");
+        } else {
+            print_info("%ld differing ranges", count);
+        }
+        return count == 0 ? 0 : 2;
+    }
+    
+    char password[MASTER_PASSWORD_SIZE];
+    if (!read_master_password(password, sizeof(password))) return 1;
+    
+    int result = file_verify_integrity(password, print_range, "cannot be checked");
+    memset(password, 0, sizeof(password));
+    
+    if (result == -1) {
+        print_error("Incorrect password or corrupted vault!");
+        return 1;
+    }
+    if (result == -2) {
+        print_info("This vault has no integrity data yet; save it once to add it.");
+        return 1;
+    }
+    if (result == 0) {
+        print_error("Vault is damaged in the ranges listed above.");
+        return 2;
+    }
+    
+    print_success("Vault is intact.");
+    return 0;
+}
+
+static PasswordManager* load_replica(const char *path, const char *password) {
+    int success;
+    PasswordManager *pm = file_load_path(path, password, &success);
+    if (!success || !pm) {
+        fprintf(stderr, "Cannot open %s (wrong password, unreadable, or a paged store)\n",
+                path);
+        return NULL;
+    }
+    return pm;
+}
+
+static int cmd_sync(int argc, char **argv) {
+    const char *paths[2] = {NULL, NULL};
+    const char *base_path = NULL;
+    int count = 0;
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--base") == 0 && i + 1 < argc) {
+            base_path = argv[++i];
+        } else if (count < 2) {
+            paths[count++] = argv[i];
+        } else {
+            count = 3;
+        }
+    }
+    
+    if (count != 2) {
+        fprintf(stderr, "Usage: cipher sync <a> <b> [--base <c>]\n");
+        return 1;
+    }
+    if (strcmp(paths[0], paths[1]) == 0) {
+        print_error("Both replicas are the same file.");
+        return 1;
+    }
+    
+    char password[MASTER_PASSWORD_SIZE];
+    get_password_input("Enter master password: ", password, sizeof(password));
+    
+    PasswordManager *a = load_replica(paths[0], password);
+    PasswordManager *b = a ? load_replica(paths[1], password) : NULL;
+    PasswordManager *base = NULL;
+    if (b && base_path) base = load_replica(base_path, password);
+    
+    int status = 1;
+    if (a && b && (!base_path || base)) {
+        MergeStats stats;
+        PasswordManager *merged = sync_merge(a, b, base, &stats);
+        
+        // Encrypt the result once, then give b the same bytes
+        if (!merged || !file_save_path(merged, password, paths[0]) ||
+            !file_copy_vault(paths[0], paths[1])) {
+            print_error("Failed to write the merged vault.");
+        } else {
+            print_success("Replicas merged.");
+            print_info("%zu entries: %zu added, %zu removed, %zu fields updated, "
+                       "%zu conflicts settled by newest edit",
+                       merged->count, stats.added, stats.removed,
+                       stats.updated, stats.conflicts);
+            status = 0;
+        }
+        pm_free(merged);
+    }
+    
+    memset(password, 0, sizeof(password));
+    pm_free(a);
+    pm_free(b);
+    pm_free(base);
+    return status;
+}
+
+static int log_export(int argc, char **argv) {
+    const char *output = NULL;
+    const char *since_arg = NULL;
+    
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--since") == 0 && i + 1 < argc) {
+            since_arg = argv[++i];
+        } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            output = argv[++i];
+        } else {
+            since_arg = NULL;
+            break;
+        }
+    }
+    
+    char *end = NULL;
+    unsigned long long since = since_arg ? strtoull(since_arg, &end, 10) : 0;
+    if (!since_arg || !output || *end != '\0' || since_arg[0] == '-') {
+        fprintf(stderr, "Usage: cipher log export --since <generation> --output <file>\n");
+        return 1;
+    }
+    
+    char password[MASTER_PASSWORD_SIZE];
+    if (!read_master_password(password, sizeof(password))) return 1;
+    
+    int success;
+    PasswordManager *pm = file_load(password, &success);
+    if (!success || !pm) {
+        memset(password, 0, sizeof(password));
+        print_error("Incorrect password or corrupted vault!");
+        return 1;
+    }
+    
+    long count = changelog_export(pm, (uint64_t)since, password, output);
+    memset(password, 0, sizeof(password));
+    
+    int status = 1;
+    if (count == -2) {
+        print_error("The vault no longer remembers deletions that far back.");
+        print_info("Oldest generation a log can start from: %llu; copy the whole vault instead",
+                   (unsigned long long)pm->log_floor);
+    } else if (count < 0) {
+        print_error("Failed to write the change log.");
+    } else {
+        print_success("Change log written.");
+        print_info("%ld changes after generation %llu, up to generation %llu",
+                   count, since,
+                   (unsigned long long)(pm->generation > since ? pm->generation : since));
+        status = 0;
+    }
+    
+    pm_free(pm);
+    return status;
+}
+
+static int log_apply(int argc, char **argv) {
+    const char *input = NULL;
+    const char *vault = file_vault_path();
+    
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--vault") == 0 && i + 1 < argc) {
+            vault = argv[++i];
+        } else if (!input) {
+            input = argv[i];
+        } else {
+            input = NULL;
+            break;
+        }
+    }
+    
+    if (!input) {
+        fprintf(stderr, "Usage: cipher log apply <file> [--vault <path>]\n");
+        return 1;
+    }
+    
+    char password[MASTER_PASSWORD_SIZE];
+    get_password_input("Enter master password: ", password, sizeof(password));
+    
+    PasswordManager *pm = load_replica(vault, password);
+    if (!pm) {
+        memset(password, 0, sizeof(password));
+        return 1;
+    }
+    
+    uint64_t generation = pm->generation;
+    size_t conflicts = 0;
+    long count = changelog_apply(pm, password, input, &conflicts);
+    
+    int status = 1;
+    if (count == -2) {
+        print_error("The log starts after this replica's generation; export from an older one.");
+        print_info("Replica is at generation %llu", (unsigned long long)generation);
+    } else if (count < 0) {
+        print_error("Cannot apply the log (wrong password or damaged file).");
+    } else if (count == 0 && pm->generation == generation) {
+        print_info("Replica is already at generation %llu; nothing to apply.",
+                   (unsigned long long)generation);
+        status = 0;
+    } else if (!file_save_path(pm, password, vault)) {
+        print_error("Failed to save the replica.");
+    } else {
+        print_success("Change log applied.");
+        print_info("%ld changes; replica is now at generation %llu", count,
+                   (unsigned long long)pm->generation);
+        if (conflicts > 0) {
+            print_info("%zu services were also changed here; the newer edit was kept",
+                       conflicts);
+        }
+        status = 0;
+    }
+    
+    memset(password, 0, sizeof(password));
+    pm_free(pm);
+    return status;
+}
+
+static int cmd_log(int argc, char **argv) {
+    if (argc >= 2 && strcmp(argv[1], "export") == 0) return log_export(argc, argv);
+    if (argc >= 2 && strcmp(argv[1], "apply") == 0) return log_apply(argc, argv);
+    
+    fprintf(stderr, "Usage: cipher log export --since <generation> --output <file>\n");
+    fprintf(stderr, "       cipher log apply <file> [--vault <path>]\n");
+    return 1;
+}
+
+static int cmd_help(int argc, char **argv);
+
+static const Command commands[] = {
+    {"audit", "audit [--breach <corpus>] [--report <file>]", "Find weak, reused and stale passwords", cmd_audit},
+    {"backup", "backup [create|list|restore <id>|prune]", "Take, list, restore or prune deduplicated snapshots", cmd_backup},
+    {"breach", "breach convert <sha1 list> <corpus>", "Convert a HIBP SHA-1 list for audit --breach", cmd_breach},
+    {"compress", "compress <on|off>", "Compress the vault payload before encryption", cmd_compress},
+    {"gen", "gen [--count N] [--length L] [--output <file>]", "Generate random passwords in bulk", cmd_gen},
+    {"gen", "gen --policy <policy> | --service <name>", "Generate passwords that follow a policy", cmd_gen},
+    {"gen", "gen --mask <mask>", "Generate fixed-format passwords (e.g. Cvccvc-99)", cmd_gen},
+    {"gen", "gen --pronounceable [--order 2|3]", "Generate easy-to-type passwords from letter patterns", cmd_gen},
+    {"get", "get <service> [--copy]", "Show one entry (or copy its password)", cmd_get},
+    {"log", "log export --since <gen> --output <file>", "Write the changes made after a generation", cmd_log},
+    {"log", "log apply <file> [--vault <path>]", "Bring a replica up to date from a change log", cmd_log},
+    {"migrate", "migrate", "Convert the vault to the paged on-disk store", cmd_migrate},
+    {"passphrase", "passphrase [--words N] [--wordlist <name|path>]", "Generate a passphrase from a wordlist", cmd_passphrase},
+    {"passphrase", "passphrase --count N [--output <file>] [--distinct]", "Generate passphrases in bulk", cmd_passphrase},
+    {"passphrase", "passphrase --dice <roll>...", "Look up words for dice you rolled (e.g. 31452)", cmd_passphrase},
+    {"policy", "policy set <service> <policy>", "Attach a password policy to a service ('*' = default)", cmd_policy},
+    {"policy", "policy show|remove <service>", "Show or detach the policy of a service", cmd_policy},
+    {"rotate", "rotate <service>... | --all", "Replace passwords with new ones following their policies", cmd_rotate},
+    {"shard", "shard <count>", "Split the vault into <count> shard files (1 = single file)", cmd_shard},
+    {"sync", "sync <a> <b> [--base <c>]", "Merge two vault replicas (three-way with a common base)", cmd_sync},
+    {"verify", "verify [--against <vault file>]", "Check vault integrity, or compare with a replica", cmd_verify},
+    {"help", "help", "Show this help", cmd_help},
+};
+
+#define COMMAND_COUNT (sizeof(commands) / sizeof(commands[0]))
+
+static int cmd_help(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    
+    printf("Usage: cipher [command] [options]\n\n");
+    printf("Without a command, cipher starts the interactive menu.\n\n");
+    printf("Commands:\n");
+    for (size_t i = 0; i < COMMAND_COUNT; i++) {
+        printf("  %-42s %s\n", commands[i].usage, commands[i].description);
+    }
+    return 0;
+}
+
+int run_command(int argc, char **argv) {
+    if (argc < 2) return cmd_help(argc, argv);
+    
+    const char *name = argv[1];
+    if (strcmp(name, "--help") == 0 || strcmp(name, "-h") == 0) {
+        return cmd_help(argc, argv);
+    }
+    
+    // Started by clipboard_copy_with_timeout(), not listed in help
+    if (strcmp(name, CLIPBOARD_SCHEDULER_COMMAND) == 0) {
+        crypto_init();
+        int status = clipboard_scheduler_run();
+        crypto_cleanup();
+        return status;
+    }
+    
+    for (size_t i = 0; i < COMMAND_COUNT; i++) {
+        if (strcmp(name, commands[i].name) == 0) {
+            crypto_init();
+            file_init();
+            int status = commands[i].run(argc - 1, argv + 1);
+            crypto_cleanup();
+            return status;
+        }
+    }
+    
+    fprintf(stderr, "Unknown command: %s\n", name);
+    fprintf(stderr, "Run 'cipher help' for a list of commands.\n");
+    return 1;
+}
@@ -0,0 +1,13 @@
+#ifndef COMMANDS_H
+#define COMMANDS_H
+
+/**
+ * Non-interactive command line interface
+ * Usage: cipher <command> [options]
+ */
+
+// Run the command named by argv[1]
+// Returns: process exit status
+int run_command(int argc, char **argv);
+
+#endif // COMMANDS_H
@@ -0,0 +1,258 @@
+#include "compress.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HASH_BITS 14
+#define MAX_OFFSET 65535
+
+typedef struct {
+    unsigned char *out;
+    size_t pos;
+    size_t capacity;
+} BlockWriter;
+
+static uint32_t read32(const unsigned char *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 |
+           (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint32_t hash_at(const unsigned char *p) {
+    return (read32(p) * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// Bytes beyond the 15 a nibble holds
+static int put_length(BlockWriter *writer, size_t extra) {
+    while (extra >= 255) {
+        if (writer->pos >= writer->capacity) return 0;
+        writer->out[writer->pos++] = 255;
+        extra -= 255;
+    }
+    if (writer->pos >= writer->capacity) return 0;
+    writer->out[writer->pos++] = (unsigned char)extra;
+    return 1;
+}
+
+// Emit literals [literal, literal + literal_len) and, if match_len > 0,
+// a match of match_len bytes at offset
+static int put_sequence(BlockWriter *writer, const unsigned char *literal,
+                        size_t literal_len, size_t offset, size_t match_len) {
+    size_t match_code = match_len ? match_len - COMPRESS_MIN_MATCH : 0;
+    unsigned char token = (unsigned char)((literal_len < 15 ? literal_len : 15) << 4 |
+                                          (match_code < 15 ? match_code : 15));
+
+    if (writer->pos >= writer->capacity) return 0;
+    writer->out[writer->pos++] = token;
+    if (literal_len >= 15 && !put_length(writer, literal_len - 15)) return 0;
+
+    if (writer->capacity - writer->pos < literal_len) return 0;
+    memcpy(writer->out + writer->pos, literal, literal_len);
+    writer->pos += literal_len;
+
+    if (match_len == 0) return 1;
+
+    if (writer->capacity - writer->pos < 2) return 0;
+    writer->out[writer->pos++] = (unsigned char)(offset & 0xff);
+    writer->out[writer->pos++] = (unsigned char)(offset >> 8);
+    return match_code < 15 || put_length(writer, match_code - 15);
+}
+
+size_t compress_bound(size_t len) {
+    return len + len / 255 + 16;
+}
+
+// Compress window[start, end); window[0, start) is history matches may
+// reach back into
+static size_t compress_window(const unsigned char *window, size_t start,
+                              size_t end, unsigned char *out, size_t capacity) {
+    uint32_t *table = calloc((size_t)1 << HASH_BITS, sizeof(uint32_t));
+    if (!table) return 0;
+
+    for (size_t pos = 0; pos + COMPRESS_MIN_MATCH <= start; pos++) {
+        table[hash_at(window + pos)] = (uint32_t)(pos + 1);
+    }
+
+    BlockWriter writer = {out, 0, capacity};
+    size_t anchor = start;
+    size_t pos = start;
+    int ok = 1;
+
+    while (ok && pos + COMPRESS_MIN_MATCH <= end) {
+        uint32_t slot = hash_at(window + pos);
+        size_t candidate = table[slot];     // Position + 1; 0 = empty
+        table[slot] = (uint32_t)(pos + 1);
+
+        if (candidate == 0 || pos - (candidate - 1) > MAX_OFFSET ||
+            read32(window + candidate - 1) != read32(window + pos)) {
+            pos++;
+            continue;
+        }
+
+        size_t match = candidate - 1;
+        size_t match_len = COMPRESS_MIN_MATCH;
+        while (pos + match_len < end &&
+               window[match + match_len] == window[pos + match_len]) {
+            match_len++;
+        }
+
+        ok = put_sequence(&writer, window + anchor, pos - anchor, pos - match, match_len);
+        pos += match_len;
+        anchor = pos;
+    }
+
+    if (ok) ok = put_sequence(&writer, window + anchor, end - anchor, 0, 0);
+
+    free(table);
+    return ok ? writer.pos : 0;
+}
+
+size_t compress_block(const unsigned char *in, size_t len,
+                      unsigned char *out, size_t capacity) {
+    if (!in || !out) return 0;
+    return compress_window(in, 0, len, out, capacity);
+}
+
+size_t compress_block_dict(const unsigned char *dict, size_t dict_len,
+                           const unsigned char *in, size_t len,
+                           unsigned char *out, size_t capacity) {
+    if (!in || !out || dict_len > COMPRESS_MAX_DICT) return 0;
+    if (!dict || dict_len == 0) return compress_window(in, 0, len, out, capacity);
+
+    // Matches into the dictionary are plain back-references once it sits
+    // right in front of the input
+    unsigned char *window = malloc(dict_len + len);
+    if (!window) return 0;
+
+    memcpy(window, dict, dict_len);
+    memcpy(window + dict_len, in, len);
+    size_t packed = compress_window(window, dict_len, dict_len + len, out, capacity);
+
+    memset(window, 0, dict_len + len);
+    free(window);
+    return packed;
+}
+
+// Read the rest of a length whose nibble was 15
+static int get_length(const unsigned char *in, size_t len, size_t *pos,
+                      size_t *value) {
+    unsigned char byte;
+    do {
+        if (*pos >= len) return 0;
+        byte = in[(*pos)++];
+        if (*value > SIZE_MAX - byte) return 0;
+        *value += byte;
+    } while (byte == 255);
+    return 1;
+}
+
+int decompress_block(const unsigned char *in, size_t len,
+                     unsigned char *out, size_t out_len) {
+    return decompress_block_dict(NULL, 0, in, len, out, out_len);
+}
+
+int decompress_block_dict(const unsigned char *dict, size_t dict_len,
+                          const unsigned char *in, size_t len,
+                          unsigned char *out, size_t out_len) {
+    if (!in || (!out && out_len > 0) || (!dict && dict_len > 0)) return 0;
+
+    size_t pos = 0;
+    size_t written = 0;
+
+    while (pos < len) {
+        unsigned char token = in[pos++];
+
+        size_t literal_len = token >> 4;
+        if (literal_len == 15 && !get_length(in, len, &pos, &literal_len)) return 0;
+        if (len - pos < literal_len || out_len - written < literal_len) return 0;
+
+        memcpy(out + written, in + pos, literal_len);
+        pos += literal_len;
+        written += literal_len;
+
+        // The last sequence has no match
+        if (pos == len) break;
+
+        if (len - pos < 2) return 0;
+        size_t offset = (size_t)in[pos] | (size_t)in[pos + 1] << 8;
+        pos += 2;
+
+        size_t match_len = token & 0x0f;
+        if (match_len == 15 && !get_length(in, len, &pos, &match_len)) return 0;
+        match_len += COMPRESS_MIN_MATCH;
+
+        if (offset == 0 || offset > dict_len + written ||
+            out_len - written < match_len) {
+            return 0;
+        }
+
+        // Byte by byte: a match may overlap the bytes it produces, and may
+        // start in the dictionary and run on into the output
+        for (size_t i = 0; i < match_len; i++) {
+            size_t back = written + i;
+            out[back] = back >= offset ? out[back - offset]
+                                       : dict[dict_len - (offset - back)];
+        }
+        written += match_len;
+    }
+
+    return written == out_len;
+}
+
+typedef struct {
+    const char *text;
+    size_t len;
+    size_t count;
+} Sample;
+
+static int compare_strings(const void *a, const void *b) {
+    return strcmp(*(const char* const*)a, *(const char* const*)b);
+}
+
+// Higher score first
+static int compare_scores(const void *a, const void *b) {
+    const Sample *x = a;
+    const Sample *y = b;
+    size_t score_x = x->count * x->len;
+    size_t score_y = y->count * y->len;
+    return score_x < score_y ? 1 : score_x > score_y ? -1 : 0;
+}
+
+size_t compress_train_dictionary(const char **samples, size_t count,
+                                 unsigned char *dict, size_t capacity) {
+    if (!samples || !dict || count == 0) return 0;
+    if (capacity > COMPRESS_MAX_DICT) capacity = COMPRESS_MAX_DICT;
+
+    // Sorting brings equal strings together to be counted
+    qsort(samples, count, sizeof(const char*), compare_strings);
+
+    Sample *unique = malloc(sizeof(Sample) * count);
+    if (!unique) return 0;
+
+    size_t unique_count = 0;
+    for (size_t i = 0; i < count;) {
+        size_t run = 1;
+        while (i + run < count && strcmp(samples[i], samples[i + run]) == 0) run++;
+
+        size_t len = strlen(samples[i]);
+        if (run > 1 && len >= COMPRESS_MIN_MATCH) {
+            unique[unique_count].text = samples[i];
+            unique[unique_count].len = len;
+            unique[unique_count].count = run;
+            unique_count++;
+        }
+        i += run;
+    }
+    qsort(unique, unique_count, sizeof(Sample), compare_scores);
+
+    // Fill from the back so the best strings get the shortest offsets
+    size_t used = 0;
+    for (size_t i = 0; i < unique_count; i++) {
+        if (unique[i].len > capacity - used) continue;
+        used += unique[i].len;
+        memcpy(dict + capacity - used, unique[i].text, unique[i].len);
+    }
+    memmove(dict, dict + capacity - used, used);
+
+    free(unique);
+    return used;
+}
@@ -0,0 +1,57 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stddef.h>
+
+/**
+ * Built-in LZ77 block codec (LZ4-class)
+ *
+ * Compresses plaintext before it is encrypted; ciphertext does not
+ * compress. A block is a series of sequences, each a token byte (high
+ * nibble: literal count, low nibble: match length - COMPRESS_MIN_MATCH,
+ * 15 meaning "more bytes follow, 255 each, until one below 255"), the
+ * literals, then a 16-bit little-endian match offset and any match length
+ * bytes. The last sequence carries literals only. Matches are found with
+ * a single hash probe per position, trading some ratio for speed.
+ *
+ * A dictionary is history placed in front of every block: matches may
+ * reach back into it, so strings that recur across blocks (domains,
+ * usernames, email suffixes) cost a match instead of literals even in
+ * the block where they first appear.
+ */
+
+#define COMPRESS_MIN_MATCH 4
+
+// Largest dictionary a match offset can reach across
+#define COMPRESS_MAX_DICT 32768
+
+// Largest compressed size of len input bytes (incompressible data)
+size_t compress_bound(size_t len);
+
+// Compress len bytes of in into out (room for capacity bytes)
+// Returns: compressed size, or 0 if it does not fit
+size_t compress_block(const unsigned char *in, size_t len,
+                      unsigned char *out, size_t capacity);
+
+// Decompress a block that must expand to exactly out_len bytes
+// Returns: 1 on success, 0 if the block is malformed
+int decompress_block(const unsigned char *in, size_t len,
+                     unsigned char *out, size_t out_len);
+
+// As above, with dict (at most COMPRESS_MAX_DICT bytes) as history; a
+// block must be decompressed with the dictionary it was compressed with
+size_t compress_block_dict(const unsigned char *dict, size_t dict_len,
+                           const unsigned char *in, size_t len,
+                           unsigned char *out, size_t capacity);
+int decompress_block_dict(const unsigned char *dict, size_t dict_len,
+                          const unsigned char *in, size_t len,
+                          unsigned char *out, size_t out_len);
+
+// Build a dictionary from sample strings: those seen at least twice, by
+// occurrences times length, best last (nearest the data) until capacity.
+// samples is sorted in place.
+// Returns: dictionary length
+size_t compress_train_dictionary(const char **samples, size_t count,
+                                 unsigned char *dict, size_t capacity);
+
+#endif // COMPRESS_H
@@ -1,6 +1,10 @@
 #include "crypto.h"
+#include <limits.h>
+#include <stdlib.h>
 #include <string.h>
+#include <openssl/crypto.h>
 #include <openssl/evp.h>
+#include <openssl/hmac.h>
 #include <openssl/rand.h>
 #include <openssl/sha.h>
 
@@ -94,6 +98,177 @@ int decrypt_data(const unsigned char *ciphertext, size_t ciphertext_len,
     return 1;
 }
 
+struct CryptoStream {
+    EVP_CIPHER_CTX *ctx;
+    int encrypt;
+};
+
+CryptoStream* crypto_stream_new(int encrypt, const unsigned char *key,
+                                const unsigned char *iv) {
+    if (!key || !iv) return NULL;
+    
+    CryptoStream *stream = malloc(sizeof(CryptoStream));
+    if (!stream) return NULL;
+    
+    stream->encrypt = encrypt ? 1 : 0;
+    stream->ctx = EVP_CIPHER_CTX_new();
+    if (!stream->ctx) {
+        free(stream);
+        return NULL;
+    }
+    
+    if (EVP_CipherInit_ex(stream->ctx, EVP_aes_256_cbc(), NULL, key, iv,
+                          stream->encrypt) != 1) {
+        crypto_stream_free(stream);
+        return NULL;
+    }
+    
+    return stream;
+}
+
+int crypto_stream_update(CryptoStream *stream, const unsigned char *in,
+                         size_t in_len, unsigned char *out, size_t *out_len) {
+    if (!stream || in_len > INT_MAX - CRYPTO_BLOCK_SIZE) return 0;
+    
+    int len;
+    if (EVP_CipherUpdate(stream->ctx, out, &len, in, (int)in_len) != 1) {
+        return 0;
+    }
+    
+    *out_len = len;
+    return 1;
+}
+
+int crypto_stream_final(CryptoStream *stream, unsigned char *out,
+                        size_t *out_len) {
+    if (!stream) return 0;
+    
+    int len;
+    if (EVP_CipherFinal_ex(stream->ctx, out, &len) != 1) {
+        return 0;
+    }
+    
+    *out_len = len;
+    return 1;
+}
+
+void crypto_stream_free(CryptoStream *stream) {
+    if (!stream) return;
+    
+    EVP_CIPHER_CTX_free(stream->ctx);
+    free(stream);
+}
+
+int decrypt_blocks(const unsigned char *ciphertext, size_t len,
+                   const unsigned char *key, const unsigned char *iv,
+                   unsigned char *plaintext) {
+    EVP_CIPHER_CTX *ctx;
+    int out_len;
+    int ok = 0;
+    
+    if (len % CRYPTO_BLOCK_SIZE != 0 || len > INT_MAX) return 0;
+    if (!(ctx = EVP_CIPHER_CTX_new())) return 0;
+    
+    if (EVP_DecryptInit_ex(ctx, EVP_aes_256_cbc(), NULL, key, iv) == 1 &&
+        EVP_CIPHER_CTX_set_padding(ctx, 0) == 1 &&
+        EVP_DecryptUpdate(ctx, plaintext, &out_len, ciphertext, (int)len) == 1 &&
+        (size_t)out_len == len) {
+        ok = 1;
+    }
+    
+    EVP_CIPHER_CTX_free(ctx);
+    return ok;
+}
+
+int hmac_sha256(const unsigned char *key, const void *data, size_t len,
+                unsigned char *out) {
+    if (!key || !out) return 0;
+    
+    unsigned int out_len = 0;
+    return HMAC(EVP_sha256(), key, KEY_SIZE, data, len,
+                out, &out_len) != NULL && out_len == HASH_SIZE;
+}
+
+int sha256(const void *data, size_t len, unsigned char *out) {
+    if (!out) return 0;
+    
+    unsigned int out_len = 0;
+    return EVP_Digest(data, len, out, &out_len, EVP_sha256(), NULL) == 1 &&
+           out_len == HASH_SIZE;
+}
+
+int sha1(const void *data, size_t len, unsigned char *out) {
+    if (!out) return 0;
+    
+    unsigned int out_len = 0;
+    return EVP_Digest(data, len, out, &out_len, EVP_sha1(), NULL) == 1 &&
+           out_len == SHA1_SIZE;
+}
+
+int derive_subkey(const unsigned char *key, const char *label,
+                  unsigned char *out) {
+    if (!label) return 0;
+    return hmac_sha256(key, label, strlen(label), out);
+}
+
+int aead_encrypt(const unsigned char *key, const unsigned char *nonce,
+                 const unsigned char *aad, size_t aad_len,
+                 const unsigned char *plaintext, size_t len,
+                 unsigned char *ciphertext, unsigned char *tag) {
+    EVP_CIPHER_CTX *ctx;
+    int out_len;
+    int ok = 0;
+    
+    if (len > INT_MAX || aad_len > INT_MAX) return 0;
+    if (!(ctx = EVP_CIPHER_CTX_new())) return 0;
+    
+    if (EVP_EncryptInit_ex(ctx, EVP_aes_256_gcm(), NULL, NULL, NULL) == 1 &&
+        EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, AEAD_NONCE_SIZE, NULL) == 1 &&
+        EVP_EncryptInit_ex(ctx, NULL, NULL, key, nonce) == 1 &&
+        (aad_len == 0 ||
+         EVP_EncryptUpdate(ctx, NULL, &out_len, aad, (int)aad_len) == 1) &&
+        EVP_EncryptUpdate(ctx, ciphertext, &out_len, plaintext, (int)len) == 1 &&
+        EVP_EncryptFinal_ex(ctx, ciphertext + out_len, &out_len) == 1 &&
+        EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, AEAD_TAG_SIZE, tag) == 1) {
+        ok = 1;
+    }
+    
+    EVP_CIPHER_CTX_free(ctx);
+    return ok;
+}
+
+int aead_decrypt(const unsigned char *key, const unsigned char *nonce,
+                 const unsigned char *aad, size_t aad_len,
+                 const unsigned char *ciphertext, size_t len,
+                 const unsigned char *tag, unsigned char *plaintext) {
+    EVP_CIPHER_CTX *ctx;
+    int out_len;
+    int ok = 0;
+    
+    if (len > INT_MAX || aad_len > INT_MAX) return 0;
+    if (!(ctx = EVP_CIPHER_CTX_new())) return 0;
+    
+    if (EVP_DecryptInit_ex(ctx, EVP_aes_256_gcm(), NULL, NULL, NULL) == 1 &&
+        EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, AEAD_NONCE_SIZE, NULL) == 1 &&
+        EVP_DecryptInit_ex(ctx, NULL, NULL, key, nonce) == 1 &&
+        (aad_len == 0 ||
+         EVP_DecryptUpdate(ctx, NULL, &out_len, aad, (int)aad_len) == 1) &&
+        EVP_DecryptUpdate(ctx, plaintext, &out_len, ciphertext, (int)len) == 1 &&
+        EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, AEAD_TAG_SIZE,
+                            (void*)tag) == 1 &&
+        EVP_DecryptFinal_ex(ctx, plaintext + out_len, &out_len) == 1) {
+        ok = 1;
+    }
+    
+    EVP_CIPHER_CTX_free(ctx);
+    if (!ok) memset(plaintext, 0, len);
+    return ok;
+}
+
+int crypto_equal(const void *a, const void *b, size_t len) {
+    return CRYPTO_memcmp(a, b, len) == 0;
+}
+
 int generate_random_bytes(unsigned char *buffer, size_t length) {
     return RAND_bytes(buffer, length) == 1;
 }
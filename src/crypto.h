@@ -7,6 +7,13 @@
 #define IV_SIZE 16          // 128 bits
 #define SALT_SIZE 16        // 128 bits
 #define HASH_SIZE 32        // SHA-256 output
+#define SHA1_SIZE 20        // SHA-1 output
+#define CRYPTO_BLOCK_SIZE 16 // AES block size
+#define AEAD_NONCE_SIZE 12  // AES-GCM nonce
+#define AEAD_TAG_SIZE 16    // AES-GCM authentication tag
+
+// Incremental AES-256-CBC context (opaque)
+typedef struct CryptoStream CryptoStream;
 
 // Initialize crypto library
 int crypto_init(void);
@@ -32,6 +39,65 @@ int decrypt_data(const unsigned char *ciphertext, size_t ciphertext_len,
                  const unsigned char *key, const unsigned char *iv,
                  unsigned char *plaintext, size_t *plaintext_len);
 
+// Start an incremental AES-256-CBC encryption (encrypt = 1) or decryption
+// Returns: new stream, or NULL on failure
+CryptoStream* crypto_stream_new(int encrypt, const unsigned char *key,
+                                const unsigned char *iv);
+
+// Process the next piece of input
+// out must have room for in_len + CRYPTO_BLOCK_SIZE bytes
+int crypto_stream_update(CryptoStream *stream, const unsigned char *in,
+                         size_t in_len, unsigned char *out, size_t *out_len);
+
+// Finish the stream (writes padding on encrypt, checks it on decrypt)
+// out must have room for CRYPTO_BLOCK_SIZE bytes
+int crypto_stream_final(CryptoStream *stream, unsigned char *out,
+                        size_t *out_len);
+
+// Free stream and wipe its key schedule
+void crypto_stream_free(CryptoStream *stream);
+
+// Decrypt whole AES-256-CBC blocks without touching padding, for random
+// access into a payload. iv is the ciphertext block preceding the first
+// one (or the payload IV); len must be a multiple of CRYPTO_BLOCK_SIZE.
+int decrypt_blocks(const unsigned char *ciphertext, size_t len,
+                   const unsigned char *key, const unsigned char *iv,
+                   unsigned char *plaintext);
+
+// Derive an independent sub-key for one purpose from a vault key
+// (HMAC-SHA256 of the label under key). out receives KEY_SIZE bytes.
+int derive_subkey(const unsigned char *key, const char *label,
+                  unsigned char *out);
+
+// Encrypt and authenticate data using AES-256-GCM
+// aad is authenticated but not encrypted; ciphertext is len bytes
+int aead_encrypt(const unsigned char *key, const unsigned char *nonce,
+                 const unsigned char *aad, size_t aad_len,
+                 const unsigned char *plaintext, size_t len,
+                 unsigned char *ciphertext, unsigned char *tag);
+
+// Decrypt data using AES-256-GCM
+// Returns: 1 if the tag matches, 0 if the data was tampered with
+int aead_decrypt(const unsigned char *key, const unsigned char *nonce,
+                 const unsigned char *aad, size_t aad_len,
+                 const unsigned char *ciphertext, size_t len,
+                 const unsigned char *tag, unsigned char *plaintext);
+
+// Keyed hash (HMAC-SHA256) of data; out receives HASH_SIZE bytes
+int hmac_sha256(const unsigned char *key, const void *data, size_t len,
+                unsigned char *out);
+
+// Plain SHA-256 of data; out receives HASH_SIZE bytes
+int sha256(const void *data, size_t len, unsigned char *out);
+
+// SHA-1 of data, only for matching published breach corpora;
+// out receives SHA1_SIZE bytes
+int sha1(const void *data, size_t len, unsigned char *out);
+
+// Constant-time comparison of secrets
+// Returns: 1 if equal, 0 if not
+int crypto_equal(const void *a, const void *b, size_t len);
+
 // Generate random bytes
 int generate_random_bytes(unsigned char *buffer, size_t length);
 
@@ -1,36 +1,49 @@
 #include "file_io.h"
+#include "blind_index.h"
+#include "btree.h"
+#include "compress.h"
 #include "crypto.h"
+#include "merkle.h"
 #include "utils.h"
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/stat.h>
 
 #ifdef _WIN32
     #include <direct.h>
     #define mkdir(path, mode) _mkdir(path)
+    #define rmdir(path) _rmdir(path)
 #else
     #include <unistd.h>
+    #include <pthread.h>
 #endif
 
+#define PATH_SIZE 600
+
 static char data_dir_path[512] = {0};
 static char data_file_path[512] = {0};
 static char backup_file_path[512] = {0};
+static char store_file_path[512] = {0};
+static char store_backup_file_path[512] = {0};
 
 // Get or create the data directory
 const char* get_data_dir(void) {
     if (data_dir_path[0] != '\0') {
         return data_dir_path;
     }
-    
+
     const char *home = getenv("HOME");
-    
+
 #ifdef _WIN32
     if (!home) {
         home = getenv("USERPROFILE");
     }
 #endif
-    
+
     if (!home) {
         // Fallback to current directory
         strncpy(data_dir_path, ".cipher", sizeof(data_dir_path) - 1);
@@ -38,7 +51,7 @@ const char* get_data_dir(void) {
         // Use ~/.cipher on Unix or %USERPROFILE%\.cipher on Windows
         snprintf(data_dir_path, sizeof(data_dir_path), "%s/.cipher", home);
     }
-    
+
     return data_dir_path;
 }
 
@@ -47,7 +60,7 @@ static const char* get_data_file_path(void) {
     if (data_file_path[0] != '\0') {
         return data_file_path;
     }
-    
+
     const char *dir = get_data_dir();
     snprintf(data_file_path, sizeof(data_file_path), "%s/%s", dir, DATA_FILE_NAME);
     return data_file_path;
@@ -58,15 +71,74 @@ static const char* get_backup_file_path(void) {
     if (backup_file_path[0] != '\0') {
         return backup_file_path;
     }
-    
+
     const char *dir = get_data_dir();
     snprintf(backup_file_path, sizeof(backup_file_path), "%s/%s", dir, BACKUP_FILE_NAME);
     return backup_file_path;
 }
 
+// Get full path to paged store file
+static const char* get_store_file_path(void) {
+    if (store_file_path[0] != '\0') {
+        return store_file_path;
+    }
+
+    const char *dir = get_data_dir();
+    snprintf(store_file_path, sizeof(store_file_path), "%s/%s", dir, STORE_FILE_NAME);
+    return store_file_path;
+}
+
+// Get full path to paged store backup file
+static const char* get_store_backup_file_path(void) {
+    if (store_backup_file_path[0] != '\0') {
+        return store_backup_file_path;
+    }
+
+    const char *dir = get_data_dir();
+    snprintf(store_backup_file_path, sizeof(store_backup_file_path), "%s/%s",
+             dir, STORE_BACKUP_FILE_NAME);
+    return store_backup_file_path;
+}
+
+// The main file of a vault and, when it is sharded, the shard table
+// its payload holds
+typedef struct {
+    FileHeader header;
+    ShardSeal shards[MAX_SHARDS];
+} VaultLayout;
+
+// Directory holding the shard files of shard set shard_set. Every full
+// rewrite of a sharded vault starts a new set, so it never touches the
+// files the current main file points to.
+// Returns: 0 if the path does not fit in buffer
+static int shard_dir_path(const char *vault_path, uint64_t shard_set,
+                          char *buffer, size_t size) {
+    int written = snprintf(buffer, size, "%s.%016llx", vault_path,
+                           (unsigned long long)shard_set);
+    return written > 0 && (size_t)written < size;
+}
+
+// Path of shard file number shard as the layout records it
+// Returns: 0 if the path does not fit in buffer
+static int shard_file_path(const char *vault_path, const VaultLayout *layout,
+                           size_t shard, char *buffer, size_t size) {
+    int written = snprintf(buffer, size, "%s.%016llx/%03u.%llu", vault_path,
+                           (unsigned long long)layout->header.shard_set,
+                           (unsigned)shard,
+                           (unsigned long long)layout->shards[shard].generation);
+    return written > 0 && (size_t)written < size;
+}
+
+// Path of the blind index belonging to a vault or shard file
+// Returns: 0 if the path does not fit in buffer
+static int index_file_path(const char *vault_path, char *buffer, size_t size) {
+    int written = snprintf(buffer, size, "%s%s", vault_path, INDEX_FILE_SUFFIX);
+    return written > 0 && (size_t)written < size;
+}
+
 int file_init(void) {
     const char *dir = get_data_dir();
-    
+
     // Create directory if it doesn't exist
     struct stat st = {0};
     if (stat(dir, &st) == -1) {
@@ -76,12 +148,12 @@ int file_init(void) {
         mkdir(dir, 0700);
 #endif
     }
-    
+
     return 1;
 }
 
-int file_exists(void) {
-    FILE *file = fopen(get_data_file_path(), "rb");
+int file_is_paged(void) {
+    FILE *file = fopen(get_store_file_path(), "rb");
     if (file) {
         fclose(file);
         return 1;
@@ -89,251 +161,2011 @@ int file_exists(void) {
     return 0;
 }
 
-int file_save(PasswordManager *pm, const char *master_password) {
-    if (!pm || !master_password) return 0;
-    
-    FILE *file = fopen(get_data_file_path(), "wb");
-    if (!file) return 0;
-    
-    // Generate salt and IV
-    FileHeader header;
-    if (!generate_random_bytes(header.salt, sizeof(header.salt)) ||
-        !generate_random_bytes(header.iv, sizeof(header.iv))) {
-        fclose(file);
-        return 0;
-    }
-    
-    // Hash master password
-    if (!hash_password(master_password, header.salt, 
-                      header.hash, sizeof(header.hash))) {
-        fclose(file);
-        return 0;
-    }
-    
-    header.entry_count = pm->count;
-    
-    // Write header
-    if (fwrite(&header, sizeof(FileHeader), 1, file) != 1) {
-        fclose(file);
-        return 0;
-    }
-    
-    // Derive encryption key
-    unsigned char key[KEY_SIZE];
-    if (!derive_key(master_password, header.salt, key, KEY_SIZE)) {
+int file_exists(void) {
+    FILE *file = fopen(get_data_file_path(), "rb");
+    if (file) {
         fclose(file);
-        return 0;
+        return 1;
     }
-    
-    // Handle empty vault (no entries)
-    if (pm->count == 0) {
-        // Write zero length for empty vault
-        size_t ciphertext_len = 0;
-        if (fwrite(&ciphertext_len, sizeof(size_t), 1, file) != 1) {
-            fclose(file);
+    return file_is_paged();
+}
+
+// ============================================================================
+// HEADER AND PAYLOAD FORMAT
+// ============================================================================
+
+// Header layout used before VAULT_VERSION 2
+typedef struct {
+    unsigned char salt[16];
+    unsigned char hash[32];
+    unsigned char iv[16];
+    size_t entry_count;
+} LegacyFileHeader;
+
+// Size of the blocks the vault payload is streamed through
+#define STREAM_CHUNK_SIZE 4096
+
+// Ciphertext length of a CBC-encrypted payload (PKCS#7 always pads)
+static size_t payload_ciphertext_len(size_t plaintext_len) {
+    return (plaintext_len / CRYPTO_BLOCK_SIZE + 1) * CRYPTO_BLOCK_SIZE;
+}
+
+// Fill in a header for the current format
+static void init_header(FileHeader *header) {
+    memset(header, 0, sizeof(FileHeader));
+    memcpy(header->magic, VAULT_MAGIC, sizeof(header->magic));
+    header->version = VAULT_VERSION;
+    header->header_size = sizeof(FileHeader);
+    header->record_size = sizeof(PasswordEntry);
+}
+
+// Smallest header each format version may have
+static size_t minimum_header_size(uint32_t version) {
+    if (version >= 6) return sizeof(FileHeader);
+    if (version >= 4) return offsetof(FileHeader, shard_set);
+    if (version == 3) return offsetof(FileHeader, generation);
+    return offsetof(FileHeader, merkle_root);
+}
+
+// Read a header in any format and leave file at the payload.
+// Legacy headers are converted so callers only see FileHeader.
+static int read_header(FILE *file, FileHeader *header) {
+    memset(header, 0, sizeof(FileHeader));
+
+    size_t prefix = offsetof(FileHeader, header_size) + sizeof(header->header_size);
+    if (fread(header, 1, prefix, file) != prefix) return 0;
+
+    if (memcmp(header->magic, VAULT_MAGIC, sizeof(header->magic)) != 0) {
+        LegacyFileHeader legacy;
+        size_t ciphertext_len;
+
+        if (fseek(file, 0, SEEK_SET) != 0 ||
+            fread(&legacy, sizeof(legacy), 1, file) != 1 ||
+            fread(&ciphertext_len, sizeof(size_t), 1, file) != 1) {
             return 0;
         }
-        fclose(file);
-        memset(key, 0, KEY_SIZE);
+
+        init_header(header);
+        header->header_size = sizeof(LegacyFileHeader) + sizeof(size_t);
+        memcpy(header->salt, legacy.salt, sizeof(header->salt));
+        memcpy(header->hash, legacy.hash, sizeof(header->hash));
+        memcpy(header->iv, legacy.iv, sizeof(header->iv));
+        header->entry_count = legacy.entry_count;
+        header->payload_len = ciphertext_len;
         return 1;
     }
-    
-    // Serialize and encrypt entries
-    size_t data_size = sizeof(PasswordEntry) * pm->count;
-    unsigned char *plaintext = (unsigned char*)pm->entries;
-    unsigned char *ciphertext = malloc(data_size + 128); // Extra space for padding
-    if (!ciphertext) {
-        fclose(file);
-        return 0;
-    }
-    
-    size_t ciphertext_len;
-    if (!encrypt_data(plaintext, data_size, key, header.iv, 
-                     ciphertext, &ciphertext_len)) {
-        free(ciphertext);
-        fclose(file);
-        return 0;
-    }
-    
-    // Write encrypted data
-    if (fwrite(&ciphertext_len, sizeof(size_t), 1, file) != 1 ||
-        fwrite(ciphertext, 1, ciphertext_len, file) != ciphertext_len) {
-        free(ciphertext);
-        fclose(file);
+
+    // Newer versions only append fields; fields an older header lacks
+    // stay zeroed
+    if (header->version < 2 || header->version > VAULT_VERSION ||
+        header->header_size < minimum_header_size(header->version) ||
+        header->header_size > sizeof(FileHeader) ||
+        fread((unsigned char*)header + prefix, 1, header->header_size - prefix,
+              file) != header->header_size - prefix) {
         return 0;
     }
-    
-    free(ciphertext);
-    fclose(file);
-    
-    // Clear sensitive data
-    memset(key, 0, KEY_SIZE);
-    
-    return 1;
+
+    // Records may only have grown since; older, shorter records are
+    // widened with zeroed fields while loading
+    return header->record_size > 0 &&
+           header->record_size <= sizeof(PasswordEntry) &&
+           header->shard_count <= MAX_SHARDS &&
+           header->codec <= VAULT_CODEC_LZ;
 }
 
-PasswordManager* file_load(const char *master_password, int *success) {
-    *success = 0;
-    
-    FILE *file = fopen(get_data_file_path(), "rb");
-    if (!file) return NULL;
-    
-    // Read header
-    FileHeader header;
-    if (fread(&header, sizeof(FileHeader), 1, file) != 1) {
-        fclose(file);
-        return NULL;
+// HMAC of the header with the MAC field zeroed, under a sub-key of the
+// vault key (version 3 headers ended at the MAC and covered only the
+// fields before it; versions 4 and 5 ended before shard_set)
+static int compute_header_mac(const FileHeader *header, const unsigned char *key,
+                              unsigned char *out) {
+    unsigned char mac_key[KEY_SIZE];
+    FileHeader copy = *header;
+    size_t len = header->version == 3 ? offsetof(FileHeader, header_mac)
+               : header->version < 6 ? offsetof(FileHeader, shard_set)
+                                     : sizeof(FileHeader);
+
+    memset(copy.header_mac, 0, sizeof(copy.header_mac));
+    int ok = derive_subkey(key, "cipher-header-mac", mac_key) &&
+             hmac_sha256(mac_key, &copy, len, out);
+    memset(mac_key, 0, sizeof(mac_key));
+    return ok;
+}
+
+// Check the header MAC (headers before VAULT_VERSION 3 have none)
+static int header_is_authentic(const FileHeader *header, const unsigned char *key) {
+    if (header->version < 3) return 1;
+
+    unsigned char mac[HASH_SIZE];
+    return compute_header_mac(header, key, mac) &&
+           crypto_equal(mac, header->header_mac, HASH_SIZE);
+}
+
+// Where the Merkle tree of a file starts
+static long tree_offset(const FileHeader *header) {
+    return (long)(header->header_size + header->payload_len);
+}
+
+// Records in the payload: entries, then tombstones
+static uint64_t header_records(const FileHeader *header) {
+    return header->entry_count + header->tombstone_count;
+}
+
+// Largest plaintext a compressed payload of data_size record bytes may
+// take: every frame incompressible, plus the dictionary
+static size_t compressed_payload_bound(size_t data_size) {
+    size_t frames = data_size / (VAULT_BLOCK_RECORDS * sizeof(PasswordEntry)) + 2;
+    return compress_bound(data_size) + frames * (sizeof(VaultFrame) + 16) +
+           VAULT_DICT_SIZE;
+}
+
+// Check that the payload length describes exactly the records the header
+// announces before anything is sized from it (a compressed payload can
+// only be checked against its largest possible size)
+static int payload_is_consistent(const FileHeader *header) {
+    uint64_t records = header_records(header);
+
+    if (records < header->entry_count) return 0;
+    if (records == 0) return 1;
+    if (records > SIZE_MAX / sizeof(PasswordEntry) / 2) return 0;
+
+    size_t data_size = header->record_size * (size_t)records;
+    if (header->codec == VAULT_CODEC_LZ) {
+        return header->payload_len > 0 &&
+               header->payload_len % CRYPTO_BLOCK_SIZE == 0 &&
+               header->payload_len <=
+                   payload_ciphertext_len(compressed_payload_bound(data_size));
     }
-    
-    // Verify master password
-    if (!verify_master_password(master_password, header.salt, header.hash)) {
-        fclose(file);
-        return NULL;
+    return header->payload_len == payload_ciphertext_len(data_size);
+}
+
+// Read the shard table that follows the main header of a sharded vault
+// and check it against the header's Merkle root (and so, once the header
+// MAC has been checked, against the key) and against the header totals
+static int read_shard_table(FILE *file, VaultLayout *layout) {
+    const FileHeader *header = &layout->header;
+    size_t shard_count = header->shard_count;
+    size_t table_len = shard_count * sizeof(ShardSeal);
+
+    if (shard_count == 0) return 1;
+    if (header->version < 6 || header->payload_len != table_len ||
+        fseek(file, (long)header->header_size, SEEK_SET) != 0 ||
+        fread(layout->shards, sizeof(ShardSeal), shard_count, file) != shard_count) {
+        return 0;
     }
-    
-    // Derive decryption key
-    unsigned char key[KEY_SIZE];
-    if (!derive_key(master_password, header.salt, key, KEY_SIZE)) {
-        fclose(file);
-        return NULL;
+
+    unsigned char root[HASH_SIZE];
+    MerkleTree *tree = merkle_new();
+    int ok = tree && merkle_append(tree, (const unsigned char*)layout->shards,
+                                   table_len) &&
+             merkle_finish(tree);
+    if (ok) {
+        merkle_root(tree, root);
+        ok = memcmp(root, header->merkle_root, HASH_SIZE) == 0;
     }
-    
-    // Read encrypted data
-    size_t ciphertext_len;
-    if (fread(&ciphertext_len, sizeof(size_t), 1, file) != 1) {
-        fclose(file);
-        return NULL;
+    merkle_free(tree);
+
+    // The shards must add up to the vault the main file announces
+    uint64_t entries = 0;
+    uint64_t tombstones = 0;
+    for (size_t shard = 0; ok && shard < shard_count; shard++) {
+        const ShardSeal *seal = &layout->shards[shard];
+        ok = seal->entry_count <= header->entry_count - entries &&
+             seal->tombstone_count <= header->tombstone_count - tombstones;
+        entries += seal->entry_count;
+        tombstones += seal->tombstone_count;
     }
+    return ok && entries == header->entry_count &&
+           tombstones == header->tombstone_count;
+}
+
+// Read the main header and shard table of the vault at vault_path (the
+// header is not authenticated here; that needs the key)
+static int read_layout(const char *vault_path, VaultLayout *layout) {
+    FILE *file = fopen(vault_path, "rb");
+    if (!file) return 0;
+
+    int ok = read_header(file, &layout->header) && read_shard_table(file, layout);
     fclose(file);
-    
-    // Handle empty vault (no entries)
-    if (ciphertext_len == 0 || header.entry_count == 0) {
-        memset(key, 0, KEY_SIZE);
-        
-        // Create empty password manager
-        PasswordManager *pm = pm_init();
-        if (!pm) return NULL;
-        
-        *success = 1;
-        return pm;
+    return ok;
+}
+
+// Check that a shard header is the one the layout sealed for shard
+static int shard_matches(const FileHeader *header, const VaultLayout *layout,
+                         size_t shard) {
+    const FileHeader *main_header = &layout->header;
+    const ShardSeal *seal = &layout->shards[shard];
+
+    return header->shard_count == main_header->shard_count &&
+           header->shard_index == shard &&
+           header->version == main_header->version &&
+           header->shard_set == main_header->shard_set &&
+           memcmp(header->salt, main_header->salt, sizeof(header->salt)) == 0 &&
+           header->generation == seal->generation &&
+           header->entry_count == seal->entry_count &&
+           header->tombstone_count == seal->tombstone_count &&
+           memcmp(header->header_mac, seal->header_mac, HASH_SIZE) == 0;
+}
+
+// Plaintext on its way into the encrypted payload, gathered so the
+// cipher always sees whole STREAM_CHUNK_SIZE blocks
+typedef struct {
+    FILE *file;
+    MerkleTree *tree;
+    CryptoStream *stream;
+    unsigned char chunk[STREAM_CHUNK_SIZE];
+    size_t used;
+    uint64_t plain_len;     // Plaintext bytes taken so far
+    uint64_t payload_len;   // Ciphertext bytes written so far
+} PayloadWriter;
+
+// Write a piece of ciphertext and feed it to the payload's Merkle tree
+static int emit_ciphertext(PayloadWriter *writer, const unsigned char *data,
+                           size_t len) {
+    writer->payload_len += len;
+    return fwrite(data, 1, len, writer->file) == len &&
+           merkle_append(writer->tree, data, len);
+}
+
+static int payload_write(PayloadWriter *writer, const void *data, size_t len) {
+    const unsigned char *bytes = data;
+    unsigned char out[STREAM_CHUNK_SIZE + CRYPTO_BLOCK_SIZE];
+    size_t out_len;
+    int ok = 1;
+
+    writer->plain_len += len;
+    while (ok && len > 0) {
+        size_t n = sizeof(writer->chunk) - writer->used;
+        if (n > len) n = len;
+
+        memcpy(writer->chunk + writer->used, bytes, n);
+        writer->used += n;
+        bytes += n;
+        len -= n;
+
+        if (writer->used == sizeof(writer->chunk)) {
+            ok = crypto_stream_update(writer->stream, writer->chunk, writer->used,
+                                      out, &out_len) &&
+                 emit_ciphertext(writer, out, out_len);
+            writer->used = 0;
+        }
     }
-    
-    unsigned char *ciphertext = malloc(ciphertext_len);
-    if (!ciphertext) {
-        return NULL;
+
+    memset(out, 0, sizeof(out));
+    return ok;
+}
+
+// Encrypt what is left and the padding
+static int payload_finish(PayloadWriter *writer) {
+    unsigned char out[STREAM_CHUNK_SIZE + CRYPTO_BLOCK_SIZE];
+    size_t out_len;
+    int ok = 1;
+
+    if (writer->used > 0) {
+        ok = crypto_stream_update(writer->stream, writer->chunk, writer->used,
+                                  out, &out_len) &&
+             emit_ciphertext(writer, out, out_len);
     }
-    
-    // Re-open file to read encrypted data
-    file = fopen(get_data_file_path(), "rb");
-    if (!file) {
-        free(ciphertext);
-        return NULL;
+    if (ok) {
+        ok = crypto_stream_final(writer->stream, out, &out_len) &&
+             emit_ciphertext(writer, out, out_len);
     }
-    
-    // Skip header and ciphertext_len
-    fseek(file, sizeof(FileHeader) + sizeof(size_t), SEEK_SET);
-    
-    if (fread(ciphertext, 1, ciphertext_len, file) != ciphertext_len) {
-        free(ciphertext);
-        fclose(file);
-        return NULL;
+
+    memset(out, 0, sizeof(out));
+    memset(writer->chunk, 0, sizeof(writer->chunk));
+    return ok;
+}
+
+// Next record of one shard (everything if shard_count is 0): the entries,
+// then the tombstones. *cursor starts at 0.
+static const PasswordEntry* next_record(const PasswordManager *pm, size_t shard,
+                                        size_t shard_count, size_t *cursor) {
+    while (*cursor < pm->count + pm->tombstone_count) {
+        size_t n = (*cursor)++;
+        const PasswordEntry *record = n < pm->count ? &pm->entries[n]
+                                                    : &pm->tombstones[n - pm->count];
+        if (shard_count == 0 || pm_shard_of(record->service, shard_count) == shard) {
+            return record;
+        }
     }
-    fclose(file);
-    
-    // Decrypt data
-    size_t plaintext_len;
-    size_t data_size = sizeof(PasswordEntry) * header.entry_count;
-    unsigned char *plaintext = malloc(data_size + 128);
-    if (!plaintext) {
-        free(ciphertext);
-        return NULL;
+    return NULL;
+}
+
+// Train the dictionary of one file on a spread of its records' usernames,
+// email domains and service domains
+static size_t train_vault_dictionary(const PasswordManager *pm, size_t shard,
+                                     size_t shard_count, size_t records,
+                                     unsigned char *dict) {
+    size_t stride = records / 4096 + 1;
+    const char **samples = malloc(sizeof(const char*) * 3 * (records / stride + 1));
+    if (!samples) return 0;
+
+    size_t count = 0;
+    size_t cursor = 0;
+    const PasswordEntry *record;
+    for (size_t n = 0; (record = next_record(pm, shard, shard_count, &cursor)); n++) {
+        if (n % stride != 0) continue;
+
+        if (record->username[0]) samples[count++] = record->username;
+
+        const char *at = strchr(record->username, '@');
+        if (at) samples[count++] = at;
+
+        // Last two labels of a domain-like service name
+        const char *dot = strrchr(record->service, '.');
+        if (dot) {
+            const char *suffix = dot;
+            while (suffix > record->service && suffix[-1] != '.') suffix--;
+            samples[count++] = suffix;
+        }
     }
-    
-    if (!decrypt_data(ciphertext, ciphertext_len, key, header.iv,
-                     plaintext, &plaintext_len)) {
-        free(ciphertext);
-        free(plaintext);
-        return NULL;
+
+    size_t len = compress_train_dictionary(samples, count, dict, VAULT_DICT_SIZE);
+    free(samples);
+    return len;
+}
+
+// Write a VaultFrame and its bytes into the payload
+static int write_frame(PayloadWriter *writer, uint32_t raw_len,
+                       const unsigned char *data, uint32_t len) {
+    VaultFrame frame = {raw_len, len};
+    return payload_write(writer, &frame, sizeof(frame)) &&
+           payload_write(writer, data, len);
+}
+
+// Dictionary frame, then the records in compressed blocks; frame_offsets
+// receives where each block's frame starts in the plaintext
+static int write_compressed_records(PayloadWriter *writer, const PasswordManager *pm,
+                                    size_t shard, size_t shard_count,
+                                    size_t records, uint64_t *frame_offsets) {
+    size_t block_size = VAULT_BLOCK_RECORDS * sizeof(PasswordEntry);
+    size_t capacity = compress_bound(block_size);
+    unsigned char *dict = malloc(VAULT_DICT_SIZE);
+    unsigned char *block = malloc(block_size);
+    unsigned char *packed = malloc(capacity);
+    int ok = dict && block && packed;
+
+    size_t dict_len = 0;
+    if (ok) {
+        dict_len = train_vault_dictionary(pm, shard, shard_count, records, dict);
+        ok = write_frame(writer, (uint32_t)dict_len, dict, (uint32_t)dict_len);
     }
-    
-    free(ciphertext);
-    memset(key, 0, KEY_SIZE);
-    
-    // Create password manager
-    PasswordManager *pm = pm_init();
-    if (!pm) {
-        free(plaintext);
-        return NULL;
+
+    size_t cursor = 0;
+    size_t frames = 0;
+    const PasswordEntry *record = ok ? next_record(pm, shard, shard_count, &cursor) : NULL;
+    while (ok && record) {
+        size_t used = 0;
+        frame_offsets[frames++] = writer->plain_len;
+        for (; record && used < block_size;
+             record = next_record(pm, shard, shard_count, &cursor)) {
+            memcpy(block + used, record, sizeof(PasswordEntry));
+            used += sizeof(PasswordEntry);
+        }
+
+        size_t len = compress_block_dict(dict, dict_len, block, used, packed, capacity);
+        if (len > 0 && len < used) {
+            ok = write_frame(writer, (uint32_t)used, packed, (uint32_t)len);
+        } else {
+            ok = write_frame(writer, (uint32_t)used, block, (uint32_t)used);
+        }
     }
-    
-    // Copy decrypted entries
-    pm->entries = realloc(pm->entries, data_size);
-    if (!pm->entries) {
-        pm_free(pm);
-        free(plaintext);
-        return NULL;
+
+    if (dict) memset(dict, 0, VAULT_DICT_SIZE);
+    if (block) memset(block, 0, block_size);
+    if (packed) memset(packed, 0, capacity);
+    free(dict);
+    free(block);
+    free(packed);
+    return ok;
+}
+
+// Encrypt the records of one shard (everything if shard_count is 0)
+// chunk by chunk straight into the file; *payload_len receives the
+// ciphertext length, and frame_offsets the frame offsets of a
+// compressed payload
+static int write_encrypted_entries(FILE *file, MerkleTree *tree,
+                                   const PasswordManager *pm,
+                                   const FileHeader *header,
+                                   const unsigned char *key,
+                                   uint64_t *payload_len,
+                                   uint64_t *frame_offsets) {
+    PayloadWriter *writer = calloc(1, sizeof(PayloadWriter));
+    if (!writer) return 0;
+
+    writer->file = file;
+    writer->tree = tree;
+    writer->stream = crypto_stream_new(1, key, header->iv);
+
+    size_t shard = header->shard_index;
+    size_t shard_count = header->shard_count;
+    int ok = writer->stream != NULL;
+
+    if (ok && header->codec == VAULT_CODEC_LZ) {
+        ok = write_compressed_records(writer, pm, shard, shard_count,
+                                      (size_t)header_records(header), frame_offsets);
+    } else {
+        size_t cursor = 0;
+        const PasswordEntry *record;
+        while (ok && (record = next_record(pm, shard, shard_count, &cursor))) {
+            ok = payload_write(writer, record, sizeof(PasswordEntry));
+        }
     }
-    
-    memcpy(pm->entries, plaintext, data_size);
-    pm->count = header.entry_count;
-    pm->capacity = header.entry_count;
-    
-    free(plaintext);
-    *success = 1;
-    return pm;
+    ok = ok && payload_finish(writer);
+    *payload_len = writer->payload_len;
+
+    crypto_stream_free(writer->stream);
+    free(writer);
+    return ok;
 }
 
-int file_verify_master_password(const char *master_password) {
-    FILE *file = fopen(get_data_file_path(), "rb");
-    if (!file) return 0;
-    
-    FileHeader header;
-    if (fread(&header, sizeof(FileHeader), 1, file) != 1) {
-        fclose(file);
-        return 0;
+// Destination for decrypted records: pre-sized slices for the entries
+// and for the tombstones that follow them
+typedef struct {
+    PasswordEntry *entries;
+    PasswordEntry *tombstones;
+    size_t entry_limit;
+    size_t count;
+    size_t partial;
+    size_t record_size;
+} RecordSink;
+
+static PasswordEntry* sink_record(RecordSink *sink) {
+    return sink->count < sink->entry_limit
+           ? &sink->entries[sink->count]
+           : &sink->tombstones[sink->count - sink->entry_limit];
+}
+
+// Append decrypted bytes to the entry store, completing records in order.
+// The sink must already hold room for every record in the payload.
+static void parse_entry_bytes(RecordSink *sink, const unsigned char *data,
+                              size_t len) {
+    while (len > 0) {
+        PasswordEntry *entry = sink_record(sink);
+        unsigned char *record = (unsigned char*)entry;
+        size_t n = sink->record_size - sink->partial;
+        if (n > len) n = len;
+
+        memcpy(record + sink->partial, data, n);
+        sink->partial += n;
+        data += n;
+        len -= n;
+
+        if (sink->partial == sink->record_size) {
+            // Fields a shorter, older record didn't have start out empty
+            memset(record + sink->record_size, 0,
+                   sizeof(PasswordEntry) - sink->record_size);
+
+            // Never trust string termination coming from disk
+            entry->service[MAX_SERVICE_NAME - 1] = '\0';
+            entry->username[MAX_USERNAME - 1] = '\0';
+            entry->password[MAX_PASSWORD - 1] = '\0';
+            sink->count++;
+            sink->partial = 0;
+        }
     }
-    fclose(file);
-    
-    return verify_master_password(master_password, header.salt, header.hash);
 }
 
-int file_create_backup(void) {
-    FILE *src = fopen(get_data_file_path(), "rb");
-    if (!src) return 0;
-    
-    FILE *dst = fopen(get_backup_file_path(), "wb");
-    if (!dst) {
-        fclose(src);
+// Compressed payload being unpacked frame by frame into a record sink
+typedef struct {
+    RecordSink *sink;
+    size_t raw_limit;           // Record bytes the header announces
+    size_t raw_total;
+    VaultFrame frame;
+    size_t head_used;           // Bytes of frame read so far
+    size_t body_used;           // Bytes of the frame's body read so far
+    int have_dict;
+    size_t dict_len;
+    unsigned char dict[VAULT_DICT_SIZE];
+    unsigned char *body;
+    unsigned char *raw;
+} FrameReader;
+
+#define FRAME_MAX_RAW (VAULT_BLOCK_RECORDS * sizeof(PasswordEntry))
+
+// Unpack a complete frame
+static int finish_frame(FrameReader *reader) {
+    const VaultFrame *frame = &reader->frame;
+    int stored = frame->packed_len == frame->raw_len;
+
+    reader->head_used = 0;
+    reader->body_used = 0;
+
+    if (!reader->have_dict) {
+        memcpy(reader->dict, reader->body, frame->raw_len);
+        reader->dict_len = frame->raw_len;
+        reader->have_dict = 1;
+        return 1;
+    }
+
+    if (frame->raw_len > reader->raw_limit - reader->raw_total) return 0;
+    if (!stored &&
+        !decompress_block_dict(reader->dict, reader->dict_len, reader->body,
+                               frame->packed_len, reader->raw, frame->raw_len)) {
         return 0;
     }
-    
-    char buffer[4096];
-    size_t bytes;
-    while ((bytes = fread(buffer, 1, sizeof(buffer), src)) > 0) {
-        if (fwrite(buffer, 1, bytes, dst) != bytes) {
-            fclose(src);
-            fclose(dst);
+
+    parse_entry_bytes(reader->sink, stored ? reader->body : reader->raw,
+                      frame->raw_len);
+    reader->raw_total += frame->raw_len;
+    return 1;
+}
+
+static int feed_frames(FrameReader *reader, const unsigned char *data, size_t len) {
+    while (len > 0) {
+        if (reader->head_used < sizeof(VaultFrame)) {
+            size_t n = sizeof(VaultFrame) - reader->head_used;
+            if (n > len) n = len;
+
+            memcpy((unsigned char*)&reader->frame + reader->head_used, data, n);
+            reader->head_used += n;
+            data += n;
+            len -= n;
+            if (reader->head_used < sizeof(VaultFrame)) return 1;
+
+            // The dictionary is stored as is; blocks must fit the buffers
+            const VaultFrame *frame = &reader->frame;
+            size_t raw_max = reader->have_dict ? FRAME_MAX_RAW : VAULT_DICT_SIZE;
+            if (frame->raw_len > raw_max ||
+                frame->packed_len > compress_bound(frame->raw_len) ||
+                (!reader->have_dict && frame->packed_len != frame->raw_len)) {
+                return 0;
+            }
+            if (frame->packed_len == 0 && !finish_frame(reader)) return 0;
+            continue;
+        }
+
+        size_t n = reader->frame.packed_len - reader->body_used;
+        if (n > len) n = len;
+
+        memcpy(reader->body + reader->body_used, data, n);
+        reader->body_used += n;
+        data += n;
+        len -= n;
+
+        if (reader->body_used == reader->frame.packed_len && !finish_frame(reader)) {
             return 0;
         }
     }
-    
-    fclose(src);
-    fclose(dst);
     return 1;
 }
 
-int file_change_master_password(PasswordManager *pm,
-                                const char *old_password,
-                                const char *new_password) {
-    if (!file_verify_master_password(old_password)) {
+// Pass decrypted bytes on: straight to the records, or through the frames
+static int consume_plaintext(RecordSink *sink, FrameReader *frames,
+                             const unsigned char *data, size_t len) {
+    if (frames) return feed_frames(frames, data, len);
+
+    parse_entry_bytes(sink, data, len);
+    return 1;
+}
+
+// Decrypt the payload block by block, parsing records as they arrive.
+// The ciphertext is hashed on the way through and must match the
+// header's Merkle root, when the file has one.
+static int read_encrypted_entries(FILE *file, RecordSink *sink,
+                                  const FileHeader *header,
+                                  const unsigned char *key) {
+    MerkleTree *tree = NULL;
+    if (header->version >= 3 && !(tree = merkle_new())) return 0;
+
+    CryptoStream *stream = crypto_stream_new(0, key, header->iv);
+    if (!stream) {
+        merkle_free(tree);
         return 0;
     }
-    
-    if (!file_create_backup()) {
-        return 0;
+
+    size_t data_size = header->record_size * (size_t)header_records(header);
+    size_t ciphertext_len = header->payload_len;
+    size_t produced = 0;
+    unsigned char in[STREAM_CHUNK_SIZE];
+    unsigned char out[STREAM_CHUNK_SIZE + CRYPTO_BLOCK_SIZE];
+    size_t out_len;
+    int ok = 1;
+
+    // A compressed payload's plaintext is bounded instead of exact
+    FrameReader *frames = NULL;
+    size_t plaintext_limit = data_size;
+    if (header->codec == VAULT_CODEC_LZ) {
+        frames = calloc(1, sizeof(FrameReader));
+        ok = frames != NULL;
+        if (ok) {
+            frames->sink = sink;
+            frames->raw_limit = data_size;
+            frames->body = malloc(compress_bound(FRAME_MAX_RAW));
+            frames->raw = malloc(FRAME_MAX_RAW);
+            ok = frames->body && frames->raw;
+        }
+        plaintext_limit = compressed_payload_bound(data_size);
     }
-    
-    return file_save(pm, new_password);
+
+    while (ok && ciphertext_len > 0) {
+        size_t n = ciphertext_len < sizeof(in) ? ciphertext_len : sizeof(in);
+        if (fread(in, 1, n, file) != n ||
+            (tree && !merkle_append(tree, in, n)) ||
+            !crypto_stream_update(stream, in, n, out, &out_len) ||
+            out_len > plaintext_limit - produced ||
+            !consume_plaintext(sink, frames, out, out_len)) {
+            ok = 0;
+            break;
+        }
+        produced += out_len;
+        ciphertext_len -= n;
+    }
+
+    if (ok) {
+        ok = crypto_stream_final(stream, out, &out_len) &&
+             out_len <= plaintext_limit - produced &&
+             consume_plaintext(sink, frames, out, out_len);
+        produced += out_len;
+    }
+    if (ok) {
+        // Nothing may be left over or missing
+        ok = frames ? frames->have_dict && frames->head_used == 0 &&
+                      frames->raw_total == data_size
+                    : produced == data_size;
+    }
+    if (frames) {
+        if (frames->body) memset(frames->body, 0, compress_bound(FRAME_MAX_RAW));
+        if (frames->raw) memset(frames->raw, 0, FRAME_MAX_RAW);
+        free(frames->body);
+        free(frames->raw);
+        memset(frames, 0, sizeof(FrameReader));
+        free(frames);
+    }
+    if (ok && tree) {
+        unsigned char root[HASH_SIZE];
+        ok = merkle_finish(tree);
+        merkle_root(tree, root);
+        ok = ok && memcmp(root, header->merkle_root, HASH_SIZE) == 0;
+    }
+
+    merkle_free(tree);
+    crypto_stream_free(stream);
+    memset(out, 0, sizeof(out));
+    return ok && sink->count == header_records(header);
+}
+
+// ============================================================================
+// SAVING
+// ============================================================================
+
+static size_t count_shard_records(const PasswordEntry *records, size_t total,
+                                  size_t shard, size_t shard_count) {
+    if (shard_count == 0) return total;
+
+    size_t count = 0;
+    for (size_t i = 0; i < total; i++) {
+        if (pm_shard_of(records[i].service, shard_count) == shard) count++;
+    }
+    return count;
+}
+
+// Write header and payload to path.tmp and move it over path, so a
+// failed save never leaves a truncated vault behind. With with_payload
+// = 0 the payload is the shard table instead (the main file of a
+// sharded vault).
+static int write_vault_file(const char *path, FileHeader *header,
+                            const PasswordManager *pm, int with_payload,
+                            const unsigned char *key, const ShardSeal *shards) {
+    char tmp_path[PATH_SIZE];
+    int len = snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    if (len < 0 || (size_t)len >= sizeof(tmp_path)) return 0;
+
+    if (!generate_random_bytes(header->iv, sizeof(header->iv))) return 0;
+
+    size_t shard = header->shard_index;
+    size_t shard_count = header->shard_count;
+    if (with_payload) {
+        header->entry_count = count_shard_records(pm->entries, pm->count,
+                                                  shard, shard_count);
+        header->tombstone_count = count_shard_records(pm->tombstones,
+                                                      pm->tombstone_count,
+                                                      shard, shard_count);
+        header->payload_len = 0;
+    } else {
+        header->payload_len = shard_count * sizeof(ShardSeal);
+    }
+
+    // Where each frame of a compressed payload starts, for the index
+    uint64_t *frame_offsets = NULL;
+    if (with_payload && header->codec == VAULT_CODEC_LZ) {
+        size_t frames = (size_t)header_records(header) / VAULT_BLOCK_RECORDS + 1;
+        frame_offsets = calloc(frames, sizeof(uint64_t));
+        if (!frame_offsets) return 0;
+    }
+
+    FILE *file = fopen(tmp_path, "wb");
+    if (!file) {
+        free(frame_offsets);
+        return 0;
+    }
+
+    // The header goes out twice: first as a placeholder, then again once
+    // the Merkle root of the payload is known and can be authenticated
+    MerkleTree *tree = merkle_new();
+    int ok = tree && fwrite(header, sizeof(FileHeader), 1, file) == 1;
+    if (ok && with_payload && header_records(header) > 0) {
+        // Encrypted and written in blocks without a whole-vault buffer;
+        // the final header records how long the payload came out
+        ok = write_encrypted_entries(file, tree, pm, header, key,
+                                     &header->payload_len, frame_offsets);
+    }
+    if (ok && !with_payload && shard_count > 0) {
+        ok = fwrite(shards, sizeof(ShardSeal), shard_count, file) == shard_count &&
+             merkle_append(tree, (const unsigned char*)shards,
+                           shard_count * sizeof(ShardSeal));
+    }
+    if (ok) {
+        ok = merkle_finish(tree) && merkle_store(file, tree);
+    }
+    if (ok) {
+        merkle_root(tree, header->merkle_root);
+        ok = compute_header_mac(header, key, header->header_mac) &&
+             fseek(file, 0, SEEK_SET) == 0 &&
+             fwrite(header, sizeof(FileHeader), 1, file) == 1;
+    }
+    merkle_free(tree);
+    if (fclose(file) != 0) ok = 0;
+
+    if (!ok || rename(tmp_path, path) != 0) {
+        remove(tmp_path);
+        free(frame_offsets);
+        return 0;
+    }
+
+    if (with_payload) {
+        // The index is only an accelerator: lookups check it against the
+        // vault IV and generation, so a failed write just means falling
+        // back to scanning the file
+        char idx_path[PATH_SIZE];
+        if (index_file_path(path, idx_path, sizeof(idx_path)) &&
+            !blind_index_write(idx_path, pm, shard, shard_count, key, header->iv,
+                               header->generation, frame_offsets,
+                               VAULT_BLOCK_RECORDS)) {
+            remove(idx_path);
+        }
+    }
+    free(frame_offsets);
+
+    return 1;
+}
+
+// Remove the shard files (and their indexes) of layout that keep does
+// not point to, and their directory when keep no longer uses it; keep
+// may be NULL to remove them all
+static void remove_stale_shards(const char *vault_path, const VaultLayout *layout,
+                                const VaultLayout *keep) {
+    int same_set = keep && keep->header.shard_count > 0 &&
+                   keep->header.shard_set == layout->header.shard_set;
+    char path[PATH_SIZE];
+    char idx_path[PATH_SIZE];
+
+    for (size_t shard = 0; shard < layout->header.shard_count; shard++) {
+        if (same_set && shard < keep->header.shard_count &&
+            keep->shards[shard].generation == layout->shards[shard].generation) {
+            continue;
+        }
+        if (!shard_file_path(vault_path, layout, shard, path, sizeof(path))) continue;
+        if (index_file_path(path, idx_path, sizeof(idx_path))) remove(idx_path);
+        remove(path);
+    }
+
+    if (layout->header.shard_count > 0 && !same_set &&
+        shard_dir_path(vault_path, layout->header.shard_set, path, sizeof(path))) {
+        rmdir(path);
+    }
+}
+
+// Sharded save: keep the existing salt (and so the key) and shard set
+// when the password and layout are unchanged, and rewrite only the shards
+// that were touched. New shard files never replace ones the current main
+// file points to: they are named by generation (or sit in a new set's
+// directory), so the rename of the main file switches the whole vault.
+static int save_sharded(PasswordManager *pm, const char *master_password,
+                        const char *vault_path, const VaultLayout *old,
+                        VaultLayout *layout) {
+    FileHeader *header = &layout->header;
+    unsigned char key[KEY_SIZE];
+    uint64_t dirty = pm->dirty_shards;
+
+    // Only a save that follows the one on disk may name files by the next
+    // generation without meeting names the current layout uses
+    int reuse = old && old->header.version == VAULT_VERSION &&
+                old->header.generation <= pm->generation &&
+                old->header.shard_count == pm->shard_count &&
+                old->header.codec == pm->codec &&
+                verify_master_password(master_password, old->header.salt,
+                                       old->header.hash);
+
+    if (reuse) {
+        *layout = *old;
+        reuse = derive_key(master_password, header->salt, key, KEY_SIZE) &&
+                header_is_authentic(header, key);
+    }
+
+    if (!reuse) {
+        init_header(header);
+        memset(layout->shards, 0, sizeof(layout->shards));
+        if (!generate_random_bytes(header->salt, sizeof(header->salt)) ||
+            !hash_password(master_password, header->salt,
+                           header->hash, sizeof(header->hash)) ||
+            !derive_key(master_password, header->salt, key, KEY_SIZE)) {
+            memset(key, 0, KEY_SIZE);
+            return 0;
+        }
+        do {
+            if (!generate_random_bytes((unsigned char*)&header->shard_set,
+                                       sizeof(header->shard_set))) {
+                memset(key, 0, KEY_SIZE);
+                return 0;
+            }
+        } while (old && header->shard_set == old->header.shard_set);
+
+        // New key: every shard has to be re-encrypted
+        dirty = ~0ULL;
+    }
+
+    char dir[PATH_SIZE];
+    if (!shard_dir_path(vault_path, header->shard_set, dir, sizeof(dir))) {
+        memset(key, 0, KEY_SIZE);
+        return 0;
+    }
+    mkdir(dir, 0700);
+
+    header->shard_count = (uint32_t)pm->shard_count;
+    header->codec = pm->codec;
+    header->generation = pm->generation + 1;
+    header->log_floor = pm->log_floor;
+    int ok = 1;
+
+    for (size_t shard = 0; ok && shard < pm->shard_count; shard++) {
+        if (!(dirty & (1ULL << shard))) continue;
+
+        char path[PATH_SIZE];
+        ShardSeal *seal = &layout->shards[shard];
+        FileHeader shard_header = *header;
+        shard_header.shard_index = (uint32_t)shard;
+        seal->generation = header->generation;
+        ok = shard_file_path(vault_path, layout, shard, path, sizeof(path)) &&
+             write_vault_file(path, &shard_header, pm, 1, key, NULL);
+        if (ok) {
+            memcpy(seal->header_mac, shard_header.header_mac, HASH_SIZE);
+            seal->entry_count = shard_header.entry_count;
+            seal->tombstone_count = shard_header.tombstone_count;
+        }
+    }
+
+    // Main file last: the rename that puts it in place switches the vault
+    // to the new shards, so until then the old ones stay in charge
+    if (ok) {
+        header->shard_index = 0;
+        header->entry_count = pm->count;
+        header->tombstone_count = pm->tombstone_count;
+        ok = write_vault_file(vault_path, header, pm, 0, key, layout->shards);
+    }
+    memset(key, 0, KEY_SIZE);
+
+    if (!ok) {
+        // Drop what this save wrote; none of it is referenced
+        remove_stale_shards(vault_path, layout, reuse ? old : NULL);
+        return 0;
+    }
+    pm->dirty_shards = 0;
+    return 1;
+}
+
+// Single-file save: new salt and key every time
+static int save_flat(PasswordManager *pm, const char *master_password,
+                     const char *vault_path) {
+    // Generate salt
+    FileHeader header;
+    init_header(&header);
+    header.codec = pm->codec;
+    header.generation = pm->generation + 1;
+    header.log_floor = pm->log_floor;
+    if (!generate_random_bytes(header.salt, sizeof(header.salt))) {
+        return 0;
+    }
+
+    // Hash master password
+    if (!hash_password(master_password, header.salt,
+                      header.hash, sizeof(header.hash))) {
+        return 0;
+    }
+
+    // Derive encryption key
+    unsigned char key[KEY_SIZE];
+    if (!derive_key(master_password, header.salt, key, KEY_SIZE)) {
+        return 0;
+    }
+
+    int ok = write_vault_file(vault_path, &header, pm, 1, key, NULL);
+
+    // Clear sensitive data
+    memset(key, 0, KEY_SIZE);
+    return ok;
+}
+
+int file_save(PasswordManager *pm, const char *master_password) {
+    if (!pm || !master_password) return 0;
+
+    // Paged stores are updated in place; just push out pending pages
+    if (pm->store) {
+        int ok = btree_flush(pm->store);
+        pm->generation = btree_generation(pm->store);
+        return ok;
+    }
+
+    return file_save_path(pm, master_password, get_data_file_path());
+}
+
+int file_save_path(PasswordManager *pm, const char *master_password,
+                   const char *vault_path) {
+    if (!pm || !master_password || !vault_path || pm->store) return 0;
+
+    VaultLayout *old = malloc(sizeof(VaultLayout));
+    VaultLayout *layout = calloc(1, sizeof(VaultLayout));
+    if (!old || !layout) {
+        free(old);
+        free(layout);
+        return 0;
+    }
+    int had_old = read_layout(vault_path, old);
+
+    int ok = pm->shard_count > 0
+             ? save_sharded(pm, master_password, vault_path,
+                            had_old ? old : NULL, layout)
+             : save_flat(pm, master_password, vault_path);
+
+    // The shard files of the previous layout that the new main file no
+    // longer points to are unreferenced now (and so is the index of a
+    // flat vault that became sharded)
+    if (ok && had_old) {
+        remove_stale_shards(vault_path, old, layout);
+        char idx_path[PATH_SIZE];
+        if (old->header.shard_count == 0 && pm->shard_count > 0 &&
+            index_file_path(vault_path, idx_path, sizeof(idx_path))) {
+            remove(idx_path);
+        }
+    }
+    free(old);
+    free(layout);
+
+    // Edits from here on belong to the next generation
+    if (ok) pm->generation++;
+    return ok;
+}
+
+// ============================================================================
+// LOADING
+// ============================================================================
+
+// Open the paged store as a password manager
+static PasswordManager* load_store(const char *master_password, int *success) {
+    PasswordManager *pm = pm_init();
+    if (!pm) return NULL;
+
+    pm->store = btree_open(get_store_file_path(), master_password);
+    if (!pm->store) {
+        pm_free(pm);
+        return NULL;
+    }
+    pm->generation = btree_generation(pm->store);
+    pm->log_floor = btree_log_floor(pm->store);
+
+    *success = 1;
+    return pm;
+}
+
+// One shard being decrypted into its slice of the entry store
+typedef struct {
+    FILE *file;
+    FileHeader header;
+    RecordSink sink;
+    const unsigned char *key;
+    int ok;
+} ShardLoad;
+
+static void* load_shard(void *arg) {
+    ShardLoad *load = arg;
+    load->ok = header_records(&load->header) == 0 ||
+               read_encrypted_entries(load->file, &load->sink, &load->header,
+                                      load->key);
+    return NULL;
+}
+
+// Open every shard, size the entry store once from the shard headers and
+// decrypt all shards concurrently into disjoint slices of it
+static int load_shards(PasswordManager *pm, const char *vault_path,
+                       const VaultLayout *layout, const unsigned char *key) {
+    size_t shard_count = layout->header.shard_count;
+    ShardLoad loads[MAX_SHARDS];
+    size_t total = 0;
+    size_t total_tombstones = 0;
+    size_t opened = 0;
+    int ok = 1;
+
+    memset(loads, 0, sizeof(loads));
+
+    for (size_t shard = 0; ok && shard < shard_count; shard++) {
+        char path[PATH_SIZE];
+        ShardLoad *load = &loads[shard];
+        load->file = shard_file_path(vault_path, layout, shard, path, sizeof(path))
+                     ? fopen(path, "rb") : NULL;
+        if (!load->file) {
+            ok = 0;
+            break;
+        }
+        opened++;
+
+        // Every shard must be the one the main file sealed; the counts
+        // then add up, as the shard table was checked against the totals
+        ok = read_header(load->file, &load->header) &&
+             shard_matches(&load->header, layout, shard) &&
+             header_is_authentic(&load->header, key) &&
+             payload_is_consistent(&load->header) &&
+             total + load->header.entry_count >= total &&
+             total_tombstones + load->header.tombstone_count >= total_tombstones;
+        total += load->header.entry_count;
+        total_tombstones += load->header.tombstone_count;
+    }
+
+    if (ok && total > 0) {
+        ok = total <= SIZE_MAX / sizeof(PasswordEntry) / 2 &&
+             pm_reserve(pm, total);
+    }
+    if (ok && total_tombstones > 0) {
+        ok = total_tombstones <= MAX_TOMBSTONES &&
+             pm_reserve_tombstones(pm, total_tombstones);
+    }
+
+    if (ok) {
+        size_t offset = 0;
+        size_t tombstone_offset = 0;
+        for (size_t shard = 0; shard < shard_count; shard++) {
+            loads[shard].sink.entries = pm->entries + offset;
+            loads[shard].sink.tombstones = pm->tombstones + tombstone_offset;
+            loads[shard].sink.entry_limit = loads[shard].header.entry_count;
+            loads[shard].sink.record_size = loads[shard].header.record_size;
+            loads[shard].key = key;
+            offset += loads[shard].header.entry_count;
+            tombstone_offset += loads[shard].header.tombstone_count;
+        }
+
+#ifdef _WIN32
+        for (size_t shard = 0; shard < shard_count; shard++) {
+            load_shard(&loads[shard]);
+        }
+#else
+        pthread_t threads[MAX_SHARDS];
+        int started[MAX_SHARDS] = {0};
+
+        for (size_t shard = 0; shard < shard_count; shard++) {
+            if (pthread_create(&threads[shard], NULL, load_shard, &loads[shard]) == 0) {
+                started[shard] = 1;
+            } else {
+                load_shard(&loads[shard]);
+            }
+        }
+        for (size_t shard = 0; shard < shard_count; shard++) {
+            if (started[shard]) pthread_join(threads[shard], NULL);
+        }
+#endif
+
+        for (size_t shard = 0; shard < shard_count; shard++) {
+            if (!loads[shard].ok) ok = 0;
+        }
+    }
+
+    for (size_t shard = 0; shard < opened; shard++) {
+        fclose(loads[shard].file);
+    }
+
+    if (ok) {
+        pm->count = total;
+        pm->tombstone_count = total_tombstones;
+        pm->shard_count = shard_count;
+        pm->dirty_shards = 0;
+    }
+    return ok;
+}
+
+PasswordManager* file_load(const char *master_password, int *success) {
+    *success = 0;
+
+    if (file_is_paged()) {
+        return load_store(master_password, success);
+    }
+
+    return file_load_path(get_data_file_path(), master_password, success);
+}
+
+PasswordManager* file_load_path(const char *vault_path,
+                                const char *master_password, int *success) {
+    *success = 0;
+    if (!vault_path || !master_password) return NULL;
+
+    FILE *file = fopen(vault_path, "rb");
+    if (!file) return NULL;
+
+    // Read header
+    FileHeader header;
+    if (!read_header(file, &header)) {
+        fclose(file);
+        return NULL;
+    }
+
+    // Verify master password
+    if (!verify_master_password(master_password, header.salt, header.hash)) {
+        fclose(file);
+        return NULL;
+    }
+
+    // Derive decryption key; it also authenticates the header, so a
+    // tampered entry count or shard layout is caught before use
+    unsigned char key[KEY_SIZE];
+    if (!derive_key(master_password, header.salt, key, KEY_SIZE) ||
+        !header_is_authentic(&header, key)) {
+        memset(key, 0, KEY_SIZE);
+        fclose(file);
+        return NULL;
+    }
+
+    // Create password manager
+    PasswordManager *pm = pm_init();
+    if (!pm) {
+        memset(key, 0, KEY_SIZE);
+        fclose(file);
+        return NULL;
+    }
+
+    pm->generation = header.generation;
+    pm->log_floor = header.log_floor;
+    pm->codec = header.codec;
+
+    // Handle empty vault (no entries)
+    if (header.shard_count == 0 &&
+        (header.payload_len == 0 || header_records(&header) == 0)) {
+        memset(key, 0, KEY_SIZE);
+        fclose(file);
+        *success = 1;
+        return pm;
+    }
+
+    if (header.shard_count == 0 &&
+        (!payload_is_consistent(&header) ||
+         header.tombstone_count > MAX_TOMBSTONES ||
+         !pm_reserve(pm, header.entry_count) ||
+         !pm_reserve_tombstones(pm, header.tombstone_count))) {
+        memset(key, 0, KEY_SIZE);
+        pm_free(pm);
+        fclose(file);
+        return NULL;
+    }
+
+    int ok;
+    if (header.shard_count > 0) {
+        // The shard table is covered by the header MAC just checked
+        VaultLayout *layout = malloc(sizeof(VaultLayout));
+        ok = layout != NULL;
+        if (ok) {
+            layout->header = header;
+            ok = read_shard_table(file, layout) &&
+                 load_shards(pm, vault_path, layout, key);
+        }
+        free(layout);
+    } else {
+        RecordSink sink = {pm->entries, pm->tombstones, header.entry_count,
+                           0, 0, header.record_size};
+        ok = read_encrypted_entries(file, &sink, &header, key);
+        pm->count = header.entry_count;
+        pm->tombstone_count = header.tombstone_count;
+    }
+    memset(key, 0, KEY_SIZE);
+    fclose(file);
+
+    if (!ok) {
+        pm_free(pm);
+        return NULL;
+    }
+
+    *success = 1;
+    return pm;
+}
+
+// ============================================================================
+// SINGLE-ENTRY LOOKUP
+// ============================================================================
+
+// Decrypt len plaintext bytes at offset of the payload by CBC random
+// access: only the blocks covering them (plus the block before, as IV)
+// are read, and only their chunks are checked against the Merkle root
+static int read_payload_range(FILE *file, const FileHeader *header,
+                              const unsigned char *key, uint64_t offset,
+                              size_t len, unsigned char *out) {
+    if (len == 0 || offset > header->payload_len) return 0;
+
+    uint64_t first = offset / CRYPTO_BLOCK_SIZE;
+    uint64_t last = (offset + len - 1) / CRYPTO_BLOCK_SIZE;
+    size_t blocks = (size_t)(last - first + 1);
+
+    if ((last + 1) * CRYPTO_BLOCK_SIZE > header->payload_len) return 0;
+
+    long payload_start = (long)header->header_size;
+    const unsigned char *iv = header->iv;
+    size_t read_len = blocks * CRYPTO_BLOCK_SIZE;
+    long read_start = payload_start + (long)(first * CRYPTO_BLOCK_SIZE);
+
+    if (first > 0) {
+        read_start -= CRYPTO_BLOCK_SIZE;
+        read_len += CRYPTO_BLOCK_SIZE;
+    }
+
+    if (header->version >= 3 &&
+        !merkle_verify_range(file, payload_start, header->payload_len,
+                             tree_offset(header),
+                             (uint64_t)(read_start - payload_start), read_len,
+                             header->merkle_root)) {
+        return 0;
+    }
+
+    unsigned char *cipher = malloc(read_len);
+    unsigned char *plain = malloc(blocks * CRYPTO_BLOCK_SIZE);
+    int ok = cipher && plain &&
+             fseek(file, read_start, SEEK_SET) == 0 &&
+             fread(cipher, 1, read_len, file) == read_len;
+
+    if (ok) {
+        const unsigned char *blocks_start = cipher;
+        if (first > 0) {
+            iv = cipher;
+            blocks_start = cipher + CRYPTO_BLOCK_SIZE;
+        }
+        ok = decrypt_blocks(blocks_start, blocks * CRYPTO_BLOCK_SIZE, key, iv, plain);
+    }
+    if (ok) memcpy(out, plain + (offset - first * CRYPTO_BLOCK_SIZE), len);
+
+    if (plain) memset(plain, 0, blocks * CRYPTO_BLOCK_SIZE);
+    free(cipher);
+    free(plain);
+    return ok;
+}
+
+static void copy_record(PasswordEntry *out, const unsigned char *record,
+                        size_t record_size) {
+    memset(out, 0, sizeof(PasswordEntry));
+    memcpy(out, record, record_size);
+    out->service[MAX_SERVICE_NAME - 1] = '\0';
+    out->username[MAX_USERNAME - 1] = '\0';
+    out->password[MAX_PASSWORD - 1] = '\0';
+}
+
+// Read the frame at offset of a compressed payload
+static int read_frame(FILE *file, const FileHeader *header, const unsigned char *key,
+                      uint64_t offset, size_t raw_max, VaultFrame *frame,
+                      unsigned char *body) {
+    return read_payload_range(file, header, key, offset, sizeof(VaultFrame),
+                              (unsigned char*)frame) &&
+           frame->raw_len <= raw_max &&
+           frame->packed_len <= compress_bound(frame->raw_len) &&
+           (frame->packed_len == 0 ||
+            read_payload_range(file, header, key, offset + sizeof(VaultFrame),
+                               frame->packed_len, body));
+}
+
+// Records of a compressed payload have no fixed offset; the index says
+// which frame holds the record, and only the dictionary and that frame
+// are decrypted and unpacked
+static int decode_single_entry(FILE *file, const FileHeader *header,
+                               const unsigned char *key, const IndexFrame *where,
+                               PasswordEntry *out) {
+    size_t record_size = header->record_size;
+    if (!payload_is_consistent(header) || where->slot >= VAULT_BLOCK_RECORDS) {
+        return 0;
+    }
+
+    unsigned char *dict = malloc(VAULT_DICT_SIZE);
+    unsigned char *body = malloc(compress_bound(FRAME_MAX_RAW));
+    unsigned char *raw = malloc(FRAME_MAX_RAW);
+    VaultFrame dict_frame, frame;
+
+    // The dictionary is the first frame and is stored as is
+    int ok = dict && body && raw &&
+             read_frame(file, header, key, 0, VAULT_DICT_SIZE, &dict_frame, dict) &&
+             dict_frame.packed_len == dict_frame.raw_len &&
+             where->offset >= sizeof(VaultFrame) + dict_frame.raw_len &&
+             read_frame(file, header, key, where->offset, FRAME_MAX_RAW, &frame, body) &&
+             (size_t)(where->slot + 1) * record_size <= frame.raw_len;
+
+    if (ok) {
+        int stored = frame.packed_len == frame.raw_len;
+        ok = stored ||
+             decompress_block_dict(dict, dict_frame.raw_len, body, frame.packed_len,
+                                   raw, frame.raw_len);
+        if (ok) {
+            copy_record(out, (stored ? body : raw) + where->slot * record_size,
+                        record_size);
+        }
+    }
+
+    if (dict) memset(dict, 0, VAULT_DICT_SIZE);
+    if (body) memset(body, 0, compress_bound(FRAME_MAX_RAW));
+    if (raw) memset(raw, 0, FRAME_MAX_RAW);
+    free(dict);
+    free(body);
+    free(raw);
+    return ok;
+}
+
+// Decrypt one record of an uncompressed payload, whose records sit at
+// fixed offsets
+static int read_single_entry(FILE *file, const FileHeader *header,
+                             const unsigned char *key, uint64_t record,
+                             PasswordEntry *out) {
+    unsigned char plain[sizeof(PasswordEntry)];
+    size_t record_size = header->record_size;
+
+    if (!read_payload_range(file, header, key, record * record_size,
+                            record_size, plain)) {
+        return 0;
+    }
+
+    copy_record(out, plain, record_size);
+    memset(plain, 0, sizeof(plain));
+    return 1;
+}
+
+// No usable index: decrypt this one file (a single shard of a sharded
+// vault) and search it
+static int lookup_by_scan(FILE *file, const FileHeader *header,
+                          const unsigned char *key, const char *service,
+                          PasswordEntry *out) {
+    if (!payload_is_consistent(header) ||
+        header->tombstone_count > MAX_TOMBSTONES ||
+        fseek(file, (long)header->header_size, SEEK_SET) != 0) {
+        return -1;
+    }
+
+    size_t records = (size_t)header_records(header);
+    PasswordEntry *entries = calloc(records, sizeof(PasswordEntry));
+    if (!entries) return -1;
+
+    RecordSink sink = {entries, entries + header->entry_count, header->entry_count,
+                       0, 0, header->record_size};
+    int result = read_encrypted_entries(file, &sink, header, key) ? 0 : -1;
+    for (size_t i = 0; result == 0 && i < header->entry_count; i++) {
+        if (strcasecmp(entries[i].service, service) == 0) {
+            *out = entries[i];
+            result = 1;
+        }
+    }
+
+    memset(entries, 0, records * sizeof(PasswordEntry));
+    free(entries);
+    return result;
+}
+
+int file_lookup_entry(const char *master_password, const char *service,
+                      PasswordEntry *out) {
+    if (!master_password || !service || !out) return -1;
+
+    if (file_is_paged()) {
+        BTree *tree = btree_open(get_store_file_path(), master_password);
+        if (!tree) return -1;
+        int found = btree_get(tree, service, out);
+        btree_close(tree);
+        return found;
+    }
+
+    const char *vault_path = get_data_file_path();
+    FILE *file = fopen(vault_path, "rb");
+    if (!file) return -1;
+
+    VaultLayout *layout = malloc(sizeof(VaultLayout));
+    if (!layout || !read_header(file, &layout->header) ||
+        !read_shard_table(file, layout)) {
+        free(layout);
+        fclose(file);
+        return -1;
+    }
+
+    // In a sharded vault only the shard owning the service is opened, and
+    // it must be the one the main file's shard table seals
+    char path[PATH_SIZE];
+    strncpy(path, vault_path, sizeof(path) - 1);
+    path[sizeof(path) - 1] = '\0';
+
+    FileHeader main_header = layout->header;
+    FileHeader header = main_header;
+    if (header.shard_count > 0) {
+        size_t shard = pm_shard_of(service, header.shard_count);
+
+        fclose(file);
+        file = shard_file_path(vault_path, layout, shard, path, sizeof(path))
+               ? fopen(path, "rb") : NULL;
+        if (!file || !read_header(file, &header) ||
+            !shard_matches(&header, layout, shard)) {
+            if (file) fclose(file);
+            free(layout);
+            return -1;
+        }
+    }
+    free(layout);
+
+    if (!verify_master_password(master_password, header.salt, header.hash)) {
+        fclose(file);
+        return -1;
+    }
+
+    unsigned char key[KEY_SIZE];
+    if (!derive_key(master_password, header.salt, key, KEY_SIZE) ||
+        !header_is_authentic(&main_header, key) ||
+        !header_is_authentic(&header, key)) {
+        memset(key, 0, KEY_SIZE);
+        fclose(file);
+        return -1;
+    }
+
+    if (header.payload_len == 0 || header.entry_count == 0) {
+        memset(key, 0, KEY_SIZE);
+        fclose(file);
+        return 0;
+    }
+
+    char idx_path[PATH_SIZE];
+    IndexFrame where = {0, 0};
+    int64_t record = index_file_path(path, idx_path, sizeof(idx_path))
+        ? blind_index_find(idx_path, key, header.iv, header.generation,
+                           header.entry_count, service, &where)
+        : -2;
+    int result;
+
+    // A verified miss is authoritative; the file is only scanned when the
+    // index is stale, missing or fails to verify
+    if (record == -1) {
+        result = 0;
+    } else if (record >= 0 && (uint64_t)record < header.entry_count &&
+               (header.codec == VAULT_CODEC_NONE
+                    ? read_single_entry(file, &header, key, (uint64_t)record, out)
+                    : decode_single_entry(file, &header, key, &where, out)) &&
+               strcasecmp(out->service, service) == 0) {
+        result = 1;
+    } else {
+        memset(out, 0, sizeof(PasswordEntry));
+        result = lookup_by_scan(file, &header, key, service, out);
+    }
+
+    memset(key, 0, KEY_SIZE);
+    fclose(file);
+    return result;
+}
+
+int file_verify_master_password(const char *master_password) {
+    if (file_is_paged()) {
+        BTree *tree = btree_open(get_store_file_path(), master_password);
+        if (!tree) return 0;
+        btree_close(tree);
+        return 1;
+    }
+
+    FILE *file = fopen(get_data_file_path(), "rb");
+    if (!file) return 0;
+
+    FileHeader header;
+    if (!read_header(file, &header)) {
+        fclose(file);
+        return 0;
+    }
+    fclose(file);
+
+    return verify_master_password(master_password, header.salt, header.hash);
+}
+
+const char* file_vault_path(void) {
+    return get_data_file_path();
+}
+
+// ============================================================================
+// INTEGRITY CHECKS
+// ============================================================================
+
+// Ranges found in one file, shifted from payload to file offsets
+typedef struct {
+    const char *path;
+    uint64_t payload_start;
+    VaultRangeVisitor visit;
+    void *ctx;
+    long count;
+} RangeReport;
+
+static int report_range(uint64_t offset, uint64_t length, void *ctx) {
+    RangeReport *report = ctx;
+
+    report->visit(report->path, report->payload_start + offset, length,
+                  report->ctx);
+    report->count++;
+    return 1;
+}
+
+// Hash the payload as it is on disk now (a short file gives a short tree)
+static MerkleTree* hash_payload(FILE *file, const FileHeader *header) {
+    MerkleTree *tree = merkle_new();
+    if (!tree) return NULL;
+
+    unsigned char buffer[STREAM_CHUNK_SIZE];
+    uint64_t remaining = header->payload_len;
+    int ok = fseek(file, (long)header->header_size, SEEK_SET) == 0;
+
+    while (ok && remaining > 0) {
+        size_t n = remaining < sizeof(buffer) ? (size_t)remaining : sizeof(buffer);
+        size_t got = fread(buffer, 1, n, file);
+        ok = merkle_append(tree, buffer, got);
+        if (got < n) break;
+        remaining -= n;
+    }
+
+    if (!ok || !merkle_finish(tree)) {
+        merkle_free(tree);
+        return NULL;
+    }
+    return tree;
+}
+
+// Check one vault or shard file against its authenticated root.
+// Returns: 1 if intact, 0 if damage was reported
+static int verify_vault_file(const char *path, const unsigned char *key,
+                             VaultRangeVisitor visit, void *ctx) {
+    FileHeader header;
+    FILE *file = fopen(path, "rb");
+
+    // Without a trusted header nothing else in the file can be checked
+    if (!file || !read_header(file, &header) || header.version < 3 ||
+        !header_is_authentic(&header, key)) {
+        if (file) fclose(file);
+        visit(path, 0, sizeof(FileHeader), ctx);
+        return 0;
+    }
+
+    unsigned char root[HASH_SIZE];
+    MerkleTree *fresh = hash_payload(file, &header);
+    merkle_root(fresh, root);
+
+    MerkleTree *stored = NULL;
+    unsigned char stored_root[HASH_SIZE];
+    if (fseek(file, tree_offset(&header), SEEK_SET) == 0) {
+        stored = merkle_load(file, header.payload_len);
+    }
+    merkle_root(stored, stored_root);
+    int stored_ok = stored &&
+                    memcmp(stored_root, header.merkle_root, HASH_SIZE) == 0;
+    fclose(file);
+
+    int intact = 1;
+    if (!fresh || memcmp(root, header.merkle_root, HASH_SIZE) != 0) {
+        intact = 0;
+        if (fresh && stored_ok) {
+            // Descend only into the subtrees whose hashes disagree
+            RangeReport report = {path, header.header_size, visit, ctx, 0};
+            merkle_diff(stored, fresh, report_range, &report);
+        } else {
+            visit(path, header.header_size, header.payload_len, ctx);
+        }
+    }
+    if (!stored_ok) {
+        intact = 0;
+        visit(path, (uint64_t)tree_offset(&header),
+              merkle_stored_size(header.payload_len), ctx);
+    }
+
+    merkle_free(fresh);
+    merkle_free(stored);
+    return intact;
+}
+
+static int visit_nothing(const PasswordEntry *entry, void *ctx) {
+    (void)entry;
+    (void)ctx;
+    return 1;
+}
+
+int file_verify_integrity(const char *master_password,
+                          VaultRangeVisitor visit, void *ctx) {
+    if (!master_password || !visit) return -1;
+
+    // Store pages carry their own GCM tags; reading them all checks them
+    if (file_is_paged()) {
+        BTree *tree = btree_open(get_store_file_path(), master_password);
+        if (!tree) return -1;
+
+        int intact = btree_foreach(tree, visit_nothing, NULL);
+        btree_close(tree);
+        if (!intact) visit(get_store_file_path(), 0, 0, ctx);
+        return intact;
+    }
+
+    const char *vault_path = get_data_file_path();
+    FILE *file = fopen(vault_path, "rb");
+    if (!file) return -1;
+
+    FileHeader header;
+    int ok = read_header(file, &header);
+    fclose(file);
+
+    if (!ok || !verify_master_password(master_password, header.salt, header.hash)) {
+        return -1;
+    }
+    if (header.version < 3) return -2;
+
+    unsigned char key[KEY_SIZE];
+    if (!derive_key(master_password, header.salt, key, KEY_SIZE)) return -1;
+
+    // Shards are found through the shard table, which the main file's
+    // root covers; each must be the shard the table seals
+    int intact = verify_vault_file(vault_path, key, visit, ctx);
+    if (header.shard_count > 0) {
+        VaultLayout *layout = malloc(sizeof(VaultLayout));
+        int readable = layout && read_layout(vault_path, layout);
+        if (!readable) {
+            if (intact) visit(vault_path, 0, sizeof(FileHeader), ctx);
+            intact = 0;
+        }
+        for (size_t shard = 0; readable && shard < layout->header.shard_count; shard++) {
+            char path[PATH_SIZE];
+            if (!shard_file_path(vault_path, layout, shard, path, sizeof(path)) ||
+                !verify_vault_file(path, key, visit, ctx)) {
+                intact = 0;
+                continue;
+            }
+
+            FileHeader shard_header;
+            FILE *shard_file = fopen(path, "rb");
+            if (!shard_file || !read_header(shard_file, &shard_header) ||
+                !shard_matches(&shard_header, layout, shard)) {
+                visit(path, 0, sizeof(FileHeader), ctx);
+                intact = 0;
+            }
+            if (shard_file) fclose(shard_file);
+        }
+        free(layout);
+    }
+
+    memset(key, 0, KEY_SIZE);
+    return intact;
+}
+
+// Compare one pair of files by their stored trees
+static long compare_vault_files(const char *path_a, const char *path_b,
+                                VaultRangeVisitor visit, void *ctx) {
+    FileHeader header_a;
+    FileHeader header_b;
+    FILE *file_a = fopen(path_a, "rb");
+    if (!file_a || !read_header(file_a, &header_a)) {
+        if (file_a) fclose(file_a);
+        return -1;
+    }
+    if (header_a.version < 3) {
+        fclose(file_a);
+        return -2;
+    }
+
+    // A file missing on the other side differs everywhere
+    FILE *file_b = fopen(path_b, "rb");
+    if (!file_b || !read_header(file_b, &header_b) || header_b.version < 3) {
+        if (file_b) fclose(file_b);
+        fclose(file_a);
+        visit(path_a, 0, (uint64_t)tree_offset(&header_a) +
+              merkle_stored_size(header_a.payload_len), ctx);
+        return 1;
+    }
+
+    long count = 0;
+    if (memcmp(&header_a, &header_b, offsetof(FileHeader, merkle_root)) != 0) {
+        visit(path_a, 0, header_a.header_size, ctx);
+        count++;
+    }
+
+    // Equal roots over equal lengths: the payloads are the same
+    if (header_a.payload_len == header_b.payload_len &&
+        memcmp(header_a.merkle_root, header_b.merkle_root, HASH_SIZE) == 0) {
+        fclose(file_a);
+        fclose(file_b);
+        return count;
+    }
+
+    MerkleTree *tree_a = NULL;
+    MerkleTree *tree_b = NULL;
+    if (fseek(file_a, tree_offset(&header_a), SEEK_SET) == 0) {
+        tree_a = merkle_load(file_a, header_a.payload_len);
+    }
+    if (fseek(file_b, tree_offset(&header_b), SEEK_SET) == 0) {
+        tree_b = merkle_load(file_b, header_b.payload_len);
+    }
+    fclose(file_a);
+    fclose(file_b);
+
+    if (!tree_a || !tree_b) {
+        merkle_free(tree_a);
+        merkle_free(tree_b);
+        return -1;
+    }
+
+    RangeReport report = {path_a, header_a.header_size, visit, ctx, 0};
+    merkle_diff(tree_a, tree_b, report_range, &report);
+    merkle_free(tree_a);
+    merkle_free(tree_b);
+    return count + report.count;
+}
+
+long file_compare_vaults(const char *path_a, const char *path_b,
+                         VaultRangeVisitor visit, void *ctx) {
+    if (!path_a || !path_b || !visit) return -1;
+
+    long count = compare_vault_files(path_a, path_b, visit, ctx);
+    if (count < 0) return count;
+
+    VaultLayout *layout_a = malloc(sizeof(VaultLayout));
+    VaultLayout *layout_b = malloc(sizeof(VaultLayout));
+    if (!layout_a || !layout_b || !read_layout(path_a, layout_a)) {
+        free(layout_a);
+        free(layout_b);
+        return -1;
+    }
+    if (!read_layout(path_b, layout_b)) layout_b->header.shard_count = 0;
+
+    // Each side finds its shards through its own table; shards that were
+    // not rewritten since the replicas split compare equal by root alone
+    for (size_t shard = 0; count >= 0 && shard < layout_a->header.shard_count; shard++) {
+        char shard_a[PATH_SIZE];
+        char shard_b[PATH_SIZE] = "";
+        if (!shard_file_path(path_a, layout_a, shard, shard_a, sizeof(shard_a)) ||
+            (shard < layout_b->header.shard_count &&
+             !shard_file_path(path_b, layout_b, shard, shard_b, sizeof(shard_b)))) {
+            count = -1;
+            break;
+        }
+
+        long found = compare_vault_files(shard_a, shard_b, visit, ctx);
+        count = found < 0 ? found : count + found;
+    }
+
+    free(layout_a);
+    free(layout_b);
+    return count;
+}
+
+// ============================================================================
+// BACKUP, PASSWORD CHANGE AND CONVERSIONS
+// ============================================================================
+
+// Copy a file to dst_path.tmp and move it over dst_path, so dst_path is
+// either the old file or a complete copy
+static int copy_file(const char *src_path, const char *dst_path) {
+    char tmp_path[PATH_SIZE];
+    int len = snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", dst_path);
+    if (len < 0 || (size_t)len >= sizeof(tmp_path)) return 0;
+
+    FILE *src = fopen(src_path, "rb");
+    if (!src) return 0;
+
+    FILE *dst = fopen(tmp_path, "wb");
+    if (!dst) {
+        fclose(src);
+        return 0;
+    }
+
+    char buffer[4096];
+    size_t bytes;
+    int ok = 1;
+    while (ok && (bytes = fread(buffer, 1, sizeof(buffer), src)) > 0) {
+        ok = fwrite(buffer, 1, bytes, dst) == bytes;
+    }
+    if (ferror(src)) ok = 0;
+
+    fclose(src);
+    if (fclose(dst) != 0) ok = 0;
+    if (!ok || rename(tmp_path, dst_path) != 0) {
+        remove(tmp_path);
+        return 0;
+    }
+    return 1;
+}
+
+// Copy the blind index of a vault or shard file along with it; a missing
+// or failed copy just leaves no index
+static void copy_index(const char *src_path, const char *dst_path) {
+    char src_idx[PATH_SIZE];
+    char dst_idx[PATH_SIZE];
+
+    if (index_file_path(src_path, src_idx, sizeof(src_idx)) &&
+        index_file_path(dst_path, dst_idx, sizeof(dst_idx)) &&
+        !copy_file(src_idx, dst_idx)) {
+        remove(dst_idx);
+    }
+}
+
+int file_copy_vault(const char *src_path, const char *dst_path) {
+    if (!src_path || !dst_path) return 0;
+
+    VaultLayout *layout = malloc(sizeof(VaultLayout));
+    VaultLayout *old = malloc(sizeof(VaultLayout));
+    int ok = layout && old && read_layout(src_path, layout);
+    int had_old = ok && read_layout(dst_path, old);
+    size_t shard_count = ok ? layout->header.shard_count : 0;
+
+    // Shards first, under the shard set the copied main file names; the
+    // main file last, so its rename switches the copy over in one step
+    char src[PATH_SIZE];
+    char dst[PATH_SIZE];
+    if (ok && shard_count > 0) {
+        ok = shard_dir_path(dst_path, layout->header.shard_set, dst, sizeof(dst));
+        if (ok) mkdir(dst, 0700);
+    }
+    for (size_t shard = 0; ok && shard < shard_count; shard++) {
+        ok = shard_file_path(src_path, layout, shard, src, sizeof(src)) &&
+             shard_file_path(dst_path, layout, shard, dst, sizeof(dst));
+
+        // A shard the destination already holds under the same seal is
+        // the same file
+        if (ok && had_old && old->header.shard_set == layout->header.shard_set &&
+            shard < old->header.shard_count &&
+            memcmp(&old->shards[shard], &layout->shards[shard], sizeof(ShardSeal)) == 0) {
+            continue;
+        }
+        ok = ok && copy_file(src, dst);
+        if (ok) copy_index(src, dst);
+    }
+
+    if (ok) ok = copy_file(src_path, dst_path);
+    if (ok) copy_index(src_path, dst_path);
+
+    if (ok && had_old) {
+        remove_stale_shards(dst_path, old, layout);
+    } else if (!ok && layout && shard_count > 0) {
+        remove_stale_shards(dst_path, layout, had_old ? old : NULL);
+    }
+
+    free(layout);
+    free(old);
+    return ok;
+}
+
+// Remove a flat or sharded vault with its shard files and indexes
+static void remove_vault_files(const char *vault_path) {
+    VaultLayout *layout = malloc(sizeof(VaultLayout));
+    if (layout && read_layout(vault_path, layout)) {
+        remove_stale_shards(vault_path, layout, NULL);
+    }
+    free(layout);
+
+    char idx_path[PATH_SIZE];
+    if (index_file_path(vault_path, idx_path, sizeof(idx_path))) remove(idx_path);
+    remove(vault_path);
+}
+
+int file_create_backup(void) {
+    if (file_is_paged()) {
+        return copy_file(get_store_file_path(), get_store_backup_file_path());
+    }
+
+    return file_copy_vault(get_data_file_path(), get_backup_file_path());
+}
+
+int file_change_master_password(PasswordManager *pm,
+                                const char *old_password,
+                                const char *new_password) {
+    if (!file_verify_master_password(old_password)) {
+        return 0;
+    }
+
+    if (!file_create_backup()) {
+        return 0;
+    }
+
+    if (pm->store) {
+        return btree_rekey(pm->store, new_password);
+    }
+
+    return file_save(pm, new_password);
+}
+
+int file_set_shard_count(PasswordManager *pm, const char *master_password,
+                         size_t shard_count) {
+    if (!pm || !master_password || pm->store || shard_count > MAX_SHARDS) {
+        return 0;
+    }
+
+    // A single shard is just the flat layout with extra steps
+    if (shard_count == 1) shard_count = 0;
+
+    // Write the whole new layout. A new shard count gets a new salt and
+    // shard set, so its files never overwrite the current ones and the
+    // rename of the main file switches from one layout to the other.
+    size_t old_count = pm->shard_count;
+    uint64_t old_dirty = pm->dirty_shards;
+    pm->shard_count = shard_count;
+    pm->dirty_shards = ~0ULL;
+    if (!file_save_path(pm, master_password, get_data_file_path())) {
+        pm->shard_count = old_count;
+        pm->dirty_shards = old_dirty;
+        return 0;
+    }
+    return 1;
+}
+
+// Every entry of flat is in the store, unchanged
+static int store_matches(const char *path, const char *master_password,
+                         const PasswordManager *flat) {
+    BTree *tree = btree_open(path, master_password);
+    if (!tree) return 0;
+
+    int ok = btree_count(tree) == flat->count &&
+             btree_tombstone_count(tree) == flat->tombstone_count &&
+             btree_generation(tree) == flat->generation;
+    PasswordEntry stored;
+    for (size_t i = 0; ok && i < flat->count; i++) {
+        const PasswordEntry *entry = &flat->entries[i];
+        ok = btree_get(tree, entry->service, &stored) &&
+             strcmp(stored.username, entry->username) == 0 &&
+             strcmp(stored.password, entry->password) == 0 &&
+             stored.password_modified == entry->password_modified &&
+             stored.generation == entry->generation;
+    }
+    memset(&stored, 0, sizeof(stored));
+
+    if (!btree_close(tree)) ok = 0;
+    return ok;
+}
+
+long file_convert_to_store(const char *master_password) {
+    if (file_is_paged()) return -1;
+
+    int success;
+    PasswordManager *flat = file_load(master_password, &success);
+    if (!success || !flat) return -1;
+
+    char tmp_path[PATH_SIZE];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", get_store_file_path());
+
+    BTree *tree = btree_create(tmp_path, master_password);
+    if (!tree) {
+        pm_free(flat);
+        return -1;
+    }
+
+    long moved = 0;
+    for (size_t i = 0; i < flat->count; i++) {
+        if (!btree_insert(tree, &flat->entries[i])) {
+            btree_close(tree);
+            pm_free(flat);
+            remove(tmp_path);
+            return -1;
+        }
+        moved++;
+    }
+
+    // Deletions and the generation carry over, so sync and change logs
+    // pick up where the flat vault left off
+    int ok = 1;
+    for (size_t i = 0; ok && i < flat->tombstone_count; i++) {
+        ok = btree_add_tombstone(tree, &flat->tombstones[i]);
+    }
+    btree_set_generation(tree, flat->generation, flat->log_floor);
+
+    // Read the store back before it takes over from the flat vault
+    ok = btree_close(tree) && ok && store_matches(tmp_path, master_password, flat);
+    pm_free(flat);
+
+    if (!ok || rename(tmp_path, get_store_file_path()) != 0) {
+        remove(tmp_path);
+        return -1;
+    }
+
+    // The store now takes precedence; keep the flat vault, shards and
+    // all, as its backup rather than deleting it
+    if (file_copy_vault(get_data_file_path(), get_backup_file_path())) {
+        remove_vault_files(get_data_file_path());
+    }
+
+    return moved;
 }
 
 // Dummy functions for compatibility
@@ -1,6 +1,7 @@
 #ifndef FILE_IO_H
 #define FILE_IO_H
 
+#include <stdint.h>
 #include "password.h"
 
 // Get the data directory path (creates if doesn't exist)
@@ -9,30 +10,136 @@ const char* get_data_dir(void);
 // Data file paths (use get_data_dir() to construct full paths)
 #define DATA_FILE_NAME "passwords.dat"
 #define BACKUP_FILE_NAME "passwords.dat.backup"
+#define STORE_FILE_NAME "passwords.db"
+#define STORE_BACKUP_FILE_NAME "passwords.db.backup"
+
+// Shard files live in a directory next to the main file named after
+// the shard set (DATA_FILE_NAME.<set id>/), as <shard>.<generation>
+#define MAX_SHARDS 64
+
+#define VAULT_MAGIC "CIPHERV2"
+#define VAULT_VERSION 6
+
+// Payload codecs (FileHeader.codec)
+#define VAULT_CODEC_NONE 0      // Records back to back
+#define VAULT_CODEC_LZ 1        // Records compressed in frames, see below
 
 // File header structure
+// Files written before VAULT_VERSION 2 have no magic and start directly
+// with salt, hash, IV and a size_t entry count; they are still readable.
+// Since VAULT_VERSION 3 the payload is followed by its Merkle tree (see
+// merkle.h) and the header, root included, is authenticated by header_mac.
+// Since VAULT_VERSION 4 the payload holds entry_count entries followed by
+// tombstone_count tombstones (deleted services, see password.h).
+// Since VAULT_VERSION 5 the records may be compressed before encryption
+// (codec VAULT_CODEC_LZ): the plaintext is then a series of frames, each
+// a VaultFrame followed by its bytes. The first frame is the dictionary,
+// trained on the vault's own usernames and domains and stored as is; the
+// rest hold VAULT_BLOCK_RECORDS records each, compressed against it (or
+// stored as is when that is no smaller). Frames depend on nothing but the
+// dictionary, and the blind index records which frame holds each entry,
+// so a lookup unpacks just the dictionary and that frame.
+// Since VAULT_VERSION 6 the main file of a sharded vault holds a shard
+// table as its (plaintext) payload: one ShardSeal per shard, covered by
+// the Merkle root and so by the header MAC. Sharded vaults written
+// before that have no table and are not readable.
 typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;   // Payload starts right after the header
+    uint32_t record_size;   // sizeof(PasswordEntry) of the writer
+    uint32_t shard_count;   // 0 = single file; N = payload split in N shards
+    uint32_t shard_index;   // Which shard this file holds (shard files only)
+    uint32_t codec;         // VAULT_CODEC_*; always 0 before VAULT_VERSION 5
     unsigned char salt[16];
     unsigned char hash[32];
     unsigned char iv[16];
-    size_t entry_count;
+    uint64_t entry_count;
+    uint64_t payload_len;   // Ciphertext bytes following the header
+    unsigned char merkle_root[32];  // Root over the encrypted payload chunks
+    unsigned char header_mac[32];   // HMAC of the whole header (this field zeroed)
+    uint64_t generation;    // Bumped by every save
+    uint64_t log_floor;     // Oldest generation change logs can start from
+    uint64_t tombstone_count;
+    uint64_t shard_set;     // Names the directory holding the shard files
 } FileHeader;
 
+// One shard as the main file records it: the shard must carry exactly
+// this header MAC (which covers its Merkle root and counts), and it is
+// found by its generation
+typedef struct {
+    unsigned char header_mac[32];
+    uint64_t generation;
+    uint64_t entry_count;
+    uint64_t tombstone_count;
+} ShardSeal;
+
+#define VAULT_BLOCK_RECORDS 64
+#define VAULT_DICT_SIZE 8192
+
+typedef struct {
+    uint32_t raw_len;       // Bytes the frame expands to
+    uint32_t packed_len;    // Bytes that follow; equal to raw_len = stored
+} VaultFrame;
+
+// Called for each damaged or differing range of a vault file
+// path: the vault or shard file; offset/length: byte range within it
+// (length 0 means the file as a whole could not be checked)
+typedef void (*VaultRangeVisitor)(const char *path, uint64_t offset,
+                                  uint64_t length, void *ctx);
+
 // Initialize data directory
 int file_init(void);
 
 // Check if password file exists
 int file_exists(void);
 
+// Check if the vault uses the paged B+tree store instead of the flat file
+int file_is_paged(void);
+
 // Save password manager to file
 int file_save(PasswordManager *pm, const char *master_password);
 
 // Load password manager from file
 PasswordManager* file_load(const char *master_password, int *success);
 
+// Load / save a flat or sharded vault at an explicit path (e.g. a
+// replica); paged stores are not supported here
+PasswordManager* file_load_path(const char *vault_path,
+                                const char *master_password, int *success);
+int file_save_path(PasswordManager *pm, const char *master_password,
+                   const char *vault_path);
+
+// Copy a flat or sharded vault, byte for byte, to another path
+int file_copy_vault(const char *src_path, const char *dst_path);
+
+// Fetch a single entry without loading the whole vault (uses the blind
+// index when it is current, falls back to a full load otherwise)
+// Returns: 1 if found, 0 if not found, -1 on wrong password or I/O error
+int file_lookup_entry(const char *master_password, const char *service,
+                      PasswordEntry *out);
+
 // Verify master password from file
 int file_verify_master_password(const char *master_password);
 
+// Full path of the vault file (the main file if the vault is sharded)
+const char* file_vault_path(void);
+
+// Check every vault file against its authenticated Merkle root, reporting
+// damaged chunk ranges to visit
+// Returns: 1 if intact, 0 if damage was found, -1 on wrong password or an
+// unreadable vault, -2 if the vault predates integrity data (save it first)
+int file_verify_integrity(const char *master_password,
+                          VaultRangeVisitor visit, void *ctx);
+
+// Compare two vault files (or two sharded vaults) by their Merkle trees,
+// reading only the trees and descending only into differing subtrees.
+// No key is needed; ranges are reported against the files of path_a.
+// Returns: number of differing ranges, -1 on I/O error, -2 if either file
+// predates integrity data
+long file_compare_vaults(const char *path_a, const char *path_b,
+                         VaultRangeVisitor visit, void *ctx);
+
 // Create backup of password file
 int file_create_backup(void);
 
@@ -41,6 +148,17 @@ int file_change_master_password(PasswordManager *pm,
                                 const char *old_password,
                                 const char *new_password);
 
+// Split the vault into shard_count files by service hash (0 = one file).
+// Saves after a change then only rewrite the shards that were touched;
+// either way the new files only take over when the main file is renamed
+// into place, so a failed save leaves the previous vault intact.
+int file_set_shard_count(PasswordManager *pm, const char *master_password,
+                         size_t shard_count);
+
+// Convert the flat vault into a paged store (the flat file becomes the
+// backup). Returns: number of entries moved, or -1 on failure
+long file_convert_to_store(const char *master_password);
+
 // ============================================================================
 // FILE LOCKING - Prevent concurrent vault access
 // ============================================================================
@@ -1,82 +1,336 @@
 #include "generator.h"
-#include "crypto.h"
+#include "charmap.h"
+#include "random.h"
+#include "strength.h"
 #include "utils.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
 
 #define UPPERCASE "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
 #define LOWERCASE "abcdefghijklmnopqrstuvwxyz"
 #define NUMBERS "0123456789"
 #define SYMBOLS "!@#$%^&*()_+-=[]{}|;:,.<>?"
+#define CONSONANTS_UPPER "BCDFGHJKLMNPQRSTVWXYZ"
+#define CONSONANTS_LOWER "bcdfghjklmnpqrstvwxyz"
+#define VOWELS_UPPER "AEIOU"
+#define VOWELS_LOWER "aeiou"
+#define HEX_LOWER "0123456789abcdef"
+
+#define RANDOM_BATCH 65536     // Random bytes fetched per refill in bulk mode
+
+// Mask positions are drawn in groups whose alphabet sizes multiply to at
+// most this, so one 32-bit draw covers a group and is rarely (under 1 in
+// 256) redrawn, and splitting it into positions needs no division
+#define MASK_GROUP_LIMIT (1u << 24)
+
+// Random bytes mapped to charset characters, refilled a whole buffer at
+// a time and handed out in runs
+typedef struct {
+    unsigned char *bytes;
+    size_t capacity;
+    size_t pos;
+    size_t len;
+} RandomPool;
+
+static void charset_add(char *chars, size_t *len, const char *add, size_t add_len) {
+    memcpy(chars + *len, add, add_len);
+    *len += add_len;
+}
+
+static int build_charset(const PasswordOptions *options, CharMap *charset) {
+    char chars[CHARSET_MAX];
+    size_t len = 0;
+    if (options->use_uppercase) charset_add(chars, &len, UPPERCASE, sizeof(UPPERCASE) - 1);
+    if (options->use_lowercase) charset_add(chars, &len, LOWERCASE, sizeof(LOWERCASE) - 1);
+    if (options->use_numbers) charset_add(chars, &len, NUMBERS, sizeof(NUMBERS) - 1);
+    if (options->use_symbols) charset_add(chars, &len, SYMBOLS, sizeof(SYMBOLS) - 1);
+    
+    // byte % len would favour the first 256 % len characters; the map
+    // drops bytes at or above the last whole multiple of len instead
+    return charmap_init(charset, chars, len);
+}
+
+// Fill out with length characters drawn uniformly from charset
+static int fill_password(char *out, int length, const CharMap *charset,
+                         RandomPool *pool) {
+    size_t produced = 0;
+    while (produced < (size_t)length) {
+        if (pool->pos == pool->len) {
+            if (!random_bytes(pool->bytes, pool->capacity)) return 0;
+            pool->pos = 0;
+            pool->len = charmap_map(charset, pool->bytes, pool->capacity,
+                                    (char*)pool->bytes);
+        }
+        
+        size_t take = pool->len - pool->pos;
+        if (take > (size_t)length - produced) take = (size_t)length - produced;
+        memcpy(out + produced, pool->bytes + pool->pos, take);
+        memset(pool->bytes + pool->pos, 0, take);
+        pool->pos += take;
+        produced += take;
+    }
+    return 1;
+}
+
+// Bulk passwords: one charset and one pool shared by every line
+typedef struct {
+    const CharMap *charset;
+    RandomPool *pool;
+    int length;
+} PasswordLines;
+
+static size_t password_line(void *ctx, char *out) {
+    PasswordLines *lines = ctx;
+    if (!fill_password(out, lines->length, lines->charset, lines->pool)) return 0;
+    return (size_t)lines->length;
+}
 
 int generate_password(char *buffer, size_t buffer_size, PasswordOptions options) {
-    if (!buffer || buffer_size < (size_t)(options.length + 1)) return 0;  // Correção: Cast para size_t
-    if (options.length < 4 || options.length > 128) return 0;
+    if (!buffer || options.length < 4 || options.length > 128) return 0;
+    if (buffer_size < (size_t)(options.length + 1)) return 0;
+    
+    CharMap charset;
+    if (!build_charset(&options, &charset)) return 0;
+    
+    // Room for the rejected draws of a typical password
+    unsigned char bytes[192];
+    RandomPool pool = {bytes, sizeof(bytes), 0, 0};
     
-    char charset[256] = {0};
-    int charset_len = 0;
+    int ok = fill_password(buffer, options.length, &charset, &pool);
+    memset(bytes, 0, sizeof(bytes));
+    if (!ok) return 0;
     
-    // Build character set
-    if (options.use_uppercase) {
-        strcat(charset, UPPERCASE);
-        charset_len += strlen(UPPERCASE);
+    buffer[options.length] = '\0';
+    return 1;
+}
+
+long long generate_password_batch(FILE *out, unsigned long long count,
+                                  PasswordOptions options) {
+    if (!out || options.length < 4 || options.length > 128) return -1;
+    
+    CharMap charset;
+    if (!build_charset(&options, &charset)) return -1;
+    
+    unsigned char *bytes = malloc(RANDOM_BATCH);
+    if (!bytes) return -1;
+    
+    RandomPool pool = {bytes, RANDOM_BATCH, 0, 0};
+    PasswordLines lines = {&charset, &pool, options.length};
+    long long written = write_generated_lines(out, count, (size_t)options.length,
+                                              password_line, &lines);
+    
+    memset(bytes, 0, RANDOM_BATCH);
+    free(bytes);
+    return written;
+}
+
+typedef struct {
+    char code;
+    const char *chars;
+} MaskClass;
+
+// "?x" classes, hashcat style
+static const MaskClass mask_query_classes[] = {
+    {'u', UPPERCASE},
+    {'l', LOWERCASE},
+    {'d', NUMBERS},
+    {'s', SYMBOLS},
+    {'a', UPPERCASE LOWERCASE NUMBERS SYMBOLS},
+    {'h', HEX_LOWER},
+};
+
+// Bare template letters, as in "Cvccvc-99"
+static const MaskClass mask_template_classes[] = {
+    {'C', CONSONANTS_UPPER},
+    {'c', CONSONANTS_LOWER},
+    {'V', VOWELS_UPPER},
+    {'v', VOWELS_LOWER},
+    {'9', NUMBERS},
+};
+
+typedef struct {
+    const char *chars;
+    uint32_t size;              // 1 = literal
+    uint64_t reciprocal;        // value / size == (value * reciprocal) >> 40 below 2^24
+} MaskPosition;
+
+typedef struct {
+    int begin;
+    int end;
+    uint32_t product;           // Combinations of the group's positions
+    uint32_t excess;            // 2^32 mod product: draws this close to 2^32 are redrawn
+} MaskGroup;
+
+struct MaskProgram {
+    MaskPosition positions[MASK_MAX_LENGTH];
+    MaskGroup groups[MASK_MAX_LENGTH];
+    char literals[MASK_MAX_LENGTH];
+    int length;
+    int group_count;
+    double bits;
+};
+
+// Multiplier that divides any group value (below 2^24) by size exactly
+static uint64_t mask_reciprocal(uint32_t size) {
+    return (1ULL << 40) / size + 1;
+}
+
+static const char* find_mask_class(const MaskClass *classes, size_t count, char code) {
+    for (size_t i = 0; i < count; i++) {
+        if (classes[i].code == code) return classes[i].chars;
     }
-    if (options.use_lowercase) {
-        strcat(charset, LOWERCASE);
-        charset_len += strlen(LOWERCASE);
+    return NULL;
+}
+
+MaskProgram* mask_compile(const char *mask, char *error, size_t error_size) {
+    MaskProgram *program = calloc(1, sizeof(MaskProgram));
+    if (!program) {
+        if (error && error_size > 0) snprintf(error, error_size, "out of memory");
+        return NULL;
     }
-    if (options.use_numbers) {
-        strcat(charset, NUMBERS);
-        charset_len += strlen(NUMBERS);
+    
+    const char *problem = NULL;
+    for (const char *p = mask ? mask : ""; !problem && *p; p++) {
+        if (program->length == MASK_MAX_LENGTH) {
+            problem = "mask is longer than 128 characters";
+            break;
+        }
+        
+        MaskPosition *position = &program->positions[program->length];
+        const char *chars = NULL;
+        char literal = *p;
+        if (*p == '?' && p[1] != '?') {
+            chars = find_mask_class(mask_query_classes,
+                                    sizeof(mask_query_classes) / sizeof(mask_query_classes[0]), *++p);
+            if (!chars) problem = "unknown ?class (use ?u ?l ?d ?s ?a ?h, or ?? for '?')";
+        } else if (*p == '?' || *p == '\\') {
+            literal = *++p;
+            if (!literal) problem = "mask ends with an escape";
+        } else {
+            chars = find_mask_class(mask_template_classes,
+                                    sizeof(mask_template_classes) / sizeof(mask_template_classes[0]), *p);
+        }
+        
+        if (chars) {
+            position->chars = chars;
+            position->size = (uint32_t)strlen(chars);
+            position->reciprocal = mask_reciprocal(position->size);
+        } else {
+            program->literals[program->length] = literal;
+            position->chars = &program->literals[program->length];
+            position->size = 1;
+        }
+        program->length++;
     }
-    if (options.use_symbols) {
-        strcat(charset, SYMBOLS);
-        charset_len += strlen(SYMBOLS);
+    if (!problem && program->length < 4) problem = "mask must give at least 4 characters";
+    
+    if (problem) {
+        if (error && error_size > 0) snprintf(error, error_size, "%s", problem);
+        free(program);
+        return NULL;
     }
     
-    if (charset_len == 0) return 0;
+    // Split the positions into groups for the 32-bit draws
+    MaskGroup *group = NULL;
+    for (int i = 0; i < program->length; i++) {
+        unsigned size = program->positions[i].size;
+        program->bits += log2((double)size);
+        if (size == 1) continue;
+        
+        if (!group || group->product > MASK_GROUP_LIMIT / size) {
+            group = &program->groups[program->group_count++];
+            group->begin = i;
+            group->product = 1;
+        }
+        group->product *= size;
+        group->end = i + 1;
+    }
+    for (int g = 0; g < program->group_count; g++) {
+        uint32_t product = program->groups[g].product;
+        program->groups[g].excess = (UINT32_MAX % product + 1) % product;
+    }
+    return program;
+}
+
+void mask_free(MaskProgram *program) {
+    free(program);
+}
+
+int mask_length(const MaskProgram *program) {
+    return program ? program->length : 0;
+}
+
+double mask_entropy_bits(const MaskProgram *program) {
+    return program ? program->bits : 0.0;
+}
+
+// Run the program: one random draw per password, redrawing only the rare
+// group value that falls in the last partial multiple of its product
+static int run_mask(const MaskProgram *program, char *out) {
+    uint32_t draws[MASK_MAX_LENGTH];
+    size_t draw_bytes = sizeof(uint32_t) * (size_t)program->group_count;
+    if (!random_bytes(draws, draw_bytes)) return 0;
     
-    // Generate random password
-    unsigned char random_bytes[128];
-    if (!generate_random_bytes(random_bytes, options.length)) {
-        return 0;
+    for (int i = 0; i < program->length; i++) {
+        out[i] = program->positions[i].chars[0];
     }
     
-    for (int i = 0; i < options.length; i++) {
-        buffer[i] = charset[random_bytes[i] % charset_len];
+    int ok = 1;
+    for (int g = 0; ok && g < program->group_count; g++) {
+        const MaskGroup *group = &program->groups[g];
+        uint32_t value = draws[g];
+        while (ok && value > UINT32_MAX - group->excess) {
+            ok = random_bytes(&value, sizeof(value));
+        }
+        value %= group->product;
+        
+        for (int i = group->begin; i < group->end; i++) {
+            const MaskPosition *position = &program->positions[i];
+            if (position->size == 1) continue;
+            uint32_t quotient = (uint32_t)((value * position->reciprocal) >> 40);
+            out[i] = position->chars[value - quotient * position->size];
+            value = quotient;
+        }
     }
-    buffer[options.length] = '\0';
     
+    memset(draws, 0, draw_bytes);
+    return ok;
+}
+
+static size_t mask_line(void *ctx, char *out) {
+    const MaskProgram *program = ctx;
+    return run_mask(program, out) ? (size_t)program->length : 0;
+}
+
+int mask_generate(const MaskProgram *program, char *buffer, size_t buffer_size) {
+    if (!program || !buffer || buffer_size < (size_t)program->length + 1) return 0;
+    if (!run_mask(program, buffer)) return 0;
+    buffer[program->length] = '\0';
     return 1;
 }
 
+long long mask_generate_batch(FILE *out, unsigned long long count,
+                              const MaskProgram *program) {
+    if (!out || !program) return -1;
+    return write_generated_lines(out, count, (size_t)program->length, mask_line,
+                                 (void*)program);
+}
+
+PasswordStrength strength_from_bits(double bits) {
+    if (bits < STRENGTH_MEDIUM_BITS) return STRENGTH_WEAK;
+    if (bits < STRENGTH_STRONG_BITS) return STRENGTH_MEDIUM;
+    if (bits < STRENGTH_VERY_STRONG_BITS) return STRENGTH_STRONG;
+    return STRENGTH_VERY_STRONG;
+}
+
 PasswordStrength calculate_strength(const char *password) {
     if (!password) return STRENGTH_WEAK;
     
-    int len = strlen(password);
-    int has_upper = 0, has_lower = 0, has_digit = 0, has_symbol = 0;
-    
-    for (int i = 0; i < len; i++) {
-        if (isupper(password[i])) has_upper = 1;
-        else if (islower(password[i])) has_lower = 1;
-        else if (isdigit(password[i])) has_digit = 1;
-        else has_symbol = 1;
-    }
-    
-    int complexity = has_upper + has_lower + has_digit + has_symbol;
-    
-    // Score calculation
-    int score = 0;
-    if (len >= 8) score++;
-    if (len >= 12) score++;
-    if (len >= 16) score++;
-    if (complexity >= 3) score++;
-    if (complexity == 4) score++;
-    
-    if (score <= 1) return STRENGTH_WEAK;
-    if (score <= 3) return STRENGTH_MEDIUM;
-    if (score <= 4) return STRENGTH_STRONG;
-    return STRENGTH_VERY_STRONG;
+    // Guesses an attacker needs, not length and character classes:
+    // "Password123!" is a dictionary word with a common suffix
+    return strength_from_bits(strength_estimate_bits(password));
 }
 
 const char* get_strength_description(PasswordStrength strength) {
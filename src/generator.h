@@ -2,6 +2,7 @@
 #define GENERATOR_H
 
 #include <stddef.h>
+#include <stdio.h>
 
 // Password generation options
 typedef struct {
@@ -20,12 +21,61 @@ typedef enum {
     STRENGTH_VERY_STRONG
 } PasswordStrength;
 
+// Longest character set (every class enabled)
+#define CHARSET_MAX 96
+
 // Generate password with given options
 int generate_password(char *buffer, size_t buffer_size, PasswordOptions options);
 
-// Calculate password strength
+// Write count passwords to out, one per line, drawing random bytes in
+// large batches and writing through one output buffer
+// Returns: number written, or -1 on failure
+long long generate_password_batch(FILE *out, unsigned long long count,
+                                  PasswordOptions options);
+
+// Fixed-format passwords from a mask, one class or literal per position:
+//   ?u ?l ?d ?s   uppercase, lowercase, digit, symbol
+//   ?a ?h         any of those four, lowercase hex digit
+//   C c V v 9     upper/lower consonant, upper/lower vowel, digit
+//   ?? or \x      a literal '?' or x; anything else is itself
+// e.g. "Cvccvc-99-Cvccvc!" or "?u?l?l?l?d?d?s". A mask compiles once into
+// per-position alphabets; each password then takes one random draw.
+#define MASK_MAX_LENGTH 128
+
+typedef struct MaskProgram MaskProgram;
+
+// Compile a mask; on failure, error (if given) says why
+// Returns: the program (free with mask_free), or NULL
+MaskProgram* mask_compile(const char *mask, char *error, size_t error_size);
+
+void mask_free(MaskProgram *program);
+
+// Length of the passwords a mask produces
+int mask_length(const MaskProgram *program);
+
+// Exact entropy of the mask: sum of log2 of each position's alphabet size
+double mask_entropy_bits(const MaskProgram *program);
+
+// Generate one password into buffer (length + 1 bytes)
+int mask_generate(const MaskProgram *program, char *buffer, size_t buffer_size);
+
+// Write count passwords to out, one per line
+// Returns: number written, or -1 on failure
+long long mask_generate_batch(FILE *out, unsigned long long count,
+                              const MaskProgram *program);
+
+// Strength levels by estimated guesses (log2): under about 1e8 guesses
+// (zxcvbn scores 0-2) is weak, under 2^40 a fast offline attack finds it
+#define STRENGTH_MEDIUM_BITS 27.0
+#define STRENGTH_STRONG_BITS 40.0
+#define STRENGTH_VERY_STRONG_BITS 64.0
+
+// Calculate password strength (see strength.h for the estimator)
 PasswordStrength calculate_strength(const char *password);
 
+// Level for an estimate from strength_estimate_bits()
+PasswordStrength strength_from_bits(double bits);
+
 // Get strength description
 const char* get_strength_description(PasswordStrength strength);
 
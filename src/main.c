@@ -21,6 +21,7 @@
 #include "passphrase.h"
 #include "clipboard.h"
 #include "file_io.h"
+#include "commands.h"
 
 #define MASTER_PASSWORD_SIZE 256
 
@@ -157,16 +158,6 @@ void add_password_menu(void) {
             return;
         }
     } else if (choice == 3) {
-        // Initialize passphrase generator if needed
-        if (!is_wordlist_loaded()) {
-            print_info("Loading wordlist...");
-            if (passphrase_init() != 0) {
-                print_error("Failed to load wordlist!");
-                press_enter_to_continue();
-                return;
-            }
-        }
-        
         printf("\nPassphrase presets:\n");
         printf("  [1] Basic    - 3 words\n");
         printf("  [2] Standard - 4 words (recommended)\n");
@@ -531,7 +522,12 @@ int unlock_vault(void) {
     return 1;
 }
 
-int main(void) {
+int main(int argc, char **argv) {
+    // Non-interactive commands
+    if (argc > 1) {
+        return run_command(argc, argv);
+    }
+    
     // Setup signal handlers for cleanup
     setup_signal_handlers();
     
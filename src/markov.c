@@ -0,0 +1,258 @@
+#include "markov.h"
+#include "passphrase.h"
+#include "random.h"
+#include "utils.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LETTERS 26
+#define SYMBOLS 27              // Letters plus the start-of-word padding
+#define PADDING 26
+#define SCALE 65536             // Table probabilities are multiples of 1/SCALE
+#define NO_ROW 0xffff
+#define GUIDE_BITS 6            // Draw bits that index a row's guide
+#define GUIDE_SIZE (1 << GUIDE_BITS)
+
+// Each context some word continues from has a row of transitions. A
+// transition names the row of the context it leads to, so sampling never
+// looks at contexts at all; a context nothing follows leads to the start.
+struct MarkovModel {
+    size_t rows;
+    uint32_t start;             // Row of a word's first letter
+    uint32_t *row_begin;        // Row -> first transition; rows + 1 entries
+    uint16_t *threshold;        // Transition -> highest 16-bit draw that picks it
+    unsigned char *letter;      // Transition -> letter
+    uint16_t *next_row;         // Transition -> row it leads to
+    unsigned char *guide;       // Row x top draw bits -> first transition that can match
+    double *row_entropy;        // Bits of information in one draw from the row
+};
+
+// Contexts are the last `order` symbols as a base-SYMBOLS number
+typedef struct {
+    size_t count;               // SYMBOLS^order
+    size_t start;               // All padding
+    uint16_t *row_of;           // Context -> row, NO_ROW if nothing follows it
+} Contexts;
+
+static size_t next_context(const Contexts *contexts, size_t context, int symbol) {
+    return context % (contexts->count / SYMBOLS) * SYMBOLS + (size_t)symbol;
+}
+
+// Count letter transitions over every run of letters in the wordlist
+static uint32_t* count_transitions(const Contexts *contexts) {
+    uint32_t *counts = calloc(contexts->count * LETTERS, sizeof(uint32_t));
+    if (!counts) return NULL;
+
+    int words = passphrase_word_count();
+    for (int i = 0; i < words; i++) {
+        // "t-shirt" counts as two words
+        size_t context = contexts->start;
+        for (const char *p = passphrase_word(i, NULL); *p; p++) {
+            if (*p < 'a' || *p > 'z') {
+                context = contexts->start;
+                continue;
+            }
+            counts[context * LETTERS + (size_t)(*p - 'a')]++;
+            context = next_context(contexts, context, *p - 'a');
+        }
+    }
+    return counts;
+}
+
+// Turn one context's counts into 16-bit thresholds: every seen letter
+// keeps at least one draw value, and the rounding is settled on the most
+// common letter so the row covers exactly SCALE values
+static void build_row(MarkovModel *model, const Contexts *contexts, const uint32_t *counts,
+                      size_t context) {
+    size_t row = contexts->row_of[context];
+
+    uint64_t total = 0;
+    for (int l = 0; l < LETTERS; l++) total += counts[l];
+
+    uint32_t share[LETTERS];
+    int64_t assigned = 0;
+    int largest = 0;
+    for (int l = 0; l < LETTERS; l++) {
+        share[l] = (uint32_t)((uint64_t)counts[l] * SCALE / total);
+        if (counts[l] > 0 && share[l] == 0) share[l] = 1;
+        if (share[l] > share[largest]) largest = l;
+        assigned += share[l];
+    }
+    share[largest] = (uint32_t)((int64_t)share[largest] + SCALE - assigned);
+
+    uint32_t t = model->row_begin[row];
+    uint32_t cumulative = 0;
+    double entropy = 0.0;
+    for (int l = 0; l < LETTERS; l++) {
+        if (share[l] == 0) continue;
+        cumulative += share[l];
+        model->threshold[t] = (uint16_t)(cumulative - 1);
+        model->letter[t] = (unsigned char)l;
+
+        uint16_t next = contexts->row_of[next_context(contexts, context, l)];
+        model->next_row[t] = next == NO_ROW ? (uint16_t)model->start : next;
+        t++;
+
+        double p = (double)share[l] / SCALE;
+        entropy -= p * log2(p);
+    }
+    model->row_begin[row + 1] = t;
+    model->row_entropy[row] = entropy;
+
+    // Draws sharing their top bits start the scan at the first threshold
+    // any of them can fall under
+    unsigned char *guide = model->guide + row * GUIDE_SIZE;
+    uint32_t first = model->row_begin[row];
+    t = first;
+    for (uint32_t g = 0; g < GUIDE_SIZE; g++) {
+        uint32_t lowest = g << (16 - GUIDE_BITS);
+        while (lowest > model->threshold[t]) t++;
+        guide[g] = (unsigned char)(t - first);
+    }
+}
+
+MarkovModel* markov_train(int order) {
+    if (order < MARKOV_MIN_ORDER || order > MARKOV_MAX_ORDER) return NULL;
+
+    Contexts contexts = {1, 0, NULL};
+    for (int i = 0; i < order; i++) {
+        contexts.count *= SYMBOLS;
+        contexts.start = contexts.start * SYMBOLS + PADDING;
+    }
+
+    uint32_t *counts = count_transitions(&contexts);
+    if (!counts) return NULL;
+
+    MarkovModel *model = calloc(1, sizeof(MarkovModel));
+    contexts.row_of = malloc(contexts.count * sizeof(uint16_t));
+    if (!model || !contexts.row_of) {
+        free(counts);
+        free(model);
+        free(contexts.row_of);
+        return NULL;
+    }
+
+    size_t transitions = 0;
+    for (size_t c = 0; c < contexts.count; c++) {
+        size_t seen = 0;
+        for (int l = 0; l < LETTERS; l++) seen += counts[c * LETTERS + l] > 0;
+        contexts.row_of[c] = seen ? (uint16_t)model->rows++ : NO_ROW;
+        transitions += seen;
+    }
+    model->start = contexts.row_of[contexts.start];
+
+    model->row_begin = calloc(model->rows + 1, sizeof(uint32_t));
+    model->threshold = malloc(transitions * sizeof(uint16_t));
+    model->letter = malloc(transitions);
+    model->next_row = malloc(transitions * sizeof(uint16_t));
+    model->guide = malloc(model->rows * GUIDE_SIZE);
+    model->row_entropy = malloc(model->rows * sizeof(double));
+    if (!model->row_begin || !model->threshold || !model->letter ||
+        !model->next_row || !model->guide || !model->row_entropy) {
+        free(counts);
+        free(contexts.row_of);
+        markov_free(model);
+        return NULL;
+    }
+
+    for (size_t c = 0; c < contexts.count; c++) {
+        if (contexts.row_of[c] != NO_ROW) build_row(model, &contexts, counts + c * LETTERS, c);
+    }
+    free(counts);
+    free(contexts.row_of);
+    return model;
+}
+
+void markov_free(MarkovModel *model) {
+    if (!model) return;
+    free(model->row_begin);
+    free(model->threshold);
+    free(model->letter);
+    free(model->next_row);
+    free(model->guide);
+    free(model->row_entropy);
+    free(model);
+}
+
+double markov_entropy_bits(const MarkovModel *model, int length) {
+    if (!model || length <= 0) return 0.0;
+
+    double *current = calloc(model->rows, sizeof(double));
+    double *next = calloc(model->rows, sizeof(double));
+    if (!current || !next) {
+        free(current);
+        free(next);
+        return 0.0;
+    }
+
+    double bits = 0.0;
+    current[model->start] = 1.0;
+    for (int i = 0; i < length; i++) {
+        memset(next, 0, model->rows * sizeof(double));
+        for (size_t row = 0; row < model->rows; row++) {
+            if (current[row] == 0.0) continue;
+            bits += current[row] * model->row_entropy[row];
+
+            uint32_t previous = 0;
+            for (uint32_t t = model->row_begin[row]; t < model->row_begin[row + 1]; t++) {
+                double p = (double)(model->threshold[t] + 1u - previous) / SCALE;
+                previous = model->threshold[t] + 1u;
+                next[model->next_row[t]] += current[row] * p;
+            }
+        }
+        double *swap = current;
+        current = next;
+        next = swap;
+    }
+
+    free(current);
+    free(next);
+    return bits;
+}
+
+// One 16-bit draw per letter, all taken in a single call
+static int walk(const MarkovModel *model, int length, char *out) {
+    uint16_t draws[MARKOV_MAX_LENGTH];
+    if (!random_bytes(draws, sizeof(uint16_t) * (size_t)length)) return 0;
+
+    uint32_t row = model->start;
+    for (int i = 0; i < length; i++) {
+        uint32_t t = model->row_begin[row] + model->guide[row * GUIDE_SIZE + (draws[i] >> (16 - GUIDE_BITS))];
+        while (draws[i] > model->threshold[t]) t++;
+
+        out[i] = (char)('a' + model->letter[t]);
+        row = model->next_row[t];
+    }
+
+    memset(draws, 0, sizeof(uint16_t) * (size_t)length);
+    return 1;
+}
+
+// Bulk words: one model and length for every line
+typedef struct {
+    const MarkovModel *model;
+    int length;
+} MarkovLines;
+
+static size_t markov_line(void *ctx, char *out) {
+    const MarkovLines *lines = ctx;
+    return walk(lines->model, lines->length, out) ? (size_t)lines->length : 0;
+}
+
+int markov_generate(const MarkovModel *model, int length, char *buffer, size_t buffer_size) {
+    if (!model || !buffer || length < 1 || length > MARKOV_MAX_LENGTH) return 0;
+    if (buffer_size < (size_t)length + 1) return 0;
+    if (!walk(model, length, buffer)) return 0;
+    buffer[length] = '\0';
+    return 1;
+}
+
+long long markov_generate_batch(FILE *out, unsigned long long count, int length,
+                                const MarkovModel *model) {
+    if (!out || !model || length < 1 || length > MARKOV_MAX_LENGTH) return -1;
+
+    MarkovLines lines = {model, length};
+    return write_generated_lines(out, count, (size_t)length, markov_line, &lines);
+}
@@ -0,0 +1,47 @@
+#ifndef MARKOV_H
+#define MARKOV_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+/**
+ * Pronounceable passwords from a character Markov model
+ *
+ * The model is trained on the EFF wordlist: for every context of the last
+ * `order` letters (padded at the start of a word) it counts which letter
+ * comes next. Each context's counts become a compact cumulative table of
+ * 16-bit thresholds, so drawing a letter is one 16-bit random value and a
+ * short scan. A context no word continues from starts a new word.
+ *
+ * Every password has exactly one path through the model, so its entropy
+ * is the expected information of the draws along the way, computed
+ * exactly from the table probabilities by following the distribution of
+ * contexts one letter at a time.
+ */
+
+#define MARKOV_MIN_ORDER 2
+#define MARKOV_MAX_ORDER 3
+#define MARKOV_DEFAULT_ORDER 2
+#define MARKOV_MAX_LENGTH 128
+
+typedef struct MarkovModel MarkovModel;
+
+// Train a model of the given order (letters of context) on the wordlist
+// Returns: the model (free with markov_free), or NULL on a bad order or
+//          out of memory
+MarkovModel* markov_train(int order);
+
+void markov_free(MarkovModel *model);
+
+// Exact entropy of the passwords of this length, in bits
+double markov_entropy_bits(const MarkovModel *model, int length);
+
+// Generate one password of length letters into buffer (length + 1 bytes)
+int markov_generate(const MarkovModel *model, int length, char *buffer, size_t buffer_size);
+
+// Write count passwords of length letters to out, one per line
+// Returns: number written, or -1 on failure
+long long markov_generate_batch(FILE *out, unsigned long long count, int length,
+                                const MarkovModel *model);
+
+#endif // MARKOV_H
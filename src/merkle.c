@@ -0,0 +1,352 @@
+#include "merkle.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define MERKLE_MAX_LEVELS 64
+
+#define LEAF_PREFIX 0x00
+#define NODE_PREFIX 0x01
+
+struct MerkleTree {
+    unsigned char *nodes;   // HASH_SIZE each, level 0 (leaves) first
+    size_t capacity;        // Nodes allocated
+    size_t leaf_count;
+    size_t node_count;
+    uint64_t payload_len;
+
+    int levels;
+    size_t level_offset[MERKLE_MAX_LEVELS];
+    size_t level_size[MERKLE_MAX_LEVELS];
+
+    // Chunk being filled, behind its one-byte hash prefix
+    unsigned char chunk[1 + MERKLE_CHUNK_SIZE];
+    size_t chunk_used;
+};
+
+// Range being accumulated while walking two trees
+typedef struct {
+    MerkleRangeVisitor visit;
+    void *ctx;
+    uint64_t payload_len;
+    size_t start;
+    size_t end;
+    int pending;
+    int stopped;
+} DiffWalk;
+
+static unsigned char* node_at(const MerkleTree *tree, int level, size_t index) {
+    return tree->nodes + (tree->level_offset[level] + index) * HASH_SIZE;
+}
+
+// Work out level offsets and sizes for leaf_count leaves
+static size_t plan_levels(MerkleTree *tree, size_t leaf_count) {
+    size_t total = 0;
+    size_t size = leaf_count;
+
+    tree->levels = 0;
+    while (size > 0 && tree->levels < MERKLE_MAX_LEVELS) {
+        tree->level_offset[tree->levels] = total;
+        tree->level_size[tree->levels] = size;
+        tree->levels++;
+        total += size;
+        if (size == 1) break;
+        size = (size + 1) / 2;
+    }
+    return total;
+}
+
+static int hash_children(const unsigned char *left, const unsigned char *right,
+                         unsigned char *out) {
+    unsigned char buffer[1 + 2 * HASH_SIZE];
+
+    buffer[0] = NODE_PREFIX;
+    memcpy(buffer + 1, left, HASH_SIZE);
+    memcpy(buffer + 1 + HASH_SIZE, right, HASH_SIZE);
+    return sha256(buffer, sizeof(buffer), out);
+}
+
+// Compute (build = 1) or check (build = 0) one inner node from its children
+static int settle_node(MerkleTree *tree, int level, size_t index, int build) {
+    const unsigned char *left = node_at(tree, level - 1, 2 * index);
+    unsigned char hash[HASH_SIZE];
+
+    if (2 * index + 1 < tree->level_size[level - 1]) {
+        if (!hash_children(left, left + HASH_SIZE, hash)) return 0;
+    } else {
+        memcpy(hash, left, HASH_SIZE);
+    }
+
+    if (build) {
+        memcpy(node_at(tree, level, index), hash, HASH_SIZE);
+        return 1;
+    }
+    return memcmp(node_at(tree, level, index), hash, HASH_SIZE) == 0;
+}
+
+static int reserve_nodes(MerkleTree *tree, size_t count) {
+    if (count <= tree->capacity) return 1;
+
+    size_t capacity = tree->capacity ? tree->capacity : 64;
+    while (capacity < count) capacity *= 2;
+
+    unsigned char *nodes = realloc(tree->nodes, capacity * HASH_SIZE);
+    if (!nodes) return 0;
+
+    tree->nodes = nodes;
+    tree->capacity = capacity;
+    return 1;
+}
+
+static int flush_chunk(MerkleTree *tree) {
+    if (!reserve_nodes(tree, tree->leaf_count + 1)) return 0;
+
+    unsigned char *leaf = tree->nodes + tree->leaf_count * HASH_SIZE;
+    if (!sha256(tree->chunk, 1 + tree->chunk_used, leaf)) return 0;
+
+    tree->leaf_count++;
+    tree->chunk_used = 0;
+    return 1;
+}
+
+MerkleTree* merkle_new(void) {
+    MerkleTree *tree = calloc(1, sizeof(MerkleTree));
+    if (!tree) return NULL;
+
+    tree->chunk[0] = LEAF_PREFIX;
+    return tree;
+}
+
+int merkle_append(MerkleTree *tree, const unsigned char *data, size_t len) {
+    if (!tree) return 0;
+
+    tree->payload_len += len;
+    while (len > 0) {
+        size_t n = MERKLE_CHUNK_SIZE - tree->chunk_used;
+        if (n > len) n = len;
+
+        memcpy(tree->chunk + 1 + tree->chunk_used, data, n);
+        tree->chunk_used += n;
+        data += n;
+        len -= n;
+
+        if (tree->chunk_used == MERKLE_CHUNK_SIZE && !flush_chunk(tree)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int merkle_finish(MerkleTree *tree) {
+    if (!tree) return 0;
+    if (tree->chunk_used > 0 && !flush_chunk(tree)) return 0;
+
+    tree->node_count = plan_levels(tree, tree->leaf_count);
+    if (!reserve_nodes(tree, tree->node_count)) return 0;
+
+    for (int level = 1; level < tree->levels; level++) {
+        for (size_t i = 0; i < tree->level_size[level]; i++) {
+            if (!settle_node(tree, level, i, 1)) return 0;
+        }
+    }
+    return 1;
+}
+
+void merkle_root(const MerkleTree *tree, unsigned char *out) {
+    if (!tree || tree->levels == 0) {
+        memset(out, 0, HASH_SIZE);
+        return;
+    }
+    memcpy(out, node_at(tree, tree->levels - 1, 0), HASH_SIZE);
+}
+
+uint64_t merkle_stored_size(uint64_t payload_len) {
+    uint64_t leaves = (payload_len + MERKLE_CHUNK_SIZE - 1) / MERKLE_CHUNK_SIZE;
+    uint64_t nodes = 0;
+
+    while (leaves > 0) {
+        nodes += leaves;
+        if (leaves == 1) break;
+        leaves = (leaves + 1) / 2;
+    }
+    return nodes * HASH_SIZE;
+}
+
+int merkle_store(FILE *file, const MerkleTree *tree) {
+    if (!file || !tree) return 0;
+    if (tree->node_count == 0) return 1;
+
+    return fwrite(tree->nodes, HASH_SIZE, tree->node_count, file) ==
+           tree->node_count;
+}
+
+MerkleTree* merkle_load(FILE *file, uint64_t payload_len) {
+    uint64_t leaves = (payload_len + MERKLE_CHUNK_SIZE - 1) / MERKLE_CHUNK_SIZE;
+    if (!file || leaves > SIZE_MAX / HASH_SIZE / 2) return NULL;
+
+    MerkleTree *tree = merkle_new();
+    if (!tree) return NULL;
+
+    tree->leaf_count = (size_t)leaves;
+    tree->payload_len = payload_len;
+    tree->node_count = plan_levels(tree, tree->leaf_count);
+
+    if (!reserve_nodes(tree, tree->node_count) ||
+        fread(tree->nodes, HASH_SIZE, tree->node_count, file) != tree->node_count) {
+        merkle_free(tree);
+        return NULL;
+    }
+
+    // Every inner node must match its children, or the root proves nothing
+    for (int level = 1; level < tree->levels; level++) {
+        for (size_t i = 0; i < tree->level_size[level]; i++) {
+            if (!settle_node(tree, level, i, 0)) {
+                merkle_free(tree);
+                return NULL;
+            }
+        }
+    }
+    return tree;
+}
+
+// Climb from one leaf to the root, reading siblings from the stored tree
+static int verify_path(FILE *file, const MerkleTree *plan, long tree_start,
+                       size_t leaf, const unsigned char *leaf_hash,
+                       const unsigned char *root) {
+    unsigned char hash[HASH_SIZE];
+    unsigned char sibling[HASH_SIZE];
+    size_t index = leaf;
+
+    memcpy(hash, leaf_hash, HASH_SIZE);
+    for (int level = 0; level + 1 < plan->levels; level++) {
+        size_t other = index ^ 1;
+
+        if (other < plan->level_size[level]) {
+            long at = tree_start +
+                      (long)((plan->level_offset[level] + other) * HASH_SIZE);
+            if (fseek(file, at, SEEK_SET) != 0 ||
+                fread(sibling, 1, HASH_SIZE, file) != HASH_SIZE) {
+                return 0;
+            }
+            if (index & 1) {
+                if (!hash_children(sibling, hash, hash)) return 0;
+            } else if (!hash_children(hash, sibling, hash)) {
+                return 0;
+            }
+        }
+        index /= 2;
+    }
+
+    return memcmp(hash, root, HASH_SIZE) == 0;
+}
+
+int merkle_verify_range(FILE *file, long payload_start, uint64_t payload_len,
+                        long tree_start, uint64_t offset, uint64_t length,
+                        const unsigned char *root) {
+    if (!file || !root || length == 0 || offset + length > payload_len) return 0;
+
+    MerkleTree *plan = merkle_new();
+    if (!plan) return 0;
+
+    uint64_t leaves = (payload_len + MERKLE_CHUNK_SIZE - 1) / MERKLE_CHUNK_SIZE;
+    plan_levels(plan, (size_t)leaves);
+
+    size_t first = (size_t)(offset / MERKLE_CHUNK_SIZE);
+    size_t last = (size_t)((offset + length - 1) / MERKLE_CHUNK_SIZE);
+    int ok = 1;
+
+    for (size_t leaf = first; ok && leaf <= last; leaf++) {
+        uint64_t start = (uint64_t)leaf * MERKLE_CHUNK_SIZE;
+        size_t n = MERKLE_CHUNK_SIZE;
+        if (start + n > payload_len) n = (size_t)(payload_len - start);
+
+        unsigned char hash[HASH_SIZE];
+        ok = fseek(file, payload_start + (long)start, SEEK_SET) == 0 &&
+             fread(plan->chunk + 1, 1, n, file) == n &&
+             sha256(plan->chunk, 1 + n, hash) &&
+             verify_path(file, plan, tree_start, leaf, hash, root);
+    }
+
+    merkle_free(plan);
+    return ok;
+}
+
+// Hand the accumulated run of chunks to the visitor
+static void emit_range(DiffWalk *walk) {
+    if (!walk->pending || walk->stopped) return;
+
+    uint64_t offset = (uint64_t)walk->start * MERKLE_CHUNK_SIZE;
+    uint64_t end = (uint64_t)walk->end * MERKLE_CHUNK_SIZE;
+    if (end > walk->payload_len) end = walk->payload_len;
+
+    if (!walk->visit(offset, end - offset, walk->ctx)) walk->stopped = 1;
+    walk->pending = 0;
+}
+
+static void mark_leaf(DiffWalk *walk, size_t leaf) {
+    if (walk->pending && walk->end == leaf) {
+        walk->end = leaf + 1;
+        return;
+    }
+    emit_range(walk);
+    walk->start = leaf;
+    walk->end = leaf + 1;
+    walk->pending = 1;
+}
+
+static int node_exists(const MerkleTree *tree, int level, size_t index) {
+    return level < tree->levels && index < tree->level_size[level];
+}
+
+// Leaves covered by node (level, index) in a tree, i.e. [first, end)
+static size_t covered_end(const MerkleTree *tree, int level, size_t index) {
+    uint64_t end = ((uint64_t)index + 1) << level;
+    return end < tree->leaf_count ? (size_t)end : tree->leaf_count;
+}
+
+static void diff_node(const MerkleTree *a, const MerkleTree *b, DiffWalk *walk,
+                      int level, size_t index) {
+    if (walk->stopped) return;
+
+    uint64_t first = (uint64_t)index << level;
+    if (first >= a->leaf_count && first >= b->leaf_count) return;
+
+    // Identical hashes over identical leaf spans: nothing below differs
+    if (node_exists(a, level, index) && node_exists(b, level, index) &&
+        covered_end(a, level, index) == covered_end(b, level, index) &&
+        memcmp(node_at(a, level, index), node_at(b, level, index), HASH_SIZE) == 0) {
+        return;
+    }
+
+    if (level == 0) {
+        mark_leaf(walk, index);
+        return;
+    }
+
+    diff_node(a, b, walk, level - 1, 2 * index);
+    diff_node(a, b, walk, level - 1, 2 * index + 1);
+}
+
+int merkle_diff(const MerkleTree *a, const MerkleTree *b,
+                MerkleRangeVisitor visit, void *ctx) {
+    if (!a || !b || !visit) return 0;
+
+    DiffWalk walk = {0};
+    walk.visit = visit;
+    walk.ctx = ctx;
+    walk.payload_len = a->payload_len > b->payload_len ? a->payload_len : b->payload_len;
+
+    int top = a->levels > b->levels ? a->levels : b->levels;
+    if (top > 0) {
+        diff_node(a, b, &walk, top - 1, 0);
+    }
+    emit_range(&walk);
+
+    return !walk.stopped;
+}
+
+void merkle_free(MerkleTree *tree) {
+    if (!tree) return;
+
+    free(tree->nodes);
+    free(tree);
+}
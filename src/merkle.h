@@ -0,0 +1,70 @@
+#ifndef MERKLE_H
+#define MERKLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "crypto.h"
+
+/**
+ * Merkle tree over fixed-size chunks of a vault payload
+ *
+ * Leaves are SHA-256 hashes of MERKLE_CHUNK_SIZE-byte chunks of the
+ * encrypted payload (the last chunk may be shorter); each parent hashes
+ * its two children, and an unpaired node at the end of a level is carried
+ * up unchanged. Leaves and inner nodes use distinct hash prefixes so one
+ * can never be passed off as the other.
+ *
+ * Trees are built incrementally while a payload is written or read, and
+ * stored level by level (leaves first) right after the payload. Two trees
+ * are compared top-down, descending only into subtrees whose hashes
+ * differ, so locating k changed chunks costs O(k log n) comparisons.
+ */
+
+#define MERKLE_CHUNK_SIZE 4096
+
+typedef struct MerkleTree MerkleTree;
+
+// Called for each run of differing chunks found by merkle_diff
+// offset/length are in payload bytes; return 0 to stop the walk
+typedef int (*MerkleRangeVisitor)(uint64_t offset, uint64_t length, void *ctx);
+
+// Start an empty tree to be fed with merkle_append
+MerkleTree* merkle_new(void);
+
+// Hash the next piece of payload
+int merkle_append(MerkleTree *tree, const unsigned char *data, size_t len);
+
+// Hash the final partial chunk and build the inner levels
+int merkle_finish(MerkleTree *tree);
+
+// Root hash (HASH_SIZE bytes, all zero for an empty payload)
+void merkle_root(const MerkleTree *tree, unsigned char *out);
+
+// Bytes a stored tree takes for a payload of payload_len bytes
+uint64_t merkle_stored_size(uint64_t payload_len);
+
+// Write a finished tree at the current file position
+int merkle_store(FILE *file, const MerkleTree *tree);
+
+// Read a stored tree for a payload of payload_len bytes from the current
+// file position. Returns NULL if it is missing or not self-consistent.
+MerkleTree* merkle_load(FILE *file, uint64_t payload_len);
+
+// Check payload bytes [offset, offset + length) of a stored payload
+// against a trusted root, reading only the chunks involved and their
+// authentication paths from the stored tree: O(log n) per chunk
+// Returns: 1 if the chunks are intact, 0 if not or on I/O error
+int merkle_verify_range(FILE *file, long payload_start, uint64_t payload_len,
+                        long tree_start, uint64_t offset, uint64_t length,
+                        const unsigned char *root);
+
+// Report every chunk range where two trees differ (payloads of different
+// lengths are compared up to the longer one)
+// Returns: 1 if the walk completed, 0 if the visitor stopped it
+int merkle_diff(const MerkleTree *a, const MerkleTree *b,
+                MerkleRangeVisitor visit, void *ctx);
+
+void merkle_free(MerkleTree *tree);
+
+#endif // MERKLE_H
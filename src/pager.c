@@ -0,0 +1,621 @@
+#ifndef _WIN32
+    #define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "pager.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#ifdef _WIN32
+    #define fseeko _fseeki64
+    #define ftello _ftelli64
+    typedef long long off_t;
+#else
+    #include <unistd.h>
+#endif
+
+#define REKEY_SUFFIX ".rekey"
+
+#define NO_FRAME -1
+
+// Version table entries of the table's own pages: the two chains take
+// turns, so a commit never overwrites the table the header points at
+#define TABLE_MARK 0x80000000u
+#define TABLE_CHAIN 0x40000000u
+#define EPOCH_LIMIT TABLE_CHAIN
+
+#define TABLE_SLOTS ((PAGE_PAYLOAD - 2 * sizeof(uint32_t)) / sizeof(uint32_t))
+
+// One page of the version table: the versions of TABLE_SLOTS pages in
+// page order, and the next page of the chain (0 = last)
+typedef struct {
+    uint32_t next;
+    uint32_t count;
+    uint32_t version[TABLE_SLOTS];
+} TablePage;
+
+_Static_assert(sizeof(TablePage) <= PAGE_PAYLOAD, "table page exceeds page");
+
+// One slot of the buffer pool
+typedef struct {
+    uint32_t pgno;
+    int pins;
+    int dirty;
+    int valid;
+    int prev;           // LRU neighbours (head = most recently used)
+    int next;
+    int hash_next;      // Chain within a hash bucket
+    unsigned char *data;
+} Frame;
+
+struct Pager {
+    FILE *file;
+    char *path;
+    unsigned char key[KEY_SIZE];
+    uint32_t page_count;
+
+    // Commit epoch each page was last written in, checked as part of the
+    // page's associated data; the table itself is sealed under the epoch
+    // of the commit that wrote it
+    uint32_t *versions;
+    uint32_t version_capacity;
+    uint64_t epoch;
+    int uncommitted;        // Pages written since the last commit
+
+    Frame *frames;
+    size_t frame_count;
+    int *buckets;
+    size_t bucket_mask;
+    int lru_head;
+    int lru_tail;
+};
+
+static size_t bucket_of(const Pager *pager, uint32_t pgno) {
+    return (pgno * 2654435761u) & pager->bucket_mask;
+}
+
+static void lru_unlink(Pager *pager, int index) {
+    Frame *frame = &pager->frames[index];
+
+    if (frame->prev != NO_FRAME) pager->frames[frame->prev].next = frame->next;
+    else pager->lru_head = frame->next;
+
+    if (frame->next != NO_FRAME) pager->frames[frame->next].prev = frame->prev;
+    else pager->lru_tail = frame->prev;
+
+    frame->prev = frame->next = NO_FRAME;
+}
+
+static void lru_push_front(Pager *pager, int index) {
+    Frame *frame = &pager->frames[index];
+
+    frame->prev = NO_FRAME;
+    frame->next = pager->lru_head;
+    if (pager->lru_head != NO_FRAME) pager->frames[pager->lru_head].prev = index;
+    pager->lru_head = index;
+    if (pager->lru_tail == NO_FRAME) pager->lru_tail = index;
+}
+
+static void hash_remove(Pager *pager, int index) {
+    int *link = &pager->buckets[bucket_of(pager, pager->frames[index].pgno)];
+
+    while (*link != NO_FRAME) {
+        if (*link == index) {
+            *link = pager->frames[index].hash_next;
+            return;
+        }
+        link = &pager->frames[*link].hash_next;
+    }
+}
+
+static int hash_lookup(const Pager *pager, uint32_t pgno) {
+    int index = pager->buckets[bucket_of(pager, pgno)];
+
+    while (index != NO_FRAME) {
+        if (pager->frames[index].pgno == pgno) return index;
+        index = pager->frames[index].hash_next;
+    }
+    return NO_FRAME;
+}
+
+static void encode_u32(uint32_t value, unsigned char *out) {
+    out[0] = (unsigned char)(value >> 24);
+    out[1] = (unsigned char)(value >> 16);
+    out[2] = (unsigned char)(value >> 8);
+    out[3] = (unsigned char)value;
+}
+
+// A data page is bound to its number and version; a table page to its
+// number and the commit epoch, so neither can stand in for the other
+static size_t page_aad(uint32_t pgno, uint32_t version, unsigned char aad[12]) {
+    encode_u32(pgno, aad);
+    encode_u32(version, aad + 4);
+    return 8;
+}
+
+static size_t table_aad(uint32_t pgno, uint64_t epoch, unsigned char aad[12]) {
+    encode_u32(pgno, aad);
+    encode_u32((uint32_t)(epoch >> 32), aad + 4);
+    encode_u32((uint32_t)epoch, aad + 8);
+    return 12;
+}
+
+// Seal one payload and write it at its slot
+static int write_page(FILE *file, const unsigned char *key, uint32_t pgno,
+                      const unsigned char *aad, size_t aad_len,
+                      const unsigned char *payload) {
+    unsigned char raw[PAGE_SIZE];
+
+    if (!generate_random_bytes(raw, AEAD_NONCE_SIZE) ||
+        !aead_encrypt(key, raw, aad, aad_len, payload, PAGE_PAYLOAD,
+                      raw + AEAD_NONCE_SIZE + AEAD_TAG_SIZE,
+                      raw + AEAD_NONCE_SIZE)) {
+        return 0;
+    }
+
+    return fseeko(file, (off_t)pgno * PAGE_SIZE, SEEK_SET) == 0 &&
+           fwrite(raw, 1, PAGE_SIZE, file) == PAGE_SIZE;
+}
+
+// Read one page and check its tag
+static int read_page(FILE *file, const unsigned char *key, uint32_t pgno,
+                     const unsigned char *aad, size_t aad_len,
+                     unsigned char *payload) {
+    unsigned char raw[PAGE_SIZE];
+
+    if (fseeko(file, (off_t)pgno * PAGE_SIZE, SEEK_SET) != 0 ||
+        fread(raw, 1, PAGE_SIZE, file) != PAGE_SIZE) {
+        return 0;
+    }
+
+    return aead_decrypt(key, raw, aad, aad_len,
+                        raw + AEAD_NONCE_SIZE + AEAD_TAG_SIZE, PAGE_PAYLOAD,
+                        raw + AEAD_NONCE_SIZE, payload);
+}
+
+static int read_data_page(Pager *pager, uint32_t pgno, unsigned char *payload) {
+    unsigned char aad[12];
+    uint32_t version = pager->versions[pgno];
+
+    // 0 = never committed, and table pages are never handed out
+    if (version == 0 || (version & TABLE_MARK)) return 0;
+    return read_page(pager->file, pager->key, pgno, aad,
+                     page_aad(pgno, version, aad), payload);
+}
+
+static int reserve_versions(Pager *pager, uint32_t count) {
+    if (count <= pager->version_capacity) return 1;
+
+    uint32_t capacity = pager->version_capacity ? pager->version_capacity : 64;
+    while (capacity < count) {
+        capacity = capacity > UINT32_MAX / 2 ? UINT32_MAX : capacity * 2;
+    }
+
+    uint32_t *versions = realloc(pager->versions, (size_t)capacity * sizeof(uint32_t));
+    if (!versions) return 0;
+    memset(versions + pager->version_capacity, 0,
+           (size_t)(capacity - pager->version_capacity) * sizeof(uint32_t));
+    pager->versions = versions;
+    pager->version_capacity = capacity;
+    return 1;
+}
+
+// Pages written before the next commit carry that commit's epoch
+static int write_back(Pager *pager, Frame *frame) {
+    if (!frame->dirty) return 1;
+
+    unsigned char aad[12];
+    if (pager->epoch + 1 >= EPOCH_LIMIT) return 0;
+    uint32_t version = (uint32_t)(pager->epoch + 1);
+    if (!write_page(pager->file, pager->key, frame->pgno, aad,
+                    page_aad(frame->pgno, version, aad), frame->data)) {
+        return 0;
+    }
+    pager->versions[frame->pgno] = version;
+    pager->uncommitted = 1;
+    frame->dirty = 0;
+    return 1;
+}
+
+// Find a frame for a new resident page, evicting the least recently
+// used unpinned page if the pool is full
+static int take_frame(Pager *pager) {
+    int index = pager->lru_tail;
+
+    while (index != NO_FRAME) {
+        Frame *frame = &pager->frames[index];
+        if (!frame->valid) break;
+        if (frame->pins == 0) {
+            if (!write_back(pager, frame)) return NO_FRAME;
+            hash_remove(pager, index);
+            frame->valid = 0;
+            break;
+        }
+        index = frame->prev;
+    }
+
+    if (index == NO_FRAME) return NO_FRAME; // Every page is pinned
+
+    lru_unlink(pager, index);
+    lru_push_front(pager, index);
+    return index;
+}
+
+static void install_frame(Pager *pager, int index, uint32_t pgno) {
+    Frame *frame = &pager->frames[index];
+    size_t bucket = bucket_of(pager, pgno);
+
+    frame->pgno = pgno;
+    frame->pins = 1;
+    frame->dirty = 0;
+    frame->valid = 1;
+    frame->hash_next = pager->buckets[bucket];
+    pager->buckets[bucket] = index;
+}
+
+// Next page of the chain marked mark, at or after pgno (0 = none)
+static uint32_t next_table_page(const Pager *pager, uint32_t pgno, uint32_t mark) {
+    for (; pgno < pager->page_count; pgno++) {
+        if (pager->versions[pgno] == mark) return pgno;
+    }
+    return 0;
+}
+
+// Write the version table for epoch to file as the chain the epoch's
+// parity selects, first growing that chain until it covers every page
+// (its own pages included)
+static int write_table(Pager *pager, FILE *file, const unsigned char *key,
+                       uint64_t epoch, uint32_t *root) {
+    uint32_t mark = TABLE_MARK | ((epoch & 1) ? TABLE_CHAIN : 0);
+    uint64_t chain_pages = 0;
+
+    for (uint32_t pgno = 1; pgno < pager->page_count; pgno++) {
+        if (pager->versions[pgno] == mark) chain_pages++;
+    }
+    while (chain_pages * TABLE_SLOTS < pager->page_count) {
+        if (pager->page_count == UINT32_MAX ||
+            !reserve_versions(pager, pager->page_count + 1)) {
+            return 0;
+        }
+        pager->versions[pager->page_count++] = mark;
+        chain_pages++;
+    }
+
+    union {
+        TablePage table;
+        unsigned char raw[PAGE_PAYLOAD];
+    } page;
+    unsigned char aad[12];
+    uint32_t first = 0;
+    uint32_t pgno = next_table_page(pager, 1, mark);
+    *root = pgno;
+
+    while (pgno != 0) {
+        uint32_t next = next_table_page(pager, pgno + 1, mark);
+        uint32_t count = pager->page_count - first;
+        if (count > TABLE_SLOTS) count = TABLE_SLOTS;
+
+        memset(&page, 0, sizeof(page));
+        page.table.next = next;
+        page.table.count = count;
+        memcpy(page.table.version, pager->versions + first, count * sizeof(uint32_t));
+        if (!write_page(file, key, pgno, aad, table_aad(pgno, epoch, aad), page.raw)) {
+            return 0;
+        }
+
+        first += count;
+        pgno = next;
+    }
+    return 1;
+}
+
+static void pager_free(Pager *pager) {
+    if (!pager) return;
+
+    if (pager->frames) {
+        for (size_t i = 0; i < pager->frame_count; i++) {
+            if (pager->frames[i].data) {
+                memset(pager->frames[i].data, 0, PAGE_PAYLOAD);
+                free(pager->frames[i].data);
+            }
+        }
+        free(pager->frames);
+    }
+    free(pager->buckets);
+    free(pager->versions);
+    free(pager->path);
+    memset(pager->key, 0, sizeof(pager->key));
+    free(pager);
+}
+
+Pager* pager_open(const char *path, const unsigned char *key,
+                  size_t cache_pages, int create) {
+    if (!path || !key) return NULL;
+    if (cache_pages < 16) cache_pages = 16;
+
+    Pager *pager = calloc(1, sizeof(Pager));
+    if (!pager) return NULL;
+
+    memcpy(pager->key, key, KEY_SIZE);
+    pager->path = malloc(strlen(path) + 1);
+    if (!pager->path) {
+        pager_free(pager);
+        return NULL;
+    }
+    strcpy(pager->path, path);
+    pager->lru_head = pager->lru_tail = NO_FRAME;
+    pager->frame_count = cache_pages;
+
+    size_t buckets = 1;
+    while (buckets < cache_pages * 2) buckets <<= 1;
+    pager->bucket_mask = buckets - 1;
+
+    pager->frames = calloc(cache_pages, sizeof(Frame));
+    pager->buckets = malloc(buckets * sizeof(int));
+    if (!pager->frames || !pager->buckets) {
+        pager_free(pager);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < buckets; i++) pager->buckets[i] = NO_FRAME;
+    for (size_t i = 0; i < cache_pages; i++) {
+        pager->frames[i].hash_next = NO_FRAME;
+        pager->frames[i].data = malloc(PAGE_PAYLOAD);
+        if (!pager->frames[i].data) {
+            pager_free(pager);
+            return NULL;
+        }
+        lru_push_front(pager, (int)i);
+    }
+
+    pager->file = fopen(path, create ? "w+b" : "r+b");
+    if (!pager->file) {
+        pager_free(pager);
+        return NULL;
+    }
+
+    if (create) {
+        // Reserve the header page until the caller writes it
+        unsigned char header[PAGE_SIZE] = {0};
+        if (fwrite(header, 1, PAGE_SIZE, pager->file) != PAGE_SIZE) {
+            fclose(pager->file);
+            pager_free(pager);
+            return NULL;
+        }
+        pager->page_count = 1;
+    } else {
+        if (fseeko(pager->file, 0, SEEK_END) != 0) {
+            fclose(pager->file);
+            pager_free(pager);
+            return NULL;
+        }
+        off_t size = ftello(pager->file);
+        if (size < PAGE_SIZE || size % PAGE_SIZE != 0 ||
+            size / PAGE_SIZE > UINT32_MAX) {
+            fclose(pager->file);
+            pager_free(pager);
+            return NULL;
+        }
+        pager->page_count = (uint32_t)(size / PAGE_SIZE);
+    }
+
+    if (!reserve_versions(pager, pager->page_count)) {
+        fclose(pager->file);
+        pager_free(pager);
+        return NULL;
+    }
+    return pager;
+}
+
+int pager_close(Pager *pager) {
+    if (!pager) return 0;
+
+    int ok = pager_flush(pager);
+    if (fclose(pager->file) != 0) ok = 0;
+    pager_free(pager);
+    return ok;
+}
+
+int pager_read_header(const char *path, unsigned char *buffer) {
+    FILE *file = fopen(path, "rb");
+    if (!file) return 0;
+
+    int ok = fread(buffer, 1, PAGE_SIZE, file) == PAGE_SIZE;
+    fclose(file);
+    return ok;
+}
+
+int pager_write_header(Pager *pager, const unsigned char *buffer) {
+    if (!pager || !buffer) return 0;
+
+    return fseeko(pager->file, 0, SEEK_SET) == 0 &&
+           fwrite(buffer, 1, PAGE_SIZE, pager->file) == PAGE_SIZE;
+}
+
+int pager_load(Pager *pager, const PagerCommit *commit) {
+    if (!pager || !commit || commit->epoch == 0 || commit->epoch >= EPOCH_LIMIT) {
+        return 0;
+    }
+
+    union {
+        TablePage table;
+        unsigned char raw[PAGE_PAYLOAD];
+    } page;
+    unsigned char aad[12];
+    uint32_t pgno = commit->table_root;
+    uint32_t first = 0;
+    uint32_t chain_pages = 0;
+
+    // Pages past the end of the table were appended after the last
+    // commit and keep version 0: nothing committed refers to them
+    while (pgno != 0) {
+        if (pgno >= pager->page_count || ++chain_pages >= pager->page_count ||
+            !read_page(pager->file, pager->key, pgno, aad,
+                       table_aad(pgno, commit->epoch, aad), page.raw) ||
+            page.table.count > TABLE_SLOTS ||
+            page.table.count > pager->page_count - first) {
+            return 0;
+        }
+
+        memcpy(pager->versions + first, page.table.version,
+               page.table.count * sizeof(uint32_t));
+        first += page.table.count;
+        pgno = page.table.next;
+    }
+
+    pager->epoch = commit->epoch;
+    pager->uncommitted = 0;
+    return first > 0;
+}
+
+unsigned char* pager_get(Pager *pager, uint32_t pgno) {
+    if (!pager || pgno == 0 || pgno >= pager->page_count) return NULL;
+
+    int index = hash_lookup(pager, pgno);
+    if (index != NO_FRAME) {
+        Frame *frame = &pager->frames[index];
+        frame->pins++;
+        lru_unlink(pager, index);
+        lru_push_front(pager, index);
+        return frame->data;
+    }
+
+    index = take_frame(pager);
+    if (index == NO_FRAME) return NULL;
+
+    Frame *frame = &pager->frames[index];
+    if (!read_data_page(pager, pgno, frame->data)) {
+        return NULL;
+    }
+
+    install_frame(pager, index, pgno);
+    return frame->data;
+}
+
+unsigned char* pager_allocate(Pager *pager, uint32_t *pgno) {
+    if (!pager || !pgno || pager->page_count == UINT32_MAX ||
+        !reserve_versions(pager, pager->page_count + 1)) {
+        return NULL;
+    }
+
+    int index = take_frame(pager);
+    if (index == NO_FRAME) return NULL;
+
+    *pgno = pager->page_count++;
+    install_frame(pager, index, *pgno);
+
+    Frame *frame = &pager->frames[index];
+    memset(frame->data, 0, PAGE_PAYLOAD);
+    frame->dirty = 1;
+    return frame->data;
+}
+
+void pager_unpin(Pager *pager, uint32_t pgno, int dirty) {
+    if (!pager) return;
+
+    int index = hash_lookup(pager, pgno);
+    if (index == NO_FRAME) return;
+
+    Frame *frame = &pager->frames[index];
+    if (frame->pins > 0) frame->pins--;
+    if (dirty) frame->dirty = 1;
+}
+
+int pager_flush(Pager *pager) {
+    if (!pager) return 0;
+
+    for (size_t i = 0; i < pager->frame_count; i++) {
+        Frame *frame = &pager->frames[i];
+        if (frame->valid && !write_back(pager, frame)) return 0;
+    }
+
+    return fflush(pager->file) == 0;
+}
+
+int pager_commit(Pager *pager, PagerCommit *commit) {
+    if (!pager || !commit) return 0;
+    if (!pager_flush(pager)) return 0;
+    if (!pager->uncommitted) return 1;
+
+    uint64_t epoch = pager->epoch + 1;
+    uint32_t root;
+    if (!write_table(pager, pager->file, pager->key, epoch, &root) ||
+        fflush(pager->file) != 0) {
+        return 0;
+    }
+
+    pager->epoch = epoch;
+    pager->uncommitted = 0;
+    commit->table_root = root;
+    commit->epoch = epoch;
+    return 1;
+}
+
+// The re-encrypted pages go to a new file that replaces the old one in a
+// single rename, so a crash leaves either the old store or the new one,
+// never pages under two keys
+int pager_rekey(Pager *pager, const unsigned char *new_key,
+                const unsigned char *header) {
+    if (!pager || !new_key || !header) return 0;
+    if (!pager_flush(pager) || pager->uncommitted) return 0;
+
+    char *tmp_path = malloc(strlen(pager->path) + sizeof(REKEY_SUFFIX));
+    if (!tmp_path) return 0;
+    strcpy(tmp_path, pager->path);
+    strcat(tmp_path, REKEY_SUFFIX);
+
+    FILE *file = fopen(tmp_path, "w+b");
+    if (!file) {
+        free(tmp_path);
+        return 0;
+    }
+
+    unsigned char payload[PAGE_PAYLOAD];
+    unsigned char blank[PAGE_SIZE] = {0};
+    unsigned char aad[12];
+    uint32_t root;
+    int ok = fwrite(header, 1, PAGE_SIZE, file) == PAGE_SIZE;
+
+    // Resident pages stay valid: only their on-disk form changes. Table
+    // pages are blank until the table is written below (the idle chain's
+    // stay blank: the next commit rewrites them before they are read),
+    // and so are pages nothing committed refers to
+    for (uint32_t pgno = 1; ok && pgno < pager->page_count; pgno++) {
+        uint32_t version = pager->versions[pgno];
+        if (version == 0 || (version & TABLE_MARK)) {
+            ok = fwrite(blank, 1, PAGE_SIZE, file) == PAGE_SIZE;
+        } else {
+            ok = read_data_page(pager, pgno, payload) &&
+                 write_page(file, new_key, pgno, aad, page_aad(pgno, version, aad), payload);
+        }
+    }
+    memset(payload, 0, sizeof(payload));
+    ok = ok && write_table(pager, file, new_key, pager->epoch, &root);
+
+    ok = ok && fflush(file) == 0;
+#ifndef _WIN32
+    ok = ok && fsync(fileno(file)) == 0;
+#endif
+    if (fclose(file) != 0) ok = 0;
+
+    if (!ok || rename(tmp_path, pager->path) != 0) {
+        remove(tmp_path);
+        free(tmp_path);
+        return 0;
+    }
+    free(tmp_path);
+
+    // From here on the store on disk is the new one
+    FILE *renamed = fopen(pager->path, "r+b");
+    if (!renamed) return 0;
+    fclose(pager->file);
+    pager->file = renamed;
+    memcpy(pager->key, new_key, KEY_SIZE);
+    return 1;
+}
+
+uint32_t pager_page_count(const Pager *pager) {
+    return pager ? pager->page_count : 0;
+}
@@ -0,0 +1,89 @@
+#ifndef PAGER_H
+#define PAGER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "crypto.h"
+
+/**
+ * Encrypted page file with an LRU buffer pool
+ *
+ * The file is a sequence of fixed 4 KB pages. Page 0 is a plaintext
+ * header owned by the caller; every other page is sealed individually
+ * with AES-256-GCM (random nonce per write), so a page can be read,
+ * verified and rewritten on its own. Decrypted pages live in a bounded
+ * pool and are written back when they are evicted or flushed.
+ *
+ * Each page's associated data is its number and the commit epoch it was
+ * last written in. A version table, kept in pages of its own and sealed
+ * under the current epoch, records every page's epoch; the caller keeps
+ * the table's location and epoch (PagerCommit) in its authenticated
+ * header, so an older copy of a page no longer verifies once it has
+ * been rewritten.
+ */
+
+#define PAGE_SIZE 4096
+#define PAGE_PAYLOAD (PAGE_SIZE - AEAD_NONCE_SIZE - AEAD_TAG_SIZE)
+
+// Default number of decrypted pages kept in memory (1 MB)
+#define PAGER_DEFAULT_CACHE 256
+
+typedef struct Pager Pager;
+
+// Where the version table of the last commit lives
+typedef struct {
+    uint32_t table_root;
+    uint32_t reserved;
+    uint64_t epoch;
+} PagerCommit;
+
+// Open (create = 0) or create (create = 1) a page file
+// key: page encryption key (KEY_SIZE bytes)
+// Returns: pager, or NULL on failure
+Pager* pager_open(const char *path, const unsigned char *key,
+                  size_t cache_pages, int create);
+
+// Flush dirty pages and close the file
+// Returns: 1 if everything was written, 0 otherwise
+int pager_close(Pager *pager);
+
+// Read the plaintext header page (PAGE_SIZE bytes) from a page file
+int pager_read_header(const char *path, unsigned char *buffer);
+
+// Overwrite the plaintext header page (PAGE_SIZE bytes)
+int pager_write_header(Pager *pager, const unsigned char *buffer);
+
+// Read the version table of an existing file; required before any page
+// of it can be read. Returns 0 if the table fails authentication.
+int pager_load(Pager *pager, const PagerCommit *commit);
+
+// Pin a page in the pool and return its decrypted payload
+// (PAGE_PAYLOAD bytes). Returns NULL if the page fails authentication.
+unsigned char* pager_get(Pager *pager, uint32_t pgno);
+
+// Append a new zeroed page and pin it
+// Returns: payload pointer, or NULL on failure; *pgno receives its number
+unsigned char* pager_allocate(Pager *pager, uint32_t *pgno);
+
+// Release a pinned page; dirty = 1 schedules it for write-back
+void pager_unpin(Pager *pager, uint32_t pgno, int dirty);
+
+// Write every dirty page back to disk; pages written since the last
+// commit can only be read again in this session until the next commit
+int pager_flush(Pager *pager);
+
+// Write every dirty page, then a new version table if any page was
+// written since the last commit; commit receives the table's location,
+// which the caller must store in its header
+int pager_commit(Pager *pager, PagerCommit *commit);
+
+// Re-encrypt every page under a new key, with header (PAGE_SIZE bytes)
+// as the new header page; everything must be committed first. The rewritten file replaces the old one
+// atomically; on failure the file on disk is unchanged.
+int pager_rekey(Pager *pager, const unsigned char *new_key,
+                const unsigned char *header);
+
+// Number of pages in the file (including the header page)
+uint32_t pager_page_count(const Pager *pager);
+
+#endif // PAGER_H
@@ -1,227 +1,233 @@
-// Feature test macros must come before any includes
-#ifndef _WIN32
-    #define _XOPEN_SOURCE 500
-    #define _DEFAULT_SOURCE
-#endif
-
 #include "passphrase.h"
 #include "clipboard.h"
+#include "random.h"
+#include "utils.h"
+#include "wordlist_data.h"
 #include <string.h>
 #include <ctype.h>
 #include <math.h>
-#include <openssl/rand.h>
+#include <stdint.h>
 
-#ifdef _WIN32
-    #include <windows.h>
-    #define PATH_MAX MAX_PATH
-#else
-    #include <unistd.h>
-    #include <limits.h>
-    #include <libgen.h>
-    #ifdef __APPLE__
-        #include <mach-o/dyld.h>
-    #endif
-    // Fallback for systems without PATH_MAX
-    #ifndef PATH_MAX
-        #define PATH_MAX 4096
-    #endif
-#endif
+#define RANDOM_DRAWS 1024       // 32-bit draws fetched at a time in bulk
 
-// Global wordlist storage
-static char wordlist[MAX_WORDS][MAX_WORD_LENGTH];
-static int wordlist_size = 0;
-static int wordlist_loaded = 0;
-static char wordlist_path[512] = {0};
+// 32-bit random draws, fetched a whole buffer at a time
+typedef struct {
+    uint32_t *draws;
+    size_t capacity;
+    size_t pos;
+} DrawPool;
 
-// Get cryptographically secure random number
-static unsigned int get_random_number(unsigned int max) {
-    unsigned char buf[4];
-    unsigned int num;
-    
-    if (RAND_bytes(buf, sizeof(buf)) != 1) {
-        // Fallback to standard rand() if OpenSSL fails
-        return rand() % max;
-    }
-    
-    num = (buf[0] << 24) | (buf[1] << 16) | (buf[2] << 8) | buf[3];
-    return num % max;
+// What every passphrase of one configuration needs, worked out once
+typedef struct {
+    const PassphraseConfig *config;
+    const Wordlist *list;
+    uint32_t size;
+    DrawPool pool;
+} PhraseBuilder;
+
+int passphrase_word_count(void) {
+    return WORDLIST_WORDS;
 }
 
-// Get the wordlist path
-const char* get_wordlist_path(void) {
-    if (wordlist_path[0] != '\0') {
-        return wordlist_path;
-    }
-    
-    char *dir_path = NULL;
-    
-#if defined(__linux__) || defined(__APPLE__) || defined(_WIN32)
-    char exe_path[PATH_MAX];
-    char exe_path_copy[PATH_MAX];
-    
-#ifdef __linux__
-    ssize_t len = readlink("/proc/self/exe", exe_path, sizeof(exe_path) - 1);
-    if (len != -1) {
-        exe_path[len] = '\0';
-        strncpy(exe_path_copy, exe_path, sizeof(exe_path_copy) - 1);
-        exe_path_copy[sizeof(exe_path_copy) - 1] = '\0';
-        dir_path = dirname(exe_path_copy);
+const char* passphrase_word(int index, size_t *length) {
+    if (index < 0 || index >= WORDLIST_WORDS) return NULL;
+    if (length) {
+        *length = (size_t)(wordlist_offsets[index + 1] - wordlist_offsets[index] - 1);
     }
-#elif defined(__APPLE__)
-    uint32_t size = sizeof(exe_path);
-    if (_NSGetExecutablePath(exe_path, &size) == 0) {
-        strncpy(exe_path_copy, exe_path, sizeof(exe_path_copy) - 1);
-        exe_path_copy[sizeof(exe_path_copy) - 1] = '\0';
-        dir_path = dirname(exe_path_copy);
+    return wordlist_blob + wordlist_offsets[index];
+}
+
+// The list is in roll order (the build checks it), so the roll is the
+// word's index written in base 6
+const char* passphrase_dice_word(const char *roll, size_t *length) {
+    if (!roll) return NULL;
+    
+    int index = 0;
+    for (int i = 0; i < PASSPHRASE_DICE_PER_WORD; i++) {
+        if (roll[i] < '1' || roll[i] > '6') return NULL;
+        index = index * 6 + (roll[i] - '1');
     }
-#elif defined(_WIN32)
-    if (GetModuleFileName(NULL, exe_path, sizeof(exe_path)) != 0) {
-        strncpy(exe_path_copy, exe_path, sizeof(exe_path_copy) - 1);
-        exe_path_copy[sizeof(exe_path_copy) - 1] = '\0';
-        dir_path = dirname(exe_path_copy);
+    if (roll[PASSPHRASE_DICE_PER_WORD] != '\0') return NULL;
+    return passphrase_word(index, length);
+}
+
+// Clean up
+void passphrase_cleanup(void) {
+    wordlist_cleanup();
+}
+
+static int next_draw(DrawPool *pool, uint32_t *value) {
+    if (pool->pos == pool->capacity) {
+        if (!random_bytes(pool->draws, pool->capacity * sizeof(uint32_t))) return 0;
+        pool->pos = 0;
     }
-#endif
-#endif
-    
-    if (dir_path) {
-        // Try ../data/eff_large_wordlist.txt (relative to bin/)
-        snprintf(wordlist_path, sizeof(wordlist_path), "%s/../data/eff_large_wordlist.txt", dir_path);
-        
-        // Check if file exists
-        FILE *test = fopen(wordlist_path, "r");
-        if (test) {
-            fclose(test);
-            return wordlist_path;
+    *value = pool->draws[pool->pos];
+    pool->draws[pool->pos++] = 0;
+    return 1;
+}
+
+// Uniform value in [0, n): the high half of draw * n, redrawing the few
+// draws whose low half would make some values more likely than others
+static int draw_below(DrawPool *pool, uint32_t n, uint32_t *value) {
+    uint32_t draw;
+    if (!next_draw(pool, &draw)) return 0;
+    
+    uint64_t product = (uint64_t)draw * n;
+    if ((uint32_t)product < n) {
+        uint32_t threshold = (uint32_t)(0u - n) % n;
+        while ((uint32_t)product < threshold) {
+            if (!next_draw(pool, &draw)) return 0;
+            product = (uint64_t)draw * n;
         }
     }
-    
-    // Fallback to relative path
-    strncpy(wordlist_path, "data/eff_large_wordlist.txt", sizeof(wordlist_path) - 1);
-    wordlist_path[sizeof(wordlist_path) - 1] = '\0';
-    return wordlist_path;
+    *value = (uint32_t)(product >> 32);
+    return 1;
 }
 
-// Load wordlist from file
-int passphrase_init(void) {
-    const char *path = get_wordlist_path();
-    FILE *file = fopen(path, "r");
-    if (!file) {
-        fprintf(stderr, "Error: Could not open wordlist file: %s\n", path);
-        fprintf(stderr, "Download it with:\n");
-        fprintf(stderr, "  wget -P data https://www.eff.org/files/2016/07/18/eff_large_wordlist.txt\n");
-        return -1;
-    }
-    
-    char line[256];
-    wordlist_size = 0;
+static int builder_init(PhraseBuilder *builder, const PassphraseConfig *config,
+                        uint32_t *draws, size_t capacity) {
+    builder->config = config;
+    builder->list = config->wordlist ? config->wordlist : wordlist_get(NULL, NULL, 0);
+    builder->size = wordlist_size(builder->list);
+    builder->pool.draws = draws;
+    builder->pool.capacity = capacity;
+    builder->pool.pos = capacity;
+    
+    if (!builder->list || config->num_words < 1 || config->num_words > PASSPHRASE_MAX_WORDS) return 0;
+    return !config->distinct_words || builder->size >= (uint32_t)config->num_words;
+}
+
+// Assemble one passphrase into out (room for passphrase_max_length())
+// Returns: its length, or 0 if no randomness was available
+static size_t build_phrase(PhraseBuilder *builder, char *out) {
+    const PassphraseConfig *config = builder->config;
+    uint32_t chosen[PASSPHRASE_MAX_WORDS];
+    size_t used = 0;
     
-    while (fgets(line, sizeof(line), file) && wordlist_size < MAX_WORDS) {
-        // Remove newline
-        line[strcspn(line, "\n")] = 0;
-        
-        // Skip empty lines
-        if (strlen(line) == 0) continue;
-        
-        // Parse line (format: "11111  abacus" or just "abacus")
-        char *word = NULL;
-        
-        // Check if line starts with digits (EFF format)
-        if (isdigit(line[0])) {
-            // Find the word after the dice number
-            word = strchr(line, '\t');
-            if (!word) word = strchr(line, ' ');
-            if (word) {
-                // Skip whitespace
-                while (*word && isspace(*word)) word++;
+    for (int i = 0; i < config->num_words; i++) {
+        uint32_t index;
+        int repeat;
+        do {
+            if (!draw_below(&builder->pool, builder->size, &index)) return 0;
+            
+            // Without replacement: draw again on a word already used, which
+            // leaves every ordered choice of distinct words equally likely
+            repeat = 0;
+            for (int j = 0; config->distinct_words && j < i; j++) {
+                if (chosen[j] == index) repeat = 1;
             }
-        } else {
-            word = line;
+        } while (repeat);
+        chosen[i] = index;
+        
+        size_t length;
+        const char *word = wordlist_word(builder->list, index, &length);
+        memcpy(out + used, word, length);
+        if (config->capitalize) {
+            out[used] = (char)toupper((unsigned char)out[used]);
         }
+        used += length;
         
-        if (word && strlen(word) > 0 && strlen(word) < MAX_WORD_LENGTH) {
-            strncpy(wordlist[wordlist_size], word, MAX_WORD_LENGTH - 1);
-            wordlist[wordlist_size][MAX_WORD_LENGTH - 1] = '\0';
-            wordlist_size++;
+        if (i < config->num_words - 1 && config->separator != '\0') {
+            out[used++] = config->separator;
         }
     }
     
-    fclose(file);
-    
-    if (wordlist_size < 1000) {
-        fprintf(stderr, "Warning: Wordlist seems too small (%d words)\n", wordlist_size);
-        fprintf(stderr, "Expected 7776 words for proper entropy.\n");
-        return -1;
+    if (config->add_number) {
+        uint32_t number;
+        if (!draw_below(&builder->pool, 10000, &number)) return 0;
+        out[used++] = config->separator != '\0' ? config->separator : '-';
+        for (int digit = 3; digit >= 0; digit--) {
+            out[used + digit] = (char)('0' + number % 10);
+            number /= 10;
+        }
+        used += 4;
     }
     
-    wordlist_loaded = 1;  // Mark as successfully loaded
-    printf("Loaded %d words from wordlist\n", wordlist_size);
-    return 0;
+    memset(chosen, 0, sizeof(chosen));
+    return used;
 }
 
-// Clean up
-void passphrase_cleanup(void) {
-    wordlist_loaded = 0;
-    wordlist_size = 0;
+static size_t phrase_line(void *ctx, char *out) {
+    return build_phrase(ctx, out);
 }
 
-// Check if wordlist is loaded
-int is_wordlist_loaded(void) {
-    return wordlist_loaded;
-}
-
-// Capitalize first letter of a word
-static void capitalize_word(char *word) {
-    if (word && word[0]) {
-        word[0] = toupper(word[0]);
-    }
+size_t passphrase_max_length(const PassphraseConfig *config) {
+    const Wordlist *list = config->wordlist ? config->wordlist : wordlist_get(NULL, NULL, 0);
+    size_t longest = list ? wordlist_longest(list) : WORDLIST_MAX_WORD;
+    return (size_t)config->num_words * (longest + 1) + 5;
 }
 
 // Generate passphrase
 char* generate_passphrase(PassphraseConfig *config) {
-    if (!wordlist_loaded || wordlist_size == 0) {
+    uint32_t draws[16];
+    PhraseBuilder builder;
+    if (!builder_init(&builder, config, draws, sizeof(draws) / sizeof(draws[0]))) {
         fprintf(stderr, "Error: Wordlist not loaded!\n");
         return NULL;
     }
     
-    // Allocate memory for passphrase
-    char *passphrase = malloc(512);
+    char *passphrase = malloc(passphrase_max_length(config) + 1);
     if (!passphrase) return NULL;
     
-    passphrase[0] = '\0';
+    size_t length = build_phrase(&builder, passphrase);
+    memset(draws, 0, sizeof(draws));
+    if (length == 0) {
+        free(passphrase);
+        return NULL;
+    }
+    passphrase[length] = '\0';
+    return passphrase;
+}
+
+long long passphrase_generate_into(char *arena, size_t size, unsigned long long count,
+                                   const PassphraseConfig *config, size_t *used) {
+    if (used) *used = 0;
+    if (!arena || !config) return -1;
     
-    // Generate words
-    for (int i = 0; i < config->num_words; i++) {
-        // Get random word index
-        int index = get_random_number(wordlist_size);
-        char word[MAX_WORD_LENGTH];
-        strncpy(word, wordlist[index], MAX_WORD_LENGTH);
-        
-        // Capitalize if needed
-        if (config->capitalize) {
-            capitalize_word(word);
-        }
-        
-        // Add word to passphrase
-        strcat(passphrase, word);
-        
-        // Add separator if not last word
-        if (i < config->num_words - 1 && config->separator != '\0') {
-            char sep[2] = {config->separator, '\0'};
-            strcat(passphrase, sep);
-        }
+    uint32_t *draws = malloc(RANDOM_DRAWS * sizeof(uint32_t));
+    if (!draws) return -1;
+    
+    PhraseBuilder builder;
+    if (!builder_init(&builder, config, draws, RANDOM_DRAWS)) {
+        free(draws);
+        return -1;
     }
     
-    // Add random number if requested
-    if (config->add_number) {
-        char num_str[16];
-        unsigned int random_num = get_random_number(10000);
-        sprintf(num_str, "%c%04u", 
-                config->separator != '\0' ? config->separator : '-', 
-                random_num);
-        strcat(passphrase, num_str);
+    size_t room = passphrase_max_length(config) + 1;
+    size_t filled = 0;
+    unsigned long long written = 0;
+    int ok = 1;
+    while (ok && written < count && size - filled >= room) {
+        size_t length = build_phrase(&builder, arena + filled);
+        ok = length > 0;
+        arena[filled + length] = '\0';
+        filled += length + 1;
+        written++;
     }
     
-    return passphrase;
+    memset(draws, 0, RANDOM_DRAWS * sizeof(uint32_t));
+    free(draws);
+    if (used) *used = filled;
+    return ok ? (long long)written : -1;
+}
+
+long long passphrase_generate_batch(FILE *out, unsigned long long count,
+                                    const PassphraseConfig *config) {
+    if (!out || !config) return -1;
+    
+    uint32_t *draws = malloc(RANDOM_DRAWS * sizeof(uint32_t));
+    PhraseBuilder builder;
+    if (!draws || !builder_init(&builder, config, draws, RANDOM_DRAWS)) {
+        free(draws);
+        return -1;
+    }
+    
+    long long written = write_generated_lines(out, count, passphrase_max_length(config),
+                                              phrase_line, &builder);
+    
+    memset(draws, 0, RANDOM_DRAWS * sizeof(uint32_t));
+    free(draws);
+    return written;
 }
 
 // Get preset configuration
@@ -231,6 +237,8 @@ PassphraseConfig get_preset_config(PresetLevel level) {
     config.capitalize = 0;
     config.add_number = 0;
     config.add_symbols = 0;
+    config.distinct_words = 0;
+    config.wordlist = NULL;
     
     switch (level) {
         case PRESET_BASIC:
@@ -254,8 +262,21 @@ PassphraseConfig get_preset_config(PresetLevel level) {
 
 // Calculate entropy
 double calculate_entropy(int num_words) {
-    if (wordlist_size == 0) return 0.0;
-    return num_words * log2((double)wordlist_size);
+    return wordlist_entropy_bits(wordlist_get(NULL, NULL, 0), num_words);
+}
+
+// Entropy of the words, from the size of the list they come from
+double passphrase_entropy(const PassphraseConfig *config) {
+    const Wordlist *list = config->wordlist ? config->wordlist : wordlist_get(NULL, NULL, 0);
+    if (!config->distinct_words) return wordlist_entropy_bits(list, config->num_words);
+    
+    // n (n - 1) ... (n - k + 1) equally likely choices
+    double bits = 0.0;
+    uint32_t size = wordlist_size(list);
+    for (int i = 0; i < config->num_words && (uint32_t)i < size; i++) {
+        bits += log2((double)(size - (uint32_t)i));
+    }
+    return bits;
 }
 
 // Get crack time estimate string
@@ -325,13 +346,15 @@ PassphraseConfig get_custom_config(void) {
     config.add_number = (input[0] == 'y' || input[0] == 'Y') ? 1 : 0;
     
     config.add_symbols = 0; // Future feature
+    config.distinct_words = 0;
+    config.wordlist = NULL;
     
     return config;
 }
 
 // Display passphrase with formatting
 void display_passphrase(const char *passphrase, PassphraseConfig *config) {
-    double entropy = calculate_entropy(config->num_words);
+    double entropy = passphrase_entropy(config);
     char crack_time[64];
     get_crack_time(entropy, crack_time, sizeof(crack_time));
     
@@ -357,16 +380,6 @@ void display_passphrase(const char *passphrase, PassphraseConfig *config) {
 
 // Display passphrase menu
 void display_passphrase_menu(void) {
-    if (!wordlist_loaded) {
-        printf("\nInitializing passphrase generator...\n");
-        if (passphrase_init() != 0) {
-            printf("\nFailed to initialize passphrase generator.\n");
-            printf("Press Enter to return to main menu...");
-            getchar();
-            return;
-        }
-    }
-    
     while (1) {
         printf("\n╔══════════════════════════════════════╗\n");
         printf("║    PASSPHRASE GENERATOR              ║\n");
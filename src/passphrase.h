@@ -1,15 +1,24 @@
 #ifndef PASSPHRASE_H
 #define PASSPHRASE_H
 
+#include "wordlist.h"
 #include <stdio.h>
 #include <stdlib.h>
 
-// Maximum number of words in wordlist
-#define MAX_WORDS 7776
-#define MAX_WORD_LENGTH 32
+#define PASSPHRASE_MAX_WORDS 20
+#define PASSPHRASE_DICE_PER_WORD 5   // Dice rolled for one built-in word
 
-// Get wordlist path (returns path relative to executable or data directory)
-const char* get_wordlist_path(void);
+// Number of words in the built-in wordlist
+int passphrase_word_count(void);
+
+// Word at index (0 to passphrase_word_count() - 1); length (if given)
+// receives its length
+const char* passphrase_word(int index, size_t *length);
+
+// Word of the built-in list for a roll of PASSPHRASE_DICE_PER_WORD dice,
+// read left to right as digits 1 to 6 ("31452")
+// Returns: the word, or NULL if roll is not that many dice
+const char* passphrase_dice_word(const char *roll, size_t *length);
 
 // Passphrase configuration structure
 typedef struct {
@@ -18,6 +27,8 @@ typedef struct {
     int capitalize;          // 1 = capitalize first letter, 0 = lowercase
     int add_number;          // 1 = add random number at end, 0 = no number
     int add_symbols;         // 1 = add symbols between words (future feature)
+    int distinct_words;      // 1 = no word twice in one passphrase
+    const Wordlist *wordlist; // List to draw from; NULL = the built-in list
 } PassphraseConfig;
 
 // Preset levels
@@ -31,21 +42,37 @@ typedef enum {
 
 // Function declarations
 
-// Initialize passphrase generator (load wordlist)
-int passphrase_init(void);
-
 // Clean up and free memory
 void passphrase_cleanup(void);
 
 // Generate passphrase with given configuration
 char* generate_passphrase(PassphraseConfig *config);
 
+// Longest passphrase config can produce, without the terminating NUL
+size_t passphrase_max_length(const PassphraseConfig *config);
+
+// Write up to count passphrases into arena, each NUL-terminated, back to
+// back; stops early once fewer than passphrase_max_length() + 1 bytes are
+// left. Randomness is drawn in bulk and each word is picked without bias.
+// Returns: number written (used, if given, receives the bytes filled), or
+//          -1 on failure
+long long passphrase_generate_into(char *arena, size_t size, unsigned long long count,
+                                   const PassphraseConfig *config, size_t *used);
+
+// Write count passphrases to out, one per line
+// Returns: number written, or -1 on failure
+long long passphrase_generate_batch(FILE *out, unsigned long long count,
+                                    const PassphraseConfig *config);
+
 // Get preset configuration
 PassphraseConfig get_preset_config(PresetLevel level);
 
-// Calculate entropy in bits
+// Entropy in bits of num_words words from the default wordlist
 double calculate_entropy(int num_words);
 
+// Entropy in bits of the words of a passphrase made with config
+double passphrase_entropy(const PassphraseConfig *config);
+
 // Display the passphrase generator menu
 void display_passphrase_menu(void);
 
@@ -55,7 +82,4 @@ PassphraseConfig get_custom_config(void);
 // Display passphrase with formatting
 void display_passphrase(const char *passphrase, PassphraseConfig *config);
 
-// Check if wordlist is loaded
-int is_wordlist_loaded(void);
-
 #endif // PASSPHRASE_H
@@ -1,8 +1,12 @@
 #include "password.h"
+#include "btree.h"
 #include "utils.h"
+#include <ctype.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h> // Necessário para strcasecmp
+#include <time.h>
 
 #define INITIAL_CAPACITY 10
 
@@ -18,21 +22,132 @@ PasswordManager* pm_init(void) {
     
     pm->count = 0;
     pm->capacity = INITIAL_CAPACITY;
+    pm->store = NULL;
+    memset(&pm->store_entry, 0, sizeof(PasswordEntry));
+    pm->shard_count = 0;
+    pm->dirty_shards = 0;
+    pm->generation = 0;
+    pm->log_floor = 0;
+    pm->codec = 0;
+    pm->tombstones = NULL;
+    pm->tombstone_count = 0;
+    pm->tombstone_capacity = 0;
     return pm;
 }
 
 void pm_free(PasswordManager *pm) {
     if (!pm) return;
     
+    // Paged vaults write every change back on close
+    if (pm->store) {
+        btree_close(pm->store);
+    }
+    
     // Clear sensitive data
+    memset(&pm->store_entry, 0, sizeof(PasswordEntry));
     if (pm->entries) {
         memset(pm->entries, 0, sizeof(PasswordEntry) * pm->capacity);
         free(pm->entries);
     }
+    if (pm->tombstones) {
+        memset(pm->tombstones, 0, sizeof(PasswordEntry) * pm->tombstone_capacity);
+        free(pm->tombstones);
+    }
     
     free(pm);
 }
 
+void pm_touch_entry(PasswordEntry *entry, int username_changed,
+                    int password_changed) {
+    if (!entry) return;
+    
+    int64_t now = (int64_t)time(NULL);
+    if (username_changed) entry->username_modified = now;
+    if (password_changed) entry->password_modified = now;
+}
+
+uint32_t pm_service_hash(const char *service) {
+    uint32_t hash = 2166136261u;
+    if (!service) return hash;
+    
+    for (const unsigned char *p = (const unsigned char*)service; *p; p++) {
+        hash ^= (uint32_t)tolower(*p);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+size_t pm_shard_of(const char *service, size_t shard_count) {
+    if (!service || shard_count == 0) return 0;
+    return pm_service_hash(service) % shard_count;
+}
+
+// Record that the shard holding service must be rewritten on save
+static void pm_mark_dirty(PasswordManager *pm, const char *service) {
+    if (pm->shard_count > 0) {
+        pm->dirty_shards |= 1ULL << pm_shard_of(service, pm->shard_count);
+    }
+}
+
+int pm_reserve_tombstones(PasswordManager *pm, size_t capacity) {
+    if (!pm) return 0;
+    if (capacity <= pm->tombstone_capacity) return 1;
+    if (capacity > SIZE_MAX / sizeof(PasswordEntry)) return 0;
+    
+    PasswordEntry *tombstones = realloc(pm->tombstones,
+                                        sizeof(PasswordEntry) * capacity);
+    if (!tombstones) return 0;
+    
+    pm->tombstones = tombstones;
+    pm->tombstone_capacity = capacity;
+    return 1;
+}
+
+// Forget the tombstone of a service that exists again
+static void pm_clear_tombstone(PasswordManager *pm, const char *service) {
+    for (size_t i = 0; i < pm->tombstone_count; i++) {
+        if (strcasecmp(pm->tombstones[i].service, service) == 0) {
+            pm_mark_dirty(pm, service);
+            pm->tombstones[i] = pm->tombstones[--pm->tombstone_count];
+            return;
+        }
+    }
+}
+
+int pm_add_tombstone(PasswordManager *pm, const char *service,
+                     uint64_t generation) {
+    if (!pm || !service) return 0;
+    
+    pm_clear_tombstone(pm, service);
+    
+    // Full: the oldest deletion falls out of reach of change logs
+    if (pm->tombstone_count >= MAX_TOMBSTONES) {
+        size_t oldest = 0;
+        for (size_t i = 1; i < pm->tombstone_count; i++) {
+            if (pm->tombstones[i].generation < pm->tombstones[oldest].generation) {
+                oldest = i;
+            }
+        }
+        if (pm->tombstones[oldest].generation > pm->log_floor) {
+            pm->log_floor = pm->tombstones[oldest].generation;
+        }
+        pm_mark_dirty(pm, pm->tombstones[oldest].service);
+        pm->tombstones[oldest] = pm->tombstones[--pm->tombstone_count];
+    }
+    
+    if (pm->tombstone_count >= pm->tombstone_capacity &&
+        !pm_reserve_tombstones(pm, pm->tombstone_capacity ? pm->tombstone_capacity * 2 : 16)) {
+        return 0;
+    }
+    
+    PasswordEntry *tombstone = &pm->tombstones[pm->tombstone_count++];
+    memset(tombstone, 0, sizeof(PasswordEntry));
+    strncpy(tombstone->service, service, MAX_SERVICE_NAME - 1);
+    tombstone->generation = generation;
+    pm_mark_dirty(pm, service);
+    return 1;
+}
+
 static int pm_resize(PasswordManager *pm) {
     size_t new_capacity = pm->capacity * 2;
     PasswordEntry *new_entries = realloc(pm->entries, 
@@ -44,6 +159,20 @@ static int pm_resize(PasswordManager *pm) {
     return 1;
 }
 
+int pm_reserve(PasswordManager *pm, size_t capacity) {
+    if (!pm) return 0;
+    if (capacity <= pm->capacity) return 1;
+    if (capacity > SIZE_MAX / sizeof(PasswordEntry)) return 0;
+    
+    PasswordEntry *new_entries = realloc(pm->entries,
+                                        sizeof(PasswordEntry) * capacity);
+    if (!new_entries) return 0;
+    
+    pm->entries = new_entries;
+    pm->capacity = capacity;
+    return 1;
+}
+
 int pm_add_entry(PasswordManager *pm, const char *service,
                  const char *username, const char *password) {
     if (!pm || !service || !username || !password) return 0;
@@ -54,12 +183,13 @@ int pm_add_entry(PasswordManager *pm, const char *service,
     }
     
     // Resize if needed
-    if (pm->count >= pm->capacity) {
+    if (!pm->store && pm->count >= pm->capacity) {
         if (!pm_resize(pm)) return 0;
     }
     
     // Add new entry
-    PasswordEntry *entry = &pm->entries[pm->count];
+    PasswordEntry *entry = pm->store ? &pm->store_entry : &pm->entries[pm->count];
+    memset(entry, 0, sizeof(PasswordEntry));
     strncpy(entry->service, service, MAX_SERVICE_NAME - 1);
     entry->service[MAX_SERVICE_NAME - 1] = '\0';
     
@@ -69,6 +199,16 @@ int pm_add_entry(PasswordManager *pm, const char *service,
     strncpy(entry->password, password, MAX_PASSWORD - 1);
     entry->password[MAX_PASSWORD - 1] = '\0';
     
+    pm_touch_entry(entry, 1, 1);
+    entry->created = entry->password_modified;
+    entry->generation = pm->generation + 1;
+    
+    if (pm->store) {
+        return btree_insert(pm->store, entry);
+    }
+    
+    pm_clear_tombstone(pm, service);
+    pm_mark_dirty(pm, service);
     pm->count++;
     return 1;
 }
@@ -76,6 +216,11 @@ int pm_add_entry(PasswordManager *pm, const char *service,
 PasswordEntry* pm_find_entry(PasswordManager *pm, const char *service) {
     if (!pm || !service) return NULL;
     
+    if (pm->store) {
+        return btree_get(pm->store, service, &pm->store_entry)
+               ? &pm->store_entry : NULL;
+    }
+    
     for (size_t i = 0; i < pm->count; i++) {
         if (strcasecmp(pm->entries[i].service, service) == 0) {
             return &pm->entries[i];
@@ -87,6 +232,11 @@ PasswordEntry* pm_find_entry(PasswordManager *pm, const char *service) {
 
 int pm_update_entry(PasswordManager *pm, const char *service,
                     const char *new_username, const char *new_password) {
+    if (pm && pm->store) {
+        return service && btree_update(pm->store, service,
+                                       new_username, new_password);
+    }
+    
     PasswordEntry *entry = pm_find_entry(pm, service);
     if (!entry) return 0;
     
@@ -100,14 +250,25 @@ int pm_update_entry(PasswordManager *pm, const char *service,
         entry->password[MAX_PASSWORD - 1] = '\0';
     }
     
+    pm_touch_entry(entry, new_username != NULL, new_password != NULL);
+    entry->generation = pm->generation + 1;
+    pm_mark_dirty(pm, entry->service);
     return 1;
 }
 
 int pm_delete_entry(PasswordManager *pm, const char *service) {
     if (!pm || !service) return 0;
     
+    if (pm->store) {
+        return btree_delete(pm->store, service);
+    }
+    
     for (size_t i = 0; i < pm->count; i++) {
         if (strcasecmp(pm->entries[i].service, service) == 0) {
+            if (!pm_add_tombstone(pm, pm->entries[i].service, pm->generation + 1)) {
+                return 0;
+            }
+            
             // Clear sensitive data
             memset(&pm->entries[i], 0, sizeof(PasswordEntry));
             
@@ -125,27 +286,62 @@ int pm_delete_entry(PasswordManager *pm, const char *service) {
     return 0;
 }
 
+int pm_put_entry(PasswordManager *pm, const PasswordEntry *entry) {
+    if (!pm || !entry || pm->store) return 0;
+    
+    PasswordEntry *existing = pm_find_entry(pm, entry->service);
+    if (!existing) {
+        if (pm->count >= pm->capacity && !pm_resize(pm)) return 0;
+        existing = &pm->entries[pm->count++];
+    }
+    
+    *existing = *entry;
+    existing->service[MAX_SERVICE_NAME - 1] = '\0';
+    existing->username[MAX_USERNAME - 1] = '\0';
+    existing->password[MAX_PASSWORD - 1] = '\0';
+    
+    pm_clear_tombstone(pm, entry->service);
+    pm_mark_dirty(pm, entry->service);
+    return 1;
+}
+
+static void print_service(size_t number, const PasswordEntry *entry) {
+    printf("  %zu. %s%s%s\n", number, 
+           COLOR_GREEN, entry->service, COLOR_RESET);
+    printf("     └─ User: %s\n", entry->username);
+}
+
+static int print_store_service(const PasswordEntry *entry, void *ctx) {
+    size_t *number = ctx;
+    print_service(++*number, entry);
+    return 1;
+}
+
 void pm_list_services(PasswordManager *pm) {
-    if (!pm || pm->count == 0) {
+    if (!pm || pm_get_count(pm) == 0) {
         print_info("No passwords stored yet.");
         return;
     }
     
     printf("\n");
     printf(COLOR_CYAN "═══════════════════════════════════════\n" COLOR_RESET);
-    printf(COLOR_CYAN "  Stored Services (%zu)\n" COLOR_RESET, pm->count);
+    printf(COLOR_CYAN "  Stored Services (%zu)\n" COLOR_RESET, pm_get_count(pm));
     printf(COLOR_CYAN "═══════════════════════════════════════\n" COLOR_RESET);
     
-    for (size_t i = 0; i < pm->count; i++) {
-        printf("  %zu. %s%s%s\n", i + 1, 
-               COLOR_GREEN, pm->entries[i].service, COLOR_RESET);
-        printf("     └─ User: %s\n", pm->entries[i].username);
+    if (pm->store) {
+        size_t number = 0;
+        btree_foreach(pm->store, print_store_service, &number);
+    } else {
+        for (size_t i = 0; i < pm->count; i++) {
+            print_service(i + 1, &pm->entries[i]);
+        }
     }
     printf("\n");
 }
 
 size_t pm_get_count(PasswordManager *pm) {
-    return pm ? pm->count : 0;
+    if (!pm) return 0;
+    return pm->store ? btree_count(pm->store) : pm->count;
 }
 
 int pm_service_exists(PasswordManager *pm, const char *service) {
@@ -2,23 +2,50 @@
 #define PASSWORD_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 #define MAX_SERVICE_NAME 100
 #define MAX_USERNAME 100
 #define MAX_PASSWORD 128
 
 // Password entry structure
+// Stamps are seconds since the epoch; 0 means unknown (entries from vaults
+// written before stamps existed). New fields are only ever appended, so
+// older, shorter records still load with the new fields zeroed.
 typedef struct {
     char service[MAX_SERVICE_NAME];
     char username[MAX_USERNAME];
     char password[MAX_PASSWORD];
+    int64_t created;
+    int64_t username_modified;
+    int64_t password_modified;
+    uint64_t generation;        // Vault generation (save) that last changed it
 } PasswordEntry;
 
+// Deleted services are remembered (as entries holding only service and
+// generation) so change logs can carry deletions; beyond this many the
+// oldest are forgotten and log_floor records how far back logs still reach
+#define MAX_TOMBSTONES 4096
+
+struct BTree;
+
 // Password manager structure
+// When store is set the entries live in a paged on-disk B+tree and the
+// in-memory array is unused; lookups are copied into store_entry.
 typedef struct {
     PasswordEntry *entries;
     size_t count;
     size_t capacity;
+    struct BTree *store;
+    PasswordEntry store_entry;
+    size_t shard_count;         // 0 = unsharded vault
+    uint64_t dirty_shards;      // Bit i set = shard i changed since save
+    uint64_t generation;        // Generation of the last save; edits get the next one
+    uint64_t log_floor;         // Oldest generation change logs can start from
+    uint32_t codec;             // Payload compression for saves (see file_io.h)
+    PasswordEntry *tombstones;
+    size_t tombstone_count;
+    size_t tombstone_capacity;
 } PasswordManager;
 
 // Initialize password manager
@@ -27,6 +54,9 @@ PasswordManager* pm_init(void);
 // Free password manager
 void pm_free(PasswordManager *pm);
 
+// Grow entry storage to hold at least capacity entries
+int pm_reserve(PasswordManager *pm, size_t capacity);
+
 // Add new password entry
 int pm_add_entry(PasswordManager *pm, const char *service, 
                  const char *username, const char *password);
@@ -41,12 +71,33 @@ int pm_update_entry(PasswordManager *pm, const char *service,
 // Delete entry
 int pm_delete_entry(PasswordManager *pm, const char *service);
 
+// Insert or replace an entry as given, stamps included (for replaying
+// changes made elsewhere)
+int pm_put_entry(PasswordManager *pm, const PasswordEntry *entry);
+
+// Remember that service was deleted in the given generation
+int pm_add_tombstone(PasswordManager *pm, const char *service,
+                     uint64_t generation);
+
+// Make room for at least capacity tombstones
+int pm_reserve_tombstones(PasswordManager *pm, size_t capacity);
+
 // List all services
 void pm_list_services(PasswordManager *pm);
 
 // Get entry count
 size_t pm_get_count(PasswordManager *pm);
 
+// Record that fields of entry were changed just now
+void pm_touch_entry(PasswordEntry *entry, int username_changed,
+                    int password_changed);
+
+// Hash of the case-folded service name (FNV-1a)
+uint32_t pm_service_hash(const char *service);
+
+// Shard a service belongs to (hash of the case-folded name)
+size_t pm_shard_of(const char *service, size_t shard_count);
+
 // Check if service exists
 int pm_service_exists(PasswordManager *pm, const char *service);
 
@@ -0,0 +1,616 @@
+#include "policy.h"
+#include "file_io.h"
+#include "random.h"
+#include "utils.h"
+#include <ctype.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+
+#define CLASS_COUNT 4
+#define SET_MAX 95              // Printable ASCII without space, plus NUL
+#define MIN_LENGTH 4
+#define MAX_LENGTH 128
+#define DEFAULT_LENGTH 16
+#define MAX_FORBIDDEN 16
+#define MAX_FORBIDDEN_LENGTH 32
+#define MAX_DEFICIT_STATES 4096 // Product over the classes of (minimum + 1)
+#define NO_SYMBOL 0xff
+#define NO_STATE 0xffff
+#define AMBIGUOUS "0O1Il|"
+#define LINE_SIZE (MAX_SERVICE_NAME + POLICY_TEXT_MAX + 8)
+#define PATH_SIZE 600
+
+static const char *class_names[CLASS_COUNT] = {"upper", "lower", "digit", "symbol"};
+
+static const char *default_sets[CLASS_COUNT] = {
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZ",
+    "abcdefghijklmnopqrstuvwxyz",
+    "0123456789",
+    "!@#$%^&*()_+-=[]{}|;:,.<>?",
+};
+
+struct PasswordPolicy {
+    int length;
+    int max_repeat;             // 0 = no limit
+    char sets[CLASS_COUNT][SET_MAX];
+    unsigned set_size[CLASS_COUNT];
+    int minimum[CLASS_COUNT];
+    char alphabet[SET_MAX];     // Every class together
+    unsigned alphabet_size;
+
+    // completions[r * deficit_states + d]: passwords of r characters that
+    // supply the missing class counts d, a mixed-radix number with one
+    // digit (0 to minimum) per class
+    double *completions;
+    size_t deficit_states;
+    size_t stride[CLASS_COUNT];
+
+    // Forbidden texts: complete automaton over case-folded characters,
+    // plus per state the characters that would finish a forbidden text
+    uint16_t *next;             // state * symbols + symbol -> state
+    unsigned char (*blocked)[32];
+    unsigned char *has_blocked;
+    unsigned char symbol[256];  // Folded character -> symbol
+    unsigned symbols;
+    size_t states;
+};
+
+typedef struct {
+    int length;
+    int max_repeat;
+    int minimum[CLASS_COUNT];
+    int excluded[CLASS_COUNT];
+    char sets[CLASS_COUNT][SET_MAX];
+    char exclude[SET_MAX];
+    char forbidden[MAX_FORBIDDEN][MAX_FORBIDDEN_LENGTH + 1];
+    int forbidden_count;
+} PolicyRules;
+
+static int fail(char *error, size_t error_size, const char *message, const char *detail) {
+    if (error && error_size > 0) {
+        snprintf(error, error_size, "%s%s%s", message, detail ? ": " : "",
+                 detail ? detail : "");
+    }
+    return 0;
+}
+
+static int parse_count(const char *value, int max, int *out) {
+    char *end = NULL;
+    long parsed = strtol(value, &end, 10);
+    if (end == value || *end != '\0' || parsed < 0 || parsed > max) return 0;
+    *out = (int)parsed;
+    return 1;
+}
+
+// Printable ASCII other than space, each character once
+static int parse_chars(const char *value, char *out) {
+    size_t len = 0;
+    for (const char *p = value; *p; p++) {
+        if (*p < '!' || *p > '~' || len + 1 >= SET_MAX) return 0;
+        if (!memchr(out, *p, len)) out[len++] = *p;
+    }
+    out[len] = '\0';
+    return len > 0;
+}
+
+static int class_index(const char *name, size_t len) {
+    for (int c = 0; c < CLASS_COUNT; c++) {
+        if (strlen(class_names[c]) == len && strncmp(name, class_names[c], len) == 0) {
+            return c;
+        }
+    }
+    return -1;
+}
+
+static int parse_rule(PolicyRules *rules, char *token, char *error, size_t error_size) {
+    char *value = strchr(token, '=');
+    if (!value) {
+        int c = strncmp(token, "no-", 3) == 0 ? class_index(token + 3, strlen(token + 3)) : -1;
+        if (c < 0) return fail(error, error_size, "unknown rule", token);
+        rules->excluded[c] = 1;
+        return 1;
+    }
+    *value++ = '\0';
+
+    size_t key_len = strlen(token);
+    int c = class_index(token, key_len);
+    if (c >= 0) {
+        if (!parse_count(value, MAX_LENGTH, &rules->minimum[c])) {
+            return fail(error, error_size, "bad count for", token);
+        }
+    } else if (key_len > 4 && strcmp(token + key_len - 4, "-set") == 0 &&
+               (c = class_index(token, key_len - 4)) >= 0) {
+        if (!parse_chars(value, rules->sets[c])) {
+            return fail(error, error_size, "character sets take printable ASCII", token);
+        }
+    } else if (strcmp(token, "length") == 0) {
+        if (!parse_count(value, MAX_LENGTH, &rules->length) || rules->length < MIN_LENGTH) {
+            return fail(error, error_size, "length must be between 4 and 128", NULL);
+        }
+    } else if (strcmp(token, "max-repeat") == 0) {
+        if (!parse_count(value, MAX_LENGTH, &rules->max_repeat) || rules->max_repeat == 0) {
+            return fail(error, error_size, "max-repeat must be at least 1", NULL);
+        }
+    } else if (strcmp(token, "exclude") == 0) {
+        if (!parse_chars(strcmp(value, "ambiguous") == 0 ? AMBIGUOUS : value, rules->exclude)) {
+            return fail(error, error_size, "exclude takes printable ASCII", NULL);
+        }
+    } else if (strcmp(token, "forbid") == 0) {
+        size_t len = strlen(value);
+        if (len == 0 || len > MAX_FORBIDDEN_LENGTH) {
+            return fail(error, error_size, "forbidden texts are 1 to 32 characters", NULL);
+        }
+        if (rules->forbidden_count == MAX_FORBIDDEN) {
+            return fail(error, error_size, "at most 16 forbidden texts", NULL);
+        }
+        char *word = rules->forbidden[rules->forbidden_count++];
+        for (size_t i = 0; i <= len; i++) {
+            word[i] = (char)tolower((unsigned char)value[i]);
+        }
+    } else {
+        return fail(error, error_size, "unknown rule", token);
+    }
+    return 1;
+}
+
+// Class alphabets less exclusions, and their union
+static int build_sets(PasswordPolicy *policy, const PolicyRules *rules,
+                      char *error, size_t error_size) {
+    unsigned char owner[256] = {0};     // Class + 1 of each character
+
+    for (int c = 0; c < CLASS_COUNT; c++) {
+        policy->set_size[c] = 0;
+        policy->minimum[c] = rules->excluded[c] ? 0 : rules->minimum[c];
+        if (rules->excluded[c]) {
+            if (rules->minimum[c] > 0) {
+                return fail(error, error_size, "a required class is excluded", class_names[c]);
+            }
+            continue;
+        }
+
+        const char *set = rules->sets[c][0] ? rules->sets[c] : default_sets[c];
+        for (const char *p = set; *p; p++) {
+            unsigned char ch = (unsigned char)*p;
+            if (strchr(rules->exclude, *p)) continue;
+            if (owner[ch] && owner[ch] != c + 1) {
+                char detail[64];
+                snprintf(detail, sizeof(detail), "'%c' in %s and %s", *p,
+                         class_names[owner[ch] - 1], class_names[c]);
+                return fail(error, error_size, "character sets overlap", detail);
+            }
+            owner[ch] = (unsigned char)(c + 1);
+            policy->sets[c][policy->set_size[c]++] = *p;
+            policy->alphabet[policy->alphabet_size++] = *p;
+        }
+        policy->sets[c][policy->set_size[c]] = '\0';
+
+        if (policy->minimum[c] > 0 && policy->set_size[c] == 0) {
+            return fail(error, error_size, "a required class has no characters left",
+                        class_names[c]);
+        }
+    }
+    policy->alphabet[policy->alphabet_size] = '\0';
+
+    if (policy->alphabet_size == 0) {
+        return fail(error, error_size, "no characters left to draw from", NULL);
+    }
+    return 1;
+}
+
+// Count, for every remaining length and missing class counts, the
+// passwords that complete them; generation samples classes by these
+static int build_completions(PasswordPolicy *policy, char *error, size_t error_size) {
+    int required = 0;
+    size_t states = 1;
+    for (int c = 0; c < CLASS_COUNT; c++) {
+        required += policy->minimum[c];
+        policy->stride[c] = states;
+        states *= (size_t)policy->minimum[c] + 1;
+        if (states > MAX_DEFICIT_STATES) {
+            return fail(error, error_size, "class minimums are too large", NULL);
+        }
+    }
+    if (required > policy->length) {
+        return fail(error, error_size, "class minimums exceed the length", NULL);
+    }
+
+    policy->deficit_states = states;
+    policy->completions = calloc((size_t)(policy->length + 1) * states, sizeof(double));
+    if (!policy->completions) return fail(error, error_size, "out of memory", NULL);
+
+    policy->completions[0] = 1.0;   // Nothing left, nothing missing
+    for (int r = 1; r <= policy->length; r++) {
+        const double *shorter = policy->completions + (size_t)(r - 1) * states;
+        double *row = policy->completions + (size_t)r * states;
+        for (size_t d = 0; d < states; d++) {
+            double total = 0.0;
+            for (int c = 0; c < CLASS_COUNT; c++) {
+                if (policy->set_size[c] == 0) continue;
+                int missing = (int)(d / policy->stride[c] % (size_t)(policy->minimum[c] + 1));
+                size_t after = missing > 0 ? d - policy->stride[c] : d;
+                total += policy->set_size[c] * shorter[after];
+            }
+            row[d] = total;
+        }
+    }
+    return 1;
+}
+
+static int is_blocked(const unsigned char *blocked, unsigned char ch) {
+    return blocked && (blocked[ch >> 3] >> (ch & 7)) & 1;
+}
+
+// Aho-Corasick automaton over the forbidden texts, as a complete DFA
+static int build_automaton(PasswordPolicy *policy, const PolicyRules *rules,
+                           char *error, size_t error_size) {
+    memset(policy->symbol, NO_SYMBOL, sizeof(policy->symbol));
+    policy->symbols = 0;
+    for (unsigned i = 0; i < policy->alphabet_size; i++) {
+        unsigned char folded = (unsigned char)tolower((unsigned char)policy->alphabet[i]);
+        if (policy->symbol[folded] == NO_SYMBOL) {
+            policy->symbol[folded] = (unsigned char)policy->symbols++;
+        }
+    }
+
+    size_t capacity = 1;
+    for (int w = 0; w < rules->forbidden_count; w++) {
+        capacity += strlen(rules->forbidden[w]);
+    }
+
+    size_t symbols = policy->symbols;
+    policy->next = malloc(capacity * symbols * sizeof(uint16_t));
+    policy->blocked = calloc(capacity, sizeof(*policy->blocked));
+    policy->has_blocked = calloc(capacity, 1);
+    unsigned char *terminal = calloc(capacity, 1);
+    uint16_t *link = calloc(capacity, sizeof(uint16_t));
+    uint16_t *queue = malloc(capacity * sizeof(uint16_t));
+    if (!policy->next || !policy->blocked || !policy->has_blocked ||
+        !terminal || !link || !queue) {
+        free(terminal);
+        free(link);
+        free(queue);
+        return fail(error, error_size, "out of memory", NULL);
+    }
+    memset(policy->next, 0xff, capacity * symbols * sizeof(uint16_t));
+
+    // Trie; a text using characters the policy never draws cannot occur
+    size_t states = 1;
+    for (int w = 0; w < rules->forbidden_count; w++) {
+        const unsigned char *word = (const unsigned char*)rules->forbidden[w];
+        int possible = 1;
+        for (const unsigned char *p = word; *p; p++) {
+            if (policy->symbol[*p] == NO_SYMBOL) possible = 0;
+        }
+        if (!possible) continue;
+
+        size_t state = 0;
+        for (const unsigned char *p = word; *p; p++) {
+            uint16_t *slot = &policy->next[state * symbols + policy->symbol[*p]];
+            if (*slot == NO_STATE) *slot = (uint16_t)states++;
+            state = *slot;
+        }
+        terminal[state] = 1;
+    }
+
+    // Breadth first: fill missing transitions from the suffix link, and
+    // mark states whose suffix ends a text
+    size_t head = 0;
+    size_t tail = 0;
+    for (size_t s = 0; s < symbols; s++) {
+        uint16_t *slot = &policy->next[s];
+        if (*slot == NO_STATE) {
+            *slot = 0;
+        } else {
+            link[*slot] = 0;
+            queue[tail++] = *slot;
+        }
+    }
+    while (head < tail) {
+        uint16_t state = queue[head++];
+        terminal[state] |= terminal[link[state]];
+        for (size_t s = 0; s < symbols; s++) {
+            uint16_t *slot = &policy->next[state * symbols + s];
+            uint16_t fallback = policy->next[link[state] * symbols + s];
+            if (*slot == NO_STATE) {
+                *slot = fallback;
+            } else {
+                link[*slot] = fallback;
+                queue[tail++] = *slot;
+            }
+        }
+    }
+    policy->states = states;
+
+    for (size_t state = 0; state < states; state++) {
+        for (unsigned i = 0; i < policy->alphabet_size; i++) {
+            unsigned char ch = (unsigned char)policy->alphabet[i];
+            unsigned char folded = (unsigned char)tolower(ch);
+            if (terminal[policy->next[state * symbols + policy->symbol[folded]]]) {
+                policy->blocked[state][ch >> 3] |= (unsigned char)(1 << (ch & 7));
+                policy->has_blocked[state] = 1;
+            }
+        }
+    }
+
+    free(terminal);
+    free(link);
+    free(queue);
+    return 1;
+}
+
+// Every class must keep a character to draw in every automaton state, even
+// with the previous character also ruled out by max-repeat; then the
+// single pass of generation can never get stuck
+static int check_satisfiable(const PasswordPolicy *policy, char *error, size_t error_size) {
+    unsigned needed = policy->max_repeat ? 2 : 1;
+    size_t states = policy->next ? policy->states : 1;
+
+    for (size_t state = 0; state < states; state++) {
+        const unsigned char *blocked = policy->next ? policy->blocked[state] : NULL;
+        for (int c = 0; c < CLASS_COUNT; c++) {
+            if (policy->set_size[c] == 0) continue;
+            unsigned allowed = 0;
+            for (unsigned i = 0; i < policy->set_size[c]; i++) {
+                if (!is_blocked(blocked, (unsigned char)policy->sets[c][i])) allowed++;
+            }
+            if (allowed < needed) {
+                return fail(error, error_size,
+                            "forbid and max-repeat rules leave a class without characters",
+                            class_names[c]);
+            }
+        }
+    }
+    return 1;
+}
+
+PasswordPolicy* policy_compile(const char *text, char *error, size_t error_size) {
+    if (!text || strlen(text) >= POLICY_TEXT_MAX) {
+        fail(error, error_size, "policy text is missing or too long", NULL);
+        return NULL;
+    }
+
+    PolicyRules rules;
+    memset(&rules, 0, sizeof(rules));
+    rules.length = DEFAULT_LENGTH;
+
+    char copy[POLICY_TEXT_MAX];
+    strcpy(copy, text);
+    char *token = copy;
+    while (*token) {
+        size_t len = strcspn(token, " \t");
+        char *rest = token + len;
+        if (*rest) *rest++ = '\0';
+        if (len > 0 && !parse_rule(&rules, token, error, error_size)) return NULL;
+        token = rest;
+    }
+
+    PasswordPolicy *policy = calloc(1, sizeof(PasswordPolicy));
+    if (!policy) {
+        fail(error, error_size, "out of memory", NULL);
+        return NULL;
+    }
+    policy->length = rules.length;
+    policy->max_repeat = rules.max_repeat;
+
+    if (!build_sets(policy, &rules, error, error_size) ||
+        !build_completions(policy, error, error_size) ||
+        (rules.forbidden_count > 0 && !build_automaton(policy, &rules, error, error_size)) ||
+        !check_satisfiable(policy, error, error_size)) {
+        policy_free(policy);
+        return NULL;
+    }
+    return policy;
+}
+
+void policy_free(PasswordPolicy *policy) {
+    if (!policy) return;
+    free(policy->completions);
+    free(policy->next);
+    free(policy->blocked);
+    free(policy->has_blocked);
+    free(policy);
+}
+
+int policy_length(const PasswordPolicy *policy) {
+    return policy ? policy->length : 0;
+}
+
+static size_t initial_deficit(const PasswordPolicy *policy) {
+    size_t deficit = 0;
+    for (int c = 0; c < CLASS_COUNT; c++) {
+        deficit += (size_t)policy->minimum[c] * policy->stride[c];
+    }
+    return deficit;
+}
+
+double policy_entropy_bits(const PasswordPolicy *policy) {
+    if (!policy) return 0.0;
+    size_t index = (size_t)policy->length * policy->deficit_states + initial_deficit(policy);
+    return log2(policy->completions[index]);
+}
+
+// Uniform in [0, 1) with 53 random bits
+static double random_unit(void) {
+    uint64_t high = random_uniform(1u << 26);
+    uint64_t low = random_uniform(1u << 27);
+    return (double)(high << 27 | low) * 0x1p-53;
+}
+
+// Pick the class of the next character: proportional to the compliant
+// passwords each choice leaves
+static int choose_class(const PasswordPolicy *policy, int remaining,
+                        size_t deficit, const int *missing) {
+    const double *shorter = policy->completions + (size_t)(remaining - 1) * policy->deficit_states;
+    double x = random_unit() * policy->completions[(size_t)remaining * policy->deficit_states + deficit];
+
+    int chosen = -1;
+    for (int c = 0; c < CLASS_COUNT; c++) {
+        if (policy->set_size[c] == 0) continue;
+        size_t after = missing[c] > 0 ? deficit - policy->stride[c] : deficit;
+        double weight = policy->set_size[c] * shorter[after];
+        if (weight <= 0.0) continue;
+        chosen = c;
+        if (x < weight) break;
+        x -= weight;
+    }
+    return chosen;
+}
+
+// Uniform among the characters of set that break no rule
+static int pick_char(const char *set, unsigned size, const unsigned char *blocked, int repeat) {
+    if (!blocked && repeat < 0) return (unsigned char)set[random_uniform(size)];
+
+    unsigned allowed = 0;
+    for (unsigned i = 0; i < size; i++) {
+        unsigned char ch = (unsigned char)set[i];
+        if (ch != repeat && !is_blocked(blocked, ch)) allowed++;
+    }
+    if (allowed == 0) return -1;
+
+    unsigned k = random_uniform(allowed);
+    for (unsigned i = 0; i < size; i++) {
+        unsigned char ch = (unsigned char)set[i];
+        if (ch != repeat && !is_blocked(blocked, ch) && k-- == 0) return ch;
+    }
+    return -1;
+}
+
+static int generate_into(const PasswordPolicy *policy, char *out) {
+    int missing[CLASS_COUNT];
+    memcpy(missing, policy->minimum, sizeof(missing));
+    size_t deficit = initial_deficit(policy);
+    size_t state = 0;
+    int previous = -1;
+    int run = 0;
+
+    for (int i = 0; i < policy->length; i++) {
+        const unsigned char *blocked = NULL;
+        if (policy->next && policy->has_blocked[state]) blocked = policy->blocked[state];
+        int repeat = (policy->max_repeat && run >= policy->max_repeat) ? previous : -1;
+
+        // With every minimum met, all compliant continuations are equally
+        // many per character, so the whole alphabet is drawn from directly
+        int c = deficit ? choose_class(policy, policy->length - i, deficit, missing) : -1;
+        int ch = c < 0 ? pick_char(policy->alphabet, policy->alphabet_size, blocked, repeat)
+                       : pick_char(policy->sets[c], policy->set_size[c], blocked, repeat);
+        if (ch < 0) return 0;
+
+        out[i] = (char)ch;
+        if (c >= 0 && missing[c] > 0) {
+            missing[c]--;
+            deficit -= policy->stride[c];
+        }
+        run = ch == previous ? run + 1 : 1;
+        previous = ch;
+        if (policy->next) {
+            unsigned char folded = (unsigned char)tolower(ch);
+            state = policy->next[state * policy->symbols + policy->symbol[folded]];
+        }
+    }
+    return 1;
+}
+
+static size_t policy_line(void *ctx, char *out) {
+    const PasswordPolicy *policy = ctx;
+    return generate_into(policy, out) ? (size_t)policy->length : 0;
+}
+
+int policy_generate(const PasswordPolicy *policy, char *buffer, size_t buffer_size) {
+    if (!policy || !buffer || buffer_size < (size_t)policy->length + 1) return 0;
+    if (!generate_into(policy, buffer)) return 0;
+    buffer[policy->length] = '\0';
+    return 1;
+}
+
+long long policy_generate_batch(FILE *out, unsigned long long count,
+                                const PasswordPolicy *policy) {
+    if (!out || !policy) return -1;
+    return write_generated_lines(out, count, (size_t)policy->length, policy_line,
+                                 (void*)policy);
+}
+
+static void policy_file_path(char *buffer, size_t size) {
+    snprintf(buffer, size, "%s/%s", get_data_dir(), POLICY_FILE_NAME);
+}
+
+// Split "<service>\t<policy>" in place; NULL policy for comments and blanks
+static char* split_line(char *line) {
+    line[strcspn(line, "\r\n")] = '\0';
+    if (line[0] == '#') return NULL;
+    char *tab = strchr(line, '\t');
+    if (!tab) return NULL;
+    *tab = '\0';
+    return tab + 1;
+}
+
+int policy_lookup(const char *service, char *text, size_t size) {
+    if (!text || size == 0) return 0;
+    snprintf(text, size, "%s", POLICY_DEFAULT);
+
+    char path[PATH_SIZE];
+    policy_file_path(path, sizeof(path));
+    FILE *file = fopen(path, "r");
+    if (!file) return 0;
+
+    int own = 0;
+    char line[LINE_SIZE];
+    while (!own && fgets(line, sizeof(line), file)) {
+        char *policy = split_line(line);
+        if (!policy) continue;
+        if (service && strcasecmp(line, service) == 0) {
+            snprintf(text, size, "%s", policy);
+            own = 1;
+        } else if (strcmp(line, POLICY_DEFAULT_SERVICE) == 0) {
+            snprintf(text, size, "%s", policy);
+        }
+    }
+    fclose(file);
+    return own;
+}
+
+int policy_attach(const char *service, const char *text) {
+    if (!service || service[0] == '\0' || strlen(service) >= MAX_SERVICE_NAME ||
+        strpbrk(service, "\t\r\n")) {
+        return 0;
+    }
+    if (text && (strlen(text) >= POLICY_TEXT_MAX || strpbrk(text, "\r\n"))) return 0;
+
+    char path[PATH_SIZE];
+    char tmp_path[PATH_SIZE + 4];
+    policy_file_path(path, sizeof(path));
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    FILE *out = fopen(tmp_path, "w");
+    if (!out) return 0;
+#ifndef _WIN32
+    chmod(tmp_path, 0600);
+#endif
+
+    // Keep every other line as it was, comments included
+    int ok = 1;
+    FILE *in = fopen(path, "r");
+    if (in) {
+        char line[LINE_SIZE];
+        char parsed[LINE_SIZE];
+        while (ok && fgets(line, sizeof(line), in)) {
+            memcpy(parsed, line, sizeof(line));
+            char *policy = split_line(parsed);
+            if (policy && strcasecmp(parsed, service) == 0) continue;
+            ok = fputs(line, out) >= 0;
+            if (ok && !strchr(line, '\n')) ok = fputc('\n', out) != EOF;
+        }
+        fclose(in);
+    }
+    if (ok && text) ok = fprintf(out, "%s\t%s\n", service, text) > 0;
+    if (fclose(out) != 0) ok = 0;
+
+    if (!ok || rename(tmp_path, path) != 0) {
+        remove(tmp_path);
+        return 0;
+    }
+    return 1;
+}
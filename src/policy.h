@@ -0,0 +1,79 @@
+#ifndef POLICY_H
+#define POLICY_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+/**
+ * Password policies
+ *
+ * A policy is a line of rules separated by spaces:
+ *
+ *   length=20 upper=1 lower=1 digit=2 symbol=1 symbol-set=!#$%&*
+ *   exclude=ambiguous max-repeat=2 forbid=password forbid=acme
+ *
+ *   length=N             password length (4 to 128; default 16)
+ *   upper|lower|digit|symbol=N
+ *                        at least N characters of the class (0 = allowed,
+ *                        the default for every class)
+ *   no-upper|no-lower|no-digit|no-symbol
+ *                        never use the class
+ *   upper-set|lower-set|digit-set|symbol-set=CHARS
+ *                        the class's alphabet (printable ASCII)
+ *   exclude=CHARS        drop these characters from every class;
+ *                        "ambiguous" stands for 0O1Il|
+ *   max-repeat=N         no character more than N times in a row
+ *   forbid=TEXT          never contain TEXT, in any letter case
+ *
+ * Compiling a policy builds everything generation needs: the alphabets,
+ * a table of how many passwords complete each prefix state (remaining
+ * length by missing class counts), and an automaton over the forbidden
+ * texts with, per state, the characters that would complete one. Each
+ * character is then drawn once: its class with probability proportional
+ * to the compliant completions, its value from the class less the
+ * characters that would break a rule. Passwords always comply and, when
+ * no repeat or forbid rule applies, are uniform over every compliant
+ * password.
+ *
+ * Policies are attached to services in POLICY_FILE_NAME in the data
+ * directory, one "<service><TAB><policy>" line each; the service "*" is
+ * the default. The file is plain text and names the services it lists.
+ */
+
+#define POLICY_FILE_NAME "policies"
+#define POLICY_TEXT_MAX 512
+#define POLICY_DEFAULT "length=20 upper=1 lower=1 digit=1 symbol=1"
+#define POLICY_DEFAULT_SERVICE "*"
+
+typedef struct PasswordPolicy PasswordPolicy;
+
+// Compile a policy; on failure, error (if given) says which rule is wrong
+// Returns: the policy (free with policy_free), or NULL
+PasswordPolicy* policy_compile(const char *text, char *error, size_t error_size);
+
+void policy_free(PasswordPolicy *policy);
+
+// Password length the policy produces
+int policy_length(const PasswordPolicy *policy);
+
+// Size of the compliant password space as bits (log2), ignoring the
+// max-repeat and forbid rules
+double policy_entropy_bits(const PasswordPolicy *policy);
+
+// Generate one compliant password into buffer (length + 1 bytes)
+int policy_generate(const PasswordPolicy *policy, char *buffer, size_t buffer_size);
+
+// Write count compliant passwords to out, one per line
+// Returns: number written, or -1 on failure
+long long policy_generate_batch(FILE *out, unsigned long long count,
+                                const PasswordPolicy *policy);
+
+// Policy text attached to service, else the default entry, else
+// POLICY_DEFAULT
+// Returns: 1 if the service has its own policy, 0 otherwise
+int policy_lookup(const char *service, char *text, size_t size);
+
+// Attach a policy to service (text NULL = detach)
+int policy_attach(const char *service, const char *text);
+
+#endif // POLICY_H
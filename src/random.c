@@ -0,0 +1,252 @@
+// Feature test macros must come before any includes
+#ifndef _WIN32
+    #define _DEFAULT_SOURCE
+#endif
+
+#include "random.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+    #include <openssl/rand.h>
+#else
+    #include <errno.h>
+    #include <pthread.h>
+    #include <sys/types.h>
+    #include <unistd.h>
+    #if defined(__linux__) || defined(__APPLE__)
+        #include <sys/random.h>
+    #endif
+#endif
+
+#define CHACHA_BLOCK 64
+#define BUFFER_BLOCKS 16
+#define KEY_WORDS 8
+#define SEED_SIZE 40            // Key and nonce
+
+typedef struct {
+    uint32_t input[16];         // Constants, key, 64-bit counter, 64-bit nonce
+    unsigned char buffer[CHACHA_BLOCK * BUFFER_BLOCKS];
+    size_t available;           // Unread bytes at the end of buffer
+    size_t since_reseed;
+    unsigned long forks_seen;
+    int seeded;
+#ifndef _WIN32
+    pid_t pid;
+#endif
+} Generator;
+
+static _Thread_local Generator generator;
+
+#ifndef _WIN32
+// Bumped in the child after every fork(); a thread whose generator saw an
+// older value reseeds before its next byte
+static volatile unsigned long fork_count = 0;
+static pthread_once_t atfork_once = PTHREAD_ONCE_INIT;
+
+static void note_fork(void) {
+    fork_count++;
+}
+
+static void register_atfork(void) {
+    pthread_atfork(NULL, NULL, note_fork);
+}
+#endif
+
+static uint32_t load32(const unsigned char *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 |
+           (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void store32(unsigned char *p, uint32_t value) {
+    p[0] = (unsigned char)value;
+    p[1] = (unsigned char)(value >> 8);
+    p[2] = (unsigned char)(value >> 16);
+    p[3] = (unsigned char)(value >> 24);
+}
+
+#define LANES 4                 // Blocks computed side by side
+
+#define ROTL32(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+// The ChaCha quarter round on the same words of every lane; written over
+// lanes so the compiler can keep the four blocks in vector registers
+#define QUARTER_ROUND(a, b, c, d) \
+    for (int l = 0; l < LANES; l++) { \
+        a[l] += b[l]; d[l] ^= a[l]; d[l] = ROTL32(d[l], 16); \
+        c[l] += d[l]; b[l] ^= c[l]; b[l] = ROTL32(b[l], 12); \
+        a[l] += b[l]; d[l] ^= a[l]; d[l] = ROTL32(d[l], 8); \
+        c[l] += d[l]; b[l] ^= c[l]; b[l] = ROTL32(b[l], 7); \
+    }
+
+// LANES consecutive 64-byte ChaCha20 keystream blocks (RFC 8439, 20
+// rounds), starting at the counter in input
+static void chacha_blocks(const uint32_t input[16], unsigned char *out) {
+    uint32_t x[16][LANES];
+    uint32_t start[16][LANES];
+    for (int i = 0; i < 16; i++) {
+        for (int l = 0; l < LANES; l++) {
+            start[i][l] = input[i];
+        }
+    }
+    for (int l = 0; l < LANES; l++) {
+        start[12][l] = input[12] + (uint32_t)l;
+        start[13][l] = input[13] + (start[12][l] < input[12]);
+    }
+    memcpy(x, start, sizeof(x));
+
+    for (int round = 0; round < 10; round++) {
+        QUARTER_ROUND(x[0], x[4], x[8], x[12]);
+        QUARTER_ROUND(x[1], x[5], x[9], x[13]);
+        QUARTER_ROUND(x[2], x[6], x[10], x[14]);
+        QUARTER_ROUND(x[3], x[7], x[11], x[15]);
+        QUARTER_ROUND(x[0], x[5], x[10], x[15]);
+        QUARTER_ROUND(x[1], x[6], x[11], x[12]);
+        QUARTER_ROUND(x[2], x[7], x[8], x[13]);
+        QUARTER_ROUND(x[3], x[4], x[9], x[14]);
+    }
+
+    for (int l = 0; l < LANES; l++) {
+        for (int i = 0; i < 16; i++) {
+            store32(out + l * CHACHA_BLOCK + 4 * i, x[i][l] + start[i][l]);
+        }
+    }
+    memset(x, 0, sizeof(x));
+    memset(start, 0, sizeof(start));
+}
+
+static int os_entropy(unsigned char *out, size_t len) {
+#if defined(_WIN32)
+    return RAND_bytes(out, (int)len) == 1;
+#elif defined(__linux__)
+    while (len > 0) {
+        ssize_t got = getrandom(out, len, 0);
+        if (got < 0) {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        out += got;
+        len -= (size_t)got;
+    }
+    return 1;
+#else
+    return getentropy(out, len) == 0;
+#endif
+}
+
+// Mix fresh kernel entropy into the key and nonce, and drop buffered output
+static int reseed(Generator *g) {
+    unsigned char seed[SEED_SIZE];
+    if (!os_entropy(seed, sizeof(seed))) return 0;
+
+    if (!g->seeded) {
+        // "expand 32-byte k"
+        g->input[0] = 0x61707865;
+        g->input[1] = 0x3320646e;
+        g->input[2] = 0x79622d32;
+        g->input[3] = 0x6b206574;
+        memset(g->input + 4, 0, sizeof(uint32_t) * 12);
+    }
+    for (int i = 0; i < KEY_WORDS; i++) {
+        g->input[4 + i] ^= load32(seed + 4 * i);
+    }
+    g->input[12] = 0;
+    g->input[13] = 0;
+    g->input[14] ^= load32(seed + 32);
+    g->input[15] ^= load32(seed + 36);
+    memset(seed, 0, sizeof(seed));
+
+    memset(g->buffer, 0, sizeof(g->buffer));
+    g->available = 0;
+    g->since_reseed = 0;
+    g->seeded = 1;
+#ifndef _WIN32
+    g->forks_seen = fork_count;
+    g->pid = getpid();
+#endif
+    return 1;
+}
+
+// Generate a buffer of keystream; its first 32 bytes become the next key
+static void refill(Generator *g) {
+    for (int block = 0; block < BUFFER_BLOCKS; block += LANES) {
+        chacha_blocks(g->input, g->buffer + block * CHACHA_BLOCK);
+        uint32_t counter = g->input[12];
+        g->input[12] += LANES;
+        if (g->input[12] < counter) g->input[13]++;
+    }
+
+    for (int i = 0; i < KEY_WORDS; i++) {
+        g->input[4 + i] = load32(g->buffer + 4 * i);
+    }
+    g->input[12] = 0;
+    g->input[13] = 0;
+    memset(g->buffer, 0, KEY_WORDS * 4);
+    g->available = sizeof(g->buffer) - KEY_WORDS * 4;
+}
+
+int random_bytes(void *buf, size_t len) {
+    Generator *g = &generator;
+    if (!buf && len > 0) return 0;
+
+#ifndef _WIN32
+    pthread_once(&atfork_once, register_atfork);
+    int stale = g->forks_seen != fork_count;
+#else
+    int stale = 0;
+#endif
+    if (!g->seeded || stale || g->since_reseed >= RANDOM_RESEED_BYTES) {
+        if (!reseed(g)) return 0;
+    }
+
+    unsigned char *out = buf;
+    while (len > 0) {
+        if (g->available == 0) {
+#ifndef _WIN32
+            // A child created without fork() (raw clone, vfork) skips the
+            // handler and is only caught here, at its first refill: until
+            // then it can hand out bytes left in the buffer it inherited
+            if (getpid() != g->pid && !reseed(g)) return 0;
+#endif
+            refill(g);
+        }
+
+        size_t take = len < g->available ? len : g->available;
+        unsigned char *source = g->buffer + sizeof(g->buffer) - g->available;
+        memcpy(out, source, take);
+        memset(source, 0, take);
+
+        g->available -= take;
+        g->since_reseed += take;
+        out += take;
+        len -= take;
+    }
+    return 1;
+}
+
+static uint32_t random_u32(void) {
+    unsigned char bytes[4];
+    if (!random_bytes(bytes, sizeof(bytes))) {
+        fprintf(stderr, "Fatal: cannot seed the random generator\n");
+        abort();
+    }
+    return load32(bytes);
+}
+
+// Lemire's multiply-and-shift: the high half of x * n is uniform once the
+// few low halves that would over-represent some values are redrawn
+uint32_t random_uniform(uint32_t n) {
+    if (n == 0) return 0;
+
+    uint64_t product = (uint64_t)random_u32() * n;
+    uint32_t low = (uint32_t)product;
+    if (low < n) {
+        uint32_t threshold = (uint32_t)(0u - n) % n;
+        while (low < threshold) {
+            product = (uint64_t)random_u32() * n;
+            low = (uint32_t)product;
+        }
+    }
+    return (uint32_t)(product >> 32);
+}
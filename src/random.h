@@ -0,0 +1,33 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Per-thread ChaCha20 random generator for password and passphrase
+ * generation
+ *
+ * Each thread keeps its own generator, so callers never share a lock.
+ * It is seeded from the kernel (getrandom/getentropy) and reseeds after
+ * RANDOM_RESEED_BYTES of output and after fork(), so a forked child never
+ * repeats its parent's stream. Each refill overwrites the key with fresh
+ * keystream (fast key erasure), so a later state cannot reproduce earlier
+ * output.
+ *
+ * Keys, salts and nonces still come from generate_random_bytes() in
+ * crypto.h.
+ */
+
+#define RANDOM_RESEED_BYTES (1024 * 1024)
+
+// Fill buf with len random bytes
+// Returns: 1 on success, 0 if the generator could not be seeded
+int random_bytes(void *buf, size_t len);
+
+// Uniform value in [0, n) without modulo bias; n = 0 returns 0.
+// Aborts if the generator cannot be seeded, rather than return a
+// predictable value.
+uint32_t random_uniform(uint32_t n);
+
+#endif // RANDOM_H
@@ -0,0 +1,716 @@
+#include "strength.h"
+#include "passphrase.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <pthread.h>
+#endif
+
+#define ALPHABET 36             // a-z, 0-9
+#define MAX_ANALYZED 128        // Longer tails are scored as brute force
+#define MAX_MATCHES 1024
+#define MAX_TOKENS 12
+#define MIN_WALK 3
+#define MIN_SEQUENCE 3
+
+// zxcvbn's floors for a pattern that covers one or several characters
+#define MIN_GUESSES_SINGLE 10.0
+#define MIN_GUESSES_MULTI 50.0
+
+// US QWERTY: 47 keys, doubled by shift; about 4.6 neighbours per key
+#define KEYBOARD_STARTS 94.0
+#define KEYBOARD_DEGREE 4.6
+#define MIN_YEAR_SPACE 20
+
+// Most common passwords first; the rank is the guess number
+static const char *common_passwords[] = {
+    "123456", "password", "123456789", "12345678", "12345", "qwerty",
+    "1234567", "111111", "1234567890", "123123", "abc123", "1234",
+    "password1", "iloveyou", "1q2w3e4r", "000000", "qwerty123", "zaq12wsx",
+    "dragon", "sunshine", "princess", "letmein", "654321", "monkey",
+    "27653", "1qaz2wsx", "123321", "qwertyuiop", "superman", "asdfghjkl",
+    "trustno1", "football", "baseball", "welcome", "admin", "master",
+    "shadow", "michael", "jennifer", "hunter", "jordan", "harley",
+    "ranger", "buster", "soccer", "hockey", "killer", "george", "charlie",
+    "andrew", "michelle", "love", "jessica", "pepper", "daniel", "access",
+    "joshua", "maggie", "starwars", "silver", "william", "dallas", "yankees",
+    "hello", "amanda", "orange", "biteme", "freedom", "computer", "sexy",
+    "thunder", "nicole", "ginger", "heather", "hammer", "summer", "corvette",
+    "taylor", "fuckyou", "austin", "merlin", "matthew", "121212", "golfer",
+    "cheese", "martin", "chelsea", "patrick", "richard", "diamond", "yellow",
+    "bigdog", "secret", "asdfgh", "sparky", "cowboy", "camaro", "anthony",
+    "matrix", "falcon", "iloveu", "bailey", "guitar", "jackson", "purple",
+    "scooter", "phoenix", "aaaaaa", "morgan", "tigers", "porsche", "mickey",
+    "maverick", "cookie", "nascar", "peanut", "justin", "131313", "money",
+    "horny", "samantha", "panties", "steelers", "joseph", "snoopy",
+    "boomer", "whatever", "iceman", "smokey", "gateway", "dakota", "cowboys",
+    "eagles", "chicken", "dick", "black", "zxcvbn", "please", "andrea",
+    "ferrari", "knight", "hardcore", "melissa", "compaq", "coffee",
+    "johnny", "bulldog", "xxxxxx", "welcome1", "batman", "qazwsx", "passw0rd",
+    "pass", "test", "changeme", "default", "root", "toor", "login",
+    "administrator", "guest", "p@ssw0rd", "qwe123", "123qwe", "1q2w3e",
+    "q1w2e3r4", "zxcvbnm", "asdf", "qwer", "abcd1234", "monday", "friday",
+    "sunday", "winter", "spring", "autumn", "december", "january",
+    "liverpool", "arsenal", "barcelona", "pokemon", "naruto", "minecraft",
+    "lovely", "flower", "angel", "baby", "family", "forever", "blessed",
+    "google", "facebook", "linkedin", "dropbox", "adobe", "apple", "samsung",
+};
+
+#define COMMON_COUNT (sizeof(common_passwords) / sizeof(common_passwords[0]))
+
+// Shared Aho-Corasick automaton, complete as a DFA: next[] has an entry
+// for every state and symbol, so matching costs one lookup per character
+typedef struct {
+    int32_t *next;          // state * ALPHABET + symbol -> state
+    int32_t *rank;          // Rank of the word ending at this state; 0 = none
+    int32_t *depth;         // Length of the word ending here
+    int32_t *report;        // Nearest suffix state that ends a word; -1 = none
+    size_t states;
+    size_t capacity;
+    int has_wordlist;
+} Automaton;
+
+// A key's place on the keyboard, in half-key columns
+typedef struct {
+    signed char row;        // -1 = not on the keyboard
+    signed char x;
+    char shifted;
+} KeyPosition;
+
+typedef struct {
+    uint16_t start;
+    uint16_t end;           // Exclusive
+    double bits;
+} Match;
+
+typedef struct {
+    Match items[MAX_MATCHES];
+    size_t count;
+} MatchList;
+
+static Automaton automaton;
+static KeyPosition keyboard[256];
+static int reference_year = 2025;
+
+#ifdef _WIN32
+static INIT_ONCE init_once = INIT_ONCE_STATIC_INIT;
+#else
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+#endif
+
+static int symbol_of(unsigned char c) {
+    if (c >= 'a' && c <= 'z') return c - 'a';
+    if (c >= 'A' && c <= 'Z') return c - 'A';
+    if (c >= '0' && c <= '9') return 26 + (c - '0');
+    return -1;
+}
+
+// The letter a l33t character stands for, or 0
+static char unleet(unsigned char c) {
+    switch (c) {
+        case '4': case '@': return 'a';
+        case '8': return 'b';
+        case '(': return 'c';
+        case '3': return 'e';
+        case '6': case '9': return 'g';
+        case '1': case '!': case '|': return 'i';
+        case '0': return 'o';
+        case '$': case '5': return 's';
+        case '7': case '+': return 't';
+        case '2': return 'z';
+        default: return 0;
+    }
+}
+
+static int32_t new_state(void) {
+    if (automaton.states == automaton.capacity) {
+        size_t capacity = automaton.capacity ? automaton.capacity * 2 : 4096;
+        int32_t *next = realloc(automaton.next, sizeof(int32_t) * ALPHABET * capacity);
+        if (!next) return -1;
+        automaton.next = next;
+
+        int32_t *rank = realloc(automaton.rank, sizeof(int32_t) * capacity);
+        if (!rank) return -1;
+        automaton.rank = rank;
+
+        int32_t *depth = realloc(automaton.depth, sizeof(int32_t) * capacity);
+        if (!depth) return -1;
+        automaton.depth = depth;
+
+        automaton.capacity = capacity;
+    }
+
+    int32_t state = (int32_t)automaton.states++;
+    for (int s = 0; s < ALPHABET; s++) {
+        automaton.next[state * ALPHABET + s] = -1;
+    }
+    automaton.rank[state] = 0;
+    automaton.depth[state] = 0;
+    return state;
+}
+
+static int insert_word(const char *word, int32_t rank) {
+    int32_t state = 0;
+    int32_t depth = 0;
+
+    for (const unsigned char *p = (const unsigned char*)word; *p; p++) {
+        int s = symbol_of(*p);
+        if (s < 0) return 1;            // Not spellable in the alphabet
+        int32_t *slot = &automaton.next[state * ALPHABET + s];
+        if (*slot < 0) {
+            int32_t child = new_state();
+            if (child < 0) return 0;
+            // new_state may have moved the table
+            automaton.next[state * ALPHABET + s] = child;
+            state = child;
+        } else {
+            state = *slot;
+        }
+        depth++;
+    }
+
+    if (depth > 0 && (automaton.rank[state] == 0 || rank < automaton.rank[state])) {
+        automaton.rank[state] = rank;
+        automaton.depth[state] = depth;
+    }
+    return 1;
+}
+
+// Add the EFF words; every one is as likely as any other to an attacker
+// working through the list, so each ranks as the list's length
+static int insert_wordlist(void) {
+    int count = passphrase_word_count();
+    int ok = 1;
+    for (int i = 0; ok && i < count; i++) {
+        ok = insert_word(passphrase_word(i, NULL), (int32_t)count);
+    }
+    return ok && count > 0;
+}
+
+// Breadth-first pass: fill the missing transitions from each state's
+// failure state, and link every state to the nearest suffix ending a word
+static int complete_automaton(void) {
+    int32_t *fail = malloc(sizeof(int32_t) * automaton.states);
+    int32_t *queue = malloc(sizeof(int32_t) * automaton.states);
+    automaton.report = malloc(sizeof(int32_t) * automaton.states);
+    if (!fail || !queue || !automaton.report) {
+        free(fail);
+        free(queue);
+        return 0;
+    }
+
+    size_t head = 0;
+    size_t tail = 0;
+    fail[0] = 0;
+    automaton.report[0] = -1;
+    for (int s = 0; s < ALPHABET; s++) {
+        int32_t child = automaton.next[s];
+        if (child < 0) {
+            automaton.next[s] = 0;
+        } else {
+            fail[child] = 0;
+            automaton.report[child] = -1;
+            queue[tail++] = child;
+        }
+    }
+
+    while (head < tail) {
+        int32_t state = queue[head++];
+        for (int s = 0; s < ALPHABET; s++) {
+            int32_t *slot = &automaton.next[state * ALPHABET + s];
+            int32_t via_fail = automaton.next[fail[state] * ALPHABET + s];
+            if (*slot < 0) {
+                *slot = via_fail;
+                continue;
+            }
+
+            int32_t child = *slot;
+            fail[child] = via_fail;
+            automaton.report[child] = automaton.rank[via_fail] ? via_fail
+                                                               : automaton.report[via_fail];
+            queue[tail++] = child;
+        }
+    }
+
+    free(fail);
+    free(queue);
+    return 1;
+}
+
+static void place_row(const char *keys, const char *shifted_keys, int row, int offset) {
+    for (int col = 0; keys[col]; col++) {
+        KeyPosition position = {(signed char)row, (signed char)(offset + 2 * col), 0};
+        keyboard[(unsigned char)keys[col]] = position;
+        position.shifted = 1;
+        keyboard[(unsigned char)shifted_keys[col]] = position;
+    }
+}
+
+static void build_tables(void) {
+    for (int c = 0; c < 256; c++) {
+        keyboard[c].row = -1;
+    }
+    // Rows are staggered by half keys: q sits between 1 and 2, a under q-w
+    place_row("`1234567890-=", "~!@#$%^&*()_+", 0, 0);
+    place_row("qwertyuiop[]\\", "QWERTYUIOP{}|", 1, 3);
+    place_row("asdfghjkl;'", "ASDFGHJKL:\"", 2, 4);
+    place_row("zxcvbnm,./", "ZXCVBNM<>?", 3, 5);
+
+    time_t now = time(NULL);
+    struct tm *utc = gmtime(&now);
+    if (utc) reference_year = utc->tm_year + 1900;
+
+    int ok = new_state() == 0;
+    for (size_t i = 0; ok && i < COMMON_COUNT; i++) {
+        ok = insert_word(common_passwords[i], (int32_t)(i + 1));
+    }
+    if (ok) automaton.has_wordlist = insert_wordlist();
+    if (ok) ok = complete_automaton();
+
+    if (!ok) {
+        // Without an automaton the other patterns still apply
+        free(automaton.next);
+        free(automaton.rank);
+        free(automaton.depth);
+        free(automaton.report);
+        memset(&automaton, 0, sizeof(automaton));
+    }
+}
+
+#ifdef _WIN32
+static BOOL CALLBACK build_tables_once(PINIT_ONCE once, PVOID param, PVOID *context) {
+    (void)once;
+    (void)param;
+    (void)context;
+    build_tables();
+    return TRUE;
+}
+#endif
+
+int strength_init(void) {
+#ifdef _WIN32
+    InitOnceExecuteOnce(&init_once, build_tables_once, NULL, NULL);
+#else
+    pthread_once(&init_once, build_tables);
+#endif
+    return automaton.has_wordlist;
+}
+
+static double binomial(int n, int k) {
+    if (k < 0 || k > n) return 0;
+    double result = 1;
+    for (int i = 1; i <= k; i++) {
+        result = result * (n - k + i) / i;
+    }
+    return result;
+}
+
+// Ways to vary the case or spelling of a word: S changed of S + U letters
+static double variations(int changed, int unchanged) {
+    if (changed == 0 || unchanged == 0) return changed ? 2 : 1;
+
+    double total = 0;
+    int limit = changed < unchanged ? changed : unchanged;
+    for (int i = 1; i <= limit; i++) {
+        total += binomial(changed + unchanged, i);
+    }
+    return total;
+}
+
+static void add_match(MatchList *list, size_t start, size_t end, double guesses) {
+    if (list->count == MAX_MATCHES) return;
+    double floor = end - start == 1 ? MIN_GUESSES_SINGLE : MIN_GUESSES_MULTI;
+    if (guesses < floor) guesses = floor;
+
+    Match *match = &list->items[list->count++];
+    match->start = (uint16_t)start;
+    match->end = (uint16_t)end;
+    match->bits = log2(guesses);
+}
+
+static double uppercase_variations(const char *text, size_t start, size_t end) {
+    int upper = 0;
+    int lower = 0;
+    for (size_t i = start; i < end; i++) {
+        unsigned char c = (unsigned char)text[i];
+        if (c >= 'A' && c <= 'Z') upper++;
+        else if (c >= 'a' && c <= 'z') lower++;
+    }
+    if (upper == 0) return 1;
+
+    // Capitalised, trailing capital or all caps: one guess each
+    unsigned char first = (unsigned char)text[start];
+    unsigned char last = (unsigned char)text[end - 1];
+    if (lower == 0 || (upper == 1 && ((first >= 'A' && first <= 'Z') ||
+                                      (last >= 'A' && last <= 'Z')))) {
+        return 2;
+    }
+    return variations(upper, lower);
+}
+
+static double leet_variations(const char *text, size_t start, size_t end) {
+    int changed = 0;
+    int unchanged = 0;
+    for (size_t i = start; i < end; i++) {
+        unsigned char c = (unsigned char)text[i];
+        if (unleet(c)) {
+            changed++;
+        } else if (c == 'a' || c == 'e' || c == 'i' || c == 'o' || c == 's' ||
+                   c == 't' || c == 'b' || c == 'g' || c == 'z' || c == 'c') {
+            unchanged++;
+        }
+    }
+    return changed ? variations(changed, unchanged) : 1;
+}
+
+// Run the automaton over text as spelled (mode 0), reversed (1) or with
+// l33t characters read as the letters they stand for (2)
+static void match_dictionary(const char *text, size_t n, int mode, MatchList *list) {
+    if (!automaton.next) return;
+
+    int32_t state = 0;
+    for (size_t pos = 0; pos < n; pos++) {
+        size_t index = mode == 1 ? n - 1 - pos : pos;
+        unsigned char c = (unsigned char)text[index];
+        if (mode == 2 && unleet(c)) c = (unsigned char)unleet(c);
+
+        int s = symbol_of(c);
+        if (s < 0) {
+            state = 0;
+            continue;
+        }
+        state = automaton.next[state * ALPHABET + s];
+
+        int32_t hit = automaton.rank[state] ? state : automaton.report[state];
+        for (; hit >= 0; hit = automaton.report[hit]) {
+            size_t len = (size_t)automaton.depth[hit];
+            size_t start = mode == 1 ? index : pos + 1 - len;
+            size_t end = start + len;
+
+            double guesses = automaton.rank[hit] * uppercase_variations(text, start, end);
+            if (mode == 1) {
+                guesses *= 2;
+            } else if (mode == 2) {
+                double leet = leet_variations(text, start, end);
+                if (leet == 1) continue;    // Already found as spelled
+                guesses *= leet;
+            }
+            add_match(list, start, end, guesses);
+        }
+    }
+}
+
+static int adjacent_keys(KeyPosition a, KeyPosition b) {
+    if (a.row < 0 || b.row < 0) return 0;
+    int rows = a.row - b.row;
+    int dx = a.x - b.x;
+    if (rows == 0) return dx == 2 || dx == -2;
+    return (rows == 1 || rows == -1) && (dx == 1 || dx == -1);
+}
+
+static double walk_guesses(int len, int turns, int shifted) {
+    double guesses = 0;
+    for (int i = 2; i <= len; i++) {
+        int possible_turns = turns < i - 1 ? turns : i - 1;
+        for (int j = 1; j <= possible_turns; j++) {
+            guesses += binomial(i - 1, j - 1) * KEYBOARD_STARTS * pow(KEYBOARD_DEGREE, j);
+        }
+    }
+
+    int unshifted = len - shifted;
+    if (shifted > 0) guesses *= unshifted == 0 ? 2 : variations(shifted, unshifted);
+    return guesses;
+}
+
+static void match_keyboard_walks(const char *text, size_t n, MatchList *list) {
+    size_t start = 0;
+    while (start + 1 < n) {
+        size_t end = start + 1;
+        int turns = 1;
+        int last_direction = 0;
+        int shifted = keyboard[(unsigned char)text[start]].shifted;
+
+        while (end < n) {
+            KeyPosition from = keyboard[(unsigned char)text[end - 1]];
+            KeyPosition to = keyboard[(unsigned char)text[end]];
+            if (!adjacent_keys(from, to)) break;
+
+            int direction = (to.row - from.row) * 8 + (to.x - from.x);
+            if (last_direction != 0 && direction != last_direction) turns++;
+            last_direction = direction;
+            shifted += to.shifted;
+            end++;
+        }
+
+        if (end - start >= MIN_WALK) {
+            add_match(list, start, end, walk_guesses((int)(end - start), turns, shifted));
+            start = end - 1;
+        } else {
+            start++;
+        }
+    }
+}
+
+static int char_class(unsigned char c) {
+    if (c >= 'a' && c <= 'z') return 1;
+    if (c >= 'A' && c <= 'Z') return 2;
+    if (c >= '0' && c <= '9') return 3;
+    return 0;
+}
+
+// "abc", "9753", "XYZ": a steady step of at most 5 within one class
+static void match_sequences(const char *text, size_t n, MatchList *list) {
+    size_t start = 0;
+    while (start + 1 < n) {
+        unsigned char first = (unsigned char)text[start];
+        int step = (unsigned char)text[start + 1] - first;
+        int kind = char_class(first);
+        size_t end = start + 1;
+
+        if (kind != 0 && step != 0 && step >= -5 && step <= 5) {
+            while (end < n && char_class((unsigned char)text[end]) == kind &&
+                   (unsigned char)text[end] - (unsigned char)text[end - 1] == step) {
+                end++;
+            }
+        }
+
+        if (end - start >= MIN_SEQUENCE) {
+            double base;
+            if (strchr("aAzZ019", first)) base = 4;
+            else if (kind == 3) base = 10;
+            else base = 26;
+            if (step < 0) base *= 2;
+            add_match(list, start, end, base * (double)(end - start));
+            start = end - 1;
+        } else {
+            start++;
+        }
+    }
+}
+
+static double estimate_span(const char *text, size_t n, int nested);
+
+// "aaaa", "abcabc": the shortest block that repeats, and how often
+static void match_repeats(const char *text, size_t n, MatchList *list) {
+    size_t start = 0;
+    while (start + 1 < n) {
+        size_t end = start + 1;
+
+        for (size_t block = 1; start + 2 * block <= n; block++) {
+            size_t repeats = 1;
+            while (start + (repeats + 1) * block <= n &&
+                   memcmp(text + start, text + start + repeats * block, block) == 0) {
+                repeats++;
+            }
+            if (repeats < 2 || (block == 1 && repeats < 3)) continue;
+
+            double block_bits = estimate_span(text + start, block, 1);
+            end = start + repeats * block;
+            add_match(list, start, end, pow(2, block_bits) * (double)repeats);
+            break;
+        }
+        start = end;
+    }
+}
+
+static int parse_number(const char *text, size_t len) {
+    int value = 0;
+    for (size_t i = 0; i < len; i++) {
+        value = value * 10 + (text[i] - '0');
+    }
+    return value;
+}
+
+static int year_space(int year) {
+    int distance = abs(year - reference_year);
+    return distance > MIN_YEAR_SPACE ? distance : MIN_YEAR_SPACE;
+}
+
+// Three numbers as day, month and year in some order; the year comes
+// first or last and has 2 or 4 digits
+// Returns: guesses, or 0 if no reading is a valid date
+static double date_guesses(const int *values, const size_t *lengths) {
+    static const int orders[3][3] = {{2, 1, 0}, {0, 1, 2}, {1, 0, 2}};  // ymd dmy mdy
+
+    for (int o = 0; o < 3; o++) {
+        int day = values[orders[o][0]];
+        int month = values[orders[o][1]];
+        int year = values[orders[o][2]];
+        size_t year_len = lengths[orders[o][2]];
+        if (lengths[orders[o][0]] > 2 || lengths[orders[o][1]] > 2) continue;
+        if (year_len == 2) year += year > 50 ? 1900 : 2000;
+        else if (year_len != 4 || year < 1000 || year > 2099) continue;
+
+        if (day >= 1 && day <= 31 && month >= 1 && month <= 12) {
+            return 365.0 * year_space(year);
+        }
+    }
+    return 0;
+}
+
+static void match_dates(const char *text, size_t n, MatchList *list) {
+    // digits[i]: length of the run of digits starting at i
+    unsigned char digits[MAX_ANALYZED + 1];
+    digits[n] = 0;
+    for (size_t i = n; i-- > 0;) {
+        digits[i] = text[i] >= '0' && text[i] <= '9' ? (unsigned char)(digits[i + 1] + 1) : 0;
+    }
+
+    for (size_t start = 0; start < n; start++) {
+        if (digits[start] == 0) continue;
+
+        // Bare years, and dates written without separators
+        for (size_t len = 4; len <= 8 && len <= digits[start]; len++) {
+            if (len == 4) {
+                int year = parse_number(text + start, 4);
+                if (year >= 1900 && year <= 2099) {
+                    add_match(list, start, start + 4, year_space(year));
+                }
+            }
+
+            double best = 0;
+            for (size_t a = 1; a <= 4 && a < len; a++) {
+                for (size_t b = 1; b <= 4 && a + b < len; b++) {
+                    size_t c = len - a - b;
+                    if (c > 4) continue;
+                    int values[3] = {parse_number(text + start, a),
+                                     parse_number(text + start + a, b),
+                                     parse_number(text + start + a + b, c)};
+                    size_t lengths[3] = {a, b, c};
+                    double guesses = date_guesses(values, lengths);
+                    if (guesses > 0 && (best == 0 || guesses < best)) best = guesses;
+                }
+            }
+            if (best > 0) add_match(list, start, start + len, best);
+        }
+
+        // 1-4 digits, separator, 1-2 digits, the same separator, 1-4 digits
+        for (size_t a = 1; a <= 4 && a <= digits[start] && start + a < n; a++) {
+            char separator = text[start + a];
+            if (digits[start + a] != 0 || !strchr("/\\-._ ", separator)) continue;
+
+            size_t second = start + a + 1;
+            for (size_t b = 1; b <= 2 && b <= digits[second]; b++) {
+                if (second + b >= n || text[second + b] != separator) continue;
+
+                size_t third = second + b + 1;
+                for (size_t c = 1; c <= 4 && c <= digits[third]; c++) {
+                    int values[3] = {parse_number(text + start, a),
+                                     parse_number(text + second, b),
+                                     parse_number(text + third, c)};
+                    size_t lengths[3] = {a, b, c};
+                    double guesses = date_guesses(values, lengths);
+                    if (guesses > 0) add_match(list, start, third + c, guesses * 4);
+                }
+            }
+        }
+    }
+}
+
+// Brute-force cost of one character, from the classes the password uses
+static double brute_force_bits(const char *text, size_t n) {
+    int lower = 0, upper = 0, digit = 0, symbol = 0, other = 0;
+    for (size_t i = 0; i < n; i++) {
+        unsigned char c = (unsigned char)text[i];
+        if (c >= 'a' && c <= 'z') lower = 1;
+        else if (c >= 'A' && c <= 'Z') upper = 1;
+        else if (c >= '0' && c <= '9') digit = 1;
+        else if (c >= 0x20 && c < 0x7f) symbol = 1;
+        else other = 1;
+    }
+
+    int cardinality = lower * 26 + upper * 26 + digit * 10 + symbol * 33 + other * 100;
+    return log2(cardinality > 1 ? cardinality : 10);
+}
+
+// Cheapest cover of text by matches and brute-force runs. With k tokens
+// an attacker also has to try their orderings, hence log2(k!).
+static double estimate_span(const char *text, size_t n, int nested) {
+    if (n == 0) return 0;
+
+    MatchList *list = malloc(sizeof(MatchList));
+    if (!list) return (double)n * brute_force_bits(text, n);
+    list->count = 0;
+
+    match_dictionary(text, n, 0, list);
+    match_dictionary(text, n, 1, list);
+    match_dictionary(text, n, 2, list);
+    match_keyboard_walks(text, n, list);
+    match_sequences(text, n, list);
+    match_dates(text, n, list);
+    if (!nested) match_repeats(text, n, list);
+
+    // Counting sort by end, so each step only looks at matches ending there
+    uint16_t first_at[MAX_ANALYZED + 2] = {0};
+    uint16_t by_end[MAX_MATCHES];
+    for (size_t m = 0; m < list->count; m++) {
+        first_at[list->items[m].end + 1]++;
+    }
+    for (size_t i = 1; i <= n + 1; i++) {
+        first_at[i] += first_at[i - 1];
+    }
+    uint16_t fill[MAX_ANALYZED + 1];
+    memcpy(fill, first_at, sizeof(fill));
+    for (size_t m = 0; m < list->count; m++) {
+        by_end[fill[list->items[m].end]++] = (uint16_t)m;
+    }
+
+    // best[i][k]: cheapest cover of the first i characters by k tokens;
+    // run[i][k]: the same with the last token a brute-force run still open.
+    // Splitting a run never helps, so a run only ever grows by one character.
+    double per_char = brute_force_bits(text, n);
+    int max_tokens = n < MAX_TOKENS ? (int)n : MAX_TOKENS;
+    static const double unreached = 1e300;
+    double best[MAX_ANALYZED + 1][MAX_TOKENS + 1];
+    double run[MAX_ANALYZED + 1][MAX_TOKENS + 1];
+    for (size_t i = 0; i <= n; i++) {
+        for (int k = 0; k <= max_tokens; k++) {
+            best[i][k] = unreached;
+            run[i][k] = unreached;
+        }
+    }
+    best[0][0] = 0;
+
+    for (size_t end = 1; end <= n; end++) {
+        for (int k = 1; k <= max_tokens; k++) {
+            double extend = run[end - 1][k];
+            double open = best[end - 1][k - 1];
+            run[end][k] = (extend < open ? extend : open) + per_char;
+            best[end][k] = run[end][k];
+        }
+        for (size_t m = first_at[end]; m < first_at[end + 1]; m++) {
+            const Match *match = &list->items[by_end[m]];
+            for (int k = 1; k <= max_tokens; k++) {
+                double cost = best[match->start][k - 1] + match->bits;
+                if (cost < best[end][k]) best[end][k] = cost;
+            }
+        }
+    }
+    free(list);
+
+    double result = unreached;
+    double log_factorial = 0;
+    for (int k = 1; k <= max_tokens; k++) {
+        log_factorial += log2(k);
+        if (best[n][k] + log_factorial < result) result = best[n][k] + log_factorial;
+    }
+    return result;
+}
+
+double strength_estimate_bits(const char *password) {
+    if (!password || !password[0]) return 0;
+    strength_init();
+
+    size_t len = strlen(password);
+    size_t n = len < MAX_ANALYZED ? len : MAX_ANALYZED;
+    double bits = estimate_span(password, n, 0);
+    if (len > n) bits += (double)(len - n) * brute_force_bits(password + n, len - n);
+    return bits;
+}
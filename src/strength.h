@@ -0,0 +1,28 @@
+#ifndef STRENGTH_H
+#define STRENGTH_H
+
+#include <stddef.h>
+
+/**
+ * Pattern-aware password strength estimator (zxcvbn-style)
+ *
+ * A password is covered by the cheapest sequence of patterns an attacker
+ * would try: dictionary words (plain, reversed or l33t-spelled, with their
+ * capitalisation), keyboard walks, character sequences, repeats and
+ * dates, with brute force for whatever is left over. The estimate is the
+ * base-2 logarithm of the guesses needed, so "Password123!" scores what a
+ * dictionary attack needs rather than what its length suggests.
+ *
+ * Dictionary words are found with a single Aho-Corasick automaton over the
+ * built-in common-password list and the EFF wordlist, built on first use
+ * and then shared read-only by every caller and thread.
+ */
+
+// Estimated guesses, as bits (log2); 0 for an empty password
+double strength_estimate_bits(const char *password);
+
+// Build the shared automaton now instead of on the first estimate
+// Returns: 1 if the EFF wordlist was included, 0 if only the built-in list
+int strength_init(void);
+
+#endif // STRENGTH_H
@@ -0,0 +1,254 @@
+#include "sync.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+// Open-addressing hash table over the entries (or tombstones) of one vault
+typedef struct {
+    const PasswordEntry *entries;
+    uint32_t *slots;    // Entry index + 1; 0 = empty
+    size_t mask;
+} JoinTable;
+
+static int join_build(JoinTable *table, const PasswordEntry *entries, size_t count) {
+    size_t size = 16;
+    while (size < count * 2) size <<= 1;
+
+    table->entries = entries;
+    table->mask = size - 1;
+    table->slots = calloc(size, sizeof(uint32_t));
+    if (!table->slots) return 0;
+
+    for (size_t i = 0; i < count; i++) {
+        size_t slot = pm_service_hash(entries[i].service) & table->mask;
+        while (table->slots[slot] != 0) slot = (slot + 1) & table->mask;
+        table->slots[slot] = (uint32_t)(i + 1);
+    }
+    return 1;
+}
+
+// Returns: index of the entry for service, or -1
+static long join_find(const JoinTable *table, const char *service) {
+    if (!table->slots) return -1;
+
+    size_t slot = pm_service_hash(service) & table->mask;
+    while (table->slots[slot] != 0) {
+        uint32_t index = table->slots[slot] - 1;
+        if (strcasecmp(table->entries[index].service, service) == 0) {
+            return (long)index;
+        }
+        slot = (slot + 1) & table->mask;
+    }
+    return -1;
+}
+
+// Entry of the table for service, or NULL
+static const PasswordEntry* join_entry(const JoinTable *table, const char *service) {
+    long index = join_find(table, service);
+    return index >= 0 ? &table->entries[index] : NULL;
+}
+
+static void copy_field(char *out, const char *value, size_t size) {
+    strncpy(out, value, size - 1);
+    out[size - 1] = '\0';
+}
+
+// Settle one field of an entry both sides have
+static void merge_field(char *out, int64_t *out_stamp, size_t size,
+                        const char *a, int64_t a_stamp,
+                        const char *b, int64_t b_stamp,
+                        const char *base, MergeStats *stats) {
+    if (strcmp(a, b) == 0) {
+        *out_stamp = a_stamp > b_stamp ? a_stamp : b_stamp;
+        return;
+    }
+
+    // Only b changed it
+    if (base && strcmp(a, base) == 0) {
+        copy_field(out, b, size);
+        *out_stamp = b_stamp;
+        stats->updated++;
+        return;
+    }
+
+    // Only a changed it
+    if (base && strcmp(b, base) == 0) return;
+
+    // Changed on both sides, or no base to tell: the later edit wins,
+    // a tie keeps a
+    stats->conflicts++;
+    if (b_stamp > a_stamp) {
+        copy_field(out, b, size);
+        *out_stamp = b_stamp;
+        stats->updated++;
+    }
+}
+
+static void merge_entry(PasswordEntry *out, const PasswordEntry *a,
+                        const PasswordEntry *b, const PasswordEntry *base,
+                        uint64_t generation, MergeStats *stats) {
+    size_t updated = stats->updated;
+    *out = *a;
+
+    merge_field(out->username, &out->username_modified, MAX_USERNAME,
+                a->username, a->username_modified,
+                b->username, b->username_modified,
+                base ? base->username : NULL, stats);
+    merge_field(out->password, &out->password_modified, MAX_PASSWORD,
+                a->password, a->password_modified,
+                b->password, b->password_modified,
+                base ? base->password : NULL, stats);
+
+    if (b->created != 0 && (a->created == 0 || b->created < a->created)) {
+        out->created = b->created;
+    }
+
+    // Anything a takes from b is a change of a's next generation
+    if (stats->updated != updated) out->generation = generation;
+}
+
+// An entry only one side has was either added there or deleted on the
+// other side. Its version in base tells which; without one, the other
+// side's tombstone does: a deletion in a later generation than the
+// entry's last change wins. Returns: 1 to keep it
+static int keep_one_sided(const PasswordEntry *entry, const PasswordEntry *base,
+                          const PasswordEntry *tombstone, int from_b,
+                          MergeStats *stats) {
+    int keep;
+
+    if (!base) {
+        keep = !tombstone || entry->generation > tombstone->generation;
+        if (keep && tombstone) stats->conflicts++;
+    } else if (strcmp(entry->username, base->username) == 0 &&
+               strcmp(entry->password, base->password) == 0) {
+        keep = 0;
+    } else {
+        // Edited on one side, deleted on the other: the edit wins
+        stats->conflicts++;
+        keep = 1;
+    }
+
+    if (keep && from_b) stats->added++;
+    if (!keep && !from_b) stats->removed++;
+    return keep;
+}
+
+// Carry over the deletions of both sides, except for services the merge
+// kept or brought back. Where both sides deleted a service the newer
+// generation stays; a deletion only b made is taken, like anything else
+// from b, as a change of a's next generation.
+static int merge_tombstones(PasswordManager *result, const PasswordManager *a,
+                            const JoinTable *a_tombstones,
+                            const JoinTable *b_tombstones,
+                            const PasswordManager *b, uint64_t generation) {
+    JoinTable table = {0};
+    if (!join_build(&table, result->entries, result->count)) return 0;
+
+    int ok = 1;
+    for (size_t i = 0; ok && i < a->tombstone_count; i++) {
+        const PasswordEntry *tombstone = &a->tombstones[i];
+        if (join_find(&table, tombstone->service) >= 0) continue;
+
+        const PasswordEntry *other = join_entry(b_tombstones, tombstone->service);
+        uint64_t newest = tombstone->generation;
+        if (other && other->generation > newest) newest = other->generation;
+        ok = pm_add_tombstone(result, tombstone->service, newest);
+    }
+    for (size_t i = 0; ok && i < b->tombstone_count; i++) {
+        const PasswordEntry *tombstone = &b->tombstones[i];
+        if (join_find(&table, tombstone->service) >= 0 ||
+            join_find(a_tombstones, tombstone->service) >= 0) {
+            continue;
+        }
+        ok = pm_add_tombstone(result, tombstone->service, generation);
+    }
+
+    free(table.slots);
+    return ok;
+}
+
+PasswordManager* sync_merge(const PasswordManager *a, const PasswordManager *b,
+                            const PasswordManager *base, MergeStats *stats) {
+    if (!a || !b || !stats || a->store || b->store || (base && base->store)) {
+        return NULL;
+    }
+    if (b->count >= UINT32_MAX || (base && base->count >= UINT32_MAX) ||
+        a->tombstone_count >= UINT32_MAX || b->tombstone_count >= UINT32_MAX) {
+        return NULL;
+    }
+
+    memset(stats, 0, sizeof(MergeStats));
+
+    PasswordManager *result = pm_init();
+    JoinTable b_table = {0};
+    JoinTable base_table = {0};
+    JoinTable a_tombstones = {0};
+    JoinTable b_tombstones = {0};
+    unsigned char *matched = calloc(b->count + 1, 1);
+
+    uint64_t generation = a->generation + 1;
+    int ok = result && matched &&
+             pm_reserve(result, a->count + b->count) &&
+             join_build(&b_table, b->entries, b->count) &&
+             join_build(&a_tombstones, a->tombstones, a->tombstone_count) &&
+             join_build(&b_tombstones, b->tombstones, b->tombstone_count) &&
+             (!base || join_build(&base_table, base->entries, base->count));
+
+    // Probe with every entry of a, then sweep up what only b has
+    for (size_t i = 0; ok && i < a->count; i++) {
+        const PasswordEntry *entry = &a->entries[i];
+        long in_b = join_find(&b_table, entry->service);
+        long in_base = join_find(&base_table, entry->service);
+        const PasswordEntry *ancestor = in_base >= 0 ? &base->entries[in_base] : NULL;
+
+        if (in_b >= 0) {
+            matched[in_b] = 1;
+            merge_entry(&result->entries[result->count++], entry,
+                        &b->entries[in_b], ancestor, generation, stats);
+        } else if (keep_one_sided(entry, ancestor,
+                                  join_entry(&b_tombstones, entry->service), 0, stats)) {
+            result->entries[result->count++] = *entry;
+        } else {
+            ok = pm_add_tombstone(result, entry->service, generation);
+        }
+    }
+
+    for (size_t i = 0; ok && i < b->count; i++) {
+        if (matched[i]) continue;
+
+        const PasswordEntry *entry = &b->entries[i];
+        long in_base = join_find(&base_table, entry->service);
+        const PasswordEntry *ancestor = in_base >= 0 ? &base->entries[in_base] : NULL;
+
+        if (keep_one_sided(entry, ancestor,
+                           join_entry(&a_tombstones, entry->service), 1, stats)) {
+            result->entries[result->count] = *entry;
+            result->entries[result->count++].generation = generation;
+        }
+    }
+
+    if (ok) {
+        ok = merge_tombstones(result, a, &a_tombstones, &b_tombstones, b,
+                              generation);
+    }
+
+    free(b_table.slots);
+    free(base_table.slots);
+    free(a_tombstones.slots);
+    free(b_tombstones.slots);
+    free(matched);
+
+    if (!ok) {
+        pm_free(result);
+        return NULL;
+    }
+
+    // Written out in full under a's layout, continuing a's generations
+    result->shard_count = a->shard_count;
+    result->dirty_shards = ~0ULL;
+    result->generation = a->generation;
+    if (a->log_floor > result->log_floor) result->log_floor = a->log_floor;
+    result->codec = a->codec;
+    return result;
+}
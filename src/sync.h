@@ -0,0 +1,39 @@
+#ifndef SYNC_H
+#define SYNC_H
+
+#include <stddef.h>
+#include "password.h"
+
+/**
+ * Reconciling replicas of a vault
+ *
+ * Entries are matched by service name with a hash join (one hash table
+ * over each of b and base, probed once per entry of a), so merging is
+ * linear in the number of entries. With a common ancestor (base) every
+ * field is merged three-way: a side that left a field as it was in base
+ * takes the other side's value. Fields changed on both sides, or any
+ * difference when there is no base, go to the newer modification stamp.
+ * An entry deleted on one side survives only if the other side edited
+ * it after base; without a base (or an entry base lacks), only if it was
+ * changed in a later generation than the other side's tombstone. The
+ * result keeps the deletions of both sides.
+ *
+ * The result continues a's generations: whatever a takes from b is
+ * stamped with a's next generation, so a change log exported from a
+ * afterwards carries the merge.
+ */
+
+typedef struct {
+    size_t added;       // Entries taken from b that a did not have
+    size_t removed;     // Entries of a dropped because b deleted them
+    size_t updated;     // Fields of a replaced by b's value
+    size_t conflicts;   // Fields or entries settled by modification stamp
+} MergeStats;
+
+// Merge in-memory vaults a and b; base is their common ancestor or NULL
+// for a two-way merge. Paged stores are not supported.
+// Returns: new password manager holding the result, or NULL on failure
+PasswordManager* sync_merge(const PasswordManager *a, const PasswordManager *b,
+                            const PasswordManager *base, MergeStats *stats);
+
+#endif // SYNC_H
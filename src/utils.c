@@ -147,3 +147,38 @@ void print_password_hidden(const char *password, int show) {
         printf("%s", COLOR_RESET);
     }
 }
+
+#define OUTPUT_BUFFER 65536
+
+long long write_generated_lines(FILE *out, unsigned long long count, size_t max_length,
+                                LineGenerator generate, void *ctx) {
+    if (!out || !generate || max_length >= OUTPUT_BUFFER) return -1;
+    
+    char *output = malloc(OUTPUT_BUFFER);
+    if (!output) return -1;
+    
+    size_t room = max_length + 1;
+    size_t used = 0;
+    unsigned long long written = 0;
+    int ok = 1;
+    
+    while (ok && written < count) {
+        if (OUTPUT_BUFFER - used < room) {
+            ok = fwrite(output, 1, used, out) == used;
+            used = 0;
+            continue;
+        }
+        
+        size_t length = generate(ctx, output + used);
+        ok = length > 0;
+        output[used + length] = '\n';
+        used += length + 1;
+        written++;
+    }
+    if (ok && used > 0) ok = fwrite(output, 1, used, out) == used;
+    if (ok) ok = fflush(out) == 0;
+    
+    memset(output, 0, OUTPUT_BUFFER);
+    free(output);
+    return ok ? (long long)written : -1;
+}
@@ -30,4 +30,16 @@ void trim_whitespace(char *str);
 // Password display (show/hide)
 void print_password_hidden(const char *password, int show);
 
+// Writes one generated line, without its newline, at out
+// Returns: the line's length, 0 on failure
+typedef size_t (*LineGenerator)(void *ctx, char *out);
+
+// Write count lines from generate to out, each at most max_length long.
+// Lines are assembled in one buffer and written a buffer at a time, so
+// the cost per line is a few hundred bytes of copying; the buffer is
+// wiped before it is freed.
+// Returns: lines written, -1 on failure
+long long write_generated_lines(FILE *out, unsigned long long count, size_t max_length,
+                                LineGenerator generate, void *ctx);
+
 #endif // UTILS_H
@@ -0,0 +1,310 @@
+#ifndef _WIN32
+    #define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "wordlist.h"
+#include "file_io.h"
+#include "wordlist_data.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <pthread.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+#define PATH_SIZE 600
+#define NAME_SIZE 128
+
+struct Wordlist {
+    char name[NAME_SIZE];
+    char path[PATH_SIZE];       // Empty for the built-in list
+    const char *text;           // The mapped file, or the built-in blob
+    size_t text_size;
+    uint32_t *start;            // Word -> offset in text
+    uint8_t *length;            // Word -> length
+    uint32_t count;
+    size_t longest;
+    Wordlist *next;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#endif
+};
+
+static Wordlist *cache = NULL;
+
+#ifdef _WIN32
+static SRWLOCK cache_lock = SRWLOCK_INIT;
+
+static void lock_cache(void) {
+    AcquireSRWLockExclusive(&cache_lock);
+}
+
+static void unlock_cache(void) {
+    ReleaseSRWLockExclusive(&cache_lock);
+}
+#else
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void lock_cache(void) {
+    pthread_mutex_lock(&cache_lock);
+}
+
+static void unlock_cache(void) {
+    pthread_mutex_unlock(&cache_lock);
+}
+#endif
+
+static void set_error(char *error, size_t error_size, const char *format, const char *detail) {
+    if (error && error_size > 0) snprintf(error, error_size, format, detail);
+}
+
+// FNV-1a
+static uint32_t hash_word(const char *word, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char)word[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static void unmap_text(Wordlist *list) {
+    if (list->path[0] == '\0') return;     // The built-in blob is not mapped
+#ifdef _WIN32
+    if (list->text) UnmapViewOfFile(list->text);
+    if (list->mapping) CloseHandle(list->mapping);
+    if (list->file != INVALID_HANDLE_VALUE) CloseHandle(list->file);
+#else
+    if (list->text) munmap((void*)list->text, list->text_size);
+#endif
+}
+
+static void free_list(Wordlist *list) {
+    if (!list) return;
+    unmap_text(list);
+    free(list->start);
+    free(list->length);
+    free(list);
+}
+
+static int map_text(Wordlist *list, char *error, size_t error_size) {
+#ifdef _WIN32
+    list->file = CreateFileA(list->path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                             OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    LARGE_INTEGER size;
+    if (list->file == INVALID_HANDLE_VALUE || !GetFileSizeEx(list->file, &size)) {
+        set_error(error, error_size, "cannot open %s", list->path);
+        return 0;
+    }
+    if (size.QuadPart == 0 || (uint64_t)size.QuadPart > UINT32_MAX) {
+        set_error(error, error_size, "%s is empty or over 4 GB", list->path);
+        return 0;
+    }
+    list->mapping = CreateFileMappingA(list->file, NULL, PAGE_READONLY, 0, 0, NULL);
+    list->text = list->mapping ? MapViewOfFile(list->mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+    list->text_size = (size_t)size.QuadPart;
+#else
+    int fd = open(list->path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) close(fd);
+        set_error(error, error_size, "cannot open %s", list->path);
+        return 0;
+    }
+    if (st.st_size <= 0 || (uint64_t)st.st_size > UINT32_MAX) {
+        close(fd);
+        set_error(error, error_size, "%s is empty or over 4 GB", list->path);
+        return 0;
+    }
+
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    list->text = map == MAP_FAILED ? NULL : map;
+    list->text_size = (size_t)st.st_size;
+#endif
+
+    if (!list->text) {
+        set_error(error, error_size, "cannot map %s", list->path);
+        return 0;
+    }
+    return 1;
+}
+
+// One pass over the text: find each line's word, drop repeats through a
+// hash table of word indexes, and record where the word is
+static int index_text(Wordlist *list, char *error, size_t error_size) {
+    const char *text = list->text;
+    const char *end = text + list->text_size;
+
+#ifndef _WIN32
+    posix_madvise((void*)text, list->text_size, POSIX_MADV_SEQUENTIAL);
+#endif
+
+    size_t lines = 1;
+    for (const char *p = text; (p = memchr(p, '\n', (size_t)(end - p))) != NULL; p++) lines++;
+
+    size_t slots = 16;
+    while (slots < lines * 2) slots *= 2;
+    uint32_t *table = calloc(slots, sizeof(uint32_t));   // Word index + 1; 0 = empty
+    list->start = malloc(lines * sizeof(uint32_t));
+    list->length = malloc(lines);
+    if (!table || !list->start || !list->length) {
+        free(table);
+        set_error(error, error_size, "out of memory indexing %s", list->path);
+        return 0;
+    }
+
+    const char *line = text;
+    while (line < end) {
+        const char *eol = memchr(line, '\n', (size_t)(end - line));
+        if (!eol) eol = end;
+        const char *word = line;
+        const char *stop = eol;
+        line = eol + 1;
+
+        while (stop > word && (stop[-1] == '\r' || stop[-1] == ' ' || stop[-1] == '\t')) stop--;
+
+        // "16655<TAB>word"
+        const char *digits = word;
+        while (digits < stop && *digits >= '0' && *digits <= '9') digits++;
+        if (digits > word && digits < stop && (*digits == '\t' || *digits == ' ')) {
+            word = digits;
+            while (word < stop && (*word == '\t' || *word == ' ')) word++;
+        }
+
+        size_t length = (size_t)(stop - word);
+        if (length == 0 || length > WORDLIST_MAX_WORD || *word == '#') continue;
+
+        size_t slot = hash_word(word, length) & (slots - 1);
+        int repeat = 0;
+        while (table[slot] != 0) {
+            uint32_t other = table[slot] - 1;
+            if (list->length[other] == length && memcmp(text + list->start[other], word, length) == 0) {
+                repeat = 1;
+                break;
+            }
+            slot = (slot + 1) & (slots - 1);
+        }
+        if (repeat) continue;
+
+        list->start[list->count] = (uint32_t)(word - text);
+        list->length[list->count] = (uint8_t)length;
+        table[slot] = ++list->count;
+        if (length > list->longest) list->longest = length;
+    }
+    free(table);
+
+#ifndef _WIN32
+    posix_madvise((void*)text, list->text_size, POSIX_MADV_RANDOM);
+#endif
+
+    if (list->count < 2) {
+        set_error(error, error_size, "%s has fewer than 2 distinct words", list->path);
+        return 0;
+    }
+    return 1;
+}
+
+static int index_builtin(Wordlist *list, char *error, size_t error_size) {
+    list->text = wordlist_blob;
+    list->text_size = wordlist_offsets[WORDLIST_WORDS];
+    list->start = malloc(WORDLIST_WORDS * sizeof(uint32_t));
+    list->length = malloc(WORDLIST_WORDS);
+    if (!list->start || !list->length) {
+        set_error(error, error_size, "out of memory indexing %s", WORDLIST_BUILTIN);
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < WORDLIST_WORDS; i++) {
+        list->start[i] = wordlist_offsets[i];
+        list->length[i] = (uint8_t)(wordlist_offsets[i + 1] - wordlist_offsets[i] - 1);
+        if (list->length[i] > list->longest) list->longest = list->length[i];
+    }
+    list->count = WORDLIST_WORDS;
+    return 1;
+}
+
+const Wordlist* wordlist_get(const char *name, char *error, size_t error_size) {
+    if (!name) name = WORDLIST_BUILTIN;
+
+    char path[PATH_SIZE] = "";
+    if (strchr(name, '/')) {
+        snprintf(path, sizeof(path), "%s", name);
+    } else if (strcmp(name, WORDLIST_BUILTIN) != 0) {
+        snprintf(path, sizeof(path), "%s/%s/%s.txt", get_data_dir(), WORDLIST_DIR_NAME, name);
+    }
+
+    lock_cache();
+    Wordlist *list = cache;
+    while (list && strcmp(list->path, path) != 0) list = list->next;
+    if (list) {
+        unlock_cache();
+        return list;
+    }
+
+    list = calloc(1, sizeof(Wordlist));
+    if (!list) {
+        unlock_cache();
+        set_error(error, error_size, "out of memory loading %s", name);
+        return NULL;
+    }
+    snprintf(list->name, sizeof(list->name), "%s", name);
+    snprintf(list->path, sizeof(list->path), "%s", path);
+#ifdef _WIN32
+    list->file = INVALID_HANDLE_VALUE;
+#endif
+
+    int ok = path[0] == '\0' ? index_builtin(list, error, error_size)
+                             : map_text(list, error, error_size) && index_text(list, error, error_size);
+    if (!ok) {
+        free_list(list);
+        unlock_cache();
+        return NULL;
+    }
+
+    list->next = cache;
+    cache = list;
+    unlock_cache();
+    return list;
+}
+
+const char* wordlist_name(const Wordlist *list) {
+    return list ? list->name : "";
+}
+
+uint32_t wordlist_size(const Wordlist *list) {
+    return list ? list->count : 0;
+}
+
+size_t wordlist_longest(const Wordlist *list) {
+    return list ? list->longest : 0;
+}
+
+const char* wordlist_word(const Wordlist *list, uint32_t index, size_t *length) {
+    if (!list || index >= list->count) return NULL;
+    if (length) *length = list->length[index];
+    return list->text + list->start[index];
+}
+
+double wordlist_entropy_bits(const Wordlist *list, int words) {
+    if (!list || words <= 0) return 0.0;
+    return words * log2((double)list->count);
+}
+
+void wordlist_cleanup(void) {
+    lock_cache();
+    while (cache) {
+        Wordlist *next = cache->next;
+        free_list(cache);
+        cache = next;
+    }
+    unlock_cache();
+}
@@ -0,0 +1,53 @@
+#ifndef WORDLIST_H
+#define WORDLIST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Passphrase wordlists
+ *
+ * Besides the built-in EFF list ("eff"), any text file of one word per
+ * line can serve as a wordlist: a diceware-style "<digits><TAB>word" line
+ * counts as its word, and blank lines and lines starting with '#' are
+ * skipped. A list is named by a path (anything with a '/') or by a name
+ * looked up as WORDLIST_DIR_NAME/<name>.txt in the data directory.
+ *
+ * A file is mapped, not read, and indexed once into a table of word
+ * offsets and lengths; repeated words count once, so a list's size, and
+ * with it the entropy of a passphrase, is its number of distinct words.
+ * Loaded lists are cached for the life of the process and are read-only,
+ * so any thread may use them.
+ */
+
+#define WORDLIST_BUILTIN "eff"
+#define WORDLIST_DIR_NAME "wordlists"
+#define WORDLIST_MAX_WORD 64        // Longer lines are skipped
+
+typedef struct Wordlist Wordlist;
+
+// Load (or find in the cache) the list named name; NULL means the
+// built-in list. On failure, error (if given) says why.
+// Returns: the list, owned by the cache, or NULL
+const Wordlist* wordlist_get(const char *name, char *error, size_t error_size);
+
+// Name the list was first requested by
+const char* wordlist_name(const Wordlist *list);
+
+// Number of distinct words
+uint32_t wordlist_size(const Wordlist *list);
+
+// Length of the longest word
+size_t wordlist_longest(const Wordlist *list);
+
+// Word at index (below wordlist_size()), NOT NUL-terminated; length
+// receives its length
+const char* wordlist_word(const Wordlist *list, uint32_t index, size_t *length);
+
+// Entropy of a passphrase of words words chosen uniformly from the list
+double wordlist_entropy_bits(const Wordlist *list, int words);
+
+// Unmap every cached list; earlier results must no longer be used
+void wordlist_cleanup(void);
+
+#endif // WORDLIST_H
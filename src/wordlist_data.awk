@@ -0,0 +1,58 @@
+# Turn the EFF large wordlist ("11111<TAB>abacus" lines) into the packed
+# C table declared in wordlist_data.h. Fails unless the list holds exactly
+# the 7776 dice rolls in order and fits 16-bit offsets.
+BEGIN {
+    FS = "\t"
+    words = 0
+    size = 0
+    print "/* Generated from the EFF wordlist by wordlist_data.awk; do not edit */"
+    print "#include \"../src/wordlist_data.h\""
+    print ""
+    print "const char wordlist_blob[] ="
+}
+
+{
+    sub(/\r$/, "")
+    if ($0 == "") next
+
+    # Dice roll of word number `words`: its base-6 digits, each plus one
+    roll = ""
+    n = words
+    for (i = 0; i < 5; i++) {
+        roll = (n % 6 + 1) roll
+        n = int(n / 6)
+    }
+    if (NF != 2 || $1 != roll || $2 == "") {
+        printf "%s:%d: expected \"%s<TAB>word\"\n", FILENAME, NR, roll > "/dev/stderr"
+        failed = 1
+        exit 1
+    }
+
+    word = $2
+    gsub(/\\/, "\\\\", word)
+    gsub(/"/, "\\\"", word)
+    printf "    \"%s\\0\"\n", word
+
+    offset[words++] = size
+    size += length($2) + 1
+}
+
+END {
+    if (failed) exit 1
+    if (words != 7776 || size > 65535) {
+        printf "%s: expected 7776 words in under 64 KB, got %d in %d bytes\n",
+               FILENAME, words, size > "/dev/stderr"
+        exit 1
+    }
+    offset[words] = size
+
+    print "    ;"
+    print ""
+    print "const uint16_t wordlist_offsets[WORDLIST_WORDS + 1] = {"
+    for (i = 0; i <= words; i += 12) {
+        line = "   "
+        for (j = i; j < i + 12 && j <= words; j++) line = line " " offset[j] ","
+        print line
+    }
+    print "};"
+}
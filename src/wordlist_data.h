@@ -0,0 +1,23 @@
+#ifndef WORDLIST_DATA_H
+#define WORDLIST_DATA_H
+
+#include <stdint.h>
+
+/**
+ * The EFF large wordlist, compiled into the binary
+ *
+ * The build generates the table from data/eff_large_wordlist.txt with
+ * wordlist_data.awk: every word NUL-terminated in one blob, and the blob
+ * offset of each word plus one past the last. Word i starts at
+ * wordlist_offsets[i] and is wordlist_offsets[i + 1] - wordlist_offsets[i]
+ * - 1 characters long. The build also checks the list is in dice order
+ * (11111, 11112, ... 66666), so word i belongs to the roll that spells i
+ * in base 6 with digits 1 to 6.
+ */
+
+#define WORDLIST_WORDS 7776
+
+extern const char wordlist_blob[];
+extern const uint16_t wordlist_offsets[WORDLIST_WORDS + 1];
+
+#endif // WORDLIST_DATA_H
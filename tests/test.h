@@ -0,0 +1,61 @@
+#ifndef TEST_H
+#define TEST_H
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * Helpers shared by the unit tests
+ *
+ * Every test is a program of its own, run by `make test`: CHECK records
+ * a failure and carries on, and test_finish() turns the tally into the
+ * exit status. The statistical checks compare a chi-square statistic
+ * against the value it exceeds with probability about one in a million,
+ * so a correct generator fails them only by extraordinary bad luck.
+ */
+
+static int test_failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            test_failures++; \
+        } \
+    } while (0)
+
+// Pearson chi-square of counts over bins that should be equally likely
+static inline double chi_square_uniform(const uint64_t *counts, size_t bins) {
+    uint64_t total = 0;
+    for (size_t i = 0; i < bins; i++) total += counts[i];
+
+    double expected = (double)total / (double)bins;
+    double chi = 0.0;
+    for (size_t i = 0; i < bins; i++) {
+        double d = (double)counts[i] - expected;
+        chi += d * d / expected;
+    }
+    return chi;
+}
+
+// Upper 1e-6 point of the chi-square distribution with df degrees of
+// freedom (Wilson-Hilferty approximation)
+static inline double chi_square_limit(double df) {
+    const double z = 4.753;
+    double a = 2.0 / (9.0 * df);
+    double t = 1.0 - a + z * sqrt(a);
+    return df * t * t * t;
+}
+
+static inline int test_finish(const char *name) {
+    if (test_failures) {
+        printf("[FAIL] %s: %d check(s) failed\n", name, test_failures);
+        return 1;
+    }
+    printf("[PASS] %s\n", name);
+    return 0;
+}
+
+#endif // TEST_H
@@ -0,0 +1,200 @@
+#ifndef _WIN32
+    #define _POSIX_C_SOURCE 200809L
+#endif
+
+// Built from the source to reach the manifest and chunk file names
+#include "../src/backup.c"
+#include "test.h"
+#include <dirent.h>
+
+#define ENTRIES 1000
+
+static void service_name(char *buffer, int i) {
+    snprintf(buffer, MAX_SERVICE_NAME, "service-%04d", i);
+}
+
+// Remove path and everything under it
+static void remove_tree(const char *path) {
+    DIR *dir = opendir(path);
+    if (!dir) {
+        remove(path);
+        return;
+    }
+
+    struct dirent *item;
+    char child[PATH_SIZE];
+    while ((item = readdir(dir)) != NULL) {
+        if (strcmp(item->d_name, ".") == 0 || strcmp(item->d_name, "..") == 0) continue;
+        snprintf(child, sizeof(child), "%s/%s", path, item->d_name);
+        remove_tree(child);
+    }
+    closedir(dir);
+    rmdir(path);
+}
+
+static int chunk_present(const ChunkId id) {
+    char path[PATH_SIZE];
+    chunk_path(id, path, sizeof(path), 0);
+    return file_present(path);
+}
+
+// A snapshot after one edit writes only the chunk holding that record;
+// one after a delete adds the chunk it left and a chunk of tombstones
+static void test_dedup(PasswordManager *pm, BackupSnapshot *first,
+                       BackupSnapshot *last) {
+    BackupSnapshot snapshot;
+    BackupStats stats;
+    char service[MAX_SERVICE_NAME];
+
+    CHECK(backup_create(pm, "master", first, &stats) == 1);
+    CHECK(stats.chunks > 4 && stats.new_chunks == stats.chunks);
+    CHECK(first->entry_count == ENTRIES);
+    CHECK(backup_create(pm, "wrong", &snapshot, &stats) == -1);
+
+    CHECK(backup_create(pm, "master", &snapshot, &stats) == 1);
+    CHECK(stats.new_chunks == 0 && stats.bytes_written == 0);
+
+    service_name(service, 500);
+    CHECK(pm_update_entry(pm, service, NULL, "changed"));
+    CHECK(backup_create(pm, "master", &snapshot, &stats) == 1);
+    CHECK(stats.new_chunks == 1);
+
+    service_name(service, 10);
+    CHECK(pm_delete_entry(pm, service));
+    pm->generation = 7;
+    CHECK(backup_create(pm, "master", last, &stats) == 1);
+    CHECK(stats.new_chunks == 2);
+    CHECK(last->entry_count == ENTRIES - 1 && last->generation == 7);
+
+    size_t count = 0;
+    BackupSnapshot *listed = backup_list(&count);
+    CHECK(listed && count == 4);
+    CHECK(listed && listed[0].id == first->id && listed[3].id == last->id);
+    free(listed);
+}
+
+// Each snapshot restores to the vault as it was, tombstones included
+static void test_restore(const BackupSnapshot *first, const BackupSnapshot *last) {
+    char service[MAX_SERVICE_NAME];
+    int status;
+
+    PasswordManager *restored = backup_restore(first->id, "master", &status);
+    CHECK(status == 1 && restored && restored->count == ENTRIES);
+    CHECK(restored && restored->tombstone_count == 0);
+    pm_free(restored);
+
+    restored = backup_restore(last->id, "master", &status);
+    CHECK(status == 1 && restored && restored->count == ENTRIES - 1);
+    if (restored) {
+        service_name(service, 500);
+        PasswordEntry *changed = pm_find_entry(restored, service);
+        CHECK(changed && strcmp(changed->password, "changed") == 0);
+        service_name(service, 10);
+        CHECK(pm_find_entry(restored, service) == NULL);
+        CHECK(restored->tombstone_count == 1 &&
+              strcmp(restored->tombstones[0].service, service) == 0);
+        CHECK(restored->generation == 7);
+        pm_free(restored);
+    }
+
+    CHECK(backup_restore(last->id, "wrong", &status) == NULL && status == -1);
+    CHECK(backup_restore(last->id + 100, "master", &status) == NULL && status == 0);
+}
+
+// Pruning refuses to run past a damaged manifest, then drops every
+// snapshot the policy does not keep and the chunks only they used
+static void test_prune(const BackupSnapshot *first, const BackupSnapshot *last) {
+    BackupPolicy policy = {0, 0, 0};
+    ManifestHeader manifest;
+    BackupKeys keys;
+    CatalogHeader catalog;
+    BackupSnapshot *listed = NULL;
+    size_t removed = 0;
+
+    CHECK(open_store("master", &catalog, &listed, &keys) == 1);
+    free(listed);
+    ChunkId *first_ids = read_manifest(first->id, &manifest, &keys);
+    ChunkId *last_ids = read_manifest(last->id, &manifest, &keys);
+    memset(&keys, 0, sizeof(keys));
+    CHECK(first_ids && last_ids);
+    if (!first_ids || !last_ids) {
+        free(first_ids);
+        free(last_ids);
+        return;
+    }
+
+    // A manifest cut short by a crash must not be taken for a whole one
+    char path[PATH_SIZE];
+    char saved_path[PATH_SIZE + 8];
+    manifest_path(first->id, path, sizeof(path));
+    snprintf(saved_path, sizeof(saved_path), "%s.saved", path);
+    CHECK(rename(path, saved_path) == 0);
+    FILE *file = fopen(path, "wb");
+    CHECK(file != NULL);
+    if (file) {
+        CHECK(fwrite(MANIFEST_MAGIC, 1, 8, file) == 8);
+        fclose(file);
+    }
+    CHECK(backup_prune(&policy, "master", &removed) == -1);
+    CHECK(rename(saved_path, path) == 0);
+
+    size_t count = 0;
+    BackupSnapshot *before = backup_list(&count);
+    CHECK(count == 4);
+    free(before);
+
+    CHECK(backup_prune(&policy, "wrong", &removed) == -2);
+    CHECK(backup_prune(&policy, "master", &removed) == 3);
+    CHECK(removed > 0);
+
+    BackupSnapshot *after = backup_list(&count);
+    CHECK(after && count == 1 && after[0].id == last->id);
+    free(after);
+
+    // The kept snapshot's chunks stay; the first one's edited chunk goes
+    size_t gone = 0;
+    for (uint32_t i = 0; i < last->chunk_count; i++) {
+        CHECK(chunk_present(last_ids[i]));
+    }
+    for (uint32_t i = 0; i < first->chunk_count; i++) {
+        if (!chunk_present(first_ids[i])) gone++;
+    }
+    CHECK(gone == removed);
+    CHECK(!file_present(path));
+
+    int status;
+    PasswordManager *restored = backup_restore(last->id, "master", &status);
+    CHECK(status == 1 && restored && restored->count == ENTRIES - 1);
+    pm_free(restored);
+
+    free(first_ids);
+    free(last_ids);
+}
+
+int main(void) {
+    char dir[] = "/tmp/test_backup.XXXXXX";
+    if (!crypto_init() || !mkdtemp(dir) || setenv("HOME", dir, 1) != 0 ||
+        !file_init()) {
+        perror("setup");
+        return 1;
+    }
+
+    PasswordManager *pm = pm_init();
+    CHECK(pm != NULL);
+    if (!pm) return test_finish("backup");
+
+    char service[MAX_SERVICE_NAME];
+    for (int i = 0; i < ENTRIES; i++) {
+        service_name(service, i);
+        CHECK(pm_add_entry(pm, service, "user", "password"));
+    }
+
+    BackupSnapshot first, last;
+    test_dedup(pm, &first, &last);
+    test_restore(&first, &last);
+    test_prune(&first, &last);
+
+    pm_free(pm);
+    remove_tree(dir);
+    return test_finish("backup");
+}
@@ -0,0 +1,116 @@
+#ifndef _WIN32
+    #define _POSIX_C_SOURCE 200809L
+#endif
+
+// Built from the source to reach the on-disk header and slot layout
+#include "../src/blind_index.c"
+#include "test.h"
+#include <unistd.h>
+
+#define ENTRIES 300
+#define GENERATION 7
+
+static char index_path[64];
+static unsigned char vault_key[KEY_SIZE];
+static unsigned char vault_iv[IV_SIZE];
+
+static int64_t find(const char *service) {
+    return blind_index_find(index_path, vault_key, vault_iv, GENERATION,
+                            ENTRIES, service, NULL);
+}
+
+// Records are numbered in vault order; lookups ignore case, and a
+// service that was never saved is a verified miss
+static void test_lookup(void) {
+    char service[MAX_SERVICE_NAME];
+
+    for (int i = 0; i < ENTRIES; i++) {
+        snprintf(service, sizeof(service), "Service%03d", i);
+        CHECK(find(service) == i);
+    }
+    CHECK(find("SERVICE042") == 42);
+    CHECK(find("absent") == -1);
+    CHECK(find("Service") == -1);
+    CHECK(find("Service9999") == -1);
+    CHECK(find("") == -1);
+
+    // An index for another payload or entry count is stale
+    unsigned char other_iv[IV_SIZE];
+    memcpy(other_iv, vault_iv, IV_SIZE);
+    other_iv[0] ^= 1;
+    CHECK(blind_index_find(index_path, vault_key, other_iv, GENERATION, ENTRIES,
+                           "Service001", NULL) == -2);
+    CHECK(blind_index_find(index_path, vault_key, vault_iv, GENERATION + 1, ENTRIES,
+                           "Service001", NULL) == -2);
+    CHECK(blind_index_find(index_path, vault_key, vault_iv, GENERATION, ENTRIES + 1,
+                           "Service001", NULL) == -2);
+}
+
+// Overwrite one slot with its right neighbour: every lookup the damaged
+// slot could decide must now fail to verify instead of claiming a miss
+static void test_tampering(void) {
+    FILE *file = fopen(index_path, "r+b");
+    CHECK(file != NULL);
+    if (!file) return;
+
+    int missing = 0;
+    for (int victim = 0; victim < ENTRIES - 1; victim += 37) {
+        IndexSlot slot, saved;
+        long offset = (long)(sizeof(IndexHeader) + victim * sizeof(IndexSlot));
+
+        CHECK(read_slot(file, (uint64_t)victim + 1, &slot));
+        CHECK(read_slot(file, (uint64_t)victim, &saved));
+        fseek(file, offset, SEEK_SET);
+        CHECK(fwrite(&slot, sizeof(slot), 1, file) == 1);
+        fflush(file);
+
+        // Which service sat in the slot is hidden by its token; none may
+        // be reported absent
+        for (int i = 0; i < ENTRIES; i++) {
+            char service[MAX_SERVICE_NAME];
+            snprintf(service, sizeof(service), "Service%03d", i);
+            int64_t record = find(service);
+            if (record == -1) missing++;
+            CHECK(record == -2 || record == i);
+        }
+
+        fseek(file, offset, SEEK_SET);
+        CHECK(fwrite(&saved, sizeof(saved), 1, file) == 1);
+        fflush(file);
+    }
+    CHECK(missing == 0);
+    fclose(file);
+
+    CHECK(find("Service123") == 123);
+}
+
+int main(void) {
+    char dir[] = "/tmp/test_blind_index.XXXXXX";
+    if (!crypto_init() || !mkdtemp(dir)) {
+        perror("setup");
+        return 1;
+    }
+    snprintf(index_path, sizeof(index_path), "%s/vault.dat.idx", dir);
+
+    PasswordManager *pm = pm_init();
+    CHECK(pm != NULL);
+    if (!pm) return test_finish("blind_index");
+
+    char service[MAX_SERVICE_NAME];
+    for (int i = 0; i < ENTRIES; i++) {
+        snprintf(service, sizeof(service), "Service%03d", i);
+        CHECK(pm_add_entry(pm, service, "user", "password"));
+    }
+    CHECK(generate_random_bytes(vault_key, sizeof(vault_key)));
+    CHECK(generate_random_bytes(vault_iv, sizeof(vault_iv)));
+    CHECK(blind_index_write(index_path, pm, 0, 0, vault_key, vault_iv, GENERATION,
+                            NULL, 0));
+
+    test_lookup();
+    test_tampering();
+
+    pm_free(pm);
+    remove(index_path);
+    rmdir(dir);
+    return test_finish("blind_index");
+}
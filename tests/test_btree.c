@@ -0,0 +1,192 @@
+#ifndef _WIN32
+    #define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "../src/btree.h"
+#include "../src/pager.h"
+#include "test.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define ENTRIES 2000
+
+static char store_path[64];
+
+static void make_entry(PasswordEntry *entry, int i, const char *password) {
+    memset(entry, 0, sizeof(*entry));
+    snprintf(entry->service, sizeof(entry->service), "service-%05d", i);
+    snprintf(entry->username, sizeof(entry->username), "user%d", i);
+    snprintf(entry->password, sizeof(entry->password), "%s", password);
+}
+
+static int count_visit(const PasswordEntry *entry, void *ctx) {
+    (void)entry;
+    (*(size_t*)ctx)++;
+    return 1;
+}
+
+// Enough entries to split leaves and internal pages; every third one is
+// deleted and every fifth updated, and all of it must survive a reopen
+static void test_round_trip(void) {
+    BTree *tree = btree_create(store_path, "master");
+    CHECK(tree != NULL);
+    if (!tree) return;
+
+    PasswordEntry entry;
+    for (int i = 0; i < ENTRIES; i++) {
+        make_entry(&entry, i, "first");
+        CHECK(btree_insert(tree, &entry));
+    }
+    CHECK(!btree_insert(tree, &entry));
+
+    for (int i = 0; i < ENTRIES; i += 3) {
+        snprintf(entry.service, sizeof(entry.service), "SERVICE-%05d", i);
+        CHECK(btree_delete(tree, entry.service));
+    }
+    CHECK(!btree_delete(tree, "service-00000"));
+    for (int i = 1; i < ENTRIES; i += 5) {
+        snprintf(entry.service, sizeof(entry.service), "service-%05d", i);
+        if (i % 3 != 0) CHECK(btree_update(tree, entry.service, NULL, "second"));
+    }
+    CHECK(btree_close(tree));
+
+    tree = btree_open(store_path, "wrong");
+    CHECK(tree == NULL);
+    if (tree) btree_close(tree);
+
+    tree = btree_open(store_path, "master");
+    CHECK(tree != NULL);
+    if (!tree) return;
+
+    size_t deleted = (ENTRIES + 2) / 3;
+    CHECK(btree_count(tree) == ENTRIES - deleted);
+    CHECK(btree_tombstone_count(tree) == deleted);
+
+    size_t visited = 0;
+    CHECK(btree_foreach(tree, count_visit, &visited));
+    CHECK(visited == ENTRIES - deleted);
+
+    for (int i = 0; i < ENTRIES; i++) {
+        char service[MAX_SERVICE_NAME];
+        snprintf(service, sizeof(service), "service-%05d", i);
+        int found = btree_get(tree, service, &entry);
+        if (i % 3 == 0) {
+            CHECK(!found);
+        } else {
+            CHECK(found);
+            if (found) {
+                CHECK(strcmp(entry.password, i % 5 == 1 ? "second" : "first") == 0);
+            }
+        }
+    }
+    CHECK(btree_close(tree));
+}
+
+static void test_rekey(void) {
+    BTree *tree = btree_open(store_path, "master");
+    CHECK(tree != NULL);
+    if (!tree) return;
+    CHECK(btree_rekey(tree, "changed"));
+    CHECK(btree_close(tree));
+
+    tree = btree_open(store_path, "master");
+    CHECK(tree == NULL);
+    if (tree) btree_close(tree);
+
+    tree = btree_open(store_path, "changed");
+    CHECK(tree != NULL);
+    if (!tree) return;
+
+    PasswordEntry entry;
+    CHECK(btree_get(tree, "service-00002", &entry));
+    CHECK(!btree_get(tree, "service-00003", &entry));
+
+    // Commits after a rekey use the other table chain
+    make_entry(&entry, ENTRIES, "after");
+    CHECK(btree_insert(tree, &entry));
+    CHECK(btree_close(tree));
+
+    tree = btree_open(store_path, "changed");
+    CHECK(tree != NULL);
+    if (!tree) return;
+    CHECK(btree_get(tree, entry.service, &entry));
+    CHECK(btree_close(tree));
+}
+
+static int read_raw_page(uint32_t pgno, unsigned char *raw) {
+    FILE *file = fopen(store_path, "rb");
+    if (!file) return 0;
+    int ok = fseek(file, (long)pgno * PAGE_SIZE, SEEK_SET) == 0 &&
+             fread(raw, 1, PAGE_SIZE, file) == PAGE_SIZE;
+    fclose(file);
+    return ok;
+}
+
+static int write_raw_page(uint32_t pgno, const unsigned char *raw) {
+    FILE *file = fopen(store_path, "r+b");
+    if (!file) return 0;
+    int ok = fseek(file, (long)pgno * PAGE_SIZE, SEEK_SET) == 0 &&
+             fwrite(raw, 1, PAGE_SIZE, file) == PAGE_SIZE;
+    if (fclose(file) != 0) ok = 0;
+    return ok;
+}
+
+// An old copy of a page is validly sealed under the page key, but once
+// the page has been rewritten it must no longer verify
+static void test_replay(void) {
+    BTree *tree = btree_create(store_path, "master");
+    CHECK(tree != NULL);
+    if (!tree) return;
+
+    PasswordEntry entry;
+    make_entry(&entry, 1, "old");
+    CHECK(btree_insert(tree, &entry));
+    CHECK(btree_close(tree));
+
+    // The first page allocated is the root leaf
+    unsigned char old_page[PAGE_SIZE];
+    unsigned char new_page[PAGE_SIZE];
+    CHECK(read_raw_page(1, old_page));
+
+    tree = btree_open(store_path, "master");
+    CHECK(tree != NULL);
+    if (!tree) return;
+    CHECK(btree_update(tree, entry.service, NULL, "new"));
+    CHECK(btree_close(tree));
+
+    CHECK(read_raw_page(1, new_page));
+    CHECK(memcmp(old_page, new_page, PAGE_SIZE) != 0);
+    CHECK(write_raw_page(1, old_page));
+
+    tree = btree_open(store_path, "master");
+    CHECK(tree != NULL);
+    if (!tree) return;
+    CHECK(!btree_get(tree, entry.service, &entry));
+    btree_close(tree);
+
+    CHECK(write_raw_page(1, new_page));
+    tree = btree_open(store_path, "master");
+    CHECK(tree != NULL);
+    if (!tree) return;
+    CHECK(btree_get(tree, entry.service, &entry));
+    CHECK(strcmp(entry.password, "new") == 0);
+    CHECK(btree_close(tree));
+}
+
+int main(void) {
+    char dir[] = "/tmp/test_btree.XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    snprintf(store_path, sizeof(store_path), "%s/store.db", dir);
+
+    test_round_trip();
+    test_rekey();
+    test_replay();
+
+    remove(store_path);
+    rmdir(dir);
+    return test_finish("btree");
+}
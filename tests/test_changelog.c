@@ -0,0 +1,189 @@
+#ifndef _WIN32
+    #define _POSIX_C_SOURCE 200809L
+#endif
+
+// Built from the source to reach the log header and change encoding
+#include "../src/changelog.c"
+#include "test.h"
+#include <unistd.h>
+
+#define ENTRIES 50
+
+static char log_path[64];
+
+static PasswordManager* make_replica(void) {
+    PasswordManager *pm = pm_init();
+    char service[MAX_SERVICE_NAME];
+
+    if (!pm) return NULL;
+    for (int i = 0; i < ENTRIES; i++) {
+        snprintf(service, sizeof(service), "service-%02d", i);
+        CHECK(pm_add_entry(pm, service, "user", "password"));
+    }
+    pm->generation = 1;
+    return pm;
+}
+
+// Seal body under a log header and write it to log_path
+static int write_log(const LogBuffer *body, uint32_t change_count,
+                     uint64_t from, uint64_t to) {
+    LogHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CHANGELOG_MAGIC, sizeof(header.magic));
+    header.version = CHANGELOG_VERSION;
+    header.change_count = change_count;
+    header.from_generation = from;
+    header.to_generation = to;
+    header.body_len = body->len;
+
+    unsigned char key[KEY_SIZE];
+    unsigned char sealed[4096];
+    int ok = body->len <= sizeof(sealed) &&
+             generate_random_bytes(header.salt, SALT_SIZE) &&
+             generate_random_bytes(header.nonce, AEAD_NONCE_SIZE) &&
+             derive_log_key("master", header.salt, key) &&
+             aead_encrypt(key, header.nonce, (const unsigned char*)&header,
+                          LOG_AAD_SIZE, body->data, body->len, sealed, header.tag);
+
+    FILE *file = ok ? fopen(log_path, "wb") : NULL;
+    if (!file) return 0;
+    ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+         fwrite(sealed, 1, body->len, file) == body->len;
+    if (fclose(file) != 0) ok = 0;
+    return ok;
+}
+
+// A replica at the log's base catches up to the exporter
+static void test_round_trip(void) {
+    PasswordManager *source = make_replica();
+    PasswordManager *replica = make_replica();
+    size_t conflicts = 0;
+    if (!source || !replica) return;
+
+    CHECK(pm_update_entry(source, "service-03", NULL, "changed"));
+    CHECK(pm_delete_entry(source, "service-07"));
+    CHECK(pm_add_entry(source, "new", "someone", "secret"));
+    source->generation = 2;
+
+    CHECK(changelog_export(source, 1, "master", log_path) == 3);
+    CHECK(changelog_apply(replica, "wrong", log_path, &conflicts) == -1);
+    CHECK(replica->generation == 1);
+
+    CHECK(changelog_apply(replica, "master", log_path, &conflicts) == 3);
+    CHECK(conflicts == 0);
+    CHECK(replica->generation == 1);
+    CHECK(replica->count == ENTRIES);
+    CHECK(pm_find_entry(replica, "service-07") == NULL);
+    CHECK(pm_find_entry(replica, "new") != NULL);
+    PasswordEntry *changed = pm_find_entry(replica, "service-03");
+    CHECK(changed && strcmp(changed->password, "changed") == 0);
+    CHECK(find_tombstone(replica, "service-07") != NULL);
+
+    // Applied again, nothing is new
+    CHECK(changelog_apply(replica, "master", log_path, &conflicts) == 0);
+
+    // A log that starts after the replica's generation leaves a gap
+    source->generation = 5;
+    CHECK(changelog_export(source, 4, "master", log_path) == 0);
+    CHECK(changelog_apply(replica, "master", log_path, &conflicts) == -2);
+
+    pm_free(source);
+    pm_free(replica);
+}
+
+// A log whose body is authentic but fails to decode halfway must not
+// leave the changes before the failure, or the new generation, behind
+static void test_partial_failure(void) {
+    PasswordManager *replica = make_replica();
+    size_t conflicts = 0;
+    if (!replica) return;
+
+    PasswordEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    snprintf(entry.service, sizeof(entry.service), "service-01");
+    snprintf(entry.password, sizeof(entry.password), "from-log");
+    entry.password_modified = 50;
+    entry.generation = 3;
+
+    LogBuffer body = {0};
+    CHECK(encode_put(&body, &entry));
+    snprintf(entry.service, sizeof(entry.service), "service-02");
+    CHECK(encode_delete(&body, &entry));
+    CHECK(buffer_reserve(&body, 1));
+    body.data[body.len++] = 0x7f;
+
+    CHECK(write_log(&body, 3, 1, 4));
+    CHECK(changelog_apply(replica, "master", log_path, &conflicts) == -1);
+    CHECK(replica->generation == 1);
+    CHECK(replica->count == ENTRIES);
+    CHECK(replica->tombstone_count == 0);
+    PasswordEntry *kept = pm_find_entry(replica, "service-01");
+    CHECK(kept && strcmp(kept->password, "password") == 0);
+
+    // The same two changes without the bad one apply
+    body.len--;
+    CHECK(write_log(&body, 2, 1, 4));
+    CHECK(changelog_apply(replica, "master", log_path, &conflicts) == 2);
+    CHECK(replica->generation == 3);
+    CHECK(replica->count == ENTRIES - 1);
+    kept = pm_find_entry(replica, "service-01");
+    CHECK(kept && strcmp(kept->password, "from-log") == 0);
+
+    buffer_free(&body);
+    pm_free(replica);
+}
+
+// Lengths in the header are checked against the file before anything is
+// allocated from them
+static void test_bounds(void) {
+    PasswordManager *replica = make_replica();
+    size_t conflicts = 0;
+    if (!replica) return;
+
+    LogHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CHANGELOG_MAGIC, sizeof(header.magic));
+    header.version = CHANGELOG_VERSION;
+    header.change_count = UINT32_MAX;
+    header.from_generation = 1;
+    header.to_generation = 2;
+    header.body_len = (uint64_t)UINT32_MAX * 8;
+
+    FILE *file = fopen(log_path, "wb");
+    CHECK(file != NULL);
+    if (file) {
+        CHECK(fwrite(&header, sizeof(header), 1, file) == 1);
+        CHECK(fwrite("short", 1, 5, file) == 5);
+        fclose(file);
+    }
+    CHECK(changelog_apply(replica, "master", log_path, &conflicts) == -1);
+
+    header.body_len = 6;
+    file = fopen(log_path, "wb");
+    if (file) {
+        CHECK(fwrite(&header, sizeof(header), 1, file) == 1);
+        CHECK(fwrite("short", 1, 5, file) == 5);
+        fclose(file);
+    }
+    CHECK(changelog_apply(replica, "master", log_path, &conflicts) == -1);
+    CHECK(replica->generation == 1 && replica->count == ENTRIES);
+
+    pm_free(replica);
+}
+
+int main(void) {
+    char dir[] = "/tmp/test_changelog.XXXXXX";
+    if (!crypto_init() || !mkdtemp(dir)) {
+        perror("setup");
+        return 1;
+    }
+    snprintf(log_path, sizeof(log_path), "%s/changes.log", dir);
+
+    test_round_trip();
+    test_partial_failure();
+    test_bounds();
+
+    remove(log_path);
+    rmdir(dir);
+    return test_finish("changelog");
+}
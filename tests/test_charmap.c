@@ -0,0 +1,111 @@
+// Built from the source so every kernel this CPU can run is reachable,
+// not only the one charmap_map() picks
+#include "../src/charmap.c"
+#include "../src/random.h"
+#include "test.h"
+#include <stdlib.h>
+
+#define INPUT_SIZE 4099         // Not a multiple of any vector width
+#define UNIFORM_BYTES (16u << 20)
+
+typedef struct {
+    const char *name;
+    MapKernel map;
+} Kernel;
+
+static size_t available_kernels(Kernel *kernels) {
+    size_t count = 0;
+    ensure_kernel();
+#if defined(CHARMAP_X86)
+    if (__builtin_cpu_supports("sse4.1")) kernels[count++] = (Kernel){"sse4.1", map_sse41};
+    if (__builtin_cpu_supports("avx2")) kernels[count++] = (Kernel){"avx2", map_avx2};
+#elif defined(CHARMAP_NEON)
+    kernels[count++] = (Kernel){"neon", map_neon};
+#endif
+    kernels[count++] = (Kernel){"dispatch", charmap_map};
+    return count;
+}
+
+// Every kernel must give the scalar reference's output, byte for byte,
+// for every charset length and every input length up to a few vectors
+static void test_kernels_match_scalar(void) {
+    Kernel kernels[4];
+    size_t kernel_count = available_kernels(kernels);
+
+    unsigned char in[INPUT_SIZE];
+    char expected[INPUT_SIZE];
+    char actual[INPUT_SIZE];
+    char chars[CHARMAP_MAX];
+    for (int i = 0; i < CHARMAP_MAX; i++) chars[i] = (char)(255 - i);
+
+    for (size_t len = 1; len <= CHARMAP_MAX; len++) {
+        CharMap map;
+        CHECK(charmap_init(&map, chars, len));
+        CHECK(random_bytes(in, sizeof(in)));
+
+        for (size_t size = 0; size <= 97; size++) {
+            size_t n = charmap_map_scalar(&map, in, size, expected);
+            for (size_t k = 0; k < kernel_count; k++) {
+                if (len < 2 && kernels[k].map != charmap_map) continue;
+                size_t m = kernels[k].map(&map, in, size, actual);
+                if (m != n || memcmp(actual, expected, n) != 0) {
+                    fprintf(stderr, "%s differs from scalar: charset %zu, input %zu\n",
+                            kernels[k].name, len, size);
+                    test_failures++;
+                }
+            }
+        }
+
+        size_t n = charmap_map_scalar(&map, in, sizeof(in), expected);
+        for (size_t k = 0; k < kernel_count; k++) {
+            if (len < 2 && kernels[k].map != charmap_map) continue;
+
+            size_t m = kernels[k].map(&map, in, sizeof(in), actual);
+            CHECK(m == n && memcmp(actual, expected, n) == 0);
+
+            // In place, as generate_password uses it
+            memcpy(actual, in, sizeof(in));
+            m = kernels[k].map(&map, (unsigned char*)actual, sizeof(in), actual);
+            CHECK(m == n && memcmp(actual, expected, n) == 0);
+        }
+    }
+}
+
+// Mapped characters must be uniform over the charset, for a length that
+// rejects bytes (62) and one that rejects none (64)
+static void test_uniform(size_t len) {
+    const char *alphabet =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    CharMap map;
+    CHECK(charmap_init(&map, alphabet, len));
+
+    unsigned char *buffer = malloc(UNIFORM_BYTES);
+    CHECK(buffer != NULL);
+    if (!buffer) return;
+
+    uint64_t counts[256] = {0};
+    CHECK(random_bytes(buffer, UNIFORM_BYTES));
+    size_t n = charmap_map(&map, buffer, UNIFORM_BYTES, (char*)buffer);
+    for (size_t i = 0; i < n; i++) {
+        counts[(size_t)(strchr(alphabet, buffer[i]) - alphabet)]++;
+    }
+
+    // Expected share of accepted bytes, with a generous margin
+    double accepted = (double)map.limit / 256.0;
+    CHECK(fabs((double)n / UNIFORM_BYTES - accepted) < 0.001);
+
+    double chi = chi_square_uniform(counts, len);
+    if (chi > chi_square_limit((double)(len - 1))) {
+        fprintf(stderr, "charset %zu: chi-square %.1f at df %zu\n", len, chi, len - 1);
+        test_failures++;
+    }
+    free(buffer);
+}
+
+int main(void) {
+    printf("charmap kernel: %s\n", charmap_kernel_name());
+    test_kernels_match_scalar();
+    test_uniform(62);
+    test_uniform(64);
+    return test_finish("charmap");
+}
@@ -0,0 +1,137 @@
+#include "../src/compress.h"
+#include "test.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_INPUT 70000
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ull;
+
+// Deterministic filler, so a failure can be reproduced
+static uint32_t next_random(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (uint32_t)rng_state;
+}
+
+static void fill_random(unsigned char *buf, size_t len) {
+    for (size_t i = 0; i < len; i++) buf[i] = (unsigned char)next_random();
+}
+
+// Records-like text: a few strings repeated with small changes
+static void fill_text(unsigned char *buf, size_t len) {
+    static const char *words[] = {"alice@example.com", "github.com", "bob",
+                                  "mail.example.org", "password", "\0\0\0\0"};
+    size_t pos = 0;
+    while (pos < len) {
+        const char *word = words[next_random() % 6];
+        size_t n = strlen(word) ? strlen(word) : 4;
+        for (size_t i = 0; i < n && pos < len; i++) buf[pos++] = (unsigned char)word[i];
+        if (pos < len) buf[pos++] = (unsigned char)('0' + next_random() % 10);
+    }
+}
+
+static int round_trip(const unsigned char *dict, size_t dict_len,
+                      const unsigned char *in, size_t len,
+                      unsigned char *packed, unsigned char *out) {
+    size_t bound = compress_bound(len);
+    size_t packed_len = compress_block_dict(dict, dict_len, in, len, packed, bound);
+
+    return packed_len > 0 && packed_len <= bound &&
+           decompress_block_dict(dict, dict_len, packed, packed_len, out, len) &&
+           memcmp(in, out, len) == 0;
+}
+
+// Any input, compressible or not, comes back unchanged and its
+// compressed form never exceeds compress_bound
+static void test_round_trip(unsigned char *in, unsigned char *packed, unsigned char *out) {
+    static const size_t sizes[] = {0, 1, 3, 4, 15, 16, 17, 255, 270, 4096, 65535,
+                                   65536, MAX_INPUT};
+    unsigned char dict[1024];
+    fill_text(dict, sizeof(dict));
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        size_t len = sizes[i];
+
+        fill_random(in, len);
+        CHECK(round_trip(NULL, 0, in, len, packed, out));
+        CHECK(round_trip(dict, sizeof(dict), in, len, packed, out));
+
+        fill_text(in, len);
+        CHECK(round_trip(NULL, 0, in, len, packed, out));
+        CHECK(round_trip(dict, sizeof(dict), in, len, packed, out));
+
+        memset(in, 'a', len);
+        CHECK(round_trip(NULL, 0, in, len, packed, out));
+    }
+
+    // Text shrinks, and shrinks further against a dictionary of itself
+    fill_text(in, 4096);
+    size_t plain = compress_block(in, 4096, packed, compress_bound(4096));
+    size_t with_dict = compress_block_dict(in, 4096, in, 4096, packed,
+                                           compress_bound(4096));
+    CHECK(plain > 0 && plain < 4096);
+    CHECK(with_dict > 0 && with_dict < plain);
+}
+
+// The compressor reports output that does not fit instead of
+// overrunning, and the decompressor refuses anything inconsistent
+static void test_bounds(unsigned char *in, unsigned char *packed, unsigned char *out) {
+    size_t len = 4096;
+    fill_random(in, len);
+    size_t packed_len = compress_block(in, len, packed, compress_bound(len));
+    CHECK(packed_len > len);
+    CHECK(compress_block(in, len, packed, packed_len - 1) == 0);
+
+    CHECK(decompress_block(packed, packed_len, out, len));
+    CHECK(!decompress_block(packed, packed_len, out, len - 1));
+    CHECK(!decompress_block(packed, packed_len, out, len + 1));
+    CHECK(!decompress_block(packed, packed_len - 1, out, len));
+
+    // A block compressed against a dictionary reaches into it, so it
+    // cannot be unpacked without one
+    unsigned char dict[512];
+    fill_text(dict, sizeof(dict));
+    memcpy(in, dict, sizeof(dict));
+    packed_len = compress_block_dict(dict, sizeof(dict), in, sizeof(dict), packed,
+                                     compress_bound(sizeof(dict)));
+    CHECK(packed_len > 0);
+    CHECK(!decompress_block(packed, packed_len, out, sizeof(dict)));
+    CHECK(compress_block_dict(in, COMPRESS_MAX_DICT + 1, in, 16, packed, 64) == 0);
+
+    // Garbage must be rejected or decoded within out_len, never beyond
+    size_t rejected = 0;
+    for (int i = 0; i < 20000; i++) {
+        size_t n = 1 + next_random() % 64;
+        fill_random(packed, n);
+        out[256] = 0x5a;
+        if (!decompress_block_dict(dict, sizeof(dict), packed, n, out, 256)) rejected++;
+        CHECK(out[256] == 0x5a);
+    }
+    CHECK(rejected > 19000);
+
+    // A length that would wrap around size_t
+    unsigned char huge[1 + 64];
+    huge[0] = 0xf0;
+    memset(huge + 1, 255, sizeof(huge) - 1);
+    CHECK(!decompress_block(huge, sizeof(huge), out, 16));
+}
+
+int main(void) {
+    unsigned char *in = malloc(MAX_INPUT);
+    unsigned char *packed = malloc(compress_bound(MAX_INPUT));
+    unsigned char *out = malloc(MAX_INPUT + 1);
+    if (!in || !packed || !out) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    test_round_trip(in, packed, out);
+    test_bounds(in, packed, out);
+
+    free(in);
+    free(packed);
+    free(out);
+    return test_finish("compress");
+}
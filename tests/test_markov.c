@@ -0,0 +1,69 @@
+// Built from the source so sampled passwords can be scored against the
+// model's own tables
+#include "../src/markov.c"
+#include "test.h"
+
+#define SAMPLES 200000
+#define LENGTH 16
+
+// Information (bits) of the draws that produced password
+static double password_bits(const MarkovModel *model, const char *password) {
+    double bits = 0.0;
+    uint32_t row = model->start;
+
+    for (const char *p = password; *p; p++) {
+        uint32_t previous = 0;
+        uint32_t t = model->row_begin[row];
+        for (; t < model->row_begin[row + 1]; t++) {
+            if (model->letter[t] == (unsigned char)(*p - 'a')) break;
+            previous = model->threshold[t] + 1u;
+        }
+        if (t == model->row_begin[row + 1]) return -1.0;
+
+        bits -= log2((double)(model->threshold[t] + 1u - previous) / SCALE);
+        row = model->next_row[t];
+    }
+    return bits;
+}
+
+// The exact entropy must agree with the mean information of sampled
+// passwords to within the Monte Carlo error
+static void test_entropy(int order) {
+    MarkovModel *model = markov_train(order);
+    CHECK(model != NULL);
+    if (!model) return;
+
+    double exact = markov_entropy_bits(model, LENGTH);
+    double sum = 0.0, sum_squares = 0.0;
+    char password[LENGTH + 1];
+
+    for (int i = 0; i < SAMPLES; i++) {
+        CHECK(markov_generate(model, LENGTH, password, sizeof(password)));
+        double bits = password_bits(model, password);
+        if (bits < 0.0) {
+            fprintf(stderr, "order %d: \"%s\" takes a transition the model lacks\n",
+                    order, password);
+            test_failures++;
+            break;
+        }
+        sum += bits;
+        sum_squares += bits * bits;
+    }
+
+    double mean = sum / SAMPLES;
+    double error = sqrt((sum_squares / SAMPLES - mean * mean) / SAMPLES);
+    printf("order %d: exact %.2f bits, sampled %.2f +- %.2f\n", order, exact, mean, error);
+    if (fabs(mean - exact) > 5.0 * error) {
+        fprintf(stderr, "order %d: exact entropy %.3f is off the sampled %.3f\n",
+                order, exact, mean);
+        test_failures++;
+    }
+    markov_free(model);
+}
+
+int main(void) {
+    test_entropy(2);
+    test_entropy(3);
+    CHECK(markov_train(MARKOV_MAX_ORDER + 1) == NULL);
+    return test_finish("markov");
+}
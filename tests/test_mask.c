@@ -0,0 +1,84 @@
+// Built from the source to reach the reciprocal the mask groups divide by
+#include "../src/generator.c"
+#include "test.h"
+
+#define SAMPLES_PER_OUTCOME 500
+
+// (value * reciprocal) >> 40 never decreases as value grows, so it is
+// value / size for every value below the group limit once it is right
+// at both ends of each quotient's run of values
+static void test_reciprocal(void) {
+    for (uint32_t size = 2; size <= 256; size++) {
+        uint64_t reciprocal = mask_reciprocal(size);
+        int ok = 1;
+        for (uint64_t first = 0; ok && first < MASK_GROUP_LIMIT; first += size) {
+            uint64_t last = first + size - 1;
+            if (last >= MASK_GROUP_LIMIT) last = MASK_GROUP_LIMIT - 1;
+            ok = (first * reciprocal) >> 40 == first / size &&
+                 (last * reciprocal) >> 40 == last / size;
+        }
+        if (!ok) {
+            fprintf(stderr, "reciprocal of %u is inexact below 2^24\n", size);
+            test_failures++;
+        }
+    }
+}
+
+static int index_of(const char *chars, char c) {
+    const char *p = strchr(chars, c);
+    return p && c ? (int)(p - chars) : -1;
+}
+
+// Every one of the 10 * 21 * 10 outputs of "x?dC?d" must be equally likely
+static void test_uniform(void) {
+    char error[128];
+    MaskProgram *program = mask_compile("x?dC?d", error, sizeof(error));
+    CHECK(program != NULL);
+    if (!program) return;
+
+    CHECK(mask_length(program) == 4);
+    CHECK(fabs(mask_entropy_bits(program) - log2(2100.0)) < 1e-9);
+
+    const size_t consonants = strlen(CONSONANTS_UPPER);
+    const size_t outcomes = 10 * consonants * 10;
+    uint64_t counts[10 * 26 * 10] = {0};
+    char password[8];
+
+    for (size_t i = 0; i < outcomes * SAMPLES_PER_OUTCOME; i++) {
+        if (!mask_generate(program, password, sizeof(password))) {
+            test_failures++;
+            break;
+        }
+
+        int d1 = index_of(NUMBERS, password[1]);
+        int c = index_of(CONSONANTS_UPPER, password[2]);
+        int d2 = index_of(NUMBERS, password[3]);
+        if (password[0] != 'x' || d1 < 0 || c < 0 || d2 < 0 || password[4] != '\0') {
+            fprintf(stderr, "unexpected mask output \"%s\"\n", password);
+            test_failures++;
+            break;
+        }
+        counts[((size_t)d1 * consonants + (size_t)c) * 10 + (size_t)d2]++;
+    }
+
+    double chi = chi_square_uniform(counts, outcomes);
+    if (chi > chi_square_limit((double)(outcomes - 1))) {
+        fprintf(stderr, "mask outputs: chi-square %.1f at df %zu\n", chi, outcomes - 1);
+        test_failures++;
+    }
+    mask_free(program);
+}
+
+static void test_rejects_bad_masks(void) {
+    char error[128];
+    CHECK(mask_compile("?x?d?d?d", error, sizeof(error)) == NULL);
+    CHECK(mask_compile("?d?d?", error, sizeof(error)) == NULL);
+    CHECK(mask_compile("?d?d", error, sizeof(error)) == NULL);
+}
+
+int main(void) {
+    test_reciprocal();
+    test_uniform();
+    test_rejects_bad_masks();
+    return test_finish("mask");
+}
@@ -0,0 +1,227 @@
+#include "../src/merkle.h"
+#include "test.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define CHUNK MERKLE_CHUNK_SIZE
+#define MAX_PAYLOAD (40 * CHUNK)
+#define MAX_RANGES 16
+
+static uint64_t rng_state = 0x2545f4914f6cdd1dull;
+
+// Deterministic filler, so a failure can be reproduced
+static uint32_t next_random(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (uint32_t)rng_state;
+}
+
+static void fill_random(unsigned char *buf, size_t len) {
+    for (size_t i = 0; i < len; i++) buf[i] = (unsigned char)next_random();
+}
+
+static MerkleTree* build(const unsigned char *data, size_t len) {
+    MerkleTree *tree = merkle_new();
+    if (tree && (!merkle_append(tree, data, len) || !merkle_finish(tree))) {
+        merkle_free(tree);
+        return NULL;
+    }
+    return tree;
+}
+
+// Ranges reported by merkle_diff, in payload bytes
+typedef struct {
+    uint64_t offset[MAX_RANGES];
+    uint64_t length[MAX_RANGES];
+    int count;
+    int limit;
+} Ranges;
+
+static int collect(uint64_t offset, uint64_t length, void *ctx) {
+    Ranges *ranges = ctx;
+    if (ranges->count < MAX_RANGES) {
+        ranges->offset[ranges->count] = offset;
+        ranges->length[ranges->count] = length;
+    }
+    ranges->count++;
+    return ranges->limit == 0 || ranges->count < ranges->limit;
+}
+
+// The root depends on the bytes only, not on how they were fed in
+static void test_root(unsigned char *data) {
+    static const size_t sizes[] = {1, CHUNK - 1, CHUNK, CHUNK + 1, 3 * CHUNK,
+                                   7 * CHUNK + 5, MAX_PAYLOAD};
+    unsigned char root[HASH_SIZE];
+    unsigned char pieces_root[HASH_SIZE];
+    unsigned char zero[HASH_SIZE] = {0};
+
+    MerkleTree *tree = build(data, 0);
+    CHECK(tree != NULL);
+    merkle_root(tree, root);
+    CHECK(memcmp(root, zero, HASH_SIZE) == 0);
+    CHECK(merkle_stored_size(0) == 0);
+    merkle_free(tree);
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        size_t len = sizes[i];
+        tree = build(data, len);
+        CHECK(tree != NULL);
+        merkle_root(tree, root);
+        merkle_free(tree);
+
+        tree = merkle_new();
+        size_t pos = 0;
+        while (tree && pos < len) {
+            size_t n = 1 + next_random() % (2 * CHUNK);
+            if (n > len - pos) n = len - pos;
+            CHECK(merkle_append(tree, data + pos, n));
+            pos += n;
+        }
+        CHECK(tree && merkle_finish(tree));
+        merkle_root(tree, pieces_root);
+        merkle_free(tree);
+        CHECK(memcmp(root, pieces_root, HASH_SIZE) == 0);
+
+        // Any changed byte changes the root
+        data[len / 2] ^= 0x40;
+        tree = build(data, len);
+        merkle_root(tree, pieces_root);
+        merkle_free(tree);
+        data[len / 2] ^= 0x40;
+        CHECK(memcmp(root, pieces_root, HASH_SIZE) != 0);
+    }
+}
+
+static void flip_byte(FILE *file, long offset) {
+    int c;
+    fseek(file, offset, SEEK_SET);
+    c = fgetc(file);
+    fseek(file, offset, SEEK_SET);
+    fputc(c ^ 0x01, file);
+    fflush(file);
+}
+
+// A stored tree loads back only if every inner node matches its
+// children, and a range verifies only while its chunks are unchanged
+static void test_store(unsigned char *data) {
+    static const size_t sizes[] = {1, CHUNK, CHUNK + 1, 5 * CHUNK + 10, 33 * CHUNK};
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        size_t len = sizes[i];
+        size_t leaves = (len + CHUNK - 1) / CHUNK;
+        unsigned char root[HASH_SIZE];
+        unsigned char loaded_root[HASH_SIZE];
+        FILE *file = tmpfile();
+        CHECK(file != NULL);
+        if (!file) return;
+
+        MerkleTree *tree = build(data, len);
+        CHECK(tree != NULL);
+        merkle_root(tree, root);
+        CHECK(fwrite(data, 1, len, file) == len);
+        CHECK(merkle_store(file, tree));
+        merkle_free(tree);
+        CHECK((uint64_t)ftell(file) == len + merkle_stored_size(len));
+
+        long tree_start = (long)len;
+        fseek(file, tree_start, SEEK_SET);
+        tree = merkle_load(file, len);
+        CHECK(tree != NULL);
+        merkle_root(tree, loaded_root);
+        merkle_free(tree);
+        CHECK(memcmp(root, loaded_root, HASH_SIZE) == 0);
+
+        CHECK(merkle_verify_range(file, 0, len, tree_start, 0, len, root));
+        CHECK(!merkle_verify_range(file, 0, len, tree_start, 0, len + 1, root));
+        CHECK(!merkle_verify_range(file, 0, len, tree_start, 0, 0, root));
+
+        // Damage the last chunk: only ranges touching it fail
+        size_t last = leaves - 1;
+        flip_byte(file, (long)(last * CHUNK));
+        CHECK(!merkle_verify_range(file, 0, len, tree_start, last * CHUNK, 1, root));
+        CHECK(!merkle_verify_range(file, 0, len, tree_start, 0, len, root));
+        if (last > 0) {
+            CHECK(merkle_verify_range(file, 0, len, tree_start, 0, last * CHUNK, root));
+        }
+        flip_byte(file, (long)(last * CHUNK));
+        CHECK(merkle_verify_range(file, 0, len, tree_start, 0, len, root));
+
+        // A damaged leaf hash no longer matches its parent
+        if (leaves > 1) {
+            flip_byte(file, tree_start);
+            fseek(file, tree_start, SEEK_SET);
+            tree = merkle_load(file, len);
+            CHECK(tree == NULL);
+            merkle_free(tree);
+            CHECK(!merkle_verify_range(file, 0, len, tree_start, CHUNK, 1, root));
+            flip_byte(file, tree_start);
+        }
+
+        // A tree cut short does not load
+        fseek(file, tree_start, SEEK_SET);
+        tree = merkle_load(file, len + CHUNK * leaves);
+        CHECK(tree == NULL);
+        merkle_free(tree);
+        fclose(file);
+    }
+}
+
+// Exactly the changed runs of chunks are reported, merged where they
+// touch, and a payload that grew differs over its new tail
+static void test_diff(unsigned char *data, unsigned char *other) {
+    size_t len = 20 * CHUNK + 100;
+    memcpy(other, data, len);
+    other[2 * CHUNK + 5] ^= 1;
+    other[3 * CHUNK + 7] ^= 1;
+    other[9 * CHUNK] ^= 1;
+    other[len - 1] ^= 1;
+
+    MerkleTree *a = build(data, len);
+    MerkleTree *b = build(other, len);
+    Ranges ranges = {{0}, {0}, 0, 0};
+    CHECK(merkle_diff(a, b, collect, &ranges));
+    CHECK(ranges.count == 3);
+    CHECK(ranges.offset[0] == 2 * CHUNK && ranges.length[0] == 2 * CHUNK);
+    CHECK(ranges.offset[1] == 9 * CHUNK && ranges.length[1] == CHUNK);
+    CHECK(ranges.offset[2] == 20 * CHUNK && ranges.length[2] == 100);
+
+    // The visitor can stop the walk
+    Ranges first = {{0}, {0}, 0, 1};
+    CHECK(!merkle_diff(a, b, collect, &first));
+    CHECK(first.count == 1);
+
+    Ranges none = {{0}, {0}, 0, 0};
+    CHECK(merkle_diff(a, a, collect, &none));
+    CHECK(none.count == 0);
+    merkle_free(b);
+
+    memcpy(other, data, len);
+    b = build(other, len + 3 * CHUNK);
+    Ranges tail = {{0}, {0}, 0, 0};
+    CHECK(merkle_diff(a, b, collect, &tail));
+    CHECK(tail.count == 1);
+    CHECK(tail.offset[0] == 20 * CHUNK && tail.length[0] == 3 * CHUNK + 100);
+
+    merkle_free(a);
+    merkle_free(b);
+}
+
+int main(void) {
+    unsigned char *data = malloc(MAX_PAYLOAD);
+    unsigned char *other = malloc(MAX_PAYLOAD);
+    if (!data || !other) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    fill_random(data, MAX_PAYLOAD);
+    fill_random(other, MAX_PAYLOAD);
+
+    test_root(data);
+    test_store(data);
+    test_diff(data, other);
+
+    free(data);
+    free(other);
+    return test_finish("merkle");
+}
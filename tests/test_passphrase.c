@@ -0,0 +1,128 @@
+#include "../src/passphrase.h"
+#include "test.h"
+#include <string.h>
+
+#define FIXTURE "tests/four_words.txt"
+#define SAMPLES_PER_OUTCOME 20000
+#define ARENA_SIZE (1 << 20)
+
+static const char *words[] = {"alpha", "bravo", "charlie", "delta"};
+
+static int word_index(const char *word, size_t length) {
+    for (int i = 0; i < 4; i++) {
+        if (strlen(words[i]) == length && memcmp(words[i], word, length) == 0) return i;
+    }
+    return -1;
+}
+
+// Number the outcome a passphrase is: its words as base-4 digits.
+// Returns: the number, or -1 if it is not num_words fixture words
+static long outcome_of(const char *phrase, int num_words, int *distinct) {
+    long outcome = 0;
+    int seen = 0;
+    const char *p = phrase;
+
+    *distinct = 1;
+    for (int i = 0; i < num_words; i++) {
+        const char *end = strchr(p, '-');
+        size_t length = end ? (size_t)(end - p) : strlen(p);
+        int index = word_index(p, length);
+        if (index < 0 || (i < num_words - 1) != (end != NULL)) return -1;
+
+        if (seen & (1 << index)) *distinct = 0;
+        seen |= 1 << index;
+        outcome = outcome * 4 + index;
+        p = end ? end + 1 : p + length;
+    }
+    return outcome;
+}
+
+// Bulk passphrases must cover their outcomes uniformly: every ordering of
+// distinct words, or every sequence when words may repeat
+static void test_uniform(const Wordlist *list, int num_words, int distinct_words) {
+    PassphraseConfig config = {0};
+    config.num_words = num_words;
+    config.separator = '-';
+    config.distinct_words = distinct_words;
+    config.wordlist = list;
+
+    size_t outcomes = 1;
+    for (int i = 0; i < num_words; i++) outcomes *= distinct_words ? (size_t)(4 - i) : 4;
+    double entropy = log2((double)outcomes);
+    CHECK(fabs(passphrase_entropy(&config) - entropy) < 1e-9);
+
+    uint64_t counts[256] = {0};
+    uint64_t seen = 0;
+    char *arena = malloc(ARENA_SIZE);
+    CHECK(arena != NULL);
+    if (!arena) return;
+
+    unsigned long long wanted = outcomes * SAMPLES_PER_OUTCOME;
+    unsigned long long done = 0;
+    while (done < wanted) {
+        size_t used;
+        long long n = passphrase_generate_into(arena, ARENA_SIZE, wanted - done, &config, &used);
+        if (n <= 0) {
+            test_failures++;
+            break;
+        }
+
+        for (const char *p = arena; p < arena + used; p += strlen(p) + 1) {
+            int distinct;
+            long outcome = outcome_of(p, num_words, &distinct);
+            if (outcome < 0 || (distinct_words && !distinct)) {
+                fprintf(stderr, "unexpected passphrase \"%s\"\n", p);
+                test_failures++;
+                free(arena);
+                return;
+            }
+            counts[outcome]++;
+        }
+        done += (unsigned long long)n;
+    }
+    free(arena);
+
+    // Squeeze out the outcomes that can never occur before the test
+    uint64_t present[256];
+    size_t bins = 0;
+    for (size_t i = 0; i < 256; i++) {
+        if (counts[i]) present[bins++] = counts[i];
+        seen += counts[i];
+    }
+    CHECK(bins == outcomes);
+    CHECK(seen == wanted);
+
+    double chi = chi_square_uniform(present, bins);
+    if (chi > chi_square_limit((double)(outcomes - 1))) {
+        fprintf(stderr, "%d words%s: chi-square %.1f at df %zu\n", num_words,
+                distinct_words ? " (distinct)" : "", chi, outcomes - 1);
+        test_failures++;
+    }
+}
+
+int main(void) {
+    char error[256];
+    const Wordlist *list = wordlist_get(FIXTURE, error, sizeof(error));
+    if (!list) {
+        fprintf(stderr, "cannot load %s: %s\n", FIXTURE, error);
+        test_failures++;
+        return test_finish("passphrase");
+    }
+    CHECK(wordlist_size(list) == 4);
+    CHECK(wordlist_longest(list) == strlen("charlie"));
+
+    test_uniform(list, 4, 1);
+    test_uniform(list, 3, 0);
+    test_uniform(list, 2, 1);
+
+    // More distinct words than the list has cannot be satisfied
+    PassphraseConfig config = {0};
+    config.num_words = 5;
+    config.distinct_words = 1;
+    config.wordlist = list;
+    char arena[256];
+    CHECK(passphrase_generate_into(arena, sizeof(arena), 1, &config, NULL) < 0);
+
+    wordlist_cleanup();
+    return test_finish("passphrase");
+}
@@ -0,0 +1,214 @@
+#include "../src/policy.h"
+#include "test.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SAMPLES_PER_OUTCOME 2000
+#define COMPLIANCE_SAMPLES 20000
+
+static const char alphabet[] = "AB01";
+
+// Number a password over alphabet as base-4 digits, -1 if it uses
+// anything else
+static long outcome_of(const char *password, int length) {
+    long outcome = 0;
+    for (int i = 0; i < length; i++) {
+        const char *at = strchr(alphabet, password[i]);
+        if (!password[i] || !at) return -1;
+        outcome = outcome * 4 + (at - alphabet);
+    }
+    return password[length] == '\0' ? outcome : -1;
+}
+
+// Without repeat or forbid rules every compliant password is equally
+// likely: over A, B, 0, 1 with at least one letter and two digits there
+// are 4 * 2 * 8 + 6 * 4 * 4 = 160 of them
+static void test_uniform(void) {
+    char error[128];
+    PasswordPolicy *policy = policy_compile(
+        "length=4 no-lower no-symbol upper-set=AB digit-set=01 upper=1 digit=2",
+        error, sizeof(error));
+    CHECK(policy != NULL);
+    if (!policy) {
+        fprintf(stderr, "%s\n", error);
+        return;
+    }
+    CHECK(policy_length(policy) == 4);
+    CHECK(fabs(policy_entropy_bits(policy) - log2(160)) < 1e-9);
+
+    uint64_t counts[256] = {0};
+    char password[8];
+    for (long i = 0; i < 160 * SAMPLES_PER_OUTCOME; i++) {
+        CHECK(policy_generate(policy, password, sizeof(password)));
+        long outcome = outcome_of(password, 4);
+        if (outcome < 0) {
+            fprintf(stderr, "unexpected password \"%s\"\n", password);
+            test_failures++;
+            break;
+        }
+        counts[outcome]++;
+    }
+    CHECK(!policy_generate(policy, password, 4));
+    policy_free(policy);
+
+    uint64_t present[256];
+    size_t bins = 0;
+    for (size_t i = 0; i < 256; i++) {
+        if (counts[i]) present[bins++] = counts[i];
+    }
+    CHECK(bins == 160);
+    double chi = chi_square_uniform(present, bins);
+    if (chi > chi_square_limit(159.0)) {
+        fprintf(stderr, "chi-square %.1f at df 159\n", chi);
+        test_failures++;
+    }
+}
+
+static int longest_run(const char *password) {
+    int longest = 0;
+    int run = 0;
+    for (size_t i = 0; password[i]; i++) {
+        run = i > 0 && password[i] == password[i - 1] ? run + 1 : 1;
+        if (run > longest) longest = run;
+    }
+    return longest;
+}
+
+static int contains_folded(const char *password, const char *text) {
+    size_t length = strlen(text);
+    for (size_t i = 0; password[i]; i++) {
+        size_t j = 0;
+        while (j < length && password[i + j] &&
+               tolower((unsigned char)password[i + j]) == tolower((unsigned char)text[j])) {
+            j++;
+        }
+        if (j == length) return 1;
+    }
+    return 0;
+}
+
+// Every password meets the class counts and sets, and breaks neither the
+// repeat nor the forbid rules, in any letter case
+static void test_rules(void) {
+    PasswordPolicy *policy = policy_compile(
+        "length=12 upper=2 lower=1 digit=3 symbol=1 symbol-set=!#% exclude=ambiguous "
+        "max-repeat=2 forbid=ab forbid=X9 forbid=!!",
+        NULL, 0);
+    CHECK(policy != NULL);
+    if (!policy) return;
+
+    char password[16];
+    for (int i = 0; i < COMPLIANCE_SAMPLES; i++) {
+        CHECK(policy_generate(policy, password, sizeof(password)));
+        int upper = 0, lower = 0, digit = 0, symbol = 0, other = 0;
+        for (size_t c = 0; password[c]; c++) {
+            unsigned char ch = (unsigned char)password[c];
+            if (strchr("0O1Il|", ch)) other++;
+            else if (isupper(ch)) upper++;
+            else if (islower(ch)) lower++;
+            else if (isdigit(ch)) digit++;
+            else if (strchr("!#%", ch)) symbol++;
+            else other++;
+        }
+        int ok = strlen(password) == 12 && upper >= 2 && lower >= 1 && digit >= 3 &&
+                 symbol >= 1 && other == 0 && longest_run(password) <= 2 &&
+                 !contains_folded(password, "ab") && !contains_folded(password, "x9") &&
+                 !contains_folded(password, "!!");
+        if (!ok) {
+            fprintf(stderr, "non-compliant password \"%s\"\n", password);
+            test_failures++;
+            break;
+        }
+    }
+    policy_free(policy);
+
+    // Over a and b without "aa" (either case) there are 8 words of four
+    // letters; each must be reachable
+    policy = policy_compile("length=4 no-upper no-digit no-symbol lower-set=ab forbid=AA",
+                            NULL, 0);
+    CHECK(policy != NULL);
+    if (!policy) return;
+
+    int seen[16] = {0};
+    int distinct = 0;
+    for (int i = 0; i < 4000; i++) {
+        CHECK(policy_generate(policy, password, sizeof(password)));
+        int index = 0;
+        for (int c = 0; c < 4; c++) index = index * 2 + (password[c] == 'b');
+        if (strstr(password, "aa") || strspn(password, "ab") != 4) {
+            fprintf(stderr, "non-compliant password \"%s\"\n", password);
+            test_failures++;
+            break;
+        }
+        if (!seen[index]++) distinct++;
+    }
+    CHECK(distinct == 8);
+    policy_free(policy);
+}
+
+// Broken or unsatisfiable policies are refused with a reason
+static void test_errors(void) {
+    static const char *bad[] = {
+        "length=3",
+        "length=129",
+        "upper=-1",
+        "colour=blue",
+        "length=4 upper=3 digit=3",
+        "no-upper no-lower no-digit no-symbol",
+        "forbid=0123456789012345678901234567890123",
+        "length=4 no-upper no-digit no-symbol lower-set=a max-repeat=1",
+        "length=4 no-upper no-digit no-symbol lower-set=ab forbid=a forbid=b",
+    };
+    char error[128];
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        error[0] = '\0';
+        PasswordPolicy *policy = policy_compile(bad[i], error, sizeof(error));
+        if (policy || error[0] == '\0') {
+            fprintf(stderr, "policy \"%s\" was not refused\n", bad[i]);
+            test_failures++;
+        }
+        policy_free(policy);
+    }
+}
+
+// The batch writer emits exactly count compliant lines
+static void test_batch(void) {
+    PasswordPolicy *policy = policy_compile("length=9 digit=2 forbid=42", NULL, 0);
+    FILE *file = tmpfile();
+    CHECK(policy && file);
+    if (!policy || !file) {
+        policy_free(policy);
+        if (file) fclose(file);
+        return;
+    }
+
+    const long long count = 20000;
+    CHECK(policy_generate_batch(file, (unsigned long long)count, policy) == count);
+    rewind(file);
+
+    char line[32];
+    long long lines = 0;
+    while (fgets(line, sizeof(line), file)) {
+        size_t length = strcspn(line, "\n");
+        if (length != 9 || line[length] != '\n' || strstr(line, "42")) {
+            fprintf(stderr, "unexpected line \"%s\"\n", line);
+            test_failures++;
+            break;
+        }
+        lines++;
+    }
+    CHECK(lines == count);
+    CHECK(policy_generate_batch(file, 0, policy) == 0);
+
+    fclose(file);
+    policy_free(policy);
+}
+
+int main(void) {
+    test_uniform();
+    test_rules();
+    test_errors();
+    test_batch();
+    return test_finish("policy");
+}
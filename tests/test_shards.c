@@ -0,0 +1,276 @@
+#ifndef _WIN32
+    #define _POSIX_C_SOURCE 200809L
+#endif
+
+// Built from the source to reach the shard table and file names
+#include "../src/file_io.c"
+#include "test.h"
+#include <dirent.h>
+
+#define ENTRIES 400
+#define SHARDS 4
+
+static char home[64];
+static char replica_path[PATH_SIZE];
+
+static void service_name(char *buffer, int i) {
+    snprintf(buffer, MAX_SERVICE_NAME, "service-%03d", i);
+}
+
+// Entries in the directory at path (not counting . and ..), -1 if absent
+static int count_files(const char *path) {
+    DIR *dir = opendir(path);
+    if (!dir) return -1;
+
+    int count = 0;
+    struct dirent *item;
+    while ((item = readdir(dir)) != NULL) {
+        if (strcmp(item->d_name, ".") != 0 && strcmp(item->d_name, "..") != 0) count++;
+    }
+    closedir(dir);
+    return count;
+}
+
+static int shard_dir_count(const char *vault_path, const VaultLayout *layout) {
+    char dir[PATH_SIZE];
+    if (!shard_dir_path(vault_path, layout->header.shard_set, dir, sizeof(dir))) return -1;
+    return count_files(dir);
+}
+
+static int read_file(const char *path, unsigned char **data, long *len) {
+    FILE *file = fopen(path, "rb");
+    if (!file) return 0;
+    int ok = fseek(file, 0, SEEK_END) == 0 && (*len = ftell(file)) > 0 &&
+             fseek(file, 0, SEEK_SET) == 0 && (*data = malloc((size_t)*len)) != NULL &&
+             fread(*data, 1, (size_t)*len, file) == (size_t)*len;
+    fclose(file);
+    return ok;
+}
+
+static int write_file(const char *path, const unsigned char *data, long len) {
+    FILE *file = fopen(path, "wb");
+    if (!file) return 0;
+    int ok = fwrite(data, 1, (size_t)len, file) == (size_t)len;
+    if (fclose(file) != 0) ok = 0;
+    return ok;
+}
+
+static void count_range(const char *path, uint64_t offset, uint64_t length, void *ctx) {
+    (void)path;
+    (void)offset;
+    (void)length;
+    (*(int*)ctx)++;
+}
+
+// A service that lands in the given shard
+static int service_in_shard(size_t shard, size_t shard_count, char *service) {
+    for (int i = 0; i < ENTRIES; i++) {
+        service_name(service, i);
+        if (pm_shard_of(service, shard_count) == shard) return 1;
+    }
+    return 0;
+}
+
+// Resharding writes a new shard set; saves after that rewrite only the
+// shards that changed, and the old files go once nothing points to them
+static void test_round_trip(PasswordManager *pm) {
+    const char *vault_path = get_data_file_path();
+    VaultLayout layout, after;
+    char service[MAX_SERVICE_NAME];
+    PasswordEntry entry;
+
+    CHECK(file_set_shard_count(pm, "master", SHARDS));
+    CHECK(pm->shard_count == SHARDS && pm->dirty_shards == 0);
+    CHECK(read_layout(vault_path, &layout));
+    CHECK(layout.header.shard_count == SHARDS);
+    CHECK(shard_dir_count(vault_path, &layout) == 2 * SHARDS);
+
+    int success;
+    PasswordManager *loaded = file_load_path(vault_path, "master", &success);
+    CHECK(success && loaded && loaded->count == ENTRIES);
+    pm_free(loaded);
+    CHECK(!file_load_path(vault_path, "wrong", &success));
+
+    service_name(service, 123);
+    CHECK(file_lookup_entry("master", service, &entry) == 1);
+    CHECK(strcmp(entry.service, service) == 0);
+    CHECK(file_lookup_entry("master", "absent", &entry) == 0);
+
+    CHECK(service_in_shard(2, SHARDS, service));
+    CHECK(pm_update_entry(pm, service, NULL, "changed"));
+    CHECK(file_save(pm, "master"));
+    CHECK(read_layout(vault_path, &after));
+    CHECK(after.header.shard_set == layout.header.shard_set);
+    for (size_t shard = 0; shard < SHARDS; shard++) {
+        int same = memcmp(&after.shards[shard], &layout.shards[shard],
+                          sizeof(ShardSeal)) == 0;
+        CHECK(same == (shard != 2));
+    }
+    CHECK(shard_dir_count(vault_path, &after) == 2 * SHARDS);
+    CHECK(file_lookup_entry("master", service, &entry) == 1);
+    CHECK(strcmp(entry.password, "changed") == 0);
+
+    int ranges = 0;
+    CHECK(file_verify_integrity("master", count_range, &ranges) == 1);
+    CHECK(ranges == 0);
+}
+
+// An old copy of a shard is validly sealed under the vault key, but the
+// main file no longer names it, and must not pass in place of the new one
+static void test_replay(PasswordManager *pm) {
+    const char *vault_path = get_data_file_path();
+    VaultLayout layout, after;
+    char service[MAX_SERVICE_NAME];
+    char path[PATH_SIZE];
+    char new_path[PATH_SIZE];
+    PasswordEntry entry;
+
+    CHECK(read_layout(vault_path, &layout));
+    CHECK(service_in_shard(1, SHARDS, service));
+    CHECK(shard_file_path(vault_path, &layout, 1, path, sizeof(path)));
+
+    unsigned char *old_data = NULL;
+    unsigned char *new_data = NULL;
+    long old_len = 0;
+    long new_len = 0;
+    CHECK(read_file(path, &old_data, &old_len));
+
+    CHECK(pm_update_entry(pm, service, NULL, "newer"));
+    CHECK(file_save(pm, "master"));
+    CHECK(read_layout(vault_path, &after));
+    CHECK(shard_file_path(vault_path, &after, 1, new_path, sizeof(new_path)));
+    CHECK(strcmp(path, new_path) != 0);
+    CHECK(read_file(new_path, &new_data, &new_len));
+
+    CHECK(write_file(new_path, old_data, old_len));
+    int success;
+    CHECK(!file_load_path(vault_path, "master", &success));
+    CHECK(file_lookup_entry("master", service, &entry) == -1);
+    int ranges = 0;
+    CHECK(file_verify_integrity("master", count_range, &ranges) == 0);
+    CHECK(ranges > 0);
+
+    CHECK(write_file(new_path, new_data, new_len));
+    PasswordManager *loaded = file_load_path(vault_path, "master", &success);
+    CHECK(success && loaded != NULL);
+    pm_free(loaded);
+    free(old_data);
+    free(new_data);
+
+    // The shard table is authenticated with the header
+    unsigned char *main_data = NULL;
+    long main_len = 0;
+    CHECK(read_file(vault_path, &main_data, &main_len));
+    if (!main_data) return;
+    size_t table = sizeof(FileHeader) + offsetof(ShardSeal, entry_count);
+    main_data[table] ^= 1;
+    CHECK(write_file(vault_path, main_data, main_len));
+    CHECK(!file_load_path(vault_path, "master", &success));
+    CHECK(file_lookup_entry("master", service, &entry) == -1);
+    main_data[table] ^= 1;
+    CHECK(write_file(vault_path, main_data, main_len));
+    free(main_data);
+}
+
+// A replica copies the shard set along; after that only the shard that
+// changed differs
+static void test_copy(PasswordManager *pm) {
+    const char *vault_path = get_data_file_path();
+    char service[MAX_SERVICE_NAME];
+    int ranges = 0;
+
+    CHECK(file_copy_vault(vault_path, replica_path));
+    CHECK(file_compare_vaults(vault_path, replica_path, count_range, &ranges) == 0);
+
+    int success;
+    PasswordManager *replica = file_load_path(replica_path, "master", &success);
+    CHECK(success && replica && replica->count == ENTRIES);
+    pm_free(replica);
+
+    CHECK(service_in_shard(3, SHARDS, service));
+    CHECK(pm_update_entry(pm, service, NULL, "replicated"));
+    CHECK(file_save(pm, "master"));
+    CHECK(file_compare_vaults(vault_path, replica_path, count_range, &ranges) > 0);
+
+    // Copying again replaces the changed shard and drops the stale one
+    VaultLayout layout;
+    CHECK(file_copy_vault(vault_path, replica_path));
+    CHECK(read_layout(replica_path, &layout));
+    CHECK(shard_dir_count(replica_path, &layout) == 2 * SHARDS);
+    ranges = 0;
+    CHECK(file_compare_vaults(vault_path, replica_path, count_range, &ranges) == 0);
+}
+
+// A reshard that fails leaves the vault and the manager as they were;
+// one that succeeds leaves no trace of the old layout
+static void test_reshard(PasswordManager *pm) {
+    const char *vault_path = get_data_file_path();
+    VaultLayout layout, after;
+    char tmp_path[PATH_SIZE];
+
+    CHECK(read_layout(vault_path, &layout));
+    int entries = count_files(home);
+
+    // The main file cannot be written while its tmp name is a directory
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", vault_path);
+    CHECK(mkdir(tmp_path, 0700) == 0);
+    CHECK(!file_set_shard_count(pm, "master", 8));
+    CHECK(pm->shard_count == SHARDS && pm->dirty_shards == 0);
+    rmdir(tmp_path);
+    CHECK(count_files(home) == entries);
+    CHECK(read_layout(vault_path, &after));
+    CHECK(memcmp(&after.header, &layout.header, sizeof(FileHeader)) == 0);
+    CHECK(memcmp(after.shards, layout.shards, SHARDS * sizeof(ShardSeal)) == 0);
+
+    CHECK(file_set_shard_count(pm, "master", 8));
+    CHECK(read_layout(vault_path, &after));
+    CHECK(after.header.shard_count == 8);
+    CHECK(after.header.shard_set != layout.header.shard_set);
+    CHECK(shard_dir_count(vault_path, &layout) == -1);
+    CHECK(count_files(home) == entries);
+
+    int success;
+    PasswordManager *loaded = file_load_path(vault_path, "master", &success);
+    CHECK(success && loaded && loaded->count == ENTRIES);
+    pm_free(loaded);
+
+    CHECK(file_set_shard_count(pm, "master", 0));
+    CHECK(shard_dir_count(vault_path, &after) == -1);
+    loaded = file_load_path(vault_path, "master", &success);
+    CHECK(success && loaded && loaded->count == ENTRIES && loaded->shard_count == 0);
+    pm_free(loaded);
+}
+
+int main(void) {
+    char dir[] = "/tmp/test_shards.XXXXXX";
+    if (!crypto_init() || !mkdtemp(dir) || setenv("HOME", dir, 1) != 0 ||
+        !file_init()) {
+        perror("setup");
+        return 1;
+    }
+    snprintf(home, sizeof(home), "%s/.cipher", dir);
+    snprintf(replica_path, sizeof(replica_path), "%s/replica.dat", dir);
+
+    PasswordManager *pm = pm_init();
+    CHECK(pm != NULL);
+    if (!pm) return test_finish("shards");
+
+    char service[MAX_SERVICE_NAME];
+    for (int i = 0; i < ENTRIES; i++) {
+        service_name(service, i);
+        CHECK(pm_add_entry(pm, service, "user", "password"));
+    }
+    CHECK(file_save(pm, "master"));
+
+    test_round_trip(pm);
+    test_replay(pm);
+    test_copy(pm);
+    test_reshard(pm);
+
+    pm_free(pm);
+    remove_vault_files(replica_path);
+    remove_vault_files(get_data_file_path());
+    rmdir(home);
+    rmdir(dir);
+    return test_finish("shards");
+}
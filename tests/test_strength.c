@@ -0,0 +1,88 @@
+#include "../src/strength.h"
+#include "test.h"
+#include <pthread.h>
+#include <string.h>
+
+#define THREADS 4
+
+static const char *samples[] = {
+    "password", "P@ssw0rd", "drowssap", "PASSWORD", "qwertyuiop", "zxcvbnm",
+    "abcdefghij", "aaaaaaaaaaaa", "abcabcabcabc", "1987-04-12", "12/04/1987",
+    "Password123!", "correcthorsebatterystaple", "kX9#mQ2!vL7p",
+};
+#define SAMPLE_COUNT (sizeof(samples) / sizeof(samples[0]))
+
+static double expected[SAMPLE_COUNT];
+
+// Threads racing to build the automaton must all see the finished one
+static void* score_samples(void *arg) {
+    double *bits = arg;
+    for (size_t i = 0; i < SAMPLE_COUNT; i++) bits[i] = strength_estimate_bits(samples[i]);
+    return NULL;
+}
+
+static void test_shared_build(void) {
+    pthread_t threads[THREADS];
+    double bits[THREADS][SAMPLE_COUNT];
+
+    for (int t = 0; t < THREADS; t++) {
+        CHECK(pthread_create(&threads[t], NULL, score_samples, bits[t]) == 0);
+    }
+    for (int t = 0; t < THREADS; t++) pthread_join(threads[t], NULL);
+
+    CHECK(strength_init() == 1);
+    score_samples(expected);
+    for (int t = 0; t < THREADS; t++) {
+        CHECK(memcmp(bits[t], expected, sizeof(expected)) == 0);
+    }
+}
+
+// Common passwords score as a handful of guesses however they are
+// spelled; patterns cost far less than their length suggests
+static void test_patterns(void) {
+    CHECK(strength_estimate_bits("") == 0);
+    CHECK(strength_estimate_bits(NULL) == 0);
+
+    const char *common[] = {"password", "P@ssw0rd", "drowssap", "PASSWORD", "monkey"};
+    for (size_t i = 0; i < sizeof(common) / sizeof(common[0]); i++) {
+        CHECK(strength_estimate_bits(common[i]) < 12);
+    }
+
+    const char *patterns[] = {"qwertyuiop", "zxcvbnm", "abcdefghij", "9876543210",
+                              "aaaaaaaaaaaa", "abcabcabcabc"};
+    for (size_t i = 0; i < sizeof(patterns) / sizeof(patterns[0]); i++) {
+        CHECK(strength_estimate_bits(patterns[i]) < 16);
+    }
+
+    CHECK(strength_estimate_bits("1987-04-12") < 20);
+    CHECK(strength_estimate_bits("12/04/1987") < 20);
+
+    // Same length and character classes, but one is a word with decoration
+    double decorated = strength_estimate_bits("Password123!");
+    double scrambled = strength_estimate_bits("kX9#mQ2!vL7p");
+    CHECK(decorated < 32);
+    CHECK(scrambled > 60);
+
+    // Wordlist words are cheaper than the letters they are made of
+    double phrase = strength_estimate_bits("correcthorsebatterystaple");
+    CHECK(phrase < strength_estimate_bits("xkqmvlprtzbnwgjhdfsycoeia") - 20);
+}
+
+// Past the analysed prefix every character adds brute-force cost
+static void test_long(void) {
+    char text[301];
+    for (int i = 0; i < 300; i++) text[i] = (char)('a' + (i * 7) % 26);
+    text[300] = '\0';
+
+    double whole = strength_estimate_bits(text);
+    text[200] = '\0';
+    double shorter = strength_estimate_bits(text);
+    CHECK(whole > shorter && whole - shorter <= 100 * 4.71);
+}
+
+int main(void) {
+    test_shared_build();
+    test_patterns();
+    test_long();
+    return test_finish("strength");
+}
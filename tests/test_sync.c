@@ -0,0 +1,183 @@
+#include "../src/sync.h"
+#include "test.h"
+#include <string.h>
+
+static void put(PasswordManager *pm, const char *service, const char *username,
+                const char *password, int64_t stamp, uint64_t generation) {
+    PasswordEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    snprintf(entry.service, sizeof(entry.service), "%s", service);
+    snprintf(entry.username, sizeof(entry.username), "%s", username);
+    snprintf(entry.password, sizeof(entry.password), "%s", password);
+    entry.created = 1000;
+    entry.username_modified = stamp;
+    entry.password_modified = stamp;
+    entry.generation = generation;
+    CHECK(pm_put_entry(pm, &entry));
+}
+
+static const PasswordEntry* find_tombstone(const PasswordManager *pm,
+                                           const char *service) {
+    for (size_t i = 0; i < pm->tombstone_count; i++) {
+        if (strcmp(pm->tombstones[i].service, service) == 0) return &pm->tombstones[i];
+    }
+    return NULL;
+}
+
+// Fields changed on one side only are taken from that side; a field
+// changed on both goes to the later stamp
+static void test_fields(void) {
+    PasswordManager *base = pm_init();
+    PasswordManager *a = pm_init();
+    PasswordManager *b = pm_init();
+    MergeStats stats;
+
+    put(base, "mail", "alice", "old", 100, 1);
+    put(a, "mail", "alice", "from-a", 200, 2);
+    put(b, "mail", "alice2", "old", 300, 2);
+    put(base, "bank", "bob", "one", 100, 1);
+    put(a, "bank", "bob", "a-side", 200, 2);
+    put(b, "bank", "bob", "b-side", 300, 2);
+    a->generation = 2;
+
+    PasswordManager *merged = sync_merge(a, b, base, &stats);
+    CHECK(merged != NULL);
+    if (merged) {
+        PasswordEntry *mail = pm_find_entry(merged, "mail");
+        PasswordEntry *bank = pm_find_entry(merged, "bank");
+        CHECK(mail && strcmp(mail->username, "alice2") == 0 &&
+              strcmp(mail->password, "from-a") == 0 && mail->generation == 3);
+        CHECK(bank && strcmp(bank->password, "b-side") == 0);
+        CHECK(stats.updated == 2 && stats.conflicts == 1);
+        CHECK(merged->generation == a->generation);
+        pm_free(merged);
+    }
+
+    pm_free(base);
+    pm_free(a);
+    pm_free(b);
+}
+
+// With a base, a deletion wins over an untouched entry and loses to an
+// edited one
+static void test_three_way_delete(void) {
+    PasswordManager *base = pm_init();
+    PasswordManager *a = pm_init();
+    PasswordManager *b = pm_init();
+    MergeStats stats;
+
+    put(base, "kept", "u", "p", 100, 1);
+    put(base, "dropped", "u", "p", 100, 1);
+    put(a, "kept", "u", "edited", 200, 4);
+    put(a, "dropped", "u", "p", 100, 1);
+    CHECK(pm_add_tombstone(b, "kept", 3));
+    CHECK(pm_add_tombstone(b, "dropped", 3));
+    a->generation = 4;
+
+    PasswordManager *merged = sync_merge(a, b, base, &stats);
+    CHECK(merged != NULL);
+    if (merged) {
+        CHECK(pm_find_entry(merged, "kept") != NULL);
+        CHECK(pm_find_entry(merged, "dropped") == NULL);
+        CHECK(find_tombstone(merged, "dropped") != NULL);
+        CHECK(find_tombstone(merged, "kept") == NULL);
+        CHECK(stats.removed == 1 && stats.conflicts == 1);
+        pm_free(merged);
+    }
+
+    pm_free(base);
+    pm_free(a);
+    pm_free(b);
+}
+
+// Without a base the other side's tombstone decides: a deletion made
+// after the entry's last change wins, on either side
+static void test_two_way_delete(void) {
+    PasswordManager *a = pm_init();
+    PasswordManager *b = pm_init();
+    MergeStats stats;
+
+    put(a, "deleted-on-b", "u", "p", 100, 2);
+    put(a, "edited-on-a", "u", "p", 100, 6);
+    put(b, "deleted-on-a", "u", "p", 100, 2);
+    put(b, "new-on-b", "u", "p", 100, 3);
+    CHECK(pm_add_tombstone(b, "deleted-on-b", 5));
+    CHECK(pm_add_tombstone(b, "edited-on-a", 5));
+    CHECK(pm_add_tombstone(a, "deleted-on-a", 4));
+    a->generation = 6;
+
+    PasswordManager *merged = sync_merge(a, b, NULL, &stats);
+    CHECK(merged != NULL);
+    if (merged) {
+        CHECK(pm_find_entry(merged, "deleted-on-b") == NULL);
+        CHECK(pm_find_entry(merged, "deleted-on-a") == NULL);
+        CHECK(pm_find_entry(merged, "edited-on-a") != NULL);
+        CHECK(pm_find_entry(merged, "new-on-b") != NULL);
+        CHECK(merged->count == 2);
+        CHECK(stats.added == 1 && stats.removed == 1 && stats.conflicts == 1);
+
+        CHECK(find_tombstone(merged, "deleted-on-b") != NULL);
+        CHECK(find_tombstone(merged, "deleted-on-a") != NULL);
+        CHECK(find_tombstone(merged, "edited-on-a") == NULL);
+        pm_free(merged);
+    }
+
+    pm_free(a);
+    pm_free(b);
+}
+
+// Both sides' tombstones survive the merge, so a third replica that
+// still has the entry loses it too
+static void test_tombstone_union(void) {
+    PasswordManager *a = pm_init();
+    PasswordManager *b = pm_init();
+    PasswordManager *c = pm_init();
+    MergeStats stats;
+
+    CHECK(pm_add_tombstone(a, "both", 3));
+    CHECK(pm_add_tombstone(b, "both", 7));
+    CHECK(pm_add_tombstone(a, "only-a", 2));
+    CHECK(pm_add_tombstone(b, "only-b", 4));
+    a->generation = 5;
+
+    PasswordManager *merged = sync_merge(a, b, NULL, &stats);
+    CHECK(merged != NULL);
+    if (!merged) {
+        pm_free(a);
+        pm_free(b);
+        pm_free(c);
+        return;
+    }
+
+    const PasswordEntry *both = find_tombstone(merged, "both");
+    const PasswordEntry *only_a = find_tombstone(merged, "only-a");
+    const PasswordEntry *only_b = find_tombstone(merged, "only-b");
+    CHECK(merged->tombstone_count == 3);
+    CHECK(both && both->generation == 7);
+    CHECK(only_a && only_a->generation == 2);
+    CHECK(only_b && only_b->generation == 6);
+
+    put(c, "only-b", "u", "p", 100, 1);
+    put(c, "other", "u", "p", 100, 1);
+    PasswordManager *third = sync_merge(merged, c, NULL, &stats);
+    CHECK(third != NULL);
+    if (third) {
+        CHECK(pm_find_entry(third, "only-b") == NULL);
+        CHECK(pm_find_entry(third, "other") != NULL);
+        CHECK(stats.added == 1);
+        pm_free(third);
+    }
+
+    pm_free(merged);
+    pm_free(a);
+    pm_free(b);
+    pm_free(c);
+}
+
+int main(void) {
+    test_fields();
+    test_three_way_delete();
+    test_two_way_delete();
+    test_tombstone_union();
+    return test_finish("sync");
+}